@@ -1186,6 +1186,33 @@ int  mdb_dbi_open(MDB_txn *txn, const char *name, unsigned int flags, MDB_dbi *d
 	 */
 int  mdb_stat(MDB_txn *txn, MDB_dbi dbi, MDB_stat *stat);
 
+	/** @brief Split a database into key ranges of about the same size.
+	 *
+	 * The tree is read from the root down to the first level that has
+	 * plenty of entries for \b parts ranges, and the keys that cut that
+	 * level into even pieces are returned. Leaf pages are only read when
+	 * the database is small, so this is cheap, but the ranges are only as
+	 * even as the fill of the pages. For a #MDB_DUPSORT database the
+	 * duplicates of a key are not counted. This function is not part of
+	 * the upstream LMDB API.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[in] parts The number of ranges wanted, at least 1.
+	 * @param[out] keys An array of at least \b parts - 1 items. It receives
+	 *	the first key of each range but the first, in order. The keys
+	 *	point into the database like the data returned by #mdb_get().
+	 * @param[out] count The number of keys returned. It is less than
+	 *	\b parts - 1 if the database has too few keys.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 *	<li>ENOMEM - out of memory.
+	 * </ul>
+	 */
+int  mdb_dbi_partition(MDB_txn *txn, MDB_dbi dbi, unsigned int parts,
+	MDB_val *keys, unsigned int *count);
+
 	/** @brief Retrieve the DB flags for a database handle.
 	 *
 	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
@@ -1513,6 +1513,37 @@ typedef struct MDB_pgstate {
 	txnid_t		mf_pglast;	/**< ID of last used record, or 0 if !mf_pghead */
 } MDB_pgstate;
 
+	/** Number of size classes in #MDB_pgruns: four for each power
+	 *	of two, the last class holds everything bigger.
+	 */
+#define MDB_PGRUN_CLASSES	128
+
+	/** A run of consecutive page numbers in me_pghead */
+typedef struct MDB_pgrun {
+	pgno_t		pr_pgno;	/**< lowest page number of the run */
+	pgno_t		pr_len;		/**< number of pages, at least 2 */
+} MDB_pgrun;
+
+	/** Index of the runs of consecutive pages in me_pghead by size,
+	 *	so that #mdb_page_alloc() of overflow pages does not scan the
+	 *	whole list for each freeDB record it merges.
+	 *
+	 *	Entries are hints: pages are taken from me_pghead without
+	 *	updating them, so an entry is checked against me_pghead before
+	 *	use and replaced by what is left of its run. Pages added to
+	 *	me_pghead by #mdb_page_alloc() get an entry for their whole run;
+	 *	other changes of me_pghead bump me_pgseq, which makes the index
+	 *	be built again. Thus every run of 2 or more free pages lies
+	 *	within the range of some entry.
+	 */
+typedef struct MDB_pgruns {
+	pgno_t		*pr_mop;	/**< me_pghead the index is for */
+	unsigned int	pr_seq;		/**< me_pgseq the index is for */
+	MDB_pgrun	*pr_runs[MDB_PGRUN_CLASSES];
+	unsigned int	pr_num[MDB_PGRUN_CLASSES];	/**< entries used */
+	unsigned int	pr_room[MDB_PGRUN_CLASSES];	/**< entries allocated */
+} MDB_pgruns;
+
 	/** The database environment. */
 struct MDB_env {
 	HANDLE		me_fd;		/**< The main data file */
@@ -1559,6 +1590,8 @@ struct MDB_env {
 	MDB_pgstate	me_pgstate;		/**< state of old pages from freeDB */
 #	define		me_pglast	me_pgstate.mf_pglast
 #	define		me_pghead	me_pgstate.mf_pghead
+	MDB_pgruns	me_pgruns;		/**< runs of pages in me_pghead */
+	unsigned int	me_pgseq;		/**< bumped when me_pghead changes */
 	MDB_page	*me_dpages;		/**< list of malloc'd blocks for re-use */
 	/** IDL of pages that became unused in a write txn */
 	MDB_IDL		me_free_pgs;
@@ -2481,6 +2514,200 @@ mdb_page_dirty(MDB_txn *txn, MDB_page *mp)
 	txn->mt_dirty_room--;
 }
 
+/** The size class of a run of len pages: the position of the highest
+ * bit of len and the two bits below it.
+ */
+static unsigned
+mdb_pgruns_class(pgno_t len)
+{
+	unsigned b = 0, c;
+	pgno_t n = len;
+
+	while (n >>= 1)
+		b++;
+	c = b * 4 + (b >= 2 ? (unsigned)(len >> (b-2)) & 3 : (unsigned)(len & 1) << 1);
+	return c < MDB_PGRUN_CLASSES ? c : MDB_PGRUN_CLASSES-1;
+}
+
+/** Add a run of pages to the index.
+ * @param[in] pr the index.
+ * @param[in] pgno the lowest page number of the run.
+ * @param[in] len the number of pages.
+ * @return 0 on success, ENOMEM on failure.
+ */
+static int
+mdb_pgruns_add(MDB_pgruns *pr, pgno_t pgno, pgno_t len)
+{
+	unsigned c = mdb_pgruns_class(len);
+
+	if (pr->pr_num[c] == pr->pr_room[c]) {
+		unsigned room = pr->pr_room[c] ? pr->pr_room[c] * 2 : 64;
+		MDB_pgrun *runs = realloc(pr->pr_runs[c], room * sizeof(MDB_pgrun));
+		if (!runs)
+			return ENOMEM;
+		pr->pr_runs[c] = runs;
+		pr->pr_room[c] = room;
+	}
+	pr->pr_runs[c][pr->pr_num[c]].pr_pgno = pgno;
+	pr->pr_runs[c][pr->pr_num[c]].pr_len = len;
+	pr->pr_num[c]++;
+	return MDB_SUCCESS;
+}
+
+/** Is the index of runs up to date with me_pghead? */
+static int
+mdb_pgruns_valid(MDB_env *env)
+{
+	return env->me_pghead && env->me_pgruns.pr_mop == env->me_pghead &&
+		env->me_pgruns.pr_seq == env->me_pgseq;
+}
+
+/** Empty the index and make it the one of me_pghead. */
+static void
+mdb_pgruns_reset(MDB_env *env)
+{
+	MDB_pgruns *pr = &env->me_pgruns;
+	unsigned c;
+
+	for (c = 0; c < MDB_PGRUN_CLASSES; c++)
+		pr->pr_num[c] = 0;
+	pr->pr_mop = env->me_pghead;
+	pr->pr_seq = env->me_pgseq;
+}
+
+/** Build the index of runs from me_pghead. */
+static int
+mdb_pgruns_build(MDB_env *env)
+{
+	pgno_t *mop = env->me_pghead;
+	unsigned i, j;
+	int rc;
+
+	mdb_pgruns_reset(env);
+	/* mop is descending: the run ending at mop[i] starts at mop[j+1] */
+	for (i = mop[0]; i > 1; i = j) {
+		for (j = i-1; j && mop[j] == mop[j+1]+1; j--) ;
+		if (i - j > 1 &&
+			(rc = mdb_pgruns_add(&env->me_pgruns, mop[i], i - j)) != MDB_SUCCESS) {
+			env->me_pgruns.pr_mop = NULL;
+			return rc;
+		}
+	}
+	return MDB_SUCCESS;
+}
+
+/** Add the runs that the pages of idl, just merged into me_pghead,
+ * are part of. Each page costs a binary search, so when idl is big
+ * compared to me_pghead the index is built again instead.
+ */
+static int
+mdb_pgruns_merged(MDB_env *env, MDB_IDL idl)
+{
+	pgno_t *mop = env->me_pghead;
+	pgno_t lowest = 0, highest = 0;
+	unsigned k, i, lo, hi, log2n = 0;
+	int rc;
+
+	env->me_pgruns.pr_mop = mop;
+	for (i = mop[0]; i >>= 1; )
+		log2n++;
+	if (idl[0] * log2n > mop[0])
+		return mdb_pgruns_build(env);
+
+	/* In ascending order, skipping pages of the run just added */
+	for (k = idl[0]; k; k--) {
+		if (idl[k] >= lowest && idl[k] <= highest)
+			continue;
+		i = mdb_midl_search(mop, idl[k]);
+		for (hi = i; hi > 1 && mop[hi-1] == mop[hi]+1; hi--) ;
+		for (lo = i; lo < mop[0] && mop[lo+1] == mop[lo]-1; lo++) ;
+		lowest = mop[lo];
+		highest = mop[hi];
+		if (lo > hi &&
+			(rc = mdb_pgruns_add(&env->me_pgruns, lowest, lo - hi + 1))) {
+			env->me_pgruns.pr_mop = NULL;
+			return rc;
+		}
+	}
+	return MDB_SUCCESS;
+}
+
+/** Find num consecutive pages in me_pghead with the index of runs.
+ * Runs of a bigger class than num always fit and are taken as they
+ * come; in the class of num the best fit is used.
+ * @param[in] env the environment.
+ * @param[in] num the number of pages, at least 2.
+ * @param[out] ip the position in me_pghead of the lowest page of the
+ *	range, or 0 if there is none.
+ * @return 0 on success, ENOMEM on failure.
+ */
+static int
+mdb_pgruns_find(MDB_env *env, pgno_t num, unsigned *ip)
+{
+	MDB_pgruns *pr = &env->me_pgruns;
+	pgno_t *mop = env->me_pghead;
+	pgno_t n2 = num - 1, end;
+	MDB_pgrun r;
+	unsigned c, c0, k, best, i, j, found;
+	int rc;
+
+	*ip = 0;
+	if (!mdb_pgruns_valid(env) && (rc = mdb_pgruns_build(env)) != MDB_SUCCESS)
+		return rc;
+
+	for (c = c0 = mdb_pgruns_class(num); c < MDB_PGRUN_CLASSES; c++) {
+		while (pr->pr_num[c]) {
+			best = pr->pr_num[c] - 1;
+			if (c == c0) {
+				for (k = 0, best = pr->pr_num[c]; k < pr->pr_num[c]; k++) {
+					if (pr->pr_runs[c][k].pr_len >= num && (best == pr->pr_num[c] ||
+						pr->pr_runs[c][k].pr_len < pr->pr_runs[c][best].pr_len))
+						best = k;
+				}
+				if (best == pr->pr_num[c])
+					break;
+			}
+			r = pr->pr_runs[c][best];
+			pr->pr_runs[c][best] = pr->pr_runs[c][--pr->pr_num[c]];
+
+			i = mdb_midl_search(mop, r.pr_pgno);
+			if (i <= mop[0] && mop[i] == r.pr_pgno && i > n2 &&
+				mop[i-n2] == r.pr_pgno + n2) {
+				if (r.pr_len - num > 1 &&
+					(rc = mdb_pgruns_add(pr, r.pr_pgno + num, r.pr_len - num)))
+					return rc;
+				*ip = i;
+				return MDB_SUCCESS;
+			}
+
+			/* Pages were taken from the run: replace the entry by
+			 * the runs left in its range, and use one if it fits.
+			 */
+			found = 0;
+			end = r.pr_pgno + r.pr_len - 1;
+			for (i = mdb_midl_search(mop, end);
+				i <= mop[0] && mop[i] >= r.pr_pgno; i = j + 1) {
+				for (j = i; j < mop[0] && mop[j+1] == mop[j]-1 &&
+					mop[j+1] >= r.pr_pgno; j++) ;
+				if (!found && j - i >= n2) {
+					found = j;
+					if (j - i > num &&
+						(rc = mdb_pgruns_add(pr, mop[j] + num, j - i + 1 - num)))
+						return rc;
+				} else if (j > i &&
+					(rc = mdb_pgruns_add(pr, mop[j], j - i + 1))) {
+					return rc;
+				}
+			}
+			if (found) {
+				*ip = found;
+				return MDB_SUCCESS;
+			}
+		}
+	}
+	return MDB_SUCCESS;
+}
+
 /** Allocate page numbers and memory for writing.  Maintain me_pglast,
  * me_pghead and mt_next_pgno.  Set #MDB_TXN_ERROR on failure.
  *
@@ -2522,6 +2749,7 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 	MDB_cursor_op op;
 	MDB_cursor m2;
 	int found_old = 0;
+	int indexed;
 
 	/* If there are any loose pages, just use them */
 	if (num == 1 && txn->mt_loose_pgs) {
@@ -2546,16 +2774,23 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		MDB_node *leaf;
 		pgno_t *idl;
 
-		/* Seek a big enough contiguous page range. Prefer
-		 * pages at the tail, just truncating the list.
+		/* Seek a big enough contiguous page range. A single page
+		 * is taken from the tail, just truncating the list; for
+		 * more, look the range up in the index of runs.
 		 */
 		if (mop_len > n2) {
-			i = mop_len;
-			do {
-				pgno = mop[i];
-				if (mop[i-n2] == pgno+n2)
+			if (n2) {
+				if ((rc = mdb_pgruns_find(env, num, &i)) != MDB_SUCCESS)
+					goto fail;
+				if (i) {
+					pgno = mop[i];
 					goto search_done;
-			} while (--i > n2);
+				}
+			} else {
+				i = mop_len;
+				pgno = mop[i];
+				goto search_done;
+			}
 			if (--retry < 0)
 				break;
 		}
@@ -2618,11 +2853,15 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 
 		idl = (MDB_ID *) data.mv_data;
 		i = idl[0];
+		indexed = mdb_pgruns_valid(env);
 		if (!mop) {
 			if (!(env->me_pghead = mop = mdb_midl_alloc(i))) {
 				rc = ENOMEM;
 				goto fail;
 			}
+			/* The index of an empty list is empty */
+			mdb_pgruns_reset(env);
+			indexed = 1;
 		} else {
 			if ((rc = mdb_midl_need(&env->me_pghead, i)) != 0)
 				goto fail;
@@ -2638,6 +2877,8 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		/* Merge in descending sorted order */
 		mdb_midl_xmerge(mop, idl);
 		mop_len = mop[0];
+		if (indexed && (rc = mdb_pgruns_merged(env, idl)) != MDB_SUCCESS)
+			goto fail;
 	}
 
 	/* Use new pages from the map when nothing suitable in the freeDB */
@@ -3299,6 +3540,7 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 		rc = 0;
 		ntxn = (MDB_ntxn *)txn;
 		ntxn->mnt_pgstate = env->me_pgstate; /* save parent me_pghead & co */
+		env->me_pgseq++;
 		if (env->me_pghead) {
 			size = MDB_IDL_SIZEOF(env->me_pghead);
 			env->me_pghead = mdb_midl_alloc(env->me_pghead[0]);
@@ -3415,6 +3657,8 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 	} else if (!F_ISSET(txn->mt_flags, MDB_TXN_FINISHED)) {
 		pgno_t *pghead = env->me_pghead;
 
+		env->me_pgseq++;
+
 		if (!(mode & MDB_END_UPDATE)) /* !(already closed cursors) */
 			mdb_cursors_close(txn, 0);
 		if (!(env->me_flags & MDB_WRITEMAP)) {
@@ -3509,6 +3753,40 @@ mdb_txn_abort(MDB_txn *txn)
 	_mdb_txn_abort(txn);
 }
 
+/** Sort the IDL of pages freed by this transaction.
+ * Each pass of #mdb_freelist_save() leaves the first entries of
+ * txn->mt_free_pgs sorted. Only pages freed after that are sorted
+ * here, and then merged in.
+ * @param[in] txn the transaction that's being committed
+ * @param[in] sorted the number of leading entries already sorted
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_free_pgs_sort(MDB_txn *txn, pgno_t sorted)
+{
+	MDB_IDL free_pgs = txn->mt_free_pgs, tail;
+	pgno_t count = free_pgs[0] - sorted;
+	int rc;
+
+	if (!sorted) {
+		mdb_midl_sort(free_pgs);
+		return MDB_SUCCESS;
+	}
+	if (!count)
+		return MDB_SUCCESS;
+	/* Room for the merged list + temp IDL of the new pages */
+	if ((rc = mdb_midl_need(&txn->mt_free_pgs, count+1)) != 0)
+		return rc;
+	free_pgs = txn->mt_free_pgs;
+	tail = free_pgs + MDB_IDL_ALLOCLEN(free_pgs) - count;
+	memcpy(tail + 1, free_pgs + sorted + 1, count * sizeof(MDB_ID));
+	tail[0] = count;
+	free_pgs[0] = sorted;
+	mdb_midl_sort(tail);
+	mdb_midl_xmerge(free_pgs, tail);
+	return MDB_SUCCESS;
+}
+
 /** Save the freelist as of this transaction to the freeDB.
  * This changes the freelist. Keep trying until it stabilizes.
  *
@@ -3526,7 +3804,7 @@ mdb_freelist_save(MDB_txn *txn)
 	MDB_env	*env = txn->mt_env;
 	int rc, maxfree_1pg = env->me_maxfree_1pg, more = 1;
 	txnid_t	pglast = 0, head_id = 0;
-	pgno_t	freecnt = 0, *free_pgs, *mop;
+	pgno_t	freecnt = 0, sorted, *free_pgs, *mop;
 	ssize_t	head_room = 0, total_room = 0, mop_len, clean_limit;
 
 	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
@@ -3616,6 +3894,7 @@ mdb_freelist_save(MDB_txn *txn)
 					return rc;
 			}
 			free_pgs = txn->mt_free_pgs;
+			sorted = freecnt;
 			/* Write to last page of freeDB */
 			key.mv_size = sizeof(txn->mt_txnid);
 			key.mv_data = &txn->mt_txnid;
@@ -3628,7 +3907,9 @@ mdb_freelist_save(MDB_txn *txn)
 				/* Retry if mt_free_pgs[] grew during the Put() */
 				free_pgs = txn->mt_free_pgs;
 			} while (freecnt < free_pgs[0]);
-			mdb_midl_sort(free_pgs);
+			if ((rc = mdb_free_pgs_sort(txn, sorted)) != 0)
+				return rc;
+			free_pgs = txn->mt_free_pgs;
 			memcpy(data.mv_data, free_pgs, data.mv_size);
 #if (MDB_DEBUG) > 1
 			{
@@ -3700,6 +3981,7 @@ mdb_freelist_save(MDB_txn *txn)
 		loose[0] = count;
 		mdb_midl_sort(loose);
 		mdb_midl_xmerge(mop, loose);
+		env->me_pgseq++;
 		txn->mt_loose_pgs = NULL;
 		txn->mt_loose_count = 0;
 		mop_len = mop[0];
@@ -4181,6 +4463,7 @@ _mdb_txn_commit(MDB_txn *txn)
 
 	mdb_midl_free(env->me_pghead);
 	env->me_pghead = NULL;
+	env->me_pgseq++;
 	mdb_midl_shrink(&txn->mt_free_pgs);
 
 #if (MDB_DEBUG) > 2
@@ -5799,6 +6082,12 @@ mdb_env_close0(MDB_env *env, int excl)
 	}
 
 	free(env->me_pbuf);
+	for (i = 0; i < MDB_PGRUN_CLASSES; i++) {
+		free(env->me_pgruns.pr_runs[i]);
+		env->me_pgruns.pr_runs[i] = NULL;
+		env->me_pgruns.pr_num[i] = env->me_pgruns.pr_room[i] = 0;
+	}
+	env->me_pgruns.pr_mop = NULL;
 	free(env->me_dbiseqs);
 	free(env->me_dbflags);
 	free(env->me_path);
@@ -6819,6 +7108,7 @@ release:
 		while (j>i)
 			mop[j--] = pg++;
 		mop[0] += ovpages;
+		env->me_pgseq++;
 	} else {
 		rc = mdb_midl_append_range(&txn->mt_free_pgs, pg, ovpages);
 		if (rc)
@@ -11031,6 +11321,125 @@ mdb_stat(MDB_txn *txn, MDB_dbi dbi, MDB_stat *arg)
 	return mdb_stat0(txn->mt_env, &txn->mt_dbs[dbi], arg);
 }
 
+/** Entries per range the walk of #mdb_dbi_partition() looks for,
+ * so that pages with more or fewer entries average out.
+ */
+#define MDB_PARTITION_SAMPLE	16
+
+/** A page of one level of the tree and the lowest key under it. */
+typedef struct MDB_partpage {
+	pgno_t		pp_pgno;
+	MDB_val		pp_low;
+} MDB_partpage;
+
+int ESECT
+mdb_dbi_partition(MDB_txn *txn, MDB_dbi dbi, unsigned int parts,
+	MDB_val *keys, unsigned int *count)
+{
+	MDB_cursor mc;
+	MDB_xcursor mx;
+	MDB_page *mp;
+	MDB_node *node;
+	MDB_partpage *level, *next;
+	size_t nlevel, nnext, entries, base, want, last;
+	unsigned int i, j, k;
+	int rc;
+
+	if (!keys || !count || !parts || !TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
+		return EINVAL;
+	*count = 0;
+
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	mdb_cursor_init(&mc, txn, dbi, &mx);
+	rc = mdb_page_search(&mc, NULL, MDB_PS_ROOTONLY);
+	if (rc)
+		return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+	mp = mc.mc_pg[0];
+
+	if ((level = malloc(sizeof(MDB_partpage))) == NULL)
+		return ENOMEM;
+	level[0].pp_pgno = mp->mp_pgno;
+	level[0].pp_low.mv_size = 0;
+	level[0].pp_low.mv_data = NULL;
+	nlevel = 1;
+	entries = NUMKEYS(mp);
+
+	/* Go down while the level is too coarse. Every page of a level is
+	 * a branch page or every page is a leaf.
+	 */
+	while (IS_BRANCH(mp) && entries < (size_t)parts * MDB_PARTITION_SAMPLE) {
+		if ((next = malloc(entries * sizeof(MDB_partpage))) == NULL) {
+			rc = ENOMEM;
+			goto done;
+		}
+		nnext = 0;
+		for (i = 0; i < nlevel; i++) {
+			if ((rc = mdb_page_get(&mc, level[i].pp_pgno, &mp, NULL)) != 0) {
+				free(next);
+				goto done;
+			}
+			for (j = 0; j < NUMKEYS(mp); j++) {
+				node = NODEPTR(mp, j);
+				next[nnext].pp_pgno = NODEPGNO(node);
+				if (j == 0) {
+					/* The first key of a branch page is not stored */
+					next[nnext].pp_low = level[i].pp_low;
+				} else {
+					next[nnext].pp_low.mv_size = NODEKSZ(node);
+					next[nnext].pp_low.mv_data = NODEKEY(node);
+				}
+				nnext++;
+			}
+		}
+		free(level);
+		level = next;
+		nlevel = nnext;
+
+		entries = 0;
+		for (i = 0; i < nlevel; i++) {
+			if ((rc = mdb_page_get(&mc, level[i].pp_pgno, &mp, NULL)) != 0)
+				goto done;
+			entries += NUMKEYS(mp);
+		}
+	}
+
+	/* Entry want of the level starts range k. Entry 0 is the lowest
+	 * key and a repeated entry would give an empty range, skip both.
+	 */
+	k = 1;
+	base = 0;
+	last = 0;
+	for (i = 0; i < nlevel && k < parts; i++) {
+		if ((rc = mdb_page_get(&mc, level[i].pp_pgno, &mp, NULL)) != 0)
+			goto done;
+		for (; k < parts; k++) {
+			want = (size_t)((mdb_size_t)k * entries / parts);
+			if (want >= base + NUMKEYS(mp))
+				break;
+			if (want == last)
+				continue;
+			last = want;
+			j = want - base;
+			node = NODEPTR(mp, j);
+			if (IS_BRANCH(mp) && j == 0) {
+				keys[*count] = level[i].pp_low;
+			} else {
+				keys[*count].mv_size = NODEKSZ(node);
+				keys[*count].mv_data = NODEKEY(node);
+			}
+			(*count)++;
+		}
+		base += NUMKEYS(mp);
+	}
+	rc = MDB_SUCCESS;
+
+done:
+	free(level);
+	return rc;
+}
+
 void mdb_dbi_close(MDB_env *env, MDB_dbi dbi)
 {
 	char *ptr;
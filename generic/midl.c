@@ -29,7 +29,20 @@
 /** @defgroup idls	ID List Management
  *	@{
  */
-#define CMP(x,y)	 ( (x) < (y) ? -1 : (x) > (y) )
+
+/* The binary searches below are branchless: each step halves the range
+ * and moves its base with a conditional move, so there is nothing to
+ * mispredict. On long lists they are bound by memory latency instead,
+ * so each step prefetches both possible midpoints of the next step.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define MIDL_PREFETCH(base, half)	do { \
+		__builtin_prefetch((base) + ((half) >> 1)); \
+		__builtin_prefetch((base) + (half) + ((half) >> 1)); \
+	} while (0)
+#else
+#define MIDL_PREFETCH(base, half)	((void)0)
+#endif
 
 unsigned mdb_midl_search( MDB_IDL ids, MDB_ID id )
 {
@@ -38,32 +51,18 @@ unsigned mdb_midl_search( MDB_IDL ids, MDB_ID id )
 	 * if found, returns position of id
 	 * if not found, returns first position greater than id
 	 */
-	unsigned base = 0;
-	unsigned cursor = 1;
-	int val = 0;
-	unsigned n = ids[0];
-
-	while( 0 < n ) {
-		unsigned pivot = n >> 1;
-		cursor = base + pivot + 1;
-		val = CMP( ids[cursor], id );
-
-		if( val < 0 ) {
-			n = pivot;
-
-		} else if ( val > 0 ) {
-			base = cursor;
-			n -= pivot + 1;
-
-		} else {
-			return cursor;
-		}
+	MDB_ID *base = ids + 1;
+	unsigned n = (unsigned)ids[0];
+
+	if (!n)
+		return 1;
+	while (n > 1) {
+		unsigned half = n >> 1;
+		MIDL_PREFETCH(base, half);
+		base += (base[half] > id) ? half : 0;
+		n -= half;
 	}
-
-	if( val > 0 ) {
-		++cursor;
-	}
-	return cursor;
+	return (unsigned)(base - ids) + (*base > id);
 }
 
 #if 0	/* superseded by append/sort */
@@ -217,8 +216,8 @@ void mdb_midl_xmerge( MDB_IDL idl, MDB_IDL merge )
 #define SMALL	8
 #define	MIDL_SWAP(a,b)	{ itmp=(a); (a)=(b); (b)=itmp; }
 
-void
-mdb_midl_sort( MDB_IDL ids )
+static void
+mdb_midl_qsort( MDB_IDL ids )
 {
 	/* Max possible depth of int-indexed tree * 2 items/level */
 	int istack[sizeof(int)*CHAR_BIT * 2];
@@ -278,6 +277,86 @@ mdb_midl_sort( MDB_IDL ids )
 	}
 }
 
+/* LSD radix sort for large arrays, #MIDL_RADIX_BITS bits per pass.
+ * Page numbers only use the low bits of an MDB_ID, so passes stop at
+ * the highest bit set in any ID, and passes over a digit that is the
+ * same in every ID are skipped. mdb_midl_sort() only uses it for lists
+ * of at least #MIDL_RADIX_MIN IDs, where at least one neighbour pair
+ * in #MIDL_RADIX_BREAKS is out of order.
+ */
+
+#define MIDL_RADIX_MIN	1024
+#define MIDL_RADIX_BREAKS	16
+#define MIDL_RADIX_BITS	11
+#define MIDL_RADIX_SIZE	(1 << MIDL_RADIX_BITS)
+#define MIDL_RADIX_MASK	(MIDL_RADIX_SIZE - 1)
+
+static int
+mdb_midl_radixsort( MDB_IDL ids )
+{
+	MDB_ID n = ids[0], i, id, top = 0, *src = ids + 1, *dst, *tmp;
+	unsigned *count, *cp, pos, c, p, passes, shift;
+
+	for (i = 0; i < n; i++)
+		top |= src[i];
+	for (passes = 0; top; top >>= MIDL_RADIX_BITS)
+		passes++;
+
+	tmp = malloc(n * sizeof(MDB_ID) +
+		passes * MIDL_RADIX_SIZE * sizeof(unsigned));
+	if (!tmp)
+		return ENOMEM;
+	count = (unsigned *)(tmp + n);
+	memset(count, 0, passes * MIDL_RADIX_SIZE * sizeof(unsigned));
+	for (i = 0; i < n; i++) {
+		id = src[i];
+		for (p = 0, cp = count; p < passes; p++, cp += MIDL_RADIX_SIZE)
+			cp[(id >> (p * MIDL_RADIX_BITS)) & MIDL_RADIX_MASK]++;
+	}
+
+	dst = tmp;
+	for (p = 0, cp = count; p < passes; p++, cp += MIDL_RADIX_SIZE) {
+		shift = p * MIDL_RADIX_BITS;
+		if (cp[(src[0] >> shift) & MIDL_RADIX_MASK] == n)
+			continue;
+		/* Descending order: highest digit goes first */
+		for (pos = 0, c = MIDL_RADIX_SIZE; c--; ) {
+			unsigned k = cp[c];
+			cp[c] = pos;
+			pos += k;
+		}
+		for (i = 0; i < n; i++) {
+			id = src[i];
+			dst[cp[(id >> shift) & MIDL_RADIX_MASK]++] = id;
+		}
+		dst = src;
+		src = (dst == tmp) ? ids + 1 : tmp;
+	}
+	if (src != ids + 1)
+		memcpy(ids + 1, src, n * sizeof(MDB_ID));
+	free(tmp);
+	return 0;
+}
+
+void
+mdb_midl_sort( MDB_IDL ids )
+{
+	MDB_ID i, n = ids[0], breaks = 0;
+
+	if (n >= MIDL_RADIX_MIN) {
+		for (i = 2; i <= n; i++)
+			breaks += ids[i-1] < ids[i];
+		if (!breaks)
+			return;
+		/* Quicksort does better on nearly sorted lists, and is the
+		 * fallback if there is no memory for the radix sort.
+		 */
+		if (breaks >= n / MIDL_RADIX_BREAKS && !mdb_midl_radixsort(ids))
+			return;
+	}
+	mdb_midl_qsort(ids);
+}
+
 unsigned mdb_mid2l_search( MDB_ID2L ids, MDB_ID id )
 {
 	/*
@@ -285,32 +364,18 @@ unsigned mdb_mid2l_search( MDB_ID2L ids, MDB_ID id )
 	 * if found, returns position of id
 	 * if not found, returns first position greater than id
 	 */
-	unsigned base = 0;
-	unsigned cursor = 1;
-	int val = 0;
+	MDB_ID2 *base = ids + 1;
 	unsigned n = (unsigned)ids[0].mid;
 
-	while( 0 < n ) {
-		unsigned pivot = n >> 1;
-		cursor = base + pivot + 1;
-		val = CMP( id, ids[cursor].mid );
-
-		if( val < 0 ) {
-			n = pivot;
-
-		} else if ( val > 0 ) {
-			base = cursor;
-			n -= pivot + 1;
-
-		} else {
-			return cursor;
-		}
+	if (!n)
+		return 1;
+	while (n > 1) {
+		unsigned half = n >> 1;
+		MIDL_PREFETCH(base, half);
+		base += (base[half].mid < id) ? half : 0;
+		n -= half;
 	}
-
-	if( val > 0 ) {
-		++cursor;
-	}
-	return cursor;
+	return (unsigned)(base - ids) + (base->mid < id);
 }
 
 int mdb_mid2l_insert( MDB_ID2L ids, MDB_ID2 *id )
@@ -363,32 +428,18 @@ unsigned mdb_mid3l_search( MDB_ID3L ids, MDB_ID id )
 	 * if found, returns position of id
 	 * if not found, returns first position greater than id
 	 */
-	unsigned base = 0;
-	unsigned cursor = 1;
-	int val = 0;
+	MDB_ID3 *base = ids + 1;
 	unsigned n = (unsigned)ids[0].mid;
 
-	while( 0 < n ) {
-		unsigned pivot = n >> 1;
-		cursor = base + pivot + 1;
-		val = CMP( id, ids[cursor].mid );
-
-		if( val < 0 ) {
-			n = pivot;
-
-		} else if ( val > 0 ) {
-			base = cursor;
-			n -= pivot + 1;
-
-		} else {
-			return cursor;
-		}
-	}
-
-	if( val > 0 ) {
-		++cursor;
+	if (!n)
+		return 1;
+	while (n > 1) {
+		unsigned half = n >> 1;
+		MIDL_PREFETCH(base, half);
+		base += (base[half].mid < id) ? half : 0;
+		n -= half;
 	}
-	return cursor;
+	return (unsigned)(base - ids) + (base->mid < id);
 }
 
 int mdb_mid3l_insert( MDB_ID3L ids, MDB_ID3 *id )
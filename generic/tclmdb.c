@@ -25,10 +25,20 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <tcl.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #ifdef USE_SYSTEM_LMDB
 #include <lmdb.h>
 #else
@@ -44,264 +54,1814 @@
 #define TCL_STORAGE_CLASS DLLEXPORT
 #endif /* BUILD_lmdb */
 
+#ifndef TCL_SIZE_MAX
+#define TCL_SIZE_MAX INT_MAX
+#endif
+
 typedef struct ThreadSpecificData {
   int initialized;                /* initialization flag */
   Tcl_HashTable *lmdb_hashtblPtr; /* per thread hash table. */
+  Tcl_HashTable *reaper_hashtblPtr; /* env handle -> LMDB_Reaper */
+  Tcl_HashTable *txninfo_hashtblPtr; /* txn handle -> LMDB_TxnInfo */
+  Tcl_Interp *watch_interp;       /* long-lived reader warning */
+  Tcl_TimerToken watch_timer;
+  int watch_threshold;            /* milliseconds, 0 is off */
+  int watch_stacks;               /* record the stack of read txns */
+  Tcl_Obj *watch_script;
   int env_count;
   int txn_count;
   int dbi_count;
   int cur_count;
+  int blob_count;
 } ThreadSpecificData;
 
+/*
+ * State of the stale reader reaper of an environment handle
+ * (env_handle reaper). The reaper is driven by the Tcl event loop
+ * of the thread that owns the environment handle.
+ */
+typedef struct LMDB_Reaper {
+  Tcl_Interp *interp;
+  MDB_env *env;
+  Tcl_HashEntry *entryPtr;        /* entry in reaper_hashtblPtr */
+  Tcl_TimerToken timer;
+  int interval;                   /* milliseconds */
+  Tcl_Obj *script;                /* report callback or NULL */
+  int lastDead;
+  Tcl_WideInt lastLag;
+} LMDB_Reaper;
+
+/*
+ * Bookkeeping for each transaction handle, used to find forgotten read
+ * transactions. An open read transaction keeps every page freed after
+ * its snapshot from being reused, so the freelist and the file grow.
+ */
+typedef struct LMDB_TxnInfo {
+  Tcl_HashEntry *entryPtr;        /* entry in txninfo_hashtblPtr */
+  MDB_env *env;
+  int readonly;
+  int nested;                     /* has a parent transaction */
+  int active;                     /* not yet committed, aborted or reset */
+  int warned;                     /* warning callback already called */
+  int epoch;                      /* counts begin and renew */
+  int writers;                    /* blob channels open for writing */
+  Tcl_Time start;
+  Tcl_Obj *stack;                 /* procs active at begin, innermost
+                                   * first, or NULL if not recorded */
+} LMDB_TxnInfo;
+
 static Tcl_ThreadDataKey dataKey;
 
 TCL_DECLARE_MUTEX(myMutex);
 
 
-void LMDB_Thread_Exit(ClientData clientdata)
+static void LMDB_ReaperFree(LMDB_Reaper *reaper)
 {
-  ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
-      Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
-
-  if(tsdPtr->lmdb_hashtblPtr) {
-    Tcl_DeleteHashTable(tsdPtr->lmdb_hashtblPtr);
-    ckfree(tsdPtr->lmdb_hashtblPtr);
+  if(reaper->timer) {
+    Tcl_DeleteTimerHandler(reaper->timer);
+  }
+  if(reaper->script) {
+    Tcl_DecrRefCount(reaper->script);
   }
+  if(reaper->entryPtr) {
+    Tcl_DeleteHashEntry(reaper->entryPtr);
+  }
+  ckfree(reaper);
 }
 
 
-static int LMDB_CUR(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
-  int choice;
-  int result;
-  MDB_cursor *cursor;
-  Tcl_HashEntry *hashEntryPtr;
-  char *curHandle;
+static void LMDB_TxnInfoFree(LMDB_TxnInfo *info)
+{
+  if(info->stack) {
+    Tcl_DecrRefCount(info->stack);
+  }
+  if(info->entryPtr) {
+    Tcl_DeleteHashEntry(info->entryPtr);
+  }
+  ckfree(info);
+}
 
+/*
+ * Mark the transaction as started now. For read-only transactions, and
+ * only while someone asks for them (lmdb readers -stacks or -threshold),
+ * also remember which procs started it. There is no public C API for
+ * call frames, so ask "info level".
+ */
+static void LMDB_TxnInfoStart(Tcl_Interp *interp, LMDB_TxnInfo *info)
+{
   ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
       Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+  Tcl_InterpState state;
+  Tcl_Obj *cmd[3];
+  int level = 0;
+  int i;
+
+  Tcl_GetTime(&info->start);
+  info->active = 1;
+  info->epoch++;
+  info->warned = 0;
+
+  if(info->stack) {
+    Tcl_DecrRefCount(info->stack);
+    info->stack = NULL;
+  }
 
-  if (tsdPtr->initialized == 0) {
-    tsdPtr->initialized = 1;
-    tsdPtr->lmdb_hashtblPtr = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
-    Tcl_InitHashTable(tsdPtr->lmdb_hashtblPtr, TCL_STRING_KEYS);
+  if( !info->readonly || (!tsdPtr->watch_stacks && !tsdPtr->watch_script) ){
+    return;
   }
 
-  static const char *CUR_strs[] = {
-    "get",
-    "getBinary",
-    "put",
-    "putBinary",
-    "del",
-    "count",
-    "renew",
-    "close",
-    0
-  };
+  info->stack = Tcl_NewListObj(0, NULL);
+  Tcl_IncrRefCount(info->stack);
 
-  enum CUR_enum {
-    CUR_GET,
-    CUR_GET_BINARY,
-    CUR_PUT,
-    CUR_PUT_BINARY,
-    CUR_DEL,
-    CUR_COUNT,
-    CUR_RENEW,
-    CUR_CLOSE,
-  };
+  state = Tcl_SaveInterpState(interp, TCL_OK);
 
-  if( objc < 2 ){
-    Tcl_WrongNumArgs(interp, 1, objv, "SUBCOMMAND ...");
-    return TCL_ERROR;
-  }
+  cmd[0] = Tcl_NewStringObj("::info", -1);
+  cmd[1] = Tcl_NewStringObj("level", -1);
+  Tcl_IncrRefCount(cmd[0]);
+  Tcl_IncrRefCount(cmd[1]);
 
-  if( Tcl_GetIndexFromObj(interp, objv[1], CUR_strs, "option", 0, &choice) ){
-    return TCL_ERROR;
+  if( Tcl_EvalObjv(interp, 2, cmd, 0) == TCL_OK ){
+    Tcl_GetIntFromObj(NULL, Tcl_GetObjResult(interp), &level);
   }
 
-  /*
-   * Get the MDB_cursor * point
-   */
-  curHandle = Tcl_GetStringFromObj(objv[0], 0);
-  hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, curHandle );
-  if( !hashEntryPtr ) {
-    if( interp ) {
-        Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-        Tcl_AppendStringsToObj( resultObj, "invalid cursor handle ", curHandle, (char *)NULL );
-    }
+  for(i = level; i > 0; i--) {
+    Tcl_Obj *frame;
 
-    return TCL_ERROR;
+    cmd[2] = Tcl_NewIntObj(i);
+    Tcl_IncrRefCount(cmd[2]);
+    if( Tcl_EvalObjv(interp, 3, cmd, 0) == TCL_OK &&
+        Tcl_ListObjIndex(NULL, Tcl_GetObjResult(interp), 0, &frame) == TCL_OK &&
+        frame ){
+      Tcl_ListObjAppendElement(NULL, info->stack, frame);
+    }
+    Tcl_DecrRefCount(cmd[2]);
   }
 
-  cursor = Tcl_GetHashValue( hashEntryPtr );
+  Tcl_DecrRefCount(cmd[0]);
+  Tcl_DecrRefCount(cmd[1]);
+  Tcl_RestoreInterpState(interp, state);
+}
 
-  switch( (enum CUR_enum)choice ){
+static Tcl_WideInt LMDB_TxnInfoAge(LMDB_TxnInfo *info)
+{
+  Tcl_Time now;
 
-    case CUR_GET: {
-      char *zArg;
-      char *key;
-      char *data;
-      Tcl_Size len;
-      MDB_val mkey;
-      MDB_val mdata;
-      MDB_cursor_op op;
-      int need_key = 0;
-      int need_key_data = 0;
-      Tcl_Obj *pResultStr = NULL;
+  Tcl_GetTime(&now);
+  return ((Tcl_WideInt) now.sec - info->start.sec) * 1000 +
+         (now.usec - info->start.usec) / 1000;
+}
 
-      if( objc < 3){
-        Tcl_WrongNumArgs(interp, 2, objv,
-        "?-set? ?-set_range? ?-current? ?-first? ?-firstdup? ?-last? ?-lastdup? \
-         ?-next? ?-nextdup? ?-nextnodup? ?-prev? ?-prevdup? ?-prevnodup? \
-         ?-get_multiple? ?-next_multiple? ?-get_both? ?-get_both_range? ?key? ?data?");
-        return TCL_ERROR;
-      }
+/*
+ * Report the active read transactions of this thread older than
+ * olderthan milliseconds, as a list of {handle age stack}.
+ */
+static Tcl_Obj *LMDB_TxnInfoList(ThreadSpecificData *tsdPtr, Tcl_WideInt olderthan)
+{
+  Tcl_Obj *pResultStr = Tcl_NewListObj(0, NULL);
+  Tcl_HashSearch search;
+  Tcl_HashEntry *entryPtr;
 
-      zArg = Tcl_GetStringFromObj(objv[2], 0);
-      if( strcmp(zArg, "-set")==0 ){
-          op = MDB_SET;
-          need_key = 1;
-      } else if( strcmp(zArg, "-set_range")==0 ){
-          op = MDB_SET_RANGE;
-          need_key = 1;
-      } else if( strcmp(zArg, "-current")==0 ){
-          op = MDB_GET_CURRENT;
-      } else if( strcmp(zArg, "-first")==0 ){
-          op = MDB_FIRST;
-      } else if( strcmp(zArg, "-firstdup")==0 ){
-          op = MDB_FIRST_DUP;
-      } else if( strcmp(zArg, "-last")==0 ){
-          op = MDB_LAST;
-      } else if( strcmp(zArg, "-lastdup")==0 ){
-          op = MDB_LAST_DUP;
-      } else if( strcmp(zArg, "-next")==0 ){
-          op = MDB_NEXT;
-      } else if( strcmp(zArg, "-nextdup")==0 ){
-          op = MDB_NEXT_DUP;
-      } else if( strcmp(zArg, "-nextnodup")==0 ){
-          op = MDB_NEXT_NODUP;
-      } else if( strcmp(zArg, "-prev")==0 ){
-          op = MDB_PREV;
-      } else if( strcmp(zArg, "-prevdup")==0 ){
-          op = MDB_PREV_DUP ;
-      } else if( strcmp(zArg, "-prevnodup")==0 ){
-          op = MDB_PREV_NODUP;
-      } else if( strcmp(zArg, "-get_multiple")==0 ){
-          /*
-           * MDB_GET_MULTIPLE only for MDB_DUPFIXED
-           */
+  if( !tsdPtr->txninfo_hashtblPtr ){
+    return pResultStr;
+  }
 
-          op = MDB_GET_MULTIPLE;
-          need_key_data = 1;
-      } else if( strcmp(zArg, "-next_multiple")==0 ){
-          op = MDB_NEXT_MULTIPLE;
-          need_key_data = 1;
-      } else if( strcmp(zArg, "-get_both")==0 ){
-          op = MDB_GET_BOTH;
-          need_key_data = 1;
-      } else if( strcmp(zArg, "-get_both_range")==0 ){
-          op = MDB_GET_BOTH_RANGE;
-          need_key_data = 1;
-      } else{
-          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-          return TCL_ERROR;
-      }
+  for(entryPtr = Tcl_FirstHashEntry(tsdPtr->txninfo_hashtblPtr, &search);
+      entryPtr; entryPtr = Tcl_NextHashEntry(&search)) {
+    LMDB_TxnInfo *info = (LMDB_TxnInfo *) Tcl_GetHashValue(entryPtr);
+    Tcl_WideInt age;
+    Tcl_Obj *pReader;
 
-      if(need_key) {
-         if( objc != 4 && objc != 5){
-           if( interp ) {
-              Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-              Tcl_AppendStringsToObj( resultObj, "Wrong option: need key", (char *)NULL );
-           }
+    if( !info->readonly || !info->active ) continue;
 
-           return TCL_ERROR; // This option need a key
-         }
+    age = LMDB_TxnInfoAge(info);
+    if( age < olderthan ) continue;
 
-         key = Tcl_GetStringFromObj(objv[3], &len);
-         if( !key || len < 1 ){
-           return TCL_ERROR;
-         }
+    pReader = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(NULL, pReader, Tcl_NewStringObj(
+        Tcl_GetHashKey(tsdPtr->txninfo_hashtblPtr, entryPtr), -1));
+    Tcl_ListObjAppendElement(NULL, pReader, Tcl_NewWideIntObj(age));
+    Tcl_ListObjAppendElement(NULL, pReader,
+        info->stack ? info->stack : Tcl_NewObj());
+    Tcl_ListObjAppendElement(NULL, pResultStr, pReader);
+  }
 
-         mkey.mv_size = len;
-         mkey.mv_data = key;
-      }
+  return pResultStr;
+}
 
-      if(need_key_data) {
-         if( objc != 5 ){
-           if( interp ) {
-              Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-              Tcl_AppendStringsToObj( resultObj, "Wrong option: need key data", (char *)NULL );
-           }
+/*
+ * 1 if this thread has an active write transaction on env. LMDB allows
+ * one writer at a time, so beginning another one from this thread
+ * would wait on itself forever.
+ */
+static int LMDB_TxnInfoWriting(ThreadSpecificData *tsdPtr, MDB_env *env)
+{
+  Tcl_HashSearch search;
+  Tcl_HashEntry *entryPtr;
 
-           return TCL_ERROR; // This option need a key and data
-         }
+  if( !tsdPtr->txninfo_hashtblPtr ){
+    return 0;
+  }
 
-         key = Tcl_GetStringFromObj(objv[3], &len);
-         if( !key || len < 1 ){
-           return TCL_ERROR;
-         }
+  for(entryPtr = Tcl_FirstHashEntry(tsdPtr->txninfo_hashtblPtr, &search);
+      entryPtr; entryPtr = Tcl_NextHashEntry(&search)) {
+    LMDB_TxnInfo *info = (LMDB_TxnInfo *) Tcl_GetHashValue(entryPtr);
 
-         mkey.mv_size = len;
-         mkey.mv_data = key;
+    if( info->env == env && !info->readonly && info->active ) return 1;
+  }
 
-         data = Tcl_GetStringFromObj(objv[4], &len);
-         if( !data || len < 1 ){
-           return TCL_ERROR;
-         }
+  return 0;
+}
 
-         mdata.mv_size = len;
-         mdata.mv_data = data;
-      }
+/*
+ * Periodic check for read transactions open longer than the threshold
+ * (lmdb readers -threshold). The callback is called once per snapshot.
+ */
+static void LMDB_TxnWatchTimer(ClientData clientData)
+{
+  ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+      Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+  Tcl_Interp *interp = tsdPtr->watch_interp;
+  Tcl_Obj *pReaders;
+  Tcl_Obj **readerv;
+  Tcl_Size readerc;
+  Tcl_Size i;
+  int interval;
+
+  interval = tsdPtr->watch_threshold / 2;
+  if( interval < 1 ) interval = 1;
+  tsdPtr->watch_timer = Tcl_CreateTimerHandler(interval, LMDB_TxnWatchTimer, NULL);
+
+  pReaders = LMDB_TxnInfoList(tsdPtr, tsdPtr->watch_threshold);
+  Tcl_IncrRefCount(pReaders);
+  Tcl_ListObjGetElements(NULL, pReaders, &readerc, &readerv);
+
+  Tcl_Preserve(interp);
+  for(i = 0; i < readerc; i++) {
+    Tcl_Obj *handle;
+    Tcl_HashEntry *entryPtr;
+    LMDB_TxnInfo *info;
+    Tcl_Obj *cmdPtr;
+
+    Tcl_ListObjIndex(NULL, readerv[i], 0, &handle);
+    entryPtr = Tcl_FindHashEntry(tsdPtr->txninfo_hashtblPtr, Tcl_GetString(handle));
+    if( !entryPtr || !tsdPtr->watch_script ) continue;
+    info = (LMDB_TxnInfo *) Tcl_GetHashValue(entryPtr);
+    if( info->warned ) continue;
+    info->warned = 1;
+
+    cmdPtr = Tcl_DuplicateObj(tsdPtr->watch_script);
+    Tcl_IncrRefCount(cmdPtr);
+    Tcl_ListObjAppendList(NULL, cmdPtr, readerv[i]);
+    if( Tcl_EvalObjEx(interp, cmdPtr, TCL_EVAL_GLOBAL) != TCL_OK ){
+      Tcl_BackgroundException(interp, TCL_ERROR);
+    }
+    Tcl_DecrRefCount(cmdPtr);
+  }
+  Tcl_Release(interp);
 
-      result = mdb_cursor_get(cursor, &mkey, &mdata, op);
-      if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
+  Tcl_DecrRefCount(pReaders);
+}
 
-        return TCL_ERROR;
-      }
 
-      pResultStr = Tcl_NewListObj(2, NULL);
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj(mkey.mv_data, mkey.mv_size));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj(mdata.mv_data, mdata.mv_size));
+void LMDB_Thread_Exit(ClientData clientdata)
+{
+  ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+      Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
 
-      Tcl_SetObjResult(interp, pResultStr);
+  if(tsdPtr->lmdb_hashtblPtr) {
+    Tcl_DeleteHashTable(tsdPtr->lmdb_hashtblPtr);
+    ckfree(tsdPtr->lmdb_hashtblPtr);
+  }
 
-      break;
+  if(tsdPtr->reaper_hashtblPtr) {
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entryPtr;
+
+    while((entryPtr = Tcl_FirstHashEntry(tsdPtr->reaper_hashtblPtr, &search))) {
+      LMDB_ReaperFree((LMDB_Reaper *) Tcl_GetHashValue(entryPtr));
     }
+    Tcl_DeleteHashTable(tsdPtr->reaper_hashtblPtr);
+    ckfree(tsdPtr->reaper_hashtblPtr);
+  }
 
-    /*
-     * Add command to handle byte array.
-     * Use at your own risk.
-     */
-    case CUR_GET_BINARY: {
-      char *zArg;
-      unsigned char *key;
-      unsigned char *data;
-      Tcl_Size len;
-      MDB_val mkey;
-      MDB_val mdata;
-      MDB_cursor_op op;
-      int need_key = 0;
-      int need_key_data = 0;
-      Tcl_Obj *pResultStr = NULL;
+  if(tsdPtr->txninfo_hashtblPtr) {
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entryPtr;
 
-      if( objc < 3){
-        Tcl_WrongNumArgs(interp, 2, objv,
-        "?-set? ?-set_range? ?-current? ?-first? ?-firstdup? ?-last? ?-lastdup? \
-         ?-next? ?-nextdup? ?-nextnodup? ?-prev? ?-prevdup? ?-prevnodup? \
-         ?-get_multiple? ?-next_multiple? ?-get_both? ?-get_both_range? ?key? ?data?");
-        return TCL_ERROR;
-      }
+    while((entryPtr = Tcl_FirstHashEntry(tsdPtr->txninfo_hashtblPtr, &search))) {
+      LMDB_TxnInfoFree((LMDB_TxnInfo *) Tcl_GetHashValue(entryPtr));
+    }
+    Tcl_DeleteHashTable(tsdPtr->txninfo_hashtblPtr);
+    ckfree(tsdPtr->txninfo_hashtblPtr);
+  }
 
-      zArg = Tcl_GetStringFromObj(objv[2], 0);
-      if( strcmp(zArg, "-set")==0 ){
-          op = MDB_SET;
-          need_key = 1;
-      } else if( strcmp(zArg, "-set_range")==0 ){
-          op = MDB_SET_RANGE;
-          need_key = 1;
+  if(tsdPtr->watch_timer) {
+    Tcl_DeleteTimerHandler(tsdPtr->watch_timer);
+  }
+  if(tsdPtr->watch_script) {
+    Tcl_DecrRefCount(tsdPtr->watch_script);
+  }
+}
+
+
+/*
+ * What cursor_handle get and dbi_handle scan return in place of the data.
+ * With -keysonly and -sizes the data bytes are never read, so the
+ * overflow pages of big values are not paged in.
+ */
+#define LMDB_DATA_BYTES 0
+#define LMDB_DATA_NONE  1               /* -keysonly */
+#define LMDB_DATA_SIZE  2               /* -sizes */
+
+/* Take -keysonly or -sizes, the later option wins. */
+static int LMDB_DataModeOption(Tcl_Interp *interp, const char *zArg,
+                               Tcl_Obj *value, int *modePtr)
+{
+  int mode = (strcmp(zArg, "-keysonly") == 0) ? LMDB_DATA_NONE
+                                               : LMDB_DATA_SIZE;
+  int b;
+
+  if(Tcl_GetBooleanFromObj(interp, value, &b) != TCL_OK) {
+    return TCL_ERROR;
+  }
+  if(b) {
+    *modePtr = mode;
+  } else if(*modePtr == mode) {
+    *modePtr = LMDB_DATA_BYTES;
+  }
+  return TCL_OK;
+}
+
+/*
+ * Take the trailing -keyvar, -valuevar, -keysonly and -sizes options of
+ * cursor_handle get off objv by lowering *objcPtr.
+ */
+static int LMDB_CursorGetOptions(Tcl_Interp *interp, int *objcPtr,
+                                 Tcl_Obj *const*objv, Tcl_Obj **keyVarPtr,
+                                 Tcl_Obj **valueVarPtr, int *modePtr)
+{
+  while(*objcPtr >= 5) {
+    const char *zArg = Tcl_GetString(objv[*objcPtr-2]);
+
+    if(strcmp(zArg, "-keyvar") == 0) {
+      *keyVarPtr = objv[*objcPtr-1];
+    } else if(strcmp(zArg, "-valuevar") == 0) {
+      *valueVarPtr = objv[*objcPtr-1];
+    } else if(strcmp(zArg, "-keysonly") == 0 || strcmp(zArg, "-sizes") == 0) {
+      if(LMDB_DataModeOption(interp, zArg, objv[*objcPtr-1], modePtr)) {
+        return TCL_ERROR;
+      }
+    } else {
+      break;
+    }
+    *objcPtr -= 2;
+  }
+  return TCL_OK;
+}
+
+/* The data of a cursor_handle get result, or NULL for -keysonly. */
+static Tcl_Obj *LMDB_DataObj(MDB_val *data, int mode, int binary)
+{
+  if(mode == LMDB_DATA_NONE) {
+    return NULL;
+  }
+  if(mode == LMDB_DATA_SIZE) {
+    return Tcl_NewWideIntObj((Tcl_WideInt) data->mv_size);
+  }
+  if(binary) {
+    return Tcl_NewByteArrayObj(data->mv_data, (Tcl_Size) data->mv_size);
+  }
+  return Tcl_NewStringObj(data->mv_data, (Tcl_Size) data->mv_size);
+}
+
+/*
+ * The bytes of data from offset on, at most length of them, for
+ * getRange. Only the slice is copied out of the map, so the pages of a
+ * big value outside of it are not read.
+ */
+/*
+ * Set a variable to val. The object already in the variable is reused
+ * if nothing else refers to it, so a loop over a cursor does not
+ * allocate a new object per step.
+ */
+static int LMDB_SetVar(Tcl_Interp *interp, Tcl_Obj *nameObj, MDB_val *val,
+                       int binary)
+{
+  Tcl_Obj *valueObj = Tcl_ObjGetVar2(interp, nameObj, NULL, 0);
+
+  if(valueObj && !Tcl_IsShared(valueObj)) {
+    if(binary) {
+      Tcl_SetByteArrayObj(valueObj, val->mv_data, (Tcl_Size) val->mv_size);
+    } else {
+      Tcl_SetStringObj(valueObj, val->mv_data, (Tcl_Size) val->mv_size);
+    }
+  } else if(binary) {
+    valueObj = Tcl_NewByteArrayObj(val->mv_data, (Tcl_Size) val->mv_size);
+  } else {
+    valueObj = Tcl_NewStringObj(val->mv_data, (Tcl_Size) val->mv_size);
+  }
+
+  if(!Tcl_ObjSetVar2(interp, nameObj, NULL, valueObj, TCL_LEAVE_ERR_MSG)) {
+    return TCL_ERROR;
+  }
+  return TCL_OK;
+}
+
+/*
+ * Result of cursor_handle get with -keyvar or -valuevar: 1 after
+ * setting the variables, 0 if there is no such pair.
+ */
+static int LMDB_CursorVars(Tcl_Interp *interp, int result, Tcl_Obj *keyVar,
+                           Tcl_Obj *valueVar, MDB_val *key, MDB_val *data,
+                           int binary, int mode)
+{
+  if(result == MDB_NOTFOUND) {
+    Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+    return TCL_OK;
+  }
+  if(result != 0) {
+    Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+    return TCL_ERROR;
+  }
+
+  if(keyVar && LMDB_SetVar(interp, keyVar, key, binary) != TCL_OK) {
+    return TCL_ERROR;
+  }
+  if(valueVar && mode == LMDB_DATA_BYTES &&
+     LMDB_SetVar(interp, valueVar, data, binary) != TCL_OK) {
+    return TCL_ERROR;
+  }
+  if(valueVar && mode == LMDB_DATA_SIZE &&
+     !Tcl_ObjSetVar2(interp, valueVar, NULL, LMDB_DataObj(data, mode, binary),
+                     TCL_LEAVE_ERR_MSG)) {
+    return TCL_ERROR;
+  }
+  Tcl_SetObjResult(interp, Tcl_NewIntObj( 1 ));
+  return TCL_OK;
+}
+
+/*
+ * Context for mdb_reader_list(). LMDB reports one line per reader slot
+ * in the form "pid thread txnid", txnid is "-" for an idle slot.
+ */
+typedef struct LMDB_ReaderScan {
+  Tcl_Obj *listPtr;               /* may be NULL */
+  int active;
+  Tcl_WideInt oldest;             /* -1 if no active reader */
+} LMDB_ReaderScan;
+
+static int LMDB_ReaderListFunc(const char *msg, void *ctx)
+{
+  LMDB_ReaderScan *scan = (LMDB_ReaderScan *) ctx;
+  int pid;
+  char thread[32];
+  char txnid[32];
+  Tcl_Obj *pReader;
+
+  if( sscanf(msg, "%d %31s %31s", &pid, thread, txnid) != 3 ){
+    return 0;  /* header line or "(no active readers)" */
+  }
+
+  if( strcmp(txnid, "-") != 0 ){
+    Tcl_WideInt id = (Tcl_WideInt) strtoull(txnid, NULL, 10);
+
+    if( scan->oldest < 0 || id < scan->oldest ){
+      scan->oldest = id;
+    }
+    scan->active++;
+  }
+
+  if( scan->listPtr ){
+    pReader = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(NULL, pReader, Tcl_NewIntObj(pid));
+    Tcl_ListObjAppendElement(NULL, pReader, Tcl_NewStringObj(thread, -1));
+    Tcl_ListObjAppendElement(NULL, pReader, Tcl_NewStringObj(txnid, -1));
+    Tcl_ListObjAppendElement(NULL, scan->listPtr, pReader);
+  }
+
+  return 0;
+}
+
+/*
+ * Value log of an environment (env_handle vlog). Puts append values
+ * bigger than the threshold to a companion log file and store a pointer
+ * record in the database instead, so the B-tree stays small and
+ * rewriting a big value is a sequential append rather than a copy of its
+ * overflow pages. Every command that reads values resolves the pointer
+ * records with LMDB_VlogGet and every put goes through LMDB_VlogPut;
+ * openBlob, which reads the map, refuses them.
+ *
+ * The log has generations, path.0, path.1 and so on; the header file at
+ * path holds the current one and the txnids of the compactions that
+ * made it and the generation before it current. env_handle vlog_compact
+ * copies the values still referenced into the next free generation; a
+ * generation is deleted once the oldest reader is not older than the
+ * compaction that moved its values out.
+ *
+ * While a log is attached, an inline value of a non-dupsort database
+ * that starts with the magic of a pointer record or of the escape is
+ * stored behind the escape, so pointer records are never ambiguous.
+ *
+ * Header: magic, generation, its txnid, the generation before and its
+ * txnid. Logs
+ * written before the txnids were added have only magic and generation.
+ * Pointer record: magic, generation, offset and length of the value.
+ * Log record: magic, key length, value length, key, value.
+ * All numbers are big-endian.
+ */
+#define LMDB_VLOG_PTRMAGIC "\0VLP"
+#define LMDB_VLOG_PTRSIZE 24
+#define LMDB_VLOG_RECMAGIC "VREC"
+#define LMDB_VLOG_RECHDR 16
+#define LMDB_VLOG_HDRMAGIC "VLOG"
+#define LMDB_VLOG_HDRSIZE 28
+#define LMDB_VLOG_OLDHDRSIZE 8
+
+#define LMDB_VLOG_ESCMAGIC "\0VLE"
+
+#define LMDB_VLOG_ISPTR(v) ((v)->mv_size == LMDB_VLOG_PTRSIZE && \
+    memcmp((v)->mv_data, LMDB_VLOG_PTRMAGIC, 4) == 0)
+
+/* Inline values that start like a pointer record or an escape. */
+#define LMDB_VLOG_NEEDSESC(v) ((v)->mv_size >= 4 && \
+    (memcmp((v)->mv_data, LMDB_VLOG_PTRMAGIC, 4) == 0 || \
+     memcmp((v)->mv_data, LMDB_VLOG_ESCMAGIC, 4) == 0))
+
+/* Kinds of data read from a database, see LMDB_VlogKind. */
+#define LMDB_VLOG_PLAIN   0
+#define LMDB_VLOG_ESCAPED 1
+#define LMDB_VLOG_POINTER 2
+
+typedef struct LMDB_Vlog {
+  char *path;                     /* header file */
+  int readonly;
+  int nosync;
+  Tcl_WideInt threshold;          /* 0 only resolves pointer records */
+  unsigned int gen;               /* generation new values go to */
+  Tcl_WideUInt made;              /* txnid that made gen current, 0 if
+                                   * not known or not committed yet */
+  unsigned int prevGen;           /* the generation current before */
+  Tcl_WideUInt prevMade;          /* txnid that made prevGen current */
+  size_t genTxn;                  /* write txn that read gen */
+  Tcl_WideInt start;              /* end of the log before genTxn first
+                                   * appended to it, -1 if it has not */
+  Tcl_Mutex mutex;                /* guards files, for worker threads */
+  Tcl_HashTable files;            /* generation -> LMDB_VlogFd */
+} LMDB_Vlog;
+
+/*
+ * The log files are used through native file handles: reads are
+ * positional, so worker threads can resolve pointer records too, and
+ * appends go straight to the end of the file, unbuffered.
+ */
+#ifdef _WIN32
+typedef HANDLE LMDB_VlogFd;
+#define LMDB_VLOG_NOFD INVALID_HANDLE_VALUE
+#else
+typedef int LMDB_VlogFd;
+#define LMDB_VLOG_NOFD (-1)
+#endif
+
+/* Flags of LMDB_VlogOpenFile. */
+#define LMDB_VLOG_READ   0
+#define LMDB_VLOG_APPEND 1
+#define LMDB_VLOG_WRITE  2        /* positional writes, the header */
+#define LMDB_VLOG_CREAT  4
+#define LMDB_VLOG_TRUNC  8
+
+static void LMDB_VlogPack(unsigned char *p, Tcl_WideUInt n, int len)
+{
+  while(len-- > 0) {
+    p[len] = (unsigned char) n;
+    n >>= 8;
+  }
+}
+
+static Tcl_WideUInt LMDB_VlogUnpack(const unsigned char *p, int len)
+{
+  Tcl_WideUInt n = 0;
+  int i;
+
+  for(i = 0; i < len; i++) {
+    n = (n << 8) | p[i];
+  }
+  return n;
+}
+
+static int LMDB_VlogOpenFile(const char *path, int flags, LMDB_VlogFd *fdPtr)
+{
+#ifdef _WIN32
+  DWORD access = GENERIC_READ;
+  DWORD disposition = OPEN_EXISTING;
+  HANDLE fd;
+
+  if(flags & LMDB_VLOG_APPEND) {
+    access |= FILE_APPEND_DATA;
+  } else if(flags & LMDB_VLOG_WRITE) {
+    access |= GENERIC_WRITE;
+  }
+  if(flags & LMDB_VLOG_TRUNC) {
+    disposition = CREATE_ALWAYS;
+  } else if(flags & LMDB_VLOG_CREAT) {
+    disposition = OPEN_ALWAYS;
+  }
+  fd = CreateFileA(path, access,
+                   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                   NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(fd == INVALID_HANDLE_VALUE) {
+    DWORD err = GetLastError();
+    return (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND)
+           ? ENOENT : (int) err;
+  }
+  *fdPtr = fd;
+  return 0;
+#else
+  int oflags = O_RDONLY;
+  int fd;
+
+  if(flags & LMDB_VLOG_APPEND) {
+    oflags = O_RDWR | O_APPEND;
+  } else if(flags & LMDB_VLOG_WRITE) {
+    oflags = O_RDWR;
+  }
+  if(flags & LMDB_VLOG_CREAT) {
+    oflags |= O_CREAT;
+  }
+  if(flags & LMDB_VLOG_TRUNC) {
+    oflags |= O_CREAT | O_TRUNC;
+  }
+#ifdef O_CLOEXEC
+  oflags |= O_CLOEXEC;
+#endif
+  do {
+    fd = open(path, oflags, 0664);
+  } while(fd < 0 && errno == EINTR);
+  if(fd < 0) {
+    return errno;
+  }
+  *fdPtr = fd;
+  return 0;
+#endif
+}
+
+static void LMDB_VlogCloseFile(LMDB_VlogFd fd)
+{
+#ifdef _WIN32
+  CloseHandle(fd);
+#else
+  close(fd);
+#endif
+}
+
+/* Read len bytes at offset. Returns MDB_CORRUPTED if the file is shorter. */
+static int LMDB_VlogRead(LMDB_VlogFd fd, char *buf, size_t len,
+                         Tcl_WideUInt offset)
+{
+  while(len > 0) {
+#ifdef _WIN32
+    OVERLAPPED ov;
+    DWORD chunk = len > 0x40000000 ? 0x40000000 : (DWORD) len;
+    DWORD got;
+
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD) offset;
+    ov.OffsetHigh = (DWORD) (offset >> 32);
+    if(!ReadFile(fd, buf, chunk, &got, &ov)) {
+      return GetLastError() == ERROR_HANDLE_EOF ? MDB_CORRUPTED : EIO;
+    }
+#else
+    ssize_t got = pread(fd, buf, len, (off_t) offset);
+
+    if(got < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+#endif
+    if(got == 0) {
+      return MDB_CORRUPTED;
+    }
+    buf += got;
+    len -= got;
+    offset += got;
+  }
+  return 0;
+}
+
+/*
+ * Write len bytes at offset. A file opened with LMDB_VLOG_APPEND is only
+ * written at its end, so offset must be the size of the file.
+ */
+static int LMDB_VlogWrite(LMDB_VlogFd fd, const char *buf, size_t len,
+                          Tcl_WideUInt offset)
+{
+  while(len > 0) {
+#ifdef _WIN32
+    OVERLAPPED ov;
+    DWORD chunk = len > 0x40000000 ? 0x40000000 : (DWORD) len;
+    DWORD put;
+
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD) offset;
+    ov.OffsetHigh = (DWORD) (offset >> 32);
+    if(!WriteFile(fd, buf, chunk, &put, &ov)) {
+      return EIO;
+    }
+#else
+    ssize_t put = pwrite(fd, buf, len, (off_t) offset);
+
+    if(put < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+#endif
+    buf += put;
+    len -= put;
+    offset += put;
+  }
+  return 0;
+}
+
+static int LMDB_VlogFileSize(LMDB_VlogFd fd, Tcl_WideInt *sizePtr)
+{
+#ifdef _WIN32
+  LARGE_INTEGER size;
+
+  if(!GetFileSizeEx(fd, &size)) {
+    return EIO;
+  }
+  *sizePtr = (Tcl_WideInt) size.QuadPart;
+#else
+  struct stat st;
+
+  if(fstat(fd, &st) != 0) {
+    return errno;
+  }
+  *sizePtr = (Tcl_WideInt) st.st_size;
+#endif
+  return 0;
+}
+
+/* Flush the file to disk. */
+static int LMDB_VlogSync(LMDB_VlogFd fd, int nosync)
+{
+  if(nosync) {
+    return 0;
+  }
+#ifdef _WIN32
+  if(!FlushFileBuffers(fd)) {
+    return EIO;
+  }
+#else
+  if(fsync(fd) != 0) {
+    return errno;
+  }
+#endif
+  return 0;
+}
+
+static LMDB_Vlog *LMDB_VlogOf(MDB_txn *txn)
+{
+  return (LMDB_Vlog *) mdb_env_get_userctx(mdb_txn_env(txn));
+}
+
+static void LMDB_VlogGenPath(LMDB_Vlog *vlog, unsigned int gen,
+                             Tcl_DString *path)
+{
+  char suffix[16];
+
+  sprintf(suffix, ".%u", gen);
+  Tcl_DStringInit(path);
+  Tcl_DStringAppend(path, vlog->path, -1);
+  Tcl_DStringAppend(path, suffix, -1);
+}
+
+static void LMDB_VlogCloseGen(LMDB_Vlog *vlog, unsigned int gen)
+{
+  Tcl_HashEntry *entryPtr;
+
+  Tcl_MutexLock(&vlog->mutex);
+  entryPtr = Tcl_FindHashEntry(&vlog->files, (char *) (size_t) gen);
+  if(entryPtr) {
+    LMDB_VlogCloseFile((LMDB_VlogFd) (intptr_t) Tcl_GetHashValue(entryPtr));
+    Tcl_DeleteHashEntry(entryPtr);
+  }
+  Tcl_MutexUnlock(&vlog->mutex);
+}
+
+/*
+ * The file of a generation, opened on first use and kept open until the
+ * environment is closed. flags are those of LMDB_VlogOpenFile; the log
+ * of a read-only environment is opened for reading whatever they say.
+ */
+static int LMDB_VlogFile(LMDB_Vlog *vlog, unsigned int gen, int flags,
+                         LMDB_VlogFd *fdPtr)
+{
+  Tcl_HashEntry *entryPtr;
+  Tcl_DString path;
+  LMDB_VlogFd fd;
+  int newvalue;
+  int result = 0;
+
+  Tcl_MutexLock(&vlog->mutex);
+  entryPtr = Tcl_FindHashEntry(&vlog->files, (char *) (size_t) gen);
+  if(entryPtr) {
+    *fdPtr = (LMDB_VlogFd) (intptr_t) Tcl_GetHashValue(entryPtr);
+  } else {
+    LMDB_VlogGenPath(vlog, gen, &path);
+    result = LMDB_VlogOpenFile(Tcl_DStringValue(&path),
+                               vlog->readonly ? LMDB_VLOG_READ
+                                              : (flags | LMDB_VLOG_APPEND),
+                               &fd);
+    Tcl_DStringFree(&path);
+    if(result == 0) {
+      entryPtr = Tcl_CreateHashEntry(&vlog->files, (char *) (size_t) gen,
+                                     &newvalue);
+      Tcl_SetHashValue(entryPtr, (ClientData) (intptr_t) fd);
+      *fdPtr = fd;
+    }
+  }
+  Tcl_MutexUnlock(&vlog->mutex);
+  return result;
+}
+
+/* Read the current generation from the header file, 0 if there is none. */
+static int LMDB_VlogReadHeader(LMDB_Vlog *vlog)
+{
+  unsigned char hdr[LMDB_VLOG_HDRSIZE];
+  LMDB_VlogFd fd = LMDB_VLOG_NOFD;
+  int result;
+
+  vlog->made = vlog->prevMade = 0;
+  vlog->prevGen = 0;
+  result = LMDB_VlogOpenFile(vlog->path, LMDB_VLOG_READ, &fd);
+  if(result == ENOENT) {
+    vlog->gen = 0;
+    return 0;
+  }
+  if(result != 0) {
+    return result;
+  }
+  result = LMDB_VlogRead(fd, (char *) hdr, LMDB_VLOG_OLDHDRSIZE, 0);
+  if(result == 0) {
+    result = LMDB_VlogRead(fd, (char *) hdr + LMDB_VLOG_OLDHDRSIZE,
+                           LMDB_VLOG_HDRSIZE - LMDB_VLOG_OLDHDRSIZE,
+                           LMDB_VLOG_OLDHDRSIZE);
+    if(result == MDB_CORRUPTED) {
+      /* An old header, without the txnids. */
+      memset(hdr + LMDB_VLOG_OLDHDRSIZE, 0,
+             LMDB_VLOG_HDRSIZE - LMDB_VLOG_OLDHDRSIZE);
+      result = 0;
+    }
+  }
+  LMDB_VlogCloseFile(fd);
+  if(result == MDB_CORRUPTED || (result == 0 &&
+     memcmp(hdr, LMDB_VLOG_HDRMAGIC, 4) != 0)) {
+    return MDB_INVALID;
+  }
+  if(result != 0) {
+    return result;
+  }
+  vlog->gen = (unsigned int) LMDB_VlogUnpack(hdr + 4, 4);
+  vlog->made = LMDB_VlogUnpack(hdr + 8, 8);
+  vlog->prevGen = (unsigned int) LMDB_VlogUnpack(hdr + 16, 4);
+  vlog->prevMade = LMDB_VlogUnpack(hdr + 20, 8);
+  return 0;
+}
+
+/*
+ * The header is smaller than a disk sector, so overwriting it in place
+ * replaces it as a whole.
+ */
+static int LMDB_VlogWriteHeader(LMDB_Vlog *vlog, unsigned int gen,
+                                Tcl_WideUInt made, unsigned int prevGen,
+                                Tcl_WideUInt prevMade)
+{
+  unsigned char hdr[LMDB_VLOG_HDRSIZE];
+  LMDB_VlogFd fd = LMDB_VLOG_NOFD;
+  int result;
+
+  result = LMDB_VlogOpenFile(vlog->path, LMDB_VLOG_WRITE | LMDB_VLOG_CREAT,
+                             &fd);
+  if(result != 0) {
+    return result;
+  }
+  memcpy(hdr, LMDB_VLOG_HDRMAGIC, 4);
+  LMDB_VlogPack(hdr + 4, gen, 4);
+  LMDB_VlogPack(hdr + 8, made, 8);
+  LMDB_VlogPack(hdr + 16, prevGen, 4);
+  LMDB_VlogPack(hdr + 20, prevMade, 8);
+  result = LMDB_VlogWrite(fd, (char *) hdr, LMDB_VLOG_HDRSIZE, 0);
+  if(result == 0) {
+    result = LMDB_VlogSync(fd, vlog->nosync);
+  }
+  LMDB_VlogCloseFile(fd);
+  return result;
+}
+
+static int LMDB_VlogExists(const char *path)
+{
+  LMDB_VlogFd fd = LMDB_VLOG_NOFD;
+
+  if(LMDB_VlogOpenFile(path, LMDB_VLOG_READ, &fd) != 0) {
+    return 0;
+  }
+  LMDB_VlogCloseFile(fd);
+  return 1;
+}
+
+/*
+ * Attach the value log of env. With create 0 this fails with ENOENT if
+ * the environment has no log; with create 1 the header is written if
+ * there is none yet, so that later opens find the log.
+ */
+static int LMDB_VlogOpen(MDB_env *env, int create, LMDB_Vlog **vlogPtr)
+{
+  LMDB_Vlog *vlog;
+  const char *env_path = NULL;
+  unsigned int flags = 0;
+  int result;
+
+  result = mdb_env_get_path(env, &env_path);
+  if(result == 0 && env_path == NULL) {
+    result = EINVAL;
+  }
+  if(result == 0) {
+    result = mdb_env_get_flags(env, &flags);
+  }
+  if(result != 0) {
+    return result;
+  }
+
+  vlog = (LMDB_Vlog *) ckalloc(sizeof(LMDB_Vlog));
+  memset(vlog, 0, sizeof(LMDB_Vlog));
+  vlog->path = ckalloc(strlen(env_path) + 16);
+  if(flags & MDB_NOSUBDIR) {
+    sprintf(vlog->path, "%s-vlog", env_path);
+  } else {
+    sprintf(vlog->path, "%s/data.vlog", env_path);
+  }
+  vlog->readonly = (flags & MDB_RDONLY) != 0;
+  vlog->nosync = (flags & MDB_NOSYNC) != 0;
+  vlog->start = -1;
+  Tcl_InitHashTable(&vlog->files, TCL_ONE_WORD_KEYS);
+
+  if(!LMDB_VlogExists(vlog->path)) {
+    Tcl_DString path;
+
+    LMDB_VlogGenPath(vlog, 0, &path);
+    if(create && !vlog->readonly) {
+      result = LMDB_VlogWriteHeader(vlog, 0, 0, 0, 0);
+    } else if(!LMDB_VlogExists(Tcl_DStringValue(&path))) {
+      /* Logs written before the header existed start with path.0. */
+      result = ENOENT;
+    }
+    Tcl_DStringFree(&path);
+  }
+  if(result == 0) {
+    result = LMDB_VlogReadHeader(vlog);
+  }
+  if(result != 0) {
+    Tcl_DeleteHashTable(&vlog->files);
+    ckfree(vlog->path);
+    ckfree(vlog);
+    return result;
+  }
+  *vlogPtr = vlog;
+  return 0;
+}
+
+static void LMDB_VlogFree(LMDB_Vlog *vlog)
+{
+  Tcl_HashSearch search;
+  Tcl_HashEntry *entryPtr;
+
+  for(entryPtr = Tcl_FirstHashEntry(&vlog->files, &search); entryPtr;
+      entryPtr = Tcl_NextHashEntry(&search)) {
+    LMDB_VlogCloseFile((LMDB_VlogFd) (intptr_t) Tcl_GetHashValue(entryPtr));
+  }
+  Tcl_DeleteHashTable(&vlog->files);
+  Tcl_MutexFinalize(&vlog->mutex);
+  ckfree(vlog->path);
+  ckfree(vlog);
+}
+
+/*
+ * Append a value to the log and fill ptr with the pointer record to
+ * store in its place. Another process may have compacted the log, so
+ * the generation is read again in each write transaction; writers are
+ * serialized by LMDB, so the end of the file is ours until commit or
+ * abort. The record is written unbuffered, so nothing of it is left
+ * behind in this process to be written later.
+ */
+static int LMDB_VlogAppend(LMDB_Vlog *vlog, MDB_txn *txn, MDB_val *key,
+                           MDB_val *data, unsigned char *ptr)
+{
+  unsigned char hdr[LMDB_VLOG_RECHDR];
+  LMDB_VlogFd fd;
+  Tcl_WideInt offset;
+  int result;
+
+  if(vlog->genTxn != mdb_txn_id(txn)) {
+    result = LMDB_VlogReadHeader(vlog);
+    if(result != 0) {
+      return result;
+    }
+    vlog->genTxn = mdb_txn_id(txn);
+    vlog->start = -1;
+  }
+
+  result = LMDB_VlogFile(vlog, vlog->gen, LMDB_VLOG_CREAT, &fd);
+  if(result == 0) {
+    result = LMDB_VlogFileSize(fd, &offset);
+  }
+  if(result != 0) {
+    return result;
+  }
+  if(vlog->start < 0) {
+    vlog->start = offset;
+  }
+
+  memcpy(hdr, LMDB_VLOG_RECMAGIC, 4);
+  LMDB_VlogPack(hdr + 4, key->mv_size, 4);
+  LMDB_VlogPack(hdr + 8, data->mv_size, 8);
+  result = LMDB_VlogWrite(fd, (char *) hdr, LMDB_VLOG_RECHDR, offset);
+  if(result == 0) {
+    result = LMDB_VlogWrite(fd, key->mv_data, key->mv_size,
+                            offset + LMDB_VLOG_RECHDR);
+  }
+  if(result == 0) {
+    result = LMDB_VlogWrite(fd, data->mv_data, data->mv_size,
+                            offset + LMDB_VLOG_RECHDR + key->mv_size);
+  }
+  if(result != 0) {
+    return result;
+  }
+
+  memcpy(ptr, LMDB_VLOG_PTRMAGIC, 4);
+  LMDB_VlogPack(ptr + 4, vlog->gen, 4);
+  LMDB_VlogPack(ptr + 8, offset + LMDB_VLOG_RECHDR + key->mv_size, 8);
+  LMDB_VlogPack(ptr + 16, data->mv_size, 8);
+  return 0;
+}
+
+/*
+ * Tell what data read from dbi is. Only non-dupsort databases of an
+ * environment with a value log have pointer records and escapes.
+ */
+static int LMDB_VlogKind(MDB_txn *txn, MDB_dbi dbi, MDB_val *data)
+{
+  unsigned int dbflags;
+
+  if(data->mv_size < 4 || memcmp(data->mv_data, LMDB_VLOG_PTRMAGIC, 3) != 0 ||
+     LMDB_VlogOf(txn) == NULL || mdb_dbi_flags(txn, dbi, &dbflags) != 0 ||
+     (dbflags & MDB_DUPSORT)) {
+    return LMDB_VLOG_PLAIN;
+  }
+  if(memcmp(data->mv_data, LMDB_VLOG_ESCMAGIC, 4) == 0) {
+    return LMDB_VLOG_ESCAPED;
+  }
+  return LMDB_VLOG_ISPTR(data) ? LMDB_VLOG_POINTER : LMDB_VLOG_PLAIN;
+}
+
+/*
+ * mdb_put, or mdb_cursor_put if cursor is not NULL, through the value
+ * log. Values of -dupsort databases are kept in the tree: pointer
+ * records would sort by their place in the log.
+ */
+static int LMDB_VlogPut(MDB_txn *txn, MDB_dbi dbi, MDB_cursor *cursor,
+                        MDB_val *key, MDB_val *data, unsigned int flags)
+{
+  LMDB_Vlog *vlog = LMDB_VlogOf(txn);
+  unsigned char ptr[LMDB_VLOG_PTRSIZE];
+  unsigned int dbflags;
+  Tcl_DString esc;
+  MDB_val pdata;
+  int result;
+
+  pdata = *data;
+  Tcl_DStringInit(&esc);
+  if(vlog) {
+    result = mdb_dbi_flags(txn, dbi, &dbflags);
+    if(result != 0) {
+      return result;
+    }
+    if(dbflags & MDB_DUPSORT) {
+      /* Stored as is. */
+    } else if(vlog->threshold > 0 &&
+              data->mv_size > (size_t) vlog->threshold) {
+      result = LMDB_VlogAppend(vlog, txn, key, data, ptr);
+      if(result != 0) {
+        return result;
+      }
+      pdata.mv_data = ptr;
+      pdata.mv_size = LMDB_VLOG_PTRSIZE;
+    } else if(LMDB_VLOG_NEEDSESC(data)) {
+      Tcl_DStringAppend(&esc, LMDB_VLOG_ESCMAGIC, 4);
+      Tcl_DStringAppend(&esc, data->mv_data, (Tcl_Size) data->mv_size);
+      pdata.mv_data = Tcl_DStringValue(&esc);
+      pdata.mv_size = Tcl_DStringLength(&esc);
+    }
+  }
+  if(cursor) {
+    result = mdb_cursor_put(cursor, key, &pdata, flags);
+  } else {
+    result = mdb_put(txn, dbi, key, &pdata, flags);
+  }
+  Tcl_DStringFree(&esc);
+  return result;
+}
+
+/*
+ * If data read from dbi is a pointer record, read count bytes of the
+ * value from *fromPtr on out of the log into buf, point data at them and
+ * set *fromPtr to 0. An escaped value loses its escape, anything else is
+ * left alone.
+ */
+static int LMDB_VlogGetRange(MDB_txn *txn, MDB_dbi dbi, MDB_val *data,
+                             Tcl_WideUInt *fromPtr, Tcl_WideUInt count,
+                             Tcl_DString *buf)
+{
+  const unsigned char *p = (const unsigned char *) data->mv_data;
+  LMDB_Vlog *vlog = LMDB_VlogOf(txn);
+  LMDB_VlogFd fd;
+  Tcl_WideInt size = 0;
+  Tcl_WideUInt offset;
+  Tcl_WideUInt length;
+  int result;
+
+  switch(LMDB_VlogKind(txn, dbi, data)) {
+    case LMDB_VLOG_ESCAPED:
+      data->mv_data = (char *) data->mv_data + 4;
+      data->mv_size -= 4;
+      return 0;
+    case LMDB_VLOG_PLAIN:
+      return 0;
+  }
+  offset = LMDB_VlogUnpack(p + 8, 8);
+  length = LMDB_VlogUnpack(p + 16, 8);
+
+  result = LMDB_VlogFile(vlog, (unsigned int) LMDB_VlogUnpack(p + 4, 4), 0,
+                         &fd);
+  if(result == 0) {
+    result = LMDB_VlogFileSize(fd, &size);
+  }
+  if(result != 0) {
+    return result == ENOENT ? MDB_CORRUPTED : result;
+  }
+  /*
+   * Check the record against the log before allocating: it may be
+   * corrupt, or a value of the user that happens to start like one.
+   */
+  if(offset > (Tcl_WideUInt) size || length > (Tcl_WideUInt) size - offset) {
+    return MDB_CORRUPTED;
+  }
+  if(*fromPtr > length) {
+    *fromPtr = length;
+  }
+  if(count > length - *fromPtr) {
+    count = length - *fromPtr;
+  }
+  if(count > (Tcl_WideUInt) TCL_SIZE_MAX) {
+    return MDB_CORRUPTED;
+  }
+  Tcl_DStringSetLength(buf, (Tcl_Size) count);
+  result = LMDB_VlogRead(fd, Tcl_DStringValue(buf), (size_t) count,
+                         offset + *fromPtr);
+  if(result != 0) {
+    return result;
+  }
+  data->mv_data = Tcl_DStringValue(buf);
+  data->mv_size = (size_t) count;
+  *fromPtr = 0;
+  return 0;
+}
+
+/*
+ * If data read from dbi is a pointer record, read the value out of the
+ * log into buf and point data at it; an escaped value loses its escape.
+ * For LMDB_DATA_SIZE only the size is needed, which the pointer record
+ * already has.
+ */
+static int LMDB_VlogGet(MDB_txn *txn, MDB_dbi dbi, MDB_val *data, int mode,
+                        Tcl_DString *buf)
+{
+  Tcl_WideUInt from = 0;
+
+  if(mode == LMDB_DATA_NONE) {
+    return 0;
+  }
+  if(mode == LMDB_DATA_SIZE &&
+     LMDB_VlogKind(txn, dbi, data) == LMDB_VLOG_POINTER) {
+    data->mv_size = (size_t) LMDB_VlogUnpack(
+        (const unsigned char *) data->mv_data + 16, 8);
+    return 0;
+  }
+  return LMDB_VlogGetRange(txn, dbi, data, &from, ~(Tcl_WideUInt) 0, buf);
+}
+
+static int LMDB_SliceObj(Tcl_Interp *interp, MDB_txn *txn, MDB_dbi dbi,
+                         MDB_val *data, Tcl_Obj *offsetObj,
+                         Tcl_Obj *lengthObj)
+{
+  Tcl_WideInt offset;
+  Tcl_WideInt length;
+  Tcl_WideUInt from;
+  Tcl_DString vbuf;
+  int result;
+
+  if(Tcl_GetWideIntFromObj(interp, offsetObj, &offset) != TCL_OK ||
+     Tcl_GetWideIntFromObj(interp, lengthObj, &length) != TCL_OK) {
+    return TCL_ERROR;
+  }
+  if(offset < 0 || length < 0) {
+    Tcl_AppendResult(interp, "offset and length must be non-negative integers", (char*)0);
+    return TCL_ERROR;
+  }
+
+  /* Only the slice of a value in the value log is read. */
+  Tcl_DStringInit(&vbuf);
+  from = (Tcl_WideUInt) offset;
+  result = LMDB_VlogGetRange(txn, dbi, data, &from, (Tcl_WideUInt) length,
+                             &vbuf);
+  if(result != 0) {
+    Tcl_DStringFree(&vbuf);
+    Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+    return TCL_ERROR;
+  }
+  offset = (Tcl_WideInt) from;
+
+  if((size_t) offset >= data->mv_size) {
+    length = 0;
+  } else if((size_t) length > data->mv_size - (size_t) offset) {
+    length = (Tcl_WideInt) (data->mv_size - (size_t) offset);
+  }
+  Tcl_SetObjResult(interp, Tcl_NewByteArrayObj(
+      (unsigned char *) data->mv_data + (length > 0 ? offset : 0),
+      (Tcl_Size) length));
+  Tcl_DStringFree(&vbuf);
+  return TCL_OK;
+}
+
+/*
+ * Called before a commit: the values must be on disk before the
+ * pointer records to them are.
+ */
+static int LMDB_VlogCommit(MDB_txn *txn)
+{
+  LMDB_Vlog *vlog = LMDB_VlogOf(txn);
+  LMDB_VlogFd fd;
+  int result;
+
+  if(!vlog || vlog->start < 0 || vlog->genTxn != mdb_txn_id(txn)) {
+    return 0;
+  }
+  vlog->start = -1;
+  result = LMDB_VlogFile(vlog, vlog->gen, 0, &fd);
+  if(result == 0) {
+    result = LMDB_VlogSync(fd, vlog->nosync);
+  }
+  return result;
+}
+
+/*
+ * Called before a write transaction is aborted: cut off the values it
+ * appended, nothing points to them. This must happen while the write
+ * lock is still held, another process may append next.
+ */
+static void LMDB_VlogAbort(MDB_txn *txn)
+{
+  LMDB_Vlog *vlog = LMDB_VlogOf(txn);
+  LMDB_VlogFd fd;
+
+  if(!vlog || vlog->start < 0 || vlog->genTxn != mdb_txn_id(txn)) {
+    return;
+  }
+#ifndef _WIN32
+  /* An append-only handle can not be truncated on Windows. */
+  if(LMDB_VlogFile(vlog, vlog->gen, 0, &fd) == 0) {
+    ftruncate(fd, (off_t) vlog->start);
+  }
+#else
+  (void) fd;
+#endif
+  vlog->start = -1;
+}
+
+static Tcl_WideInt LMDB_VlogSize(LMDB_Vlog *vlog, unsigned int gen)
+{
+  LMDB_VlogFd fd;
+  Tcl_WideInt size = 0;
+
+  if(LMDB_VlogFile(vlog, gen, 0, &fd) != 0 ||
+     LMDB_VlogFileSize(fd, &size) != 0) {
+    return 0;
+  }
+  return size;
+}
+
+/* Move the values dbi points to into the generation of vlog. */
+static int LMDB_VlogCompactDbi(LMDB_Vlog *vlog, MDB_txn *txn, MDB_dbi dbi,
+                               Tcl_WideInt *moved)
+{
+  MDB_cursor *cursor;
+  MDB_val key, data, pdata;
+  unsigned char ptr[LMDB_VLOG_PTRSIZE];
+  unsigned int dbflags;
+  Tcl_DString buf;
+  int result;
+
+  result = mdb_dbi_flags(txn, dbi, &dbflags);
+  if(result != 0 || (dbflags & MDB_DUPSORT)) {
+    return result;
+  }
+  result = mdb_cursor_open(txn, dbi, &cursor);
+  if(result != 0) {
+    return result;
+  }
+
+  Tcl_DStringInit(&buf);
+  while((result = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == 0) {
+    if(LMDB_VlogKind(txn, dbi, &data) != LMDB_VLOG_POINTER) {
+      continue;
+    }
+    result = LMDB_VlogGet(txn, dbi, &data, LMDB_DATA_BYTES, &buf);
+    if(result == 0) {
+      result = LMDB_VlogAppend(vlog, txn, &key, &data, ptr);
+    }
+    if(result == 0) {
+      pdata.mv_data = ptr;
+      pdata.mv_size = LMDB_VLOG_PTRSIZE;
+      result = mdb_cursor_put(cursor, &key, &pdata, MDB_CURRENT);
+    }
+    if(result != 0) {
+      break;
+    }
+    (*moved)++;
+  }
+  Tcl_DStringFree(&buf);
+  mdb_cursor_close(cursor);
+  return result == MDB_NOTFOUND ? 0 : result;
+}
+
+/*
+ * Copy the values still referenced by the main database and every named
+ * database into a new generation and point the records at the copies,
+ * in one write transaction. The new generation is made current before
+ * the commit: if the commit fails, new values go to a file that nothing
+ * points to yet, which is harmless.
+ */
+/*
+ * Delete the generations before the current one that no reader can
+ * see any more. A reader needs a generation while its snapshot is older
+ * than the compaction that moved the values out of it; only the txnids
+ * of the last two compactions are known, older generations wait for a
+ * later compaction if a reader is older than both.
+ */
+static void LMDB_VlogSweep(MDB_env *env, LMDB_Vlog *vlog)
+{
+  LMDB_ReaderScan scan;
+  Tcl_DString path;
+  Tcl_Obj *pathObj;
+  unsigned int top;
+  unsigned int gen;
+
+  scan.listPtr = NULL;
+  scan.active = 0;
+  scan.oldest = -1;
+  mdb_reader_list(env, LMDB_ReaderListFunc, &scan);
+
+  if(scan.oldest < 0 ||
+     (vlog->made > 0 && (Tcl_WideUInt) scan.oldest >= vlog->made)) {
+    top = vlog->gen;
+  } else if(vlog->prevMade > 0 &&
+            (Tcl_WideUInt) scan.oldest >= vlog->prevMade) {
+    top = vlog->prevGen;
+  } else {
+    return;
+  }
+
+  /* Generations are deleted from the bottom up, so stop at a gap. */
+  for(gen = top; gen-- > 0; ) {
+    LMDB_VlogCloseGen(vlog, gen);
+    LMDB_VlogGenPath(vlog, gen, &path);
+    pathObj = Tcl_NewStringObj(Tcl_DStringValue(&path), -1);
+    Tcl_IncrRefCount(pathObj);
+    Tcl_DStringFree(&path);
+    if(Tcl_FSDeleteFile(pathObj) != TCL_OK) {
+      Tcl_DecrRefCount(pathObj);
+      break;
+    }
+    Tcl_DecrRefCount(pathObj);
+  }
+}
+
+static int LMDB_VlogCompact(MDB_env *env, LMDB_Vlog *vlog,
+                            Tcl_WideInt *moved, Tcl_WideInt *reclaimed)
+{
+  MDB_txn *txn;
+  MDB_cursor *cursor = NULL;
+  MDB_val key, data;
+  MDB_dbi dbi;
+  LMDB_VlogFd fd;
+  unsigned int oldgen, oldprevgen;
+  Tcl_WideUInt oldmade, oldprevmade;
+  Tcl_WideUInt made;
+  unsigned int gen;
+  int result;
+  int rc;
+
+  *moved = 0;
+  *reclaimed = 0;
+  result = mdb_txn_begin(env, NULL, 0, &txn);
+  if(result != 0) {
+    return result;
+  }
+  result = LMDB_VlogReadHeader(vlog);
+  if(result != 0) {
+    mdb_txn_abort(txn);
+    return result;
+  }
+  oldgen = vlog->gen;
+  oldmade = vlog->made;
+  oldprevgen = vlog->prevGen;
+  oldprevmade = vlog->prevMade;
+
+  /*
+   * A generation left over by a compaction that did not commit may have
+   * been appended to by another process, it is skipped and deleted with
+   * the older ones.
+   */
+  for(gen = oldgen + 1; ; gen++) {
+    Tcl_DString path;
+    int exists;
+
+    LMDB_VlogGenPath(vlog, gen, &path);
+    exists = LMDB_VlogExists(Tcl_DStringValue(&path));
+    Tcl_DStringFree(&path);
+    if(!exists) {
+      break;
+    }
+  }
+  result = LMDB_VlogFile(vlog, gen, LMDB_VLOG_TRUNC, &fd);
+  if(result != 0) {
+    mdb_txn_abort(txn);
+    return result;
+  }
+  vlog->gen = gen;
+  vlog->genTxn = mdb_txn_id(txn);
+  made = (Tcl_WideUInt) vlog->genTxn;
+  vlog->start = -1;
+
+  result = mdb_dbi_open(txn, NULL, 0, &dbi);
+  if(result == 0) {
+    result = LMDB_VlogCompactDbi(vlog, txn, dbi, moved);
+  }
+  if(result == 0) {
+    result = mdb_cursor_open(txn, dbi, &cursor);
+  }
+  while(result == 0 &&
+        (result = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_NODUP)) == 0) {
+    char *dbname;
+    MDB_dbi subdbi;
+
+    /* Named databases are keys of the main DB without a NUL byte. */
+    if(memchr(key.mv_data, '\0', key.mv_size)) {
+      continue;
+    }
+    dbname = ckalloc(key.mv_size + 1);
+    memcpy(dbname, key.mv_data, key.mv_size);
+    dbname[key.mv_size] = '\0';
+    rc = mdb_dbi_open(txn, dbname, 0, &subdbi);
+    ckfree(dbname);
+    if(rc == MDB_INCOMPATIBLE) {
+      continue;
+    }
+    result = rc;
+    if(result == 0) {
+      result = LMDB_VlogCompactDbi(vlog, txn, subdbi, moved);
+    }
+  }
+  if(cursor) {
+    mdb_cursor_close(cursor);
+  }
+  if(result == MDB_NOTFOUND) {
+    result = 0;
+  }
+
+  /*
+   * Other processes must append to the new generation once the write
+   * lock is released, so it becomes current before the commit, but
+   * without a txnid: nothing is deleted on its account until the commit
+   * has succeeded.
+   */
+  if(result == 0) {
+    vlog->start = -1;
+    result = LMDB_VlogSync(fd, vlog->nosync);
+  }
+  if(result == 0) {
+    result = LMDB_VlogWriteHeader(vlog, gen, 0, oldgen, oldmade);
+  }
+  if(result == 0) {
+    result = mdb_txn_commit(txn);
+  } else {
+    mdb_txn_abort(txn);
+  }
+  if(result != 0) {
+    LMDB_VlogWriteHeader(vlog, oldgen, oldmade, oldprevgen, oldprevmade);
+    vlog->gen = oldgen;
+    vlog->genTxn = 0;
+    LMDB_VlogCloseGen(vlog, gen);
+    return result;
+  }
+  vlog->genTxn = 0;
+
+  vlog->made = made;
+  vlog->prevGen = oldgen;
+  vlog->prevMade = oldmade;
+  LMDB_VlogWriteHeader(vlog, gen, vlog->made, vlog->prevGen, vlog->prevMade);
+
+  *reclaimed = LMDB_VlogSize(vlog, oldgen) - LMDB_VlogSize(vlog, gen);
+  LMDB_VlogSweep(env, vlog);
+  return 0;
+}
+
+
+
+static int LMDB_CUR(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  int choice;
+  int result;
+  MDB_cursor *cursor;
+  Tcl_HashEntry *hashEntryPtr;
+  char *curHandle;
+
+  ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+      Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+
+  if (tsdPtr->initialized == 0) {
+    tsdPtr->initialized = 1;
+    tsdPtr->lmdb_hashtblPtr = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+    Tcl_InitHashTable(tsdPtr->lmdb_hashtblPtr, TCL_STRING_KEYS);
+  }
+
+  static const char *CUR_strs[] = {
+    "get",
+    "getBinary",
+    "put",
+    "putBinary",
+    "del",
+    "count",
+    "renew",
+    "close",
+    "getRange",
+    0
+  };
+
+  enum CUR_enum {
+    CUR_GET,
+    CUR_GET_BINARY,
+    CUR_PUT,
+    CUR_PUT_BINARY,
+    CUR_DEL,
+    CUR_COUNT,
+    CUR_RENEW,
+    CUR_CLOSE,
+    CUR_GETRANGE,
+  };
+
+  if( objc < 2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "SUBCOMMAND ...");
+    return TCL_ERROR;
+  }
+
+  if( Tcl_GetIndexFromObj(interp, objv[1], CUR_strs, "option", 0, &choice) ){
+    return TCL_ERROR;
+  }
+
+  /*
+   * Get the MDB_cursor * point
+   */
+  curHandle = Tcl_GetStringFromObj(objv[0], 0);
+  hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, curHandle );
+  if( !hashEntryPtr ) {
+    if( interp ) {
+        Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+        Tcl_AppendStringsToObj( resultObj, "invalid cursor handle ", curHandle, (char *)NULL );
+    }
+
+    return TCL_ERROR;
+  }
+
+  cursor = Tcl_GetHashValue( hashEntryPtr );
+
+  switch( (enum CUR_enum)choice ){
+
+    case CUR_GET: {
+      char *zArg;
+      char *key;
+      char *data;
+      Tcl_Size len;
+      MDB_val mkey;
+      MDB_val mdata;
+      MDB_cursor_op op;
+      int need_key = 0;
+      int need_key_data = 0;
+      Tcl_Obj *keyVar = NULL;
+      Tcl_Obj *valueVar = NULL;
+      int mode = LMDB_DATA_BYTES;
+      Tcl_Obj *pResultStr = NULL;
+      Tcl_DString vbuf;
+
+      if( objc < 3){
+        Tcl_WrongNumArgs(interp, 2, objv,
+        "?-set? ?-set_range? ?-current? ?-first? ?-firstdup? ?-last? ?-lastdup? \
+         ?-next? ?-nextdup? ?-nextnodup? ?-prev? ?-prevdup? ?-prevnodup? \
+         ?-get_multiple? ?-next_multiple? ?-get_both? ?-get_both_range? ?key? ?data? \
+         ?-keyvar varName? ?-valuevar varName? ?-keysonly boolean? ?-sizes boolean?");
+        return TCL_ERROR;
+      }
+
+      if(LMDB_CursorGetOptions(interp, &objc, objv, &keyVar, &valueVar, &mode)) {
+        return TCL_ERROR;
+      }
+
+      zArg = Tcl_GetStringFromObj(objv[2], 0);
+      if( strcmp(zArg, "-set")==0 ){
+          op = MDB_SET;
+          need_key = 1;
+      } else if( strcmp(zArg, "-set_range")==0 ){
+          op = MDB_SET_RANGE;
+          need_key = 1;
+      } else if( strcmp(zArg, "-current")==0 ){
+          op = MDB_GET_CURRENT;
+      } else if( strcmp(zArg, "-first")==0 ){
+          op = MDB_FIRST;
+      } else if( strcmp(zArg, "-firstdup")==0 ){
+          op = MDB_FIRST_DUP;
+      } else if( strcmp(zArg, "-last")==0 ){
+          op = MDB_LAST;
+      } else if( strcmp(zArg, "-lastdup")==0 ){
+          op = MDB_LAST_DUP;
+      } else if( strcmp(zArg, "-next")==0 ){
+          op = MDB_NEXT;
+      } else if( strcmp(zArg, "-nextdup")==0 ){
+          op = MDB_NEXT_DUP;
+      } else if( strcmp(zArg, "-nextnodup")==0 ){
+          op = MDB_NEXT_NODUP;
+      } else if( strcmp(zArg, "-prev")==0 ){
+          op = MDB_PREV;
+      } else if( strcmp(zArg, "-prevdup")==0 ){
+          op = MDB_PREV_DUP ;
+      } else if( strcmp(zArg, "-prevnodup")==0 ){
+          op = MDB_PREV_NODUP;
+      } else if( strcmp(zArg, "-get_multiple")==0 ){
+          /*
+           * MDB_GET_MULTIPLE only for MDB_DUPFIXED
+           */
+
+          op = MDB_GET_MULTIPLE;
+          need_key_data = 1;
+      } else if( strcmp(zArg, "-next_multiple")==0 ){
+          op = MDB_NEXT_MULTIPLE;
+          need_key_data = 1;
+      } else if( strcmp(zArg, "-get_both")==0 ){
+          op = MDB_GET_BOTH;
+          need_key_data = 1;
+      } else if( strcmp(zArg, "-get_both_range")==0 ){
+          op = MDB_GET_BOTH_RANGE;
+          need_key_data = 1;
+      } else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+      }
+
+      if(need_key) {
+         if( objc != 4 && objc != 5){
+           if( interp ) {
+              Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+              Tcl_AppendStringsToObj( resultObj, "Wrong option: need key", (char *)NULL );
+           }
+
+           return TCL_ERROR; // This option need a key
+         }
+
+         key = Tcl_GetStringFromObj(objv[3], &len);
+         if( !key || len < 1 ){
+           return TCL_ERROR;
+         }
+
+         mkey.mv_size = len;
+         mkey.mv_data = key;
+      }
+
+      if(need_key_data) {
+         if( objc != 5 ){
+           if( interp ) {
+              Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+              Tcl_AppendStringsToObj( resultObj, "Wrong option: need key data", (char *)NULL );
+           }
+
+           return TCL_ERROR; // This option need a key and data
+         }
+
+         key = Tcl_GetStringFromObj(objv[3], &len);
+         if( !key || len < 1 ){
+           return TCL_ERROR;
+         }
+
+         mkey.mv_size = len;
+         mkey.mv_data = key;
+
+         data = Tcl_GetStringFromObj(objv[4], &len);
+         if( !data || len < 1 ){
+           return TCL_ERROR;
+         }
+
+         mdata.mv_size = len;
+         mdata.mv_data = data;
+      }
+
+      Tcl_DStringInit(&vbuf);
+      result = mdb_cursor_get(cursor, &mkey, &mdata, op);
+      if(result == 0) {
+        result = LMDB_VlogGet(mdb_cursor_txn(cursor), mdb_cursor_dbi(cursor),
+                              &mdata, mode, &vbuf);
+      }
+      if(keyVar || valueVar) {
+        result = LMDB_CursorVars(interp, result, keyVar, valueVar,
+                                 &mkey, &mdata, 0, mode);
+        Tcl_DStringFree(&vbuf);
+        return result;
+      }
+      if(result != 0) {
+        Tcl_DStringFree(&vbuf);
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      if(mode == LMDB_DATA_NONE) {
+        Tcl_DStringFree(&vbuf);
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(mkey.mv_data, mkey.mv_size));
+        break;
+      }
+
+      pResultStr = Tcl_NewListObj(2, NULL);
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj(mkey.mv_data, mkey.mv_size));
+      Tcl_ListObjAppendElement(interp, pResultStr, LMDB_DataObj(&mdata, mode, 0));
+      Tcl_DStringFree(&vbuf);
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    /*
+     * Add command to handle byte array.
+     * Use at your own risk.
+     */
+    case CUR_GET_BINARY: {
+      char *zArg;
+      unsigned char *key;
+      unsigned char *data;
+      Tcl_Size len;
+      MDB_val mkey;
+      MDB_val mdata;
+      MDB_cursor_op op;
+      int need_key = 0;
+      int need_key_data = 0;
+      Tcl_Obj *keyVar = NULL;
+      Tcl_Obj *valueVar = NULL;
+      int mode = LMDB_DATA_BYTES;
+      Tcl_Obj *pResultStr = NULL;
+      Tcl_DString vbuf;
+
+      if( objc < 3){
+        Tcl_WrongNumArgs(interp, 2, objv,
+        "?-set? ?-set_range? ?-current? ?-first? ?-firstdup? ?-last? ?-lastdup? \
+         ?-next? ?-nextdup? ?-nextnodup? ?-prev? ?-prevdup? ?-prevnodup? \
+         ?-get_multiple? ?-next_multiple? ?-get_both? ?-get_both_range? ?key? ?data? \
+         ?-keyvar varName? ?-valuevar varName? ?-keysonly boolean? ?-sizes boolean?");
+        return TCL_ERROR;
+      }
+
+      if(LMDB_CursorGetOptions(interp, &objc, objv, &keyVar, &valueVar, &mode)) {
+        return TCL_ERROR;
+      }
+
+      zArg = Tcl_GetStringFromObj(objv[2], 0);
+      if( strcmp(zArg, "-set")==0 ){
+          op = MDB_SET;
+          need_key = 1;
+      } else if( strcmp(zArg, "-set_range")==0 ){
+          op = MDB_SET_RANGE;
+          need_key = 1;
       } else if( strcmp(zArg, "-current")==0 ){
           op = MDB_GET_CURRENT;
       } else if( strcmp(zArg, "-first")==0 ){
@@ -329,169 +1889,5071 @@ static int LMDB_CUR(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
            * MDB_GET_MULTIPLE only for MDB_DUPFIXED
            */
 
-          op = MDB_GET_MULTIPLE;
-          need_key_data = 1;
-      } else if( strcmp(zArg, "-next_multiple")==0 ){
-          op = MDB_NEXT_MULTIPLE;
-          need_key_data = 1;
-      } else if( strcmp(zArg, "-get_both")==0 ){
-          op = MDB_GET_BOTH;
-          need_key_data = 1;
-      } else if( strcmp(zArg, "-get_both_range")==0 ){
-          op = MDB_GET_BOTH_RANGE;
-          need_key_data = 1;
-      } else{
-          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          op = MDB_GET_MULTIPLE;
+          need_key_data = 1;
+      } else if( strcmp(zArg, "-next_multiple")==0 ){
+          op = MDB_NEXT_MULTIPLE;
+          need_key_data = 1;
+      } else if( strcmp(zArg, "-get_both")==0 ){
+          op = MDB_GET_BOTH;
+          need_key_data = 1;
+      } else if( strcmp(zArg, "-get_both_range")==0 ){
+          op = MDB_GET_BOTH_RANGE;
+          need_key_data = 1;
+      } else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+      }
+
+      if(need_key) {
+         if( objc != 4 && objc != 5){
+           if( interp ) {
+              Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+              Tcl_AppendStringsToObj( resultObj, "Wrong option: need key", (char *)NULL );
+           }
+
+           return TCL_ERROR; // This option need a key
+         }
+
+         key = Tcl_GetByteArrayFromObj(objv[3], &len);
+         if( !key || len < 1 ){
+           return TCL_ERROR;
+         }
+
+         mkey.mv_size = len;
+         mkey.mv_data = key;
+      }
+
+      if(need_key_data) {
+         if( objc != 5 ){
+           if( interp ) {
+              Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+              Tcl_AppendStringsToObj( resultObj, "Wrong option: need key data", (char *)NULL );
+           }
+
+           return TCL_ERROR; // This option need a key and data
+         }
+
+         key = Tcl_GetByteArrayFromObj(objv[3], &len);
+         if( !key || len < 1 ){
+           return TCL_ERROR;
+         }
+
+         mkey.mv_size = len;
+         mkey.mv_data = key;
+
+         data = Tcl_GetByteArrayFromObj(objv[4], &len);
+         if( !data || len < 1 ){
+           return TCL_ERROR;
+         }
+
+         mdata.mv_size = len;
+         mdata.mv_data = data;
+      }
+
+      Tcl_DStringInit(&vbuf);
+      result = mdb_cursor_get(cursor, &mkey, &mdata, op);
+      if(result == 0) {
+        result = LMDB_VlogGet(mdb_cursor_txn(cursor), mdb_cursor_dbi(cursor),
+                              &mdata, mode, &vbuf);
+      }
+      if(keyVar || valueVar) {
+        result = LMDB_CursorVars(interp, result, keyVar, valueVar,
+                                 &mkey, &mdata, 1, mode);
+        Tcl_DStringFree(&vbuf);
+        return result;
+      }
+      if(result != 0) {
+        Tcl_DStringFree(&vbuf);
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      if(mode == LMDB_DATA_NONE) {
+        Tcl_DStringFree(&vbuf);
+        Tcl_SetObjResult(interp, Tcl_NewByteArrayObj(mkey.mv_data, mkey.mv_size));
+        break;
+      }
+
+      pResultStr = Tcl_NewListObj(2, NULL);
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewByteArrayObj(mkey.mv_data, mkey.mv_size));
+      Tcl_ListObjAppendElement(interp, pResultStr, LMDB_DataObj(&mdata, mode, 1));
+      Tcl_DStringFree(&vbuf);
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case CUR_PUT: {
+      char *zArg;
+      char *key;
+      char *data;
+      Tcl_Size key_len;
+      Tcl_Size data_len;
+      MDB_val mkey;
+      MDB_val mdata;
+      int flags = 0;
+      int i = 0;
+
+      if( objc < 4 || (objc&1)!=0) {
+        Tcl_WrongNumArgs(interp, 2, objv, "key data ?-current boolean? ?-nodupdata boolean? ?-nooverwrite boolean? ?-append boolean? ?-appenddup boolean? ");
+        return TCL_ERROR;
+      }
+
+      key = Tcl_GetStringFromObj(objv[2], &key_len);
+      if( !key || key_len < 1 ){
+         return TCL_ERROR;
+      }
+
+      data = Tcl_GetStringFromObj(objv[3], &data_len);
+      if( !data || data_len < 1 ){
+         return TCL_ERROR;
+      }
+
+      for(i=4; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-current")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_CURRENT;
+            }else{
+              flags &= ~MDB_CURRENT;
+            }
+        } else if( strcmp(zArg, "-nodupdata")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NODUPDATA;
+            }else{
+              flags &= ~MDB_NODUPDATA;
+            }
+        } else if( strcmp(zArg, "-nooverwrite")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NOOVERWRITE;
+            }else{
+              flags &= ~MDB_NOOVERWRITE;
+            }
+        } else if( strcmp(zArg, "-append")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_APPEND;
+            }else{
+              flags &= ~MDB_APPEND;
+            }
+        } else if( strcmp(zArg, "-appenddup")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_APPENDDUP;
+            }else{
+              flags &= ~MDB_APPENDDUP;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      mkey.mv_size = key_len;
+      mkey.mv_data = key;
+
+      mdata.mv_size = data_len;
+      mdata.mv_data = data;
+
+      result = LMDB_VlogPut(mdb_cursor_txn(cursor), mdb_cursor_dbi(cursor),
+                            cursor, &mkey, &mdata, flags);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    /*
+     * Add command to handle byte array.
+     * Use at your own risk.
+     */
+    case CUR_PUT_BINARY: {
+      char *zArg;
+      unsigned char *key;
+      unsigned char *data;
+      Tcl_Size key_len;
+      Tcl_Size data_len;
+      MDB_val mkey;
+      MDB_val mdata;
+      int flags = 0;
+      int i = 0;
+
+      if( objc < 4 || (objc&1)!=0) {
+        Tcl_WrongNumArgs(interp, 2, objv, "key data ?-current boolean? ?-nodupdata boolean? ?-nooverwrite boolean? ?-append boolean? ?-appenddup boolean? ");
+        return TCL_ERROR;
+      }
+
+      key = Tcl_GetByteArrayFromObj(objv[2], &key_len);
+      if( !key || key_len < 1 ){
+         return TCL_ERROR;
+      }
+
+      data = Tcl_GetByteArrayFromObj(objv[3], &data_len);
+      if( !data || data_len < 1 ){
+         return TCL_ERROR;
+      }
+
+      for(i=4; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-current")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_CURRENT;
+            }else{
+              flags &= ~MDB_CURRENT;
+            }
+        } else if( strcmp(zArg, "-nodupdata")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NODUPDATA;
+            }else{
+              flags &= ~MDB_NODUPDATA;
+            }
+        } else if( strcmp(zArg, "-nooverwrite")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NOOVERWRITE;
+            }else{
+              flags &= ~MDB_NOOVERWRITE;
+            }
+        } else if( strcmp(zArg, "-append")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_APPEND;
+            }else{
+              flags &= ~MDB_APPEND;
+            }
+        } else if( strcmp(zArg, "-appenddup")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_APPENDDUP;
+            }else{
+              flags &= ~MDB_APPENDDUP;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      mkey.mv_size = key_len;
+      mkey.mv_data = key;
+
+      mdata.mv_size = data_len;
+      mdata.mv_data = data;
+
+      result = LMDB_VlogPut(mdb_cursor_txn(cursor), mdb_cursor_dbi(cursor),
+                            cursor, &mkey, &mdata, flags);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case CUR_DEL: {
+      char *zArg;
+      int flags = 0;
+      int i = 0;
+
+      if( objc != 2 && objc != 4){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-nodupdata boolean? ");
+        return TCL_ERROR;
+      }
+
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-nodupdata")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NODUPDATA;
+            }else{
+              flags &= ~MDB_NODUPDATA;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      result = mdb_cursor_del(cursor, flags);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case CUR_COUNT: {
+      size_t count;
+      Tcl_Obj *pResultStr = NULL;
+
+      if( objc != 2){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      result = mdb_cursor_count(cursor, &count);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      pResultStr = Tcl_NewIntObj( count );
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case CUR_GETRANGE: {
+      MDB_val mkey;
+      MDB_val mdata;
+
+      if( objc != 4){
+        Tcl_WrongNumArgs(interp, 2, objv, "offset length ");
+        return TCL_ERROR;
+      }
+
+      result = mdb_cursor_get(cursor, &mkey, &mdata, MDB_GET_CURRENT);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      return LMDB_SliceObj(interp, mdb_cursor_txn(cursor),
+                           mdb_cursor_dbi(cursor), &mdata, objv[2], objv[3]);
+    }
+
+    case CUR_RENEW: {
+      char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+
+      if( objc != 4){
+        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid ");
+        return TCL_ERROR;
+      }
+
+      zArg = Tcl_GetStringFromObj(objv[2], 0);
+      if( strcmp(zArg, "-txn")==0 ){
+         txnHandle = Tcl_GetStringFromObj(objv[3], 0);
+      } else{
+         Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+         return TCL_ERROR;
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+      result = mdb_cursor_renew(txn, cursor);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case CUR_CLOSE: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      mdb_cursor_close (cursor);
+
+      Tcl_MutexLock(&myMutex);
+      if( hashEntryPtr )  Tcl_DeleteHashEntry(hashEntryPtr);
+      Tcl_MutexUnlock(&myMutex);
+      Tcl_DeleteCommand(interp, curHandle);
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+  }
+
+  return TCL_OK;
+}
+
+
+/*
+ * A key range of a cursor walk: the keys from from (inclusive) to to
+ * (exclusive) that start with prefix. A bound of size 0 is not set.
+ * The prefix is compared bytewise, so it is only a range in databases
+ * with the default key order.
+ */
+typedef struct LMDB_Range {
+  MDB_val from;
+  MDB_val to;
+  MDB_val prefix;
+} LMDB_Range;
+
+/* Move the cursor to the first pair at or after the start of the range. */
+static int LMDB_RangeFirst(MDB_txn *txn, MDB_dbi dbi, LMDB_Range *range,
+                           MDB_cursor *cursor, MDB_val *key, MDB_val *data)
+{
+  MDB_val *start = NULL;
+
+  if(range->from.mv_size > 0) {
+    start = &range->from;
+  }
+  if(range->prefix.mv_size > 0 &&
+     (!start || mdb_cmp(txn, dbi, &range->prefix, start) > 0)) {
+    start = &range->prefix;
+  }
+  if(!start) {
+    return mdb_cursor_get(cursor, key, data, MDB_FIRST);
+  }
+  *key = *start;
+  return mdb_cursor_get(cursor, key, data, MDB_SET_RANGE);
+}
+
+/* 1 if key is past the end of the range. */
+static int LMDB_RangeDone(MDB_txn *txn, MDB_dbi dbi, LMDB_Range *range,
+                          MDB_val *key)
+{
+  if(range->to.mv_size > 0 && mdb_cmp(txn, dbi, key, &range->to) >= 0) {
+    return 1;
+  }
+  if(range->prefix.mv_size > 0 &&
+     (key->mv_size < range->prefix.mv_size ||
+      memcmp(key->mv_data, range->prefix.mv_data, range->prefix.mv_size) != 0)) {
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Delete the pairs of a range with one cursor and count them. The data
+ * items of a dupsort key go in one mdb_cursor_del. A range without bounds
+ * is emptied with mdb_drop, which frees the pages without visiting the
+ * keys.
+ */
+static int LMDB_RangeDelete(MDB_txn *txn, MDB_dbi dbi, LMDB_Range *range,
+                            Tcl_WideInt *countPtr)
+{
+  MDB_cursor *cursor;
+  MDB_val key;
+  MDB_val data;
+  MDB_stat stat;
+  unsigned int flags;
+  int result;
+
+  *countPtr = 0;
+  if(range->from.mv_size == 0 && range->to.mv_size == 0 &&
+     range->prefix.mv_size == 0) {
+    result = mdb_stat(txn, dbi, &stat);
+    if(result == 0) {
+      result = mdb_drop(txn, dbi, 0);
+    }
+    if(result == 0) {
+      *countPtr = (Tcl_WideInt) stat.ms_entries;
+    }
+    return result;
+  }
+
+  result = mdb_dbi_flags(txn, dbi, &flags);
+  if(result == 0) {
+    result = mdb_cursor_open(txn, dbi, &cursor);
+  }
+  if(result != 0) {
+    return result;
+  }
+
+  result = LMDB_RangeFirst(txn, dbi, range, cursor, &key, &data);
+  while(result == 0 && !LMDB_RangeDone(txn, dbi, range, &key)) {
+    size_t n = 1;
+
+    if(flags & MDB_DUPSORT) {
+      result = mdb_cursor_count(cursor, &n);
+      if(result != 0) {
+        break;
+      }
+    }
+    result = mdb_cursor_del(cursor, (flags & MDB_DUPSORT) ? MDB_NODUPDATA : 0);
+    if(result != 0) {
+      break;
+    }
+    *countPtr += (Tcl_WideInt) n;
+    /* After a delete the cursor is already on the next pair. */
+    result = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+  }
+  mdb_cursor_close(cursor);
+
+  return (result == MDB_NOTFOUND) ? 0 : result;
+}
+
+/*
+ * Read-modify-write of dbi_handle incr, append and cas: one cursor is
+ * set on the key, and the new data is put through the same cursor with
+ * MDB_CURRENT, so the tree is searched once. Not for dupsort databases,
+ * where MDB_CURRENT can not change the sort order of the data.
+ */
+static int LMDB_RmwGet(MDB_txn *txn, MDB_dbi dbi, MDB_val *key,
+                       MDB_cursor **cursorPtr, MDB_val *data, int *foundPtr,
+                       Tcl_DString *vbuf)
+{
+  unsigned int flags;
+  int result;
+
+  result = mdb_dbi_flags(txn, dbi, &flags);
+  if(result == 0 && (flags & MDB_DUPSORT)) {
+    result = MDB_INCOMPATIBLE;
+  }
+  if(result == 0) {
+    result = mdb_cursor_open(txn, dbi, cursorPtr);
+  }
+  if(result != 0) {
+    return result;
+  }
+
+  result = mdb_cursor_get(*cursorPtr, key, data, MDB_SET);
+  *foundPtr = (result == 0);
+  if(result == 0) {
+    result = LMDB_VlogGet(txn, dbi, data, LMDB_DATA_BYTES, vbuf);
+  } else if(result == MDB_NOTFOUND) {
+    result = 0;
+  }
+  if(result != 0) {
+    mdb_cursor_close(*cursorPtr);
+  }
+  return result;
+}
+
+/* Store data and close the cursor of LMDB_RmwGet. */
+static int LMDB_RmwPut(MDB_cursor *cursor, MDB_val *key, MDB_val *data,
+                       int found)
+{
+  int result;
+
+  result = LMDB_VlogPut(mdb_cursor_txn(cursor), mdb_cursor_dbi(cursor),
+                        cursor, key, data, found ? MDB_CURRENT : 0);
+  mdb_cursor_close(cursor);
+  return result;
+}
+
+/*
+ * Common part of the channels on data in the map (dbi_handle openBlob
+ * and blobOpen). The map holds the data only as long as the transaction
+ * it was found in, so every read or write checks that the transaction
+ * has not ended or been renewed since the channel was opened.
+ */
+typedef struct LMDB_ChanBase {
+  Tcl_Channel chan;
+  char *txnHandle;
+  int epoch;                      /* of the transaction at open */
+  int watchMask;
+  Tcl_TimerToken timer;
+} LMDB_ChanBase;
+
+static void LMDB_ChanBaseInit(LMDB_ChanBase *base, const char *txnHandle,
+                              LMDB_TxnInfo *info)
+{
+  base->txnHandle = ckalloc(strlen(txnHandle) + 1);
+  strcpy(base->txnHandle, txnHandle);
+  base->epoch = info->epoch;
+}
+
+static void LMDB_ChanBaseFree(LMDB_ChanBase *base)
+{
+  if(base->timer) {
+    Tcl_DeleteTimerHandler(base->timer);
+  }
+  ckfree(base->txnHandle);
+}
+
+/*
+ * The bookkeeping of the transaction the channel was opened in, or NULL
+ * if the handle was closed or renewed since.
+ */
+static LMDB_TxnInfo *LMDB_ChanInfo(LMDB_ChanBase *base)
+{
+  Tcl_HashEntry *entryPtr = NULL;
+
+  ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+      Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+
+  if(tsdPtr->txninfo_hashtblPtr) {
+    entryPtr = Tcl_FindHashEntry(tsdPtr->txninfo_hashtblPtr, base->txnHandle);
+  }
+  if(entryPtr) {
+    LMDB_TxnInfo *info = (LMDB_TxnInfo *) Tcl_GetHashValue(entryPtr);
+
+    if(info->epoch == base->epoch) {
+      return info;
+    }
+  }
+  return NULL;
+}
+
+/* 1 if the transaction is usable, else 0 with the channel error set. */
+static int LMDB_ChanAlive(LMDB_ChanBase *base)
+{
+  LMDB_TxnInfo *info = LMDB_ChanInfo(base);
+  Tcl_Obj *msg;
+
+  if(info && info->active) {
+    return 1;
+  }
+
+  /* The error is a list of return options followed by the message. */
+  msg = Tcl_ObjPrintf("transaction %s of the blob has ended", base->txnHandle);
+  Tcl_SetChannelError(base->chan, Tcl_NewListObj(1, &msg));
+  return 0;
+}
+
+/* Report an LMDB error as the error of the channel. */
+static void LMDB_ChanError(LMDB_ChanBase *base, int result)
+{
+  Tcl_Obj *msg = Tcl_ObjPrintf("ERROR: %s", mdb_strerror(result));
+
+  Tcl_SetChannelError(base->chan, Tcl_NewListObj(1, &msg));
+}
+
+/*
+ * The data can always be read or written, so a fileevent on the
+ * channel is fired from a timer for as long as it is wanted.
+ */
+static void LMDB_ChanTimer(ClientData clientData)
+{
+  LMDB_ChanBase *base = (LMDB_ChanBase *) clientData;
+
+  base->timer = Tcl_CreateTimerHandler(0, LMDB_ChanTimer, base);
+  /* This may close the channel and free base, along with the timer. */
+  Tcl_NotifyChannel(base->chan, base->watchMask);
+}
+
+static void LMDB_ChanWatch(ClientData instanceData, int mask)
+{
+  LMDB_ChanBase *base = (LMDB_ChanBase *) instanceData;
+
+  base->watchMask = mask & (TCL_READABLE|TCL_WRITABLE);
+  if(base->watchMask && !base->timer) {
+    base->timer = Tcl_CreateTimerHandler(0, LMDB_ChanTimer, base);
+  } else if(!base->watchMask && base->timer) {
+    Tcl_DeleteTimerHandler(base->timer);
+    base->timer = NULL;
+  }
+}
+
+static int LMDB_ChanGetHandle(ClientData instanceData, int direction,
+                              ClientData *handlePtr)
+{
+  return TCL_ERROR;
+}
+
+static int LMDB_ChanBlockMode(ClientData instanceData, int mode)
+{
+  return 0;
+}
+
+/*
+ * A read-only channel on the data of a key (dbi_handle openBlob). It
+ * reads straight from the map.
+ */
+typedef struct LMDB_Blob {
+  LMDB_ChanBase base;             /* must be first */
+  MDB_val data;
+  size_t pos;
+} LMDB_Blob;
+
+static int LMDB_BlobClose(ClientData instanceData, Tcl_Interp *interp,
+                          int flags)
+{
+  LMDB_Blob *blob = (LMDB_Blob *) instanceData;
+
+  if((flags & (TCL_CLOSE_READ|TCL_CLOSE_WRITE)) != 0) {
+    return EINVAL;
+  }
+  LMDB_ChanBaseFree(&blob->base);
+  ckfree(blob);
+  return 0;
+}
+
+static int LMDB_BlobInput(ClientData instanceData, char *buf, int toRead,
+                          int *errorCodePtr)
+{
+  LMDB_Blob *blob = (LMDB_Blob *) instanceData;
+
+  if(!LMDB_ChanAlive(&blob->base)) {
+    *errorCodePtr = EINVAL;
+    return -1;
+  }
+  if(blob->pos >= blob->data.mv_size) {
+    return 0;
+  }
+  if((size_t) toRead > blob->data.mv_size - blob->pos) {
+    toRead = (int) (blob->data.mv_size - blob->pos);
+  }
+  memcpy(buf, (char *) blob->data.mv_data + blob->pos, toRead);
+  blob->pos += toRead;
+  return toRead;
+}
+
+static int LMDB_BlobOutput(ClientData instanceData, const char *buf,
+                           int toWrite, int *errorCodePtr)
+{
+  *errorCodePtr = EINVAL;
+  return -1;
+}
+
+/* New position of a seek in data of size bytes, or -1. */
+static Tcl_WideInt LMDB_SeekPos(Tcl_WideInt pos, Tcl_WideInt size,
+                                Tcl_WideInt offset, int seekMode)
+{
+  if(seekMode == SEEK_SET) {
+    pos = offset;
+  } else if(seekMode == SEEK_CUR) {
+    pos += offset;
+  } else {
+    pos = size + offset;
+  }
+  return (pos < 0) ? -1 : pos;
+}
+
+static Tcl_WideInt LMDB_BlobWideSeek(ClientData instanceData,
+                                     Tcl_WideInt offset, int seekMode,
+                                     int *errorCodePtr)
+{
+  LMDB_Blob *blob = (LMDB_Blob *) instanceData;
+  Tcl_WideInt pos;
+
+  pos = LMDB_SeekPos((Tcl_WideInt) blob->pos,
+                     (Tcl_WideInt) blob->data.mv_size, offset, seekMode);
+  if(pos < 0) {
+    *errorCodePtr = EINVAL;
+    return -1;
+  }
+  blob->pos = (size_t) pos;
+  return pos;
+}
+
+#if TCL_MAJOR_VERSION < 9
+static int LMDB_BlobSeek(ClientData instanceData, long offset, int seekMode,
+                         int *errorCodePtr)
+{
+  return (int) LMDB_BlobWideSeek(instanceData, offset, seekMode, errorCodePtr);
+}
+#endif
+
+static Tcl_ChannelType LMDB_BlobChannelType = {
+  "lmdbblob",
+  TCL_CHANNEL_VERSION_5,
+  TCL_CLOSE2PROC,
+  LMDB_BlobInput,
+  LMDB_BlobOutput,
+#if TCL_MAJOR_VERSION < 9
+  LMDB_BlobSeek,
+#else
+  NULL,
+#endif
+  NULL,                           /* setOptionProc */
+  NULL,                           /* getOptionProc */
+  LMDB_ChanWatch,
+  LMDB_ChanGetHandle,
+  LMDB_BlobClose,
+  LMDB_ChanBlockMode,
+  NULL,                           /* flushProc */
+  NULL,                           /* handlerProc */
+  LMDB_BlobWideSeek,
+  NULL,                           /* threadActionProc */
+  NULL                            /* truncateProc */
+};
+
+/*
+ * Filters of dbi_handle scan and export. They are checked against the
+ * key and data in the map, before anything is copied out, so pairs that
+ * do not match cost no Tcl objects. Patterns see the bytes up to the
+ * first NUL.
+ */
+typedef struct LMDB_Filter {
+  Tcl_Interp *interp;             /* for -keyregexp errors */
+  const char *keymatch;           /* NULL if not given */
+  Tcl_RegExp keyregexp;
+  const char *valuematch;
+  Tcl_DString buf;                /* terminated copy of a key or data */
+} LMDB_Filter;
+
+static void LMDB_FilterInit(LMDB_Filter *filter, Tcl_Interp *interp)
+{
+  memset(filter, 0, sizeof(LMDB_Filter));
+  filter->interp = interp;
+  Tcl_DStringInit(&filter->buf);
+}
+
+/*
+ * Take a filter option. Returns TCL_OK if zArg was one, TCL_CONTINUE if
+ * it was not, TCL_ERROR for a bad regular expression.
+ */
+static int LMDB_FilterOption(LMDB_Filter *filter, const char *zArg,
+                             Tcl_Obj *value)
+{
+  if(strcmp(zArg, "-keymatch") == 0) {
+    filter->keymatch = Tcl_GetString(value);
+  } else if(strcmp(zArg, "-keyregexp") == 0) {
+    filter->keyregexp = Tcl_GetRegExpFromObj(filter->interp, value,
+                                             TCL_REG_ADVANCED);
+    if(!filter->keyregexp) {
+      return TCL_ERROR;
+    }
+  } else if(strcmp(zArg, "-valuematch") == 0) {
+    filter->valuematch = Tcl_GetString(value);
+  } else {
+    return TCL_CONTINUE;
+  }
+  return TCL_OK;
+}
+
+static const char *LMDB_FilterString(LMDB_Filter *filter, MDB_val *val)
+{
+  Tcl_DStringSetLength(&filter->buf, 0);
+  Tcl_DStringAppend(&filter->buf, val->mv_data, (Tcl_Size) val->mv_size);
+  return Tcl_DStringValue(&filter->buf);
+}
+
+/* Returns 1 if the pair matches, 0 if not, -1 on a regexp error. */
+static int LMDB_FilterMatch(LMDB_Filter *filter, MDB_val *key, MDB_val *data)
+{
+  const char *str;
+
+  if(filter->keymatch || filter->keyregexp) {
+    str = LMDB_FilterString(filter, key);
+    if(filter->keymatch && !Tcl_StringMatch(str, filter->keymatch)) {
+      return 0;
+    }
+    if(filter->keyregexp) {
+      int match = Tcl_RegExpExec(filter->interp, filter->keyregexp, str, str);
+
+      if(match <= 0) {
+        return match;
+      }
+    }
+  }
+  if(filter->valuematch) {
+    str = LMDB_FilterString(filter, data);
+    if(!Tcl_StringMatch(str, filter->valuematch)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+/*
+ * Record formats of dbi_handle export and import.
+ *
+ * binary:  4 byte big-endian key length, key, 4 byte data length, data
+ * tsv:     key TAB data NEWLINE, with \\ \t \n \r escaped
+ * mdbdump: the bytevalue format of the mdb_dump and mdb_load tools
+ */
+static const char *LMDB_Format_strs[] = {
+  "binary",
+  "tsv",
+  "mdbdump",
+  0
+};
+
+enum LMDB_Format_enum {
+  LMDB_FORMAT_BINARY,
+  LMDB_FORMAT_TSV,
+  LMDB_FORMAT_MDBDUMP,
+};
+
+/* Records are framed into a buffer that is written out in pieces this big. */
+#define LMDB_EXPORT_BUFSIZE 65536
+
+/* Largest data length a binary import record may claim. */
+#define LMDB_IMPORT_MAXDATA 0x40000000
+
+static const char LMDB_hexdigits[] = "0123456789abcdef";
+
+
+static void LMDB_ExportLength(Tcl_DString *bufPtr, size_t len)
+{
+  unsigned char b[4];
+
+  b[0] = (unsigned char)(len >> 24);
+  b[1] = (unsigned char)(len >> 16);
+  b[2] = (unsigned char)(len >> 8);
+  b[3] = (unsigned char)len;
+  Tcl_DStringAppend(bufPtr, (char *) b, 4);
+}
+
+
+static void LMDB_ExportTsv(Tcl_DString *bufPtr, MDB_val *val)
+{
+  const char *p = val->mv_data;
+  const char *end = p + val->mv_size;
+  const char *start = p;
+
+  for( ; p < end; p++) {
+    const char *esc;
+
+    switch(*p) {
+      case '\\': esc = "\\\\"; break;
+      case '\t': esc = "\\t"; break;
+      case '\n': esc = "\\n"; break;
+      case '\r': esc = "\\r"; break;
+      default: continue;
+    }
+    Tcl_DStringAppend(bufPtr, start, (Tcl_Size)(p - start));
+    Tcl_DStringAppend(bufPtr, esc, 2);
+    start = p + 1;
+  }
+  Tcl_DStringAppend(bufPtr, start, (Tcl_Size)(end - start));
+}
+
+
+/*
+ * One data line of the mdb_dump format: a space, then the value as hex
+ * digits (bytevalue) or as printable characters with \xx escapes (print).
+ */
+static void LMDB_ExportDumpValue(Tcl_DString *bufPtr, MDB_val *val, int print)
+{
+  const unsigned char *p = val->mv_data;
+  Tcl_Size len = Tcl_DStringLength(bufPtr);
+  char *out;
+  size_t i;
+
+  /* Enough for the worst case, trimmed below. */
+  Tcl_DStringSetLength(bufPtr, len + 2 + 3 * val->mv_size);
+  out = Tcl_DStringValue(bufPtr) + len;
+  *out++ = ' ';
+  for(i = 0; i < val->mv_size; i++) {
+    if(!print) {
+      *out++ = LMDB_hexdigits[p[i] >> 4];
+      *out++ = LMDB_hexdigits[p[i] & 15];
+    } else if(p[i] == '\\') {
+      *out++ = '\\';
+      *out++ = '\\';
+    } else if(p[i] >= 0x20 && p[i] < 0x7f) {
+      *out++ = p[i];
+    } else {
+      *out++ = '\\';
+      *out++ = LMDB_hexdigits[p[i] >> 4];
+      *out++ = LMDB_hexdigits[p[i] & 15];
+    }
+  }
+  *out++ = '\n';
+  Tcl_DStringSetLength(bufPtr, out - Tcl_DStringValue(bufPtr));
+}
+
+
+/*
+ * The mdb_dump header for a database. name is NULL for the main DB.
+ */
+static int LMDB_DumpHeader(Tcl_DString *bufPtr, MDB_txn *txn, MDB_dbi dbi,
+                           const char *name, int print)
+{
+  static const struct {
+    unsigned int bit;
+    const char *name;
+  } dbflags[] = {
+    { MDB_REVERSEKEY, "reversekey" },
+    { MDB_DUPSORT, "duplicates" },
+    { MDB_INTEGERKEY, "integerkey" },
+    { MDB_DUPFIXED, "dupfixed" },
+    { MDB_INTEGERDUP, "integerdup" },
+    { MDB_REVERSEDUP, "reversedup" },
+    { 0, NULL }
+  };
+  MDB_envinfo info;
+  MDB_stat stat;
+  unsigned int flags;
+  char buf[64];
+  int result;
+  int i;
+
+  result = mdb_dbi_flags(txn, dbi, &flags);
+  if(result == 0) result = mdb_env_info(mdb_txn_env(txn), &info);
+  if(result == 0) result = mdb_env_stat(mdb_txn_env(txn), &stat);
+  if(result != 0) {
+    return result;
+  }
+
+  Tcl_DStringAppend(bufPtr, "VERSION=3\n", -1);
+  Tcl_DStringAppend(bufPtr, print ? "format=print\n" : "format=bytevalue\n", -1);
+  if(name) {
+    Tcl_DStringAppend(bufPtr, "database=", -1);
+    Tcl_DStringAppend(bufPtr, name, -1);
+    Tcl_DStringAppend(bufPtr, "\n", 1);
+  }
+  Tcl_DStringAppend(bufPtr, "type=btree\n", -1);
+  sprintf(buf, "mapsize=%" TCL_LL_MODIFIER "u\n",
+          (Tcl_WideUInt) info.me_mapsize);
+  Tcl_DStringAppend(bufPtr, buf, -1);
+  if(info.me_mapaddr) {
+    sprintf(buf, "mapaddr=%p\n", info.me_mapaddr);
+    Tcl_DStringAppend(bufPtr, buf, -1);
+  }
+  sprintf(buf, "maxreaders=%u\n", info.me_maxreaders);
+  Tcl_DStringAppend(bufPtr, buf, -1);
+  for(i = 0; dbflags[i].bit; i++) {
+    if(flags & dbflags[i].bit) {
+      Tcl_DStringAppend(bufPtr, dbflags[i].name, -1);
+      Tcl_DStringAppend(bufPtr, "=1\n", -1);
+    }
+  }
+  sprintf(buf, "db_pagesize=%u\n", stat.ms_psize);
+  Tcl_DStringAppend(bufPtr, buf, -1);
+  Tcl_DStringAppend(bufPtr, "HEADER=END\n", -1);
+
+  return 0;
+}
+
+
+/*
+ * Export output goes to a sink, a Tcl channel or the queue of a dump
+ * worker thread. A sink returns 0 on success.
+ */
+typedef int (LMDB_ExportSink)(void *ctx, const char *buf, Tcl_Size len);
+
+/* Returned by LMDB_ExportDbi if the sink failed. */
+#define LMDB_EXPORT_SINKERR (-1)
+
+/* A filter failed, the message is in the interpreter result. */
+#define LMDB_EXPORT_FILTERERR (-2)
+
+static int LMDB_ChannelSink(void *ctx, const char *buf, Tcl_Size len)
+{
+  return Tcl_Write((Tcl_Channel) ctx, buf, len) != len;
+}
+
+
+/*
+ * Write the records of dbi with keys in [from, to) to a sink. from and
+ * to may be NULL for the first and past the last key. For the mdbdump
+ * format name is the database= of the header. The count of records
+ * written is stored in *countPtr. Does not use an interpreter, so it can
+ * run in a worker thread. Returns 0, an LMDB error code or
+ * LMDB_EXPORT_SINKERR.
+ */
+static int LMDB_ExportDbi(MDB_txn *txn, MDB_dbi dbi, int format, int print,
+                          const char *name, MDB_val *from, MDB_val *to,
+                          LMDB_Filter *filter, LMDB_ExportSink *sink,
+                          void *ctx, Tcl_WideInt *countPtr)
+{
+  MDB_cursor *cursor;
+  MDB_val mkey;
+  MDB_val mdata;
+  Tcl_DString buf;
+  Tcl_DString vbuf;
+  Tcl_WideInt count = 0;
+  int result;
+  int op;
+
+  *countPtr = 0;
+  result = mdb_cursor_open(txn, dbi, &cursor);
+  if(result != 0) {
+    return result;
+  }
+
+  Tcl_DStringInit(&buf);
+  Tcl_DStringInit(&vbuf);
+  if(format == LMDB_FORMAT_MDBDUMP) {
+    result = LMDB_DumpHeader(&buf, txn, dbi, name, print);
+    if(result != 0) {
+      goto done;
+    }
+  }
+
+  if(from) {
+    mkey = *from;
+    op = MDB_SET_RANGE;
+  } else {
+    op = MDB_FIRST;
+  }
+
+  while((result = mdb_cursor_get(cursor, &mkey, &mdata, op)) == 0) {
+    op = MDB_NEXT;
+    if(to && mdb_cmp(txn, dbi, &mkey, to) >= 0) {
+      break;
+    }
+    if(filter && filter->valuematch) {
+      result = LMDB_VlogGet(txn, dbi, &mdata, LMDB_DATA_BYTES, &vbuf);
+      if(result != 0) {
+        goto done;
+      }
+    }
+    if(filter) {
+      int match = LMDB_FilterMatch(filter, &mkey, &mdata);
+
+      if(match < 0) {
+        result = LMDB_EXPORT_FILTERERR;
+        goto done;
+      }
+      if(match == 0) {
+        continue;
+      }
+    }
+    if(!filter || !filter->valuematch) {
+      result = LMDB_VlogGet(txn, dbi, &mdata, LMDB_DATA_BYTES, &vbuf);
+      if(result != 0) {
+        goto done;
+      }
+    }
+
+    switch(format) {
+      case LMDB_FORMAT_BINARY:
+        LMDB_ExportLength(&buf, mkey.mv_size);
+        Tcl_DStringAppend(&buf, mkey.mv_data, (Tcl_Size) mkey.mv_size);
+        LMDB_ExportLength(&buf, mdata.mv_size);
+        Tcl_DStringAppend(&buf, mdata.mv_data, (Tcl_Size) mdata.mv_size);
+        break;
+      case LMDB_FORMAT_TSV:
+        LMDB_ExportTsv(&buf, &mkey);
+        Tcl_DStringAppend(&buf, "\t", 1);
+        LMDB_ExportTsv(&buf, &mdata);
+        Tcl_DStringAppend(&buf, "\n", 1);
+        break;
+      case LMDB_FORMAT_MDBDUMP:
+        LMDB_ExportDumpValue(&buf, &mkey, print);
+        LMDB_ExportDumpValue(&buf, &mdata, print);
+        break;
+    }
+    count++;
+
+    if(Tcl_DStringLength(&buf) >= LMDB_EXPORT_BUFSIZE) {
+      if(sink(ctx, Tcl_DStringValue(&buf), Tcl_DStringLength(&buf))) {
+        result = LMDB_EXPORT_SINKERR;
+        goto done;
+      }
+      Tcl_DStringSetLength(&buf, 0);
+    }
+  }
+  if(result != MDB_NOTFOUND && result != 0) {
+    goto done;
+  }
+
+  if(format == LMDB_FORMAT_MDBDUMP) {
+    Tcl_DStringAppend(&buf, "DATA=END\n", -1);
+  }
+  result = 0;
+  if(Tcl_DStringLength(&buf) > 0 &&
+     sink(ctx, Tcl_DStringValue(&buf), Tcl_DStringLength(&buf))) {
+    result = LMDB_EXPORT_SINKERR;
+  }
+  *countPtr = count;
+
+done:
+  mdb_cursor_close(cursor);
+  Tcl_DStringFree(&buf);
+  Tcl_DStringFree(&vbuf);
+  return result;
+}
+
+
+/*
+ * Leave the error of LMDB_ExportDbi in the interpreter result.
+ */
+static void LMDB_ExportError(Tcl_Interp *interp, Tcl_Channel chan, int result)
+{
+  if(result == LMDB_EXPORT_SINKERR) {
+    Tcl_AppendResult(interp, "error writing \"", Tcl_GetChannelName(chan),
+                     "\": ", Tcl_PosixError(interp), (char *)NULL);
+  } else if(result == LMDB_EXPORT_FILTERERR) {
+    /* The message is already there. */
+  } else {
+    Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char *)NULL);
+  }
+}
+
+
+/*
+ * Buffered input of dbi_handle import. Tcl_Read does no encoding
+ * conversion, so the bytes are the ones dbi_handle export wrote.
+ */
+typedef struct LMDB_Input {
+  Tcl_Channel chan;
+  Tcl_DString buf;
+  Tcl_Size pos;                   /* first unconsumed byte of buf */
+  int eof;
+} LMDB_Input;
+
+static void LMDB_InputInit(LMDB_Input *in, Tcl_Channel chan)
+{
+  in->chan = chan;
+  Tcl_DStringInit(&in->buf);
+  in->pos = 0;
+  in->eof = 0;
+}
+
+/*
+ * Make at least need bytes available after in->pos, unless the channel
+ * is at end of file. Returns TCL_ERROR on a read error.
+ */
+static int LMDB_InputFill(Tcl_Interp *interp, LMDB_Input *in, Tcl_Size need)
+{
+  while(!in->eof && Tcl_DStringLength(&in->buf) - in->pos < need) {
+    Tcl_Size len = Tcl_DStringLength(&in->buf) - in->pos;
+    Tcl_Size want = need - len;
+    Tcl_Size got;
+
+    if(in->pos > 0) {
+      memmove(Tcl_DStringValue(&in->buf), Tcl_DStringValue(&in->buf) + in->pos,
+              len);
+      in->pos = 0;
+    }
+    if(want < LMDB_EXPORT_BUFSIZE) {
+      want = LMDB_EXPORT_BUFSIZE;
+    }
+    /* Grow with the bytes that actually arrive, not with the claim. */
+    if(want > len && want > LMDB_EXPORT_BUFSIZE) {
+      want = len > LMDB_EXPORT_BUFSIZE ? len : LMDB_EXPORT_BUFSIZE;
+    }
+    Tcl_DStringSetLength(&in->buf, len + want);
+    got = Tcl_Read(in->chan, Tcl_DStringValue(&in->buf) + len, want);
+    if(got < 0) {
+      Tcl_DStringSetLength(&in->buf, len);
+      Tcl_AppendResult(interp, "error reading \"", Tcl_GetChannelName(in->chan),
+                       "\": ", Tcl_PosixError(interp), (char *)NULL);
+      return TCL_ERROR;
+    }
+    Tcl_DStringSetLength(&in->buf, len + got);
+    if(got == 0 && Tcl_Eof(in->chan)) {
+      in->eof = 1;
+    }
+  }
+  return TCL_OK;
+}
+
+/*
+ * Get the next line without its newline. *linePtr is NULL at end of file.
+ * The line is valid until the next call.
+ */
+static int LMDB_InputLine(Tcl_Interp *interp, LMDB_Input *in,
+                          char **linePtr, Tcl_Size *lenPtr)
+{
+  Tcl_Size scanned = 0;
+  char *start, *nl;
+
+  for(;;) {
+    Tcl_Size avail = Tcl_DStringLength(&in->buf) - in->pos;
+
+    start = Tcl_DStringValue(&in->buf) + in->pos;
+    nl = memchr(start + scanned, '\n', avail - scanned);
+    if(nl) {
+      *linePtr = start;
+      *lenPtr = nl - start;
+      in->pos += *lenPtr + 1;
+      return TCL_OK;
+    }
+    if(in->eof) {
+      if(avail == 0) {
+        *linePtr = NULL;
+        *lenPtr = 0;
+      } else {
+        *linePtr = start;
+        *lenPtr = avail;
+        in->pos += avail;
+      }
+      return TCL_OK;
+    }
+    scanned = avail;
+    if(LMDB_InputFill(interp, in, avail + 1) != TCL_OK) {
+      return TCL_ERROR;
+    }
+  }
+}
+
+static int LMDB_HexValue(int c)
+{
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/*
+ * Decode a tsv field, or a data line of the mdb_dump bytevalue or print
+ * format (without the leading space), and append it to bufPtr.
+ * Returns 0 if the input is malformed.
+ */
+static int LMDB_ImportDecode(Tcl_DString *bufPtr, const char *p, Tcl_Size len,
+                             int format, int print)
+{
+  const char *end = p + len;
+  Tcl_Size start = Tcl_DStringLength(bufPtr);
+  char *out;
+
+  /* The decoded value is never longer than the input. */
+  Tcl_DStringSetLength(bufPtr, start + len);
+  out = Tcl_DStringValue(bufPtr) + start;
+
+  if(format == LMDB_FORMAT_TSV) {
+    for( ; p < end; p++) {
+      if(*p != '\\') {
+        *out++ = *p;
+        continue;
+      }
+      if(++p == end) return 0;
+      switch(*p) {
+        case '\\': *out++ = '\\'; break;
+        case 't': *out++ = '\t'; break;
+        case 'n': *out++ = '\n'; break;
+        case 'r': *out++ = '\r'; break;
+        default: return 0;
+      }
+    }
+  } else if(print) {
+    for( ; p < end; p++) {
+      int hi, lo;
+
+      if(*p != '\\') {
+        *out++ = *p;
+        continue;
+      }
+      if(++p == end) return 0;
+      if(*p == '\\') {
+        *out++ = '\\';
+        continue;
+      }
+      if(p + 1 == end) return 0;
+      hi = LMDB_HexValue(p[0]);
+      lo = LMDB_HexValue(p[1]);
+      if(hi < 0 || lo < 0) return 0;
+      *out++ = (char)((hi << 4) | lo);
+      p++;
+    }
+  } else {
+    if(len & 1) return 0;
+    for( ; p < end; p += 2) {
+      int hi = LMDB_HexValue(p[0]);
+      int lo = LMDB_HexValue(p[1]);
+
+      if(hi < 0 || lo < 0) return 0;
+      *out++ = (char)((hi << 4) | lo);
+    }
+  }
+
+  Tcl_DStringSetLength(bufPtr, out - Tcl_DStringValue(bufPtr));
+  return 1;
+}
+
+/*
+ * Read an mdb_dump header up to HEADER=END. The header is returned as a
+ * list of names and values in *headerPtr (with a reference count of 1)
+ * and *printPtr tells whether the data lines use the print format.
+ * *headerPtr is NULL if the input is at end of file.
+ */
+static int LMDB_ImportHeader(Tcl_Interp *interp, LMDB_Input *in,
+                             Tcl_Obj **headerPtr, int *printPtr)
+{
+  Tcl_Obj *header = NULL;
+  char *line;
+  Tcl_Size len;
+
+  *headerPtr = NULL;
+  *printPtr = 0;
+  for(;;) {
+    char *eq;
+
+    if(LMDB_InputLine(interp, in, &line, &len) != TCL_OK) {
+      goto error;
+    }
+    if(!line) {
+      if(!header) {
+        return TCL_OK;
+      }
+      Tcl_AppendResult(interp, "unexpected end of file in dump header", (char *)NULL);
+      goto error;
+    }
+    if(!header) {
+      if(len != 9 || strncmp(line, "VERSION=3", 9) != 0) {
+        Tcl_AppendResult(interp, "unsupported dump format, expected VERSION=3",
+                         (char *)NULL);
+        return TCL_ERROR;
+      }
+      header = Tcl_NewListObj(0, NULL);
+      Tcl_IncrRefCount(header);
+      continue;
+    }
+    if(len == 10 && strncmp(line, "HEADER=END", 10) == 0) {
+      break;
+    }
+    eq = memchr(line, '=', len);
+    if(!eq) {
+      Tcl_AppendResult(interp, "malformed dump header line", (char *)NULL);
+      goto error;
+    }
+    Tcl_ListObjAppendElement(interp, header, Tcl_NewStringObj(line, eq - line));
+    Tcl_ListObjAppendElement(interp, header,
+                             Tcl_NewStringObj(eq + 1, len - (eq - line) - 1));
+    if(eq - line == 6 && strncmp(line, "format", 6) == 0) {
+      if(len == 12 && strncmp(eq + 1, "print", 5) == 0) {
+        *printPtr = 1;
+      } else if(len != 16 || strncmp(eq + 1, "bytevalue", 9) != 0) {
+        Tcl_AppendResult(interp, "unsupported dump format \"", eq + 1, "\"",
+                         (char *)NULL);
+        goto error;
+      }
+    }
+  }
+
+  *headerPtr = header;
+  return TCL_OK;
+
+error:
+  if(header) {
+    Tcl_DecrRefCount(header);
+  }
+  return TCL_ERROR;
+}
+
+/*
+ * A batch of parsed records. Keys and data are stored in data and the
+ * records refer to them by offset, as data grows while it is filled.
+ */
+typedef struct LMDB_ImportRec {
+  size_t koff, klen;
+  size_t doff, dlen;
+  unsigned int flags;             /* MDB_APPEND, MDB_APPENDDUP or 0 */
+} LMDB_ImportRec;
+
+typedef struct LMDB_Import {
+  MDB_env *env;
+  MDB_dbi dbi;
+  int format;
+  int print;                      /* mdbdump data lines use print format */
+  int append;                     /* 1 yes, 0 no, -1 auto */
+  int autoAppend;                 /* -append auto was given */
+  int sorted;                     /* records arrive in database order */
+  int dupsort;
+  Tcl_DString data;
+  LMDB_ImportRec *recs;
+  int nrecs;
+  int maxrecs;
+  Tcl_DString prevKey;            /* key of the previous record */
+  int havePrev;
+  Tcl_WideInt count;              /* records stored so far */
+  Tcl_WideInt commits;
+} LMDB_Import;
+
+/*
+ * Read the next record into the batch. Returns TCL_BREAK at the end of
+ * the input.
+ */
+static int LMDB_ImportRead(Tcl_Interp *interp, LMDB_Input *in, LMDB_Import *im)
+{
+  LMDB_ImportRec *rec;
+  Tcl_DString *data = &im->data;
+  size_t koff = Tcl_DStringLength(data);
+
+  if(im->nrecs == im->maxrecs) {
+    im->maxrecs = im->maxrecs ? 2 * im->maxrecs : 1024;
+    im->recs = (LMDB_ImportRec *) ckrealloc((char *) im->recs,
+                                            im->maxrecs * sizeof(LMDB_ImportRec));
+  }
+  rec = &im->recs[im->nrecs];
+
+  if(im->format == LMDB_FORMAT_BINARY) {
+    const unsigned char *p;
+    size_t len;
+    size_t maxkey = im->env ? (size_t) mdb_env_get_maxkeysize(im->env) : 511;
+    int i;
+
+    for(i = 0; i < 2; i++) {
+      if(LMDB_InputFill(interp, in, 4) != TCL_OK) {
+        return TCL_ERROR;
+      }
+      if(Tcl_DStringLength(&in->buf) - in->pos == 0 && i == 0) {
+        return TCL_BREAK;
+      }
+      if(Tcl_DStringLength(&in->buf) - in->pos < 4) {
+        goto truncated;
+      }
+      p = (unsigned char *) Tcl_DStringValue(&in->buf) + in->pos;
+      len = ((size_t)p[0] << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | p[3];
+      if(len > (i == 0 ? maxkey : LMDB_IMPORT_MAXDATA)) {
+        Tcl_AppendResult(interp, "corrupt binary record, ",
+                         i == 0 ? "key" : "data", " too long", (char *)NULL);
+        return TCL_ERROR;
+      }
+      in->pos += 4;
+      if(LMDB_InputFill(interp, in, (Tcl_Size) len) != TCL_OK) {
+        return TCL_ERROR;
+      }
+      if((size_t)(Tcl_DStringLength(&in->buf) - in->pos) < len) {
+        goto truncated;
+      }
+      Tcl_DStringAppend(data, Tcl_DStringValue(&in->buf) + in->pos, (Tcl_Size) len);
+      in->pos += len;
+      if(i == 0) {
+        rec->koff = koff;
+        rec->klen = len;
+      } else {
+        rec->doff = koff + rec->klen;
+        rec->dlen = len;
+      }
+    }
+  } else if(im->format == LMDB_FORMAT_TSV) {
+    char *line, *tab;
+    Tcl_Size len;
+
+    if(LMDB_InputLine(interp, in, &line, &len) != TCL_OK) {
+      return TCL_ERROR;
+    }
+    if(!line) {
+      return TCL_BREAK;
+    }
+    tab = memchr(line, '\t', len);
+    if(!tab) {
+      Tcl_AppendResult(interp, "malformed tsv record, missing tab", (char *)NULL);
+      return TCL_ERROR;
+    }
+    rec->koff = koff;
+    if(!LMDB_ImportDecode(data, line, tab - line, im->format, 0)) {
+      goto malformed;
+    }
+    rec->klen = Tcl_DStringLength(data) - koff;
+    rec->doff = Tcl_DStringLength(data);
+    if(!LMDB_ImportDecode(data, tab + 1, len - (tab - line) - 1, im->format, 0)) {
+      goto malformed;
+    }
+    rec->dlen = Tcl_DStringLength(data) - rec->doff;
+  } else {
+    char *line;
+    Tcl_Size len;
+    int i;
+
+    for(i = 0; i < 2; i++) {
+      if(LMDB_InputLine(interp, in, &line, &len) != TCL_OK) {
+        return TCL_ERROR;
+      }
+      if(!line) {
+        Tcl_AppendResult(interp, "unexpected end of file, missing DATA=END",
+                         (char *)NULL);
+        return TCL_ERROR;
+      }
+      if(i == 0 && len == 8 && strncmp(line, "DATA=END", 8) == 0) {
+        return TCL_BREAK;
+      }
+      if(len < 1 || line[0] != ' ' ||
+         !LMDB_ImportDecode(data, line + 1, len - 1, im->format, im->print)) {
+        goto malformed;
+      }
+      if(i == 0) {
+        rec->koff = koff;
+        rec->klen = Tcl_DStringLength(data) - koff;
+      } else {
+        rec->doff = koff + rec->klen;
+        rec->dlen = Tcl_DStringLength(data) - rec->doff;
+      }
+    }
+  }
+
+  rec->flags = 0;
+  im->nrecs++;
+  return TCL_OK;
+
+truncated:
+  Tcl_AppendResult(interp, "truncated binary record", (char *)NULL);
+  return TCL_ERROR;
+
+malformed:
+  Tcl_AppendResult(interp, "malformed ", LMDB_Format_strs[im->format],
+                   " record", (char *)NULL);
+  return TCL_ERROR;
+}
+
+/*
+ * Choose the put flags of the batch. With -append auto, records are
+ * appended as long as the keys arrive in increasing order. mdb_put checks
+ * against the last key of the database itself, so this is only a guess
+ * of what will succeed.
+ */
+static void LMDB_ImportFlags(LMDB_Import *im, MDB_txn *txn)
+{
+  MDB_val key, prev;
+  int i;
+
+  for(i = 0; i < im->nrecs && im->append; i++) {
+    LMDB_ImportRec *rec = &im->recs[i];
+    int cmp = 1;
+
+    key.mv_size = rec->klen;
+    key.mv_data = Tcl_DStringValue(&im->data) + rec->koff;
+    if(im->havePrev) {
+      prev.mv_size = Tcl_DStringLength(&im->prevKey);
+      prev.mv_data = Tcl_DStringValue(&im->prevKey);
+      cmp = mdb_cmp(txn, im->dbi, &key, &prev);
+    }
+    if(cmp > 0) {
+      rec->flags = MDB_APPEND;
+    } else if(cmp == 0 && im->dupsort) {
+      /* Sorted duplicates, mdb_put finds the end of the key anyway. */
+      rec->flags = im->append == 1 ? MDB_APPENDDUP : 0;
+    } else if(im->append == -1) {
+      im->append = 0;
+    } else {
+      rec->flags = MDB_APPEND;
+    }
+    Tcl_DStringSetLength(&im->prevKey, 0);
+    Tcl_DStringAppend(&im->prevKey, key.mv_data, (Tcl_Size) key.mv_size);
+    im->havePrev = 1;
+  }
+}
+
+/*
+ * Store records [first, last) of the batch in one transaction. If the
+ * transaction gets too many dirty pages (MDB_TXN_FULL) the range is
+ * split in two and each half is committed on its own.
+ */
+static int LMDB_ImportCommit(Tcl_Interp *interp, LMDB_Import *im,
+                             int first, int last)
+{
+  MDB_txn *txn;
+  MDB_cursor *cursor;
+  MDB_val key, data;
+  int result;
+  int i;
+
+  if(first == last) {
+    return TCL_OK;
+  }
+
+  result = mdb_txn_begin(im->env, NULL, 0, &txn);
+  if(result != 0) {
+    goto error;
+  }
+  result = mdb_cursor_open(txn, im->dbi, &cursor);
+  if(result != 0) {
+    mdb_txn_abort(txn);
+    goto error;
+  }
+  if(first == 0 && last == im->nrecs) {
+    LMDB_ImportFlags(im, txn);
+  }
+
+  for(i = first; i < last; i++) {
+    LMDB_ImportRec *rec = &im->recs[i];
+
+    key.mv_size = rec->klen;
+    key.mv_data = Tcl_DStringValue(&im->data) + rec->koff;
+    data.mv_size = rec->dlen;
+    data.mv_data = Tcl_DStringValue(&im->data) + rec->doff;
+    result = LMDB_VlogPut(txn, im->dbi, cursor, &key, &data, rec->flags);
+    if(result == MDB_KEYEXIST && rec->flags && im->autoAppend) {
+      /*
+       * Out of order with the keys already in the database. Sorted
+       * input gets past them again, so only stop appending otherwise.
+       */
+      if(!im->sorted) {
+        im->append = 0;
+      }
+      result = LMDB_VlogPut(txn, im->dbi, cursor, &key, &data, 0);
+    }
+    if(result != 0) {
+      break;
+    }
+  }
+  mdb_cursor_close(cursor);
+  if(result == 0) {
+    result = LMDB_VlogCommit(txn);
+  }
+  if(result == 0) {
+    result = mdb_txn_commit(txn);
+  } else {
+    LMDB_VlogAbort(txn);
+    mdb_txn_abort(txn);
+  }
+
+  if(result == MDB_TXN_FULL && last - first > 1) {
+    int mid = first + (last - first) / 2;
+
+    if(LMDB_ImportCommit(interp, im, first, mid) != TCL_OK) {
+      return TCL_ERROR;
+    }
+    return LMDB_ImportCommit(interp, im, mid, last);
+  }
+  if(result != 0) {
+    goto error;
+  }
+
+  im->count += last - first;
+  im->commits++;
+  return TCL_OK;
+
+error:
+  Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char *)NULL);
+  return TCL_ERROR;
+}
+
+/*
+ * Read records from chan into dbi, committing every batch records or
+ * batchBytes bytes (0 is no limit). Records committed before an error
+ * stay in the database; the count is in im->count.
+ */
+static int LMDB_ImportRun(Tcl_Interp *interp, LMDB_Import *im, LMDB_Input *in,
+                          int batch, Tcl_WideInt batchBytes)
+{
+  MDB_txn *txn;
+  unsigned int flags;
+  int result;
+  int code;
+
+  result = mdb_txn_begin(im->env, NULL, MDB_RDONLY, &txn);
+  if(result == 0) {
+    result = mdb_dbi_flags(txn, im->dbi, &flags);
+    mdb_txn_abort(txn);
+  }
+  if(result != 0) {
+    Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char *)NULL);
+    return TCL_ERROR;
+  }
+  im->dupsort = (flags & MDB_DUPSORT) != 0;
+
+  for(;;) {
+    code = LMDB_ImportRead(interp, in, im);
+    if(code == TCL_ERROR) {
+      return TCL_ERROR;
+    }
+    if(im->nrecs > 0 &&
+       (code == TCL_BREAK || im->nrecs >= batch ||
+        (batchBytes > 0 && Tcl_DStringLength(&im->data) >= batchBytes))) {
+      if(LMDB_ImportCommit(interp, im, 0, im->nrecs) != TCL_OK) {
+        return TCL_ERROR;
+      }
+      im->nrecs = 0;
+      Tcl_DStringSetLength(&im->data, 0);
+    }
+    if(code == TCL_BREAK) {
+      return TCL_OK;
+    }
+  }
+}
+
+
+/*
+ * Worker threads that must read the same snapshot each begin a read
+ * transaction and report its txnid. LMDB cannot begin a transaction on
+ * a chosen snapshot, so the calling thread lets the workers go once all
+ * txnids match and otherwise has them begin again.
+ */
+#define LMDB_SNAPSHOT_RETRIES 100
+
+typedef struct LMDB_Snapshot {
+  MDB_env *env;
+  Tcl_Mutex mutex;
+  Tcl_Condition cond;
+  int begun;                      /* workers that began a transaction */
+  int beginResult;                /* first mdb_txn_begin error */
+  size_t *txnids;
+  size_t want;                    /* txnid the workers must get, 0 any */
+  int round;                      /* current attempt */
+  int decided;                    /* last attempt with a decision */
+  int decision;                   /* 1 go, 0 try again, -1 give up */
+} LMDB_Snapshot;
+
+static void LMDB_SnapshotInit(LMDB_Snapshot *snap, MDB_env *env, int nthreads)
+{
+  memset(snap, 0, sizeof(LMDB_Snapshot));
+  snap->env = env;
+  snap->txnids = (size_t *) ckalloc(nthreads * sizeof(size_t));
+  snap->decided = -1;
+}
+
+static void LMDB_SnapshotFree(LMDB_Snapshot *snap)
+{
+  ckfree((char *) snap->txnids);
+  Tcl_MutexFinalize(&snap->mutex);
+  Tcl_ConditionFinalize(&snap->cond);
+}
+
+/*
+ * Called by worker index: returns a read transaction on the agreed
+ * snapshot, or NULL if the calling thread gave up.
+ */
+static MDB_txn *LMDB_SnapshotBegin(LMDB_Snapshot *snap, int index)
+{
+  MDB_txn *txn = NULL;
+  int decision;
+  int round;
+  int result;
+
+  for(round = 0; ; round++) {
+    result = mdb_txn_begin(snap->env, NULL, MDB_RDONLY, &txn);
+
+    Tcl_MutexLock(&snap->mutex);
+    if(result != 0) {
+      txn = NULL;
+      if(!snap->beginResult) {
+        snap->beginResult = result;
+      }
+    } else {
+      snap->txnids[index] = mdb_txn_id(txn);
+    }
+    snap->begun++;
+    Tcl_ConditionNotify(&snap->cond);
+    while(snap->decided < round) {
+      Tcl_ConditionWait(&snap->cond, &snap->mutex, NULL);
+    }
+    decision = snap->decision;
+    Tcl_MutexUnlock(&snap->mutex);
+
+    if(decision == 1) {
+      return txn;
+    }
+    if(txn) {
+      mdb_txn_abort(txn);
+      txn = NULL;
+    }
+    if(decision < 0) {
+      return NULL;
+    }
+  }
+}
+
+/*
+ * Called by the calling thread once started workers run. A non-zero
+ * result makes the workers give up. Returns 0 when the workers hold
+ * transactions on one snapshot, or an error code.
+ */
+static int LMDB_SnapshotAgree(LMDB_Snapshot *snap, int started, int result)
+{
+  int i;
+
+  Tcl_MutexLock(&snap->mutex);
+  if(result != 0) {
+    snap->beginResult = result;
+  }
+  for(snap->round = 0; ; snap->round++) {
+    int same = 1;
+
+    while(snap->begun < started) {
+      Tcl_ConditionWait(&snap->cond, &snap->mutex, NULL);
+    }
+    for(i = 1; i < started; i++) {
+      if(snap->txnids[i] != snap->txnids[0]) {
+        same = 0;
+      }
+    }
+    if(snap->beginResult || snap->round == LMDB_SNAPSHOT_RETRIES) {
+      snap->decision = -1;
+    } else if(same && snap->want && snap->txnids[0] != snap->want) {
+      /* That snapshot is gone, a newer transaction never gets it. */
+      snap->decision = -1;
+    } else {
+      snap->decision = same ? 1 : 0;
+    }
+    snap->begun = 0;
+    snap->decided = snap->round;
+    Tcl_ConditionNotify(&snap->cond);
+    if(snap->decision != 0) {
+      break;
+    }
+  }
+  result = 0;
+  if(snap->decision < 0) {
+    result = snap->beginResult ? snap->beginResult : MDB_BAD_TXN;
+  }
+  Tcl_MutexUnlock(&snap->mutex);
+
+  return result;
+}
+
+
+/*
+ * Keys that split dbi into parts ranges of about the same size. The
+ * bundled library reads them off the upper levels of the tree, the
+ * system library has no such call and the keys are counted out.
+ */
+#ifdef USE_SYSTEM_LMDB
+static int LMDB_Partition(MDB_txn *txn, MDB_dbi dbi, unsigned int parts,
+                          MDB_val *keys, unsigned int *count)
+{
+  MDB_stat stat;
+  MDB_cursor *cursor;
+  MDB_val key, data;
+  mdb_size_t n = 0;
+  unsigned int k = 1;
+  int result;
+
+  *count = 0;
+  result = mdb_stat(txn, dbi, &stat);
+  if(result != 0) {
+    return result;
+  }
+  result = mdb_cursor_open(txn, dbi, &cursor);
+  if(result != 0) {
+    return result;
+  }
+  result = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
+  while(result == 0 && k < parts) {
+    if(n >= (mdb_size_t) k * stat.ms_entries / parts) {
+      if(n > 0 &&
+         (*count == 0 || mdb_cmp(txn, dbi, &key, &keys[*count - 1]) != 0)) {
+        keys[(*count)++] = key;
+      }
+      k++;
+      continue;
+    }
+    n++;
+    result = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+  }
+  mdb_cursor_close(cursor);
+
+  return result == MDB_NOTFOUND ? 0 : result;
+}
+#else
+#define LMDB_Partition mdb_dbi_partition
+#endif
+
+/*
+ * dbi_handle parallelScan: one worker thread per key range, each in a
+ * transaction on the same snapshot and with its own interpreter for
+ * the scripts.
+ */
+struct LMDB_Scan;
+
+typedef struct LMDB_ScanSlice {
+  struct LMDB_Scan *scan;
+  int index;
+  Tcl_ThreadId tid;
+  Tcl_DString from;               /* first key, empty for the first slice */
+  Tcl_DString to;                 /* end key, empty for the last slice */
+  Tcl_WideInt count;
+  int code;                       /* TCL_OK or TCL_ERROR */
+  int result;                     /* LMDB error code */
+  Tcl_DString value;              /* -final result or error message */
+} LMDB_ScanSlice;
+
+typedef struct LMDB_Scan {
+  MDB_dbi dbi;
+  const char *init;               /* scripts, NULL if not given */
+  const char *script;
+  const char *final;
+  LMDB_Snapshot snap;
+} LMDB_Scan;
+
+/*
+ * Evaluate a script in the worker interpreter and keep an error
+ * message. break and continue are passed on, not turned into errors.
+ */
+static int LMDB_ScanEval(LMDB_ScanSlice *slice, Tcl_Interp *interp,
+                         Tcl_Obj *script)
+{
+  int code;
+
+  Tcl_AllowExceptions(interp);
+  code = Tcl_EvalObjEx(interp, script, 0);
+
+  if(code == TCL_ERROR) {
+    Tcl_DStringAppend(&slice->value, Tcl_GetStringResult(interp), -1);
+  }
+  return code;
+}
+
+/*
+ * Scan the range of a slice in txn, with the scripts evaluated in an
+ * interpreter of its own.
+ */
+static void LMDB_ScanRange(LMDB_ScanSlice *slice, MDB_txn *txn)
+{
+  LMDB_Scan *scan = slice->scan;
+  Tcl_Interp *interp = NULL;
+  Tcl_Obj *script = NULL;
+  MDB_cursor *cursor = NULL;
+  MDB_val key, data, to;
+  Tcl_DString vbuf;
+  int op = MDB_FIRST;
+  int code = TCL_OK;
+  int result;
+
+  Tcl_DStringInit(&vbuf);
+  if(scan->init || scan->script || scan->final) {
+    interp = Tcl_CreateInterp();
+  }
+  if(scan->init) {
+    Tcl_Obj *init = Tcl_NewStringObj(scan->init, -1);
+
+    Tcl_IncrRefCount(init);
+    code = LMDB_ScanEval(slice, interp, init);
+    Tcl_DecrRefCount(init);
+  }
+  if(scan->script) {
+    /* One object for the whole slice, so it is compiled once. */
+    script = Tcl_NewStringObj(scan->script, -1);
+    Tcl_IncrRefCount(script);
+  }
+
+  result = mdb_cursor_open(txn, scan->dbi, &cursor);
+  if(Tcl_DStringLength(&slice->from) > 0) {
+    key.mv_size = Tcl_DStringLength(&slice->from);
+    key.mv_data = Tcl_DStringValue(&slice->from);
+    op = MDB_SET_RANGE;
+  }
+  to.mv_size = Tcl_DStringLength(&slice->to);
+  to.mv_data = Tcl_DStringValue(&slice->to);
+
+  while(result == 0 && code != TCL_ERROR && code != TCL_BREAK) {
+    result = mdb_cursor_get(cursor, &key, &data, op);
+    op = MDB_NEXT;
+    if(result != 0) {
+      break;
+    }
+    if(to.mv_size > 0 && mdb_cmp(txn, scan->dbi, &key, &to) >= 0) {
+      break;
+    }
+    slice->count++;
+    if(script) {
+      result = LMDB_VlogGet(txn, scan->dbi, &data, LMDB_DATA_BYTES, &vbuf);
+      if(result != 0) {
+        break;
+      }
+      Tcl_SetVar2Ex(interp, "key", NULL,
+                    Tcl_NewStringObj(key.mv_data, key.mv_size), 0);
+      Tcl_SetVar2Ex(interp, "data", NULL,
+                    Tcl_NewStringObj(data.mv_data, data.mv_size), 0);
+      code = LMDB_ScanEval(slice, interp, script);
+    }
+  }
+  if(result == MDB_NOTFOUND) {
+    result = 0;
+  }
+  slice->result = result;
+
+  if(result == 0 && code != TCL_ERROR && scan->final) {
+    Tcl_Obj *final = Tcl_NewStringObj(scan->final, -1);
+
+    Tcl_IncrRefCount(final);
+    code = LMDB_ScanEval(slice, interp, final);
+    if(code != TCL_ERROR) {
+      Tcl_DStringAppend(&slice->value, Tcl_GetStringResult(interp), -1);
+    }
+    Tcl_DecrRefCount(final);
+  }
+  slice->code = (code == TCL_ERROR) ? TCL_ERROR : TCL_OK;
+
+  if(cursor) {
+    mdb_cursor_close(cursor);
+  }
+  Tcl_DStringFree(&vbuf);
+  if(script) {
+    Tcl_DecrRefCount(script);
+  }
+  if(interp) {
+    Tcl_DeleteInterp(interp);
+  }
+}
+
+static Tcl_ThreadCreateType LMDB_ScanThread(ClientData clientData)
+{
+  LMDB_ScanSlice *slice = (LMDB_ScanSlice *) clientData;
+  MDB_txn *txn;
+
+  txn = LMDB_SnapshotBegin(&slice->scan->snap, slice->index);
+  if(txn) {
+    LMDB_ScanRange(slice, txn);
+    mdb_txn_abort(txn);
+  }
+
+  Tcl_FinalizeThread();
+  TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ * Split dbi into nslices ranges in txn, or in a read transaction of its
+ * own if txn is NULL, and scan them in parallel on the snapshot of that
+ * transaction. If the workers cannot get the snapshot (txn is a write
+ * transaction, or a read transaction older than the last commit), the
+ * ranges are scanned one after the other in txn. The result is a list
+ * with the -final result, or the number of pairs, of each slice in key
+ * order.
+ */
+static int LMDB_ParallelScan(Tcl_Interp *interp, MDB_env *env, MDB_txn *txn,
+                             MDB_dbi dbi, LMDB_Scan *scan, int nslices)
+{
+  LMDB_ScanSlice *slices;
+  MDB_val *keys;
+  MDB_txn *own = NULL;
+  unsigned int nkeys = 0;
+  Tcl_Obj *resultObj;
+  int started = 0;
+  int result = 0;
+  int code = TCL_OK;
+  int i;
+
+  keys = (MDB_val *) ckalloc(nslices * sizeof(MDB_val));
+  slices = (LMDB_ScanSlice *) ckalloc(nslices * sizeof(LMDB_ScanSlice));
+  memset(slices, 0, nslices * sizeof(LMDB_ScanSlice));
+  for(i = 0; i < nslices; i++) {
+    slices[i].scan = scan;
+    slices[i].index = i;
+    Tcl_DStringInit(&slices[i].from);
+    Tcl_DStringInit(&slices[i].to);
+    Tcl_DStringInit(&slices[i].value);
+  }
+
+  if(!txn) {
+    result = mdb_txn_begin(env, NULL, MDB_RDONLY, &own);
+    txn = own;
+  }
+  if(result == 0) {
+    result = LMDB_Partition(txn, dbi, (unsigned int) nslices, keys, &nkeys);
+    for(i = 0; result == 0 && i < (int) nkeys; i++) {
+      Tcl_DStringAppend(&slices[i].to, keys[i].mv_data, (Tcl_Size) keys[i].mv_size);
+      Tcl_DStringAppend(&slices[i+1].from, keys[i].mv_data, (Tcl_Size) keys[i].mv_size);
+    }
+  }
+  if(result != 0) {
+    goto error;
+  }
+
+  /* A small database gives fewer ranges. */
+  nslices = nkeys + 1;
+  LMDB_SnapshotInit(&scan->snap, env, nslices);
+  scan->snap.want = mdb_txn_id(txn);
+  for(i = 0; i < nslices; i++) {
+    if(Tcl_CreateThread(&slices[i].tid, LMDB_ScanThread, &slices[i],
+                        TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+      break;
+    }
+    started++;
+  }
+  result = LMDB_SnapshotAgree(&scan->snap, started,
+                              started < nslices ? EAGAIN : 0);
+  for(i = 0; i < started; i++) {
+    int state;
+    Tcl_JoinThread(slices[i].tid, &state);
+  }
+  LMDB_SnapshotFree(&scan->snap);
+  if(result != 0) {
+    /* No worker scanned anything, do it here. */
+    for(i = 0; i < nslices; i++) {
+      LMDB_ScanRange(&slices[i], txn);
+    }
+  }
+
+  resultObj = Tcl_NewListObj(0, NULL);
+  for(i = 0; i < nslices; i++) {
+    if(slices[i].result != 0) {
+      Tcl_DecrRefCount(resultObj);
+      result = slices[i].result;
+      goto error;
+    }
+    if(slices[i].code == TCL_ERROR) {
+      Tcl_DecrRefCount(resultObj);
+      Tcl_SetObjResult(interp, Tcl_NewStringObj(Tcl_DStringValue(&slices[i].value),
+                                                Tcl_DStringLength(&slices[i].value)));
+      code = TCL_ERROR;
+      goto done;
+    }
+    if(scan->final) {
+      Tcl_ListObjAppendElement(NULL, resultObj,
+                               Tcl_NewStringObj(Tcl_DStringValue(&slices[i].value),
+                                                Tcl_DStringLength(&slices[i].value)));
+    } else {
+      Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewWideIntObj(slices[i].count));
+    }
+  }
+  Tcl_SetObjResult(interp, resultObj);
+  goto done;
+
+error:
+  Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char *)NULL);
+  code = TCL_ERROR;
+
+done:
+  if(own) {
+    mdb_txn_abort(own);
+  }
+  for(i = 0; i < nslices; i++) {
+    Tcl_DStringFree(&slices[i].from);
+    Tcl_DStringFree(&slices[i].to);
+    Tcl_DStringFree(&slices[i].value);
+  }
+  ckfree((char *) slices);
+  ckfree((char *) keys);
+  return code;
+}
+
+
+/*
+ * dbi_handle aggregate: count, sum, min, max and avg of the values of a
+ * key range, decoded in C while the cursor walks the range.
+ */
+static const char *LMDB_AggType_strs[] = {
+  "text",
+  "int64",
+  "double",
+  0
+};
+
+enum LMDB_AggType_enum {
+  LMDB_AGG_TEXT,
+  LMDB_AGG_INT64,
+  LMDB_AGG_DOUBLE,
+};
+
+static const char *LMDB_AggOp_strs[] = {
+  "count",
+  "sum",
+  "min",
+  "max",
+  "avg",
+  0
+};
+
+enum LMDB_AggOp_enum {
+  LMDB_AGG_COUNT,
+  LMDB_AGG_SUM,
+  LMDB_AGG_MIN,
+  LMDB_AGG_MAX,
+  LMDB_AGG_AVG,
+};
+
+/* A value that could not be decoded, the message is in the error string. */
+#define LMDB_AGG_VALUEERR (-1)
+
+typedef struct LMDB_Number {
+  int isDouble;
+  Tcl_WideInt i;
+  double d;
+} LMDB_Number;
+
+typedef struct LMDB_AggState {
+  Tcl_WideInt count;
+  LMDB_Number sum;
+  LMDB_Number min;
+  LMDB_Number max;
+} LMDB_AggState;
+
+typedef struct LMDB_AggQuery {
+  MDB_dbi dbi;
+  int valuetype;
+  int numeric;                    /* an op needs the values */
+  LMDB_Range range;
+  LMDB_Snapshot snap;
+} LMDB_AggQuery;
+
+typedef struct LMDB_AggSlice {
+  LMDB_AggQuery *query;
+  int index;
+  Tcl_ThreadId tid;
+  Tcl_DString from;               /* empty for the first slice */
+  Tcl_DString to;                 /* empty for the last slice */
+  LMDB_AggState state;
+  int result;                     /* of LMDB_AggRange */
+  Tcl_DString error;
+} LMDB_AggSlice;
+
+static double LMDB_NumberDouble(LMDB_Number *n)
+{
+  return n->isDouble ? n->d : (double) n->i;
+}
+
+static int LMDB_NumberCmp(LMDB_Number *a, LMDB_Number *b)
+{
+  if(!a->isDouble && !b->isDouble) {
+    return a->i < b->i ? -1 : a->i > b->i;
+  } else {
+    double x = LMDB_NumberDouble(a), y = LMDB_NumberDouble(b);
+    return x < y ? -1 : x > y;
+  }
+}
+
+/* sum += n. An integer sum that would overflow goes on as a double. */
+static void LMDB_NumberAdd(LMDB_Number *sum, LMDB_Number *n)
+{
+  if(!sum->isDouble && !n->isDouble) {
+    Tcl_WideInt a = sum->i, b = n->i;
+
+    if(!((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b))) {
+      sum->i = a + b;
+      return;
+    }
+  }
+  sum->d = LMDB_NumberDouble(sum) + LMDB_NumberDouble(n);
+  sum->isDouble = 1;
+}
+
+static void LMDB_AggAdd(LMDB_AggState *st, LMDB_Number *n)
+{
+  if(st->count == 0 || LMDB_NumberCmp(n, &st->min) < 0) {
+    st->min = *n;
+  }
+  if(st->count == 0 || LMDB_NumberCmp(n, &st->max) > 0) {
+    st->max = *n;
+  }
+  LMDB_NumberAdd(&st->sum, n);
+}
+
+static void LMDB_AggMerge(LMDB_AggState *st, LMDB_AggState *other)
+{
+  if(other->count == 0) {
+    return;
+  }
+  if(st->count == 0 || LMDB_NumberCmp(&other->min, &st->min) < 0) {
+    st->min = other->min;
+  }
+  if(st->count == 0 || LMDB_NumberCmp(&other->max, &st->max) > 0) {
+    st->max = other->max;
+  }
+  LMDB_NumberAdd(&st->sum, &other->sum);
+  st->count += other->count;
+}
+
+/*
+ * Decode a value. text is a decimal integer or a floating point number
+ * with optional white space around it, int64 and double are 8 bytes in
+ * native byte order (binary format m and d).
+ */
+static int LMDB_AggValue(int valuetype, MDB_val *data, LMDB_Number *n,
+                         Tcl_DString *errorPtr)
+{
+  if(valuetype == LMDB_AGG_INT64 || valuetype == LMDB_AGG_DOUBLE) {
+    if(data->mv_size != 8) {
+      Tcl_DStringAppend(errorPtr, "expected an 8 byte value", -1);
+      return LMDB_AGG_VALUEERR;
+    }
+    if(valuetype == LMDB_AGG_INT64) {
+      int64_t i;
+
+      memcpy(&i, data->mv_data, 8);
+      n->isDouble = 0;
+      n->i = (Tcl_WideInt) i;
+    } else {
+      memcpy(&n->d, data->mv_data, 8);
+      n->isDouble = 1;
+    }
+    return 0;
+  } else {
+    char buf[64];
+    char *str, *end;
+    Tcl_DString copy;
+    int result = 0;
+
+    /* strtoll and strtod need a terminated string. */
+    Tcl_DStringInit(&copy);
+    if(data->mv_size < sizeof(buf)) {
+      str = buf;
+    } else {
+      Tcl_DStringSetLength(&copy, (Tcl_Size) data->mv_size);
+      str = Tcl_DStringValue(&copy);
+    }
+    memcpy(str, data->mv_data, data->mv_size);
+    str[data->mv_size] = '\0';
+
+    errno = 0;
+    n->i = (Tcl_WideInt) strtoll(str, &end, 10);
+    n->isDouble = 0;
+    if(end == str || errno == ERANGE || (*end && !isspace((unsigned char) *end))) {
+      n->d = strtod(str, &end);
+      n->isDouble = 1;
+    }
+    while(end > str && *end && isspace((unsigned char) *end)) {
+      end++;
+    }
+    if(end == str || *end) {
+      Tcl_DStringAppend(errorPtr, "expected number but got \"", -1);
+      Tcl_DStringAppend(errorPtr, str, -1);
+      Tcl_DStringAppend(errorPtr, "\"", -1);
+      result = LMDB_AGG_VALUEERR;
+    }
+    Tcl_DStringFree(&copy);
+    return result;
+  }
+}
+
+/*
+ * Aggregate the part of the query range in [from, to) (size 0 is no
+ * bound) into st. Returns 0, an LMDB error or LMDB_AGG_VALUEERR.
+ */
+static int LMDB_AggRange(MDB_txn *txn, LMDB_AggQuery *q, MDB_val *from,
+                         MDB_val *to, LMDB_AggState *st, Tcl_DString *errorPtr)
+{
+  MDB_cursor *cursor = NULL;
+  MDB_val key, data;
+  LMDB_Range range = q->range;
+  LMDB_Number n;
+  Tcl_DString vbuf;
+  int result;
+
+  if(from->mv_size > 0 && (range.from.mv_size == 0 ||
+                           mdb_cmp(txn, q->dbi, from, &range.from) > 0)) {
+    range.from = *from;
+  }
+  if(to->mv_size > 0 && (range.to.mv_size == 0 ||
+                         mdb_cmp(txn, q->dbi, to, &range.to) < 0)) {
+    range.to = *to;
+  }
+
+  Tcl_DStringInit(&vbuf);
+  result = mdb_cursor_open(txn, q->dbi, &cursor);
+  if(result == 0) {
+    result = LMDB_RangeFirst(txn, q->dbi, &range, cursor, &key, &data);
+  }
+  while(result == 0 && !LMDB_RangeDone(txn, q->dbi, &range, &key)) {
+    if(q->numeric) {
+      result = LMDB_VlogGet(txn, q->dbi, &data, LMDB_DATA_BYTES, &vbuf);
+      if(result == 0) {
+        result = LMDB_AggValue(q->valuetype, &data, &n, errorPtr);
+      }
+      if(result != 0) {
+        break;
+      }
+      LMDB_AggAdd(st, &n);
+    }
+    st->count++;
+    result = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+  }
+  if(result == MDB_NOTFOUND) {
+    result = 0;
+  }
+  if(cursor) {
+    mdb_cursor_close(cursor);
+  }
+  Tcl_DStringFree(&vbuf);
+  return result;
+}
+
+static Tcl_ThreadCreateType LMDB_AggThread(ClientData clientData)
+{
+  LMDB_AggSlice *slice = (LMDB_AggSlice *) clientData;
+  MDB_txn *txn;
+  MDB_val from, to;
+
+  txn = LMDB_SnapshotBegin(&slice->query->snap, slice->index);
+  if(txn) {
+    from.mv_size = Tcl_DStringLength(&slice->from);
+    from.mv_data = Tcl_DStringValue(&slice->from);
+    to.mv_size = Tcl_DStringLength(&slice->to);
+    to.mv_data = Tcl_DStringValue(&slice->to);
+    slice->result = LMDB_AggRange(txn, slice->query, &from, &to,
+                                  &slice->state, &slice->error);
+    mdb_txn_abort(txn);
+  }
+
+  Tcl_FinalizeThread();
+  TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ * Aggregate in nslices worker threads that must read the snapshot of
+ * txn. Returns 1 if they did, with the result in st, or 0 if the work
+ * has to be done in txn itself: the snapshot is gone (txn is a write
+ * transaction, or a read transaction older than the last commit), or
+ * threads could not be started.
+ */
+static int LMDB_AggParallel(MDB_txn *txn, LMDB_AggQuery *q, int nslices,
+                            LMDB_AggState *st, int *resultPtr,
+                            Tcl_DString *errorPtr)
+{
+  LMDB_AggSlice *slices;
+  MDB_val *keys;
+  unsigned int nkeys = 0;
+  int started = 0;
+  int done = 0;
+  int result;
+  int i;
+
+  keys = (MDB_val *) ckalloc(nslices * sizeof(MDB_val));
+  slices = (LMDB_AggSlice *) ckalloc(nslices * sizeof(LMDB_AggSlice));
+  memset(slices, 0, nslices * sizeof(LMDB_AggSlice));
+  for(i = 0; i < nslices; i++) {
+    slices[i].query = q;
+    slices[i].index = i;
+    Tcl_DStringInit(&slices[i].from);
+    Tcl_DStringInit(&slices[i].to);
+    Tcl_DStringInit(&slices[i].error);
+  }
+
+  result = LMDB_Partition(txn, q->dbi, (unsigned int) nslices, keys, &nkeys);
+  if(result != 0 || nkeys == 0) {
+    goto cleanup;
+  }
+  for(i = 0; i < (int) nkeys; i++) {
+    Tcl_DStringAppend(&slices[i].to, keys[i].mv_data, (Tcl_Size) keys[i].mv_size);
+    Tcl_DStringAppend(&slices[i+1].from, keys[i].mv_data, (Tcl_Size) keys[i].mv_size);
+  }
+
+  LMDB_SnapshotInit(&q->snap, mdb_txn_env(txn), nkeys + 1);
+  q->snap.want = mdb_txn_id(txn);
+  for(i = 0; i < (int) nkeys + 1; i++) {
+    if(Tcl_CreateThread(&slices[i].tid, LMDB_AggThread, &slices[i],
+                        TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+      break;
+    }
+    started++;
+  }
+  result = LMDB_SnapshotAgree(&q->snap, started,
+                              started < (int) nkeys + 1 ? EAGAIN : 0);
+  for(i = 0; i < started; i++) {
+    int state;
+    Tcl_JoinThread(slices[i].tid, &state);
+  }
+  LMDB_SnapshotFree(&q->snap);
+  if(result != 0) {
+    goto cleanup;
+  }
+
+  done = 1;
+  *resultPtr = 0;
+  for(i = 0; i < (int) nkeys + 1; i++) {
+    if(slices[i].result != 0) {
+      *resultPtr = slices[i].result;
+      Tcl_DStringAppend(errorPtr, Tcl_DStringValue(&slices[i].error),
+                        Tcl_DStringLength(&slices[i].error));
+      break;
+    }
+    LMDB_AggMerge(st, &slices[i].state);
+  }
+
+cleanup:
+  for(i = 0; i < nslices; i++) {
+    Tcl_DStringFree(&slices[i].from);
+    Tcl_DStringFree(&slices[i].to);
+    Tcl_DStringFree(&slices[i].error);
+  }
+  ckfree((char *) slices);
+  ckfree((char *) keys);
+  return done;
+}
+
+
+/*
+ * Chunked blobs (dbi_handle blobOpen, blobGet and blobDelete). A large
+ * object is stored as chunks under the key followed by a NUL byte and
+ * the 4-byte big-endian chunk number, and a manifest under the key
+ * itself: "LMCB", the 4-byte chunk size and the 8-byte size, big-endian.
+ * A chunk fills one overflow page by default, so a large object never
+ * needs a run of contiguous free pages, which a large value does.
+ */
+#define LMDB_CHUNK_MAGIC "LMCB"
+#define LMDB_CHUNK_MANIFEST 16
+
+/* PAGEHDRSZ of 64-bit builds, a few bytes more than needed on 32-bit. */
+#define LMDB_CHUNK_PAGEHDR 16
+
+typedef struct LMDB_Chunked {
+  MDB_txn *txn;
+  MDB_dbi dbi;
+  char *key;                      /* key, NUL and the chunk number */
+  size_t keylen;
+  unsigned int chunksize;
+  Tcl_WideInt size;
+} LMDB_Chunked;
+
+static void LMDB_ChunkedInit(LMDB_Chunked *cb, MDB_txn *txn, MDB_dbi dbi,
+                             const char *key, size_t keylen)
+{
+  memset(cb, 0, sizeof(LMDB_Chunked));
+  cb->txn = txn;
+  cb->dbi = dbi;
+  cb->keylen = keylen;
+  cb->key = ckalloc(keylen + 5);
+  memcpy(cb->key, key, keylen);
+  cb->key[keylen] = '\0';
+}
+
+static void LMDB_ChunkedFree(LMDB_Chunked *cb)
+{
+  ckfree(cb->key);
+}
+
+static void LMDB_ChunkKey(LMDB_Chunked *cb, unsigned int n, MDB_val *key)
+{
+  unsigned char *p = (unsigned char *) cb->key + cb->keylen;
+
+  p[1] = (unsigned char) (n >> 24);
+  p[2] = (unsigned char) (n >> 16);
+  p[3] = (unsigned char) (n >> 8);
+  p[4] = (unsigned char) n;
+  key->mv_data = cb->key;
+  key->mv_size = cb->keylen + 5;
+}
+
+/*
+ * Read the manifest into cb. Returns MDB_NOTFOUND if there is no key,
+ * MDB_INCOMPATIBLE if its data is not a manifest.
+ */
+static int LMDB_ChunkManifest(LMDB_Chunked *cb)
+{
+  MDB_val key, data;
+  Tcl_DString vbuf;
+  unsigned char p[LMDB_CHUNK_MANIFEST];
+  int result;
+  int i;
+
+  key.mv_data = cb->key;
+  key.mv_size = cb->keylen;
+  Tcl_DStringInit(&vbuf);
+  result = mdb_get(cb->txn, cb->dbi, &key, &data);
+  if(result == 0) {
+    result = LMDB_VlogGet(cb->txn, cb->dbi, &data, LMDB_DATA_BYTES, &vbuf);
+  }
+  if(result == 0 && (data.mv_size != LMDB_CHUNK_MANIFEST ||
+                     memcmp(data.mv_data, LMDB_CHUNK_MAGIC, 4) != 0)) {
+    result = MDB_INCOMPATIBLE;
+  }
+  if(result == 0) {
+    memcpy(p, data.mv_data, LMDB_CHUNK_MANIFEST);
+  }
+  Tcl_DStringFree(&vbuf);
+  if(result != 0) {
+    return result;
+  }
+  cb->chunksize = ((unsigned int) p[4] << 24) | ((unsigned int) p[5] << 16) |
+                  ((unsigned int) p[6] << 8) | p[7];
+  cb->size = 0;
+  for(i = 8; i < 16; i++) {
+    cb->size = (cb->size << 8) | p[i];
+  }
+  if(cb->chunksize == 0) {
+    return MDB_INCOMPATIBLE;
+  }
+  return 0;
+}
+
+static int LMDB_ChunkPutManifest(LMDB_Chunked *cb)
+{
+  MDB_val key, data;
+  unsigned char p[LMDB_CHUNK_MANIFEST];
+  int i;
+
+  memcpy(p, LMDB_CHUNK_MAGIC, 4);
+  p[4] = (unsigned char) (cb->chunksize >> 24);
+  p[5] = (unsigned char) (cb->chunksize >> 16);
+  p[6] = (unsigned char) (cb->chunksize >> 8);
+  p[7] = (unsigned char) cb->chunksize;
+  for(i = 0; i < 8; i++) {
+    p[15-i] = (unsigned char) (cb->size >> (8*i));
+  }
+  key.mv_data = cb->key;
+  key.mv_size = cb->keylen;
+  data.mv_data = p;
+  data.mv_size = LMDB_CHUNK_MANIFEST;
+  return LMDB_VlogPut(cb->txn, cb->dbi, NULL, &key, &data, 0);
+}
+
+static unsigned int LMDB_ChunkCount(LMDB_Chunked *cb)
+{
+  return (unsigned int) ((cb->size + cb->chunksize - 1) / cb->chunksize);
+}
+
+/*
+ * Delete the manifest and the chunks it counts, and the chunk after the
+ * last in case an append was cut short. Only chunk keys are deleted, not
+ * other keys that happen to start with the key and a NUL. Without a
+ * manifest (cb->chunksize 0) only the key itself is deleted.
+ */
+static int LMDB_ChunkDelete(LMDB_Chunked *cb)
+{
+  MDB_val key;
+  unsigned int count = 0;
+  unsigned int n;
+  int result;
+
+  if(cb->chunksize > 0) {
+    count = LMDB_ChunkCount(cb) + 1;
+  }
+  key.mv_data = cb->key;
+  key.mv_size = cb->keylen;
+  result = mdb_del(cb->txn, cb->dbi, &key, NULL);
+  for(n = 0; (result == 0 || result == MDB_NOTFOUND) && n < count; n++) {
+    LMDB_ChunkKey(cb, n, &key);
+    result = mdb_del(cb->txn, cb->dbi, &key, NULL);
+  }
+  return result == MDB_NOTFOUND ? 0 : result;
+}
+
+/* Copy len bytes from pos on out of the chunks. */
+static int LMDB_ChunkRead(LMDB_Chunked *cb, Tcl_WideInt pos, char *buf,
+                          size_t len)
+{
+  MDB_val key, data;
+  Tcl_DString vbuf;
+  int result = 0;
+
+  Tcl_DStringInit(&vbuf);
+  while(len > 0) {
+    unsigned int n = (unsigned int) (pos / cb->chunksize);
+    Tcl_WideUInt off = (Tcl_WideUInt) (pos % cb->chunksize);
+    size_t count = cb->chunksize - (size_t) off;
+
+    if(count > len) {
+      count = len;
+    }
+    LMDB_ChunkKey(cb, n, &key);
+    result = mdb_get(cb->txn, cb->dbi, &key, &data);
+    if(result == 0) {
+      /* A chunk in the value log is read only as far as needed. */
+      result = LMDB_VlogGetRange(cb->txn, cb->dbi, &data, &off, count,
+                                 &vbuf);
+    }
+    if(result == 0 && data.mv_size < off + count) {
+      result = MDB_INCOMPATIBLE;
+    }
+    if(result != 0) {
+      break;
+    }
+    memcpy(buf, (char *) data.mv_data + off, count);
+    buf += count;
+    pos += count;
+    len -= count;
+  }
+  Tcl_DStringFree(&vbuf);
+  return result;
+}
+
+/*
+ * A channel on a chunked blob (dbi_handle blobOpen). Reads fetch the
+ * chunks they need; writes go to the end only, through a buffer of one
+ * chunk that is put when it is full. Closing puts the last chunk and the
+ * manifest.
+ */
+typedef struct LMDB_ChunkChan {
+  LMDB_ChanBase base;             /* must be first */
+  LMDB_Chunked cb;
+  int writing;
+  Tcl_WideInt pos;                /* read position */
+  char *buf;                      /* the last chunk when writing */
+  unsigned int fill;
+} LMDB_ChunkChan;
+
+static int LMDB_ChunkFlush(LMDB_ChunkChan *cc)
+{
+  MDB_val key, data;
+
+  LMDB_ChunkKey(&cc->cb, (unsigned int) ((cc->cb.size - cc->fill) /
+                                         cc->cb.chunksize), &key);
+  data.mv_data = cc->buf;
+  data.mv_size = cc->fill;
+  return LMDB_VlogPut(cc->cb.txn, cc->cb.dbi, NULL, &key, &data, 0);
+}
+
+static int LMDB_ChunkChanClose(ClientData instanceData, Tcl_Interp *interp,
+                               int flags)
+{
+  LMDB_ChunkChan *cc = (LMDB_ChunkChan *) instanceData;
+  int result = 0;
+
+  if((flags & (TCL_CLOSE_READ|TCL_CLOSE_WRITE)) != 0) {
+    return EINVAL;
+  }
+  if(cc->writing) {
+    LMDB_TxnInfo *info = LMDB_ChanInfo(&cc->base);
+
+    if(info) {
+      info->writers--;
+    }
+    if(!LMDB_ChanAlive(&cc->base)) {
+      result = EINVAL;
+      if(interp) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+            "transaction %s of the blob has ended", cc->base.txnHandle));
+      }
+    } else {
+      if(cc->fill > 0) {
+        result = LMDB_ChunkFlush(cc);
+      }
+      if(result == 0) {
+        result = LMDB_ChunkPutManifest(&cc->cb);
+      }
+      if(result != 0 && interp) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("ERROR: %s",
+                                               mdb_strerror(result)));
+      }
+    }
+    ckfree(cc->buf);
+  }
+  LMDB_ChunkedFree(&cc->cb);
+  LMDB_ChanBaseFree(&cc->base);
+  ckfree(cc);
+  return (result == 0) ? 0 : EINVAL;
+}
+
+static int LMDB_ChunkChanInput(ClientData instanceData, char *buf,
+                               int toRead, int *errorCodePtr)
+{
+  LMDB_ChunkChan *cc = (LMDB_ChunkChan *) instanceData;
+  int result;
+
+  if(!LMDB_ChanAlive(&cc->base)) {
+    *errorCodePtr = EINVAL;
+    return -1;
+  }
+  if(cc->pos >= cc->cb.size) {
+    return 0;
+  }
+  if((Tcl_WideInt) toRead > cc->cb.size - cc->pos) {
+    toRead = (int) (cc->cb.size - cc->pos);
+  }
+  result = LMDB_ChunkRead(&cc->cb, cc->pos, buf, (size_t) toRead);
+  if(result != 0) {
+    LMDB_ChanError(&cc->base, result);
+    *errorCodePtr = EINVAL;
+    return -1;
+  }
+  cc->pos += toRead;
+  return toRead;
+}
+
+static int LMDB_ChunkChanOutput(ClientData instanceData, const char *buf,
+                                int toWrite, int *errorCodePtr)
+{
+  LMDB_ChunkChan *cc = (LMDB_ChunkChan *) instanceData;
+  int written = 0;
+
+  if(!LMDB_ChanAlive(&cc->base)) {
+    *errorCodePtr = EINVAL;
+    return -1;
+  }
+  while(written < toWrite) {
+    unsigned int count = cc->cb.chunksize - cc->fill;
+
+    if(count > (unsigned int) (toWrite - written)) {
+      count = (unsigned int) (toWrite - written);
+    }
+    memcpy(cc->buf + cc->fill, buf + written, count);
+    cc->fill += count;
+    cc->cb.size += count;
+    written += (int) count;
+    if(cc->fill == cc->cb.chunksize) {
+      int result = LMDB_ChunkFlush(cc);
+
+      if(result != 0) {
+        LMDB_ChanError(&cc->base, result);
+        *errorCodePtr = EINVAL;
+        return -1;
+      }
+      cc->fill = 0;
+    }
+  }
+  return written;
+}
+
+static Tcl_WideInt LMDB_ChunkChanWideSeek(ClientData instanceData,
+                                          Tcl_WideInt offset, int seekMode,
+                                          int *errorCodePtr)
+{
+  LMDB_ChunkChan *cc = (LMDB_ChunkChan *) instanceData;
+  Tcl_WideInt pos;
+
+  if(cc->writing) {
+    /* Only tell, writes always go to the end. */
+    if(offset != 0 || seekMode == SEEK_SET) {
+      *errorCodePtr = EINVAL;
+      return -1;
+    }
+    return cc->cb.size;
+  }
+  pos = LMDB_SeekPos(cc->pos, cc->cb.size, offset, seekMode);
+  if(pos < 0) {
+    *errorCodePtr = EINVAL;
+    return -1;
+  }
+  cc->pos = pos;
+  return pos;
+}
+
+#if TCL_MAJOR_VERSION < 9
+static int LMDB_ChunkChanSeek(ClientData instanceData, long offset,
+                              int seekMode, int *errorCodePtr)
+{
+  return (int) LMDB_ChunkChanWideSeek(instanceData, offset, seekMode,
+                                      errorCodePtr);
+}
+#endif
+
+static Tcl_ChannelType LMDB_ChunkChannelType = {
+  "lmdbchunked",
+  TCL_CHANNEL_VERSION_5,
+  TCL_CLOSE2PROC,
+  LMDB_ChunkChanInput,
+  LMDB_ChunkChanOutput,
+#if TCL_MAJOR_VERSION < 9
+  LMDB_ChunkChanSeek,
+#else
+  NULL,
+#endif
+  NULL,                           /* setOptionProc */
+  NULL,                           /* getOptionProc */
+  LMDB_ChanWatch,
+  LMDB_ChanGetHandle,
+  LMDB_ChunkChanClose,
+  LMDB_ChanBlockMode,
+  NULL,                           /* flushProc */
+  NULL,                           /* handlerProc */
+  LMDB_ChunkChanWideSeek,
+  NULL,                           /* threadActionProc */
+  NULL                            /* truncateProc */
+};
+
+/*
+ * dbi_handle blobGet -threads n: every worker copies a run of chunks
+ * into the result, in a read transaction on the snapshot of the caller.
+ */
+typedef struct LMDB_ChunkFetch {
+  LMDB_Chunked *cb;
+  unsigned char *buf;
+  LMDB_Snapshot snap;
+} LMDB_ChunkFetch;
+
+typedef struct LMDB_ChunkSlice {
+  LMDB_ChunkFetch *fetch;
+  int index;
+  Tcl_ThreadId tid;
+  Tcl_WideInt pos;
+  size_t len;
+  int result;
+} LMDB_ChunkSlice;
+
+static Tcl_ThreadCreateType LMDB_ChunkThread(ClientData clientData)
+{
+  LMDB_ChunkSlice *slice = (LMDB_ChunkSlice *) clientData;
+  LMDB_Chunked *cb = slice->fetch->cb;
+  LMDB_Chunked mine;
+  MDB_txn *txn;
+
+  txn = LMDB_SnapshotBegin(&slice->fetch->snap, slice->index);
+  if(txn) {
+    LMDB_ChunkedInit(&mine, txn, cb->dbi, cb->key,
+                     cb->keylen);
+    mine.chunksize = cb->chunksize;
+    mine.size = cb->size;
+    slice->result = LMDB_ChunkRead(&mine, slice->pos,
+                                   (char *) slice->fetch->buf + slice->pos,
+                                   slice->len);
+    LMDB_ChunkedFree(&mine);
+    mdb_txn_abort(txn);
+  }
+
+  Tcl_FinalizeThread();
+  TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ * Read the whole blob into buf with nslices threads. Returns 1 if they
+ * did, with their result in *resultPtr, or 0 if the work has to be done
+ * in the transaction of cb itself (see LMDB_AggParallel).
+ */
+static int LMDB_ChunkParallel(LMDB_Chunked *cb, unsigned char *buf,
+                              int nslices, int *resultPtr)
+{
+  LMDB_ChunkFetch fetch;
+  LMDB_ChunkSlice *slices;
+  unsigned int nchunks = LMDB_ChunkCount(cb);
+  unsigned int first = 0;
+  int started = 0;
+  int done = 0;
+  int result;
+  int i;
+
+  if((unsigned int) nslices > nchunks) {
+    nslices = (int) nchunks;
+  }
+  if(nslices < 2) {
+    return 0;
+  }
+
+  fetch.cb = cb;
+  fetch.buf = buf;
+  slices = (LMDB_ChunkSlice *) ckalloc(nslices * sizeof(LMDB_ChunkSlice));
+  memset(slices, 0, nslices * sizeof(LMDB_ChunkSlice));
+  for(i = 0; i < nslices; i++) {
+    unsigned int count = nchunks / nslices + ((unsigned int) i < nchunks % nslices);
+    Tcl_WideInt end;
+
+    slices[i].fetch = &fetch;
+    slices[i].index = i;
+    slices[i].pos = (Tcl_WideInt) first * cb->chunksize;
+    first += count;
+    end = (Tcl_WideInt) first * cb->chunksize;
+    if(end > cb->size) {
+      end = cb->size;
+    }
+    slices[i].len = (size_t) (end - slices[i].pos);
+  }
+
+  LMDB_SnapshotInit(&fetch.snap, mdb_txn_env(cb->txn), nslices);
+  fetch.snap.want = mdb_txn_id(cb->txn);
+  for(i = 0; i < nslices; i++) {
+    if(Tcl_CreateThread(&slices[i].tid, LMDB_ChunkThread, &slices[i],
+                        TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+      break;
+    }
+    started++;
+  }
+  result = LMDB_SnapshotAgree(&fetch.snap, started,
+                              started < nslices ? EAGAIN : 0);
+  for(i = 0; i < started; i++) {
+    int state;
+    Tcl_JoinThread(slices[i].tid, &state);
+  }
+  LMDB_SnapshotFree(&fetch.snap);
+
+  if(result == 0) {
+    done = 1;
+    *resultPtr = 0;
+    for(i = 0; i < nslices; i++) {
+      if(slices[i].result != 0) {
+        *resultPtr = slices[i].result;
+        break;
+      }
+    }
+  }
+  ckfree((char *) slices);
+  return done;
+}
+
+static int LMDB_DBI(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  int choice;
+  int result;
+  MDB_dbi dbi;
+  Tcl_HashEntry *hashEntryPtr;
+  char *dbiHandle;
+
+  ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+      Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+
+  if (tsdPtr->initialized == 0) {
+    tsdPtr->initialized = 1;
+    tsdPtr->lmdb_hashtblPtr = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+    Tcl_InitHashTable(tsdPtr->lmdb_hashtblPtr, TCL_STRING_KEYS);
+  }
+
+  static const char *DBI_strs[] = {
+    "put",
+    "putBinary",
+    "get",
+    "getBinary",
+    "del",
+    "delBinary",
+    "drop",
+    "close",
+    "stat",
+    "cursor",
+    "export",
+    "import",
+    "partitions",
+    "parallelScan",
+    "aggregate",
+    "scan",
+    "delrange",
+    "delprefix",
+    "incr",
+    "append",
+    "cas",
+    "getRange",
+    "openBlob",
+    "blobOpen",
+    "blobGet",
+    "blobDelete",
+    0
+  };
+
+  enum DBI_enum {
+    DBI_PUT,
+    DBI_PUT_BINARY,
+    DBI_GET,
+    DBI_GET_BINARY,
+    DBI_DEL,
+    DBI_DEL_BINARY,
+    DBI_DROP,
+    DBI_CLOSE,
+    DBI_STAT,
+    DBI_CURSOR,
+    DBI_EXPORT,
+    DBI_IMPORT,
+    DBI_PARTITIONS,
+    DBI_PARALLELSCAN,
+    DBI_AGGREGATE,
+    DBI_SCAN,
+    DBI_DELRANGE,
+    DBI_DELPREFIX,
+    DBI_INCR,
+    DBI_APPEND,
+    DBI_CAS,
+    DBI_GETRANGE,
+    DBI_OPENBLOB,
+    DBI_BLOBOPEN,
+    DBI_BLOBGET,
+    DBI_BLOBDELETE,
+  };
+
+  if( objc < 2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "SUBCOMMAND ...");
+    return TCL_ERROR;
+  }
+
+  if( Tcl_GetIndexFromObj(interp, objv[1], DBI_strs, "option", 0, &choice) ){
+    return TCL_ERROR;
+  }
+
+  /*
+   * Get the MDB_dbi value
+   */
+  dbiHandle = Tcl_GetStringFromObj(objv[0], 0);
+  hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, dbiHandle );
+  if( !hashEntryPtr ) {
+    if( interp ) {
+        Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+
+        Tcl_AppendStringsToObj( resultObj, "invalid dbi handle ", dbiHandle, (char *)NULL );
+    }
+
+    return TCL_ERROR;
+  }
+
+  dbi = (MDB_dbi)(uintptr_t)Tcl_GetHashValue( hashEntryPtr );
+
+  switch( (enum DBI_enum)choice ){
+
+    case DBI_PUT: {
+      char *key;
+      char *data;
+      Tcl_Size key_len;
+      Tcl_Size data_len;
+      MDB_val mkey;
+      MDB_val mdata;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      int flags = 0;
+      int i = 0;
+
+      if( objc < 4 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "key data -txn txnid ?-nodupdata boolean? ?-nooverwrite boolean? ?-append boolean? ?-appenddup boolean? ");
+        return TCL_ERROR;
+      }
+
+      key = Tcl_GetStringFromObj(objv[2], &key_len);
+      if( !key || key_len < 1 ){
+        return TCL_ERROR;
+      }
+
+      data = Tcl_GetStringFromObj(objv[3], &data_len);
+      if( !data || data_len < 1 ){
+        return TCL_ERROR;
+      }
+
+      for(i=4; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-nodupdata")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NODUPDATA;
+            }else{
+              flags &= ~MDB_NODUPDATA;
+            }
+        } else if( strcmp(zArg, "-nooverwrite")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NOOVERWRITE;
+            }else{
+              flags &= ~MDB_NOOVERWRITE;
+            }
+        } else if( strcmp(zArg, "-append")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_APPEND;
+            }else{
+              flags &= ~MDB_APPEND;
+            }
+        } else if( strcmp(zArg, "-appenddup")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_APPENDDUP;
+            }else{
+              flags &= ~MDB_APPENDDUP;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      mkey.mv_size = key_len;
+      mkey.mv_data = key;
+      mdata.mv_size = data_len;
+      mdata.mv_data = data;
+
+      result = LMDB_VlogPut(txn, dbi, NULL, &mkey, &mdata, flags);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    /*
+     * Add command to handle byte array.
+     * Use at your own risk.
+     */
+    case DBI_PUT_BINARY: {
+      unsigned char *key;
+      unsigned char *data;
+      Tcl_Size key_len;
+      Tcl_Size data_len;
+      MDB_val mkey;
+      MDB_val mdata;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      int flags = 0;
+      int i = 0;
+
+      if( objc < 4 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "key data -txn txnid ?-nodupdata boolean? ?-nooverwrite boolean? ?-append boolean? ?-appenddup boolean? ");
+        return TCL_ERROR;
+      }
+
+      key = Tcl_GetByteArrayFromObj(objv[2], &key_len);
+      if( !key || key_len < 1 ){
+        return TCL_ERROR;
+      }
+
+      data = Tcl_GetByteArrayFromObj(objv[3], &data_len);
+      if( !data || data_len < 1 ){
+        return TCL_ERROR;
+      }
+
+      for(i=4; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-nodupdata")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NODUPDATA;
+            }else{
+              flags &= ~MDB_NODUPDATA;
+            }
+        } else if( strcmp(zArg, "-nooverwrite")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NOOVERWRITE;
+            }else{
+              flags &= ~MDB_NOOVERWRITE;
+            }
+        } else if( strcmp(zArg, "-append")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_APPEND;
+            }else{
+              flags &= ~MDB_APPEND;
+            }
+        } else if( strcmp(zArg, "-appenddup")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_APPENDDUP;
+            }else{
+              flags &= ~MDB_APPENDDUP;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      mkey.mv_size = key_len;
+      mkey.mv_data = key;
+      mdata.mv_size = data_len;
+      mdata.mv_data = data;
+
+      result = LMDB_VlogPut(txn, dbi, NULL, &mkey, &mdata, flags);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case DBI_GET: {
+      char *key;
+      Tcl_Size len;
+      MDB_val mkey;
+      MDB_val mdata;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      int i = 0;
+      Tcl_Obj *pResultStr;
+      Tcl_DString vbuf;
+
+      if( objc != 5 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "key -txn txnid ");
+        return TCL_ERROR;
+      }
+
+      key = Tcl_GetStringFromObj(objv[2], &len);
+      if( !key || len < 1 ){
+        return TCL_ERROR;
+      }
+
+      for(i=3; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      mkey.mv_size = len;
+      mkey.mv_data = key;
+
+      Tcl_DStringInit(&vbuf);
+      result = mdb_get (txn, dbi, &mkey, &mdata);
+      if(result == 0) {
+        result = LMDB_VlogGet(txn, dbi, &mdata, LMDB_DATA_BYTES, &vbuf);
+      }
+      if(result != 0) {
+        Tcl_DStringFree(&vbuf);
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      pResultStr = Tcl_NewStringObj( mdata.mv_data, mdata.mv_size );
+      Tcl_DStringFree(&vbuf);
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    /*
+     * Add command to handle byte array.
+     * Use at your own risk.
+     */
+    case DBI_GET_BINARY: {
+      unsigned char *key;
+      Tcl_Size len;
+      MDB_val mkey;
+      MDB_val mdata;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      int i = 0;
+      Tcl_Obj *pResultStr;
+      Tcl_DString vbuf;
+
+      if( objc != 5 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "key -txn txnid ");
+        return TCL_ERROR;
+      }
+
+      key = Tcl_GetByteArrayFromObj(objv[2], &len);
+      if( !key || len < 1 ){
+        return TCL_ERROR;
+      }
+
+      for(i=3; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      mkey.mv_size = len;
+      mkey.mv_data = key;
+
+      Tcl_DStringInit(&vbuf);
+      result = mdb_get (txn, dbi, &mkey, &mdata);
+      if(result == 0) {
+        result = LMDB_VlogGet(txn, dbi, &mdata, LMDB_DATA_BYTES, &vbuf);
+      }
+      if(result != 0) {
+        Tcl_DStringFree(&vbuf);
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      pResultStr = Tcl_NewByteArrayObj( mdata.mv_data, mdata.mv_size );
+      Tcl_DStringFree(&vbuf);
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case DBI_DEL: {
+      char *key;
+      char *data;
+      Tcl_Size key_len;
+      Tcl_Size data_len;
+      MDB_val mkey;
+      MDB_val mdata;
+      int isEmptyData = 0;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      int i = 0;
+
+      if( objc < 6 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "key data -txn txnid");
+        return TCL_ERROR;
+      }
+
+      key = Tcl_GetStringFromObj(objv[2], &key_len);
+      if( !key || key_len < 1 ){
+        return TCL_ERROR;
+      }
+
+      /*
+       * Improve this command behavior.
+       * If user indicates data is an empty string "", don't return error.
+       */
+      data = Tcl_GetStringFromObj(objv[3], &data_len);
+      if( !data || data_len < 1 ){
+        //return TCL_ERROR;
+        isEmptyData = 1;
+      }
+
+      for(i=4; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      mkey.mv_size = key_len;
+      mkey.mv_data = key;
+
+      /*
+       * Improve this command behavior.
+       * Data is not a empty data, get it.
+       */
+      if(isEmptyData == 0) {
+        mdata.mv_size = data_len;
+        mdata.mv_data = data;
+      }
+
+      /*
+       * Improve this command behavior.
+       * If the database supports sorted duplicates and the data parameter is NULL,
+       * all of the duplicate data items for the key will be deleted.
+       * Otherwise, if the data parameter is non-NULL only the matching data item
+       * will be deleted.
+       */
+      if(isEmptyData == 0) {
+        result = mdb_del (txn, dbi, &mkey, &mdata);
+      } else {
+        result = mdb_del (txn, dbi, &mkey, NULL);
+      }
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    /*
+     * Add command to handle byte array.
+     * Use at your own risk.
+     */
+    case DBI_DEL_BINARY: {
+      unsigned char *key;
+      unsigned char *data;
+      Tcl_Size key_len;
+      Tcl_Size data_len;
+      MDB_val mkey;
+      MDB_val mdata;
+      int isEmptyData = 0;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      int i = 0;
+
+      if( objc < 6 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "key data -txn txnid");
+        return TCL_ERROR;
+      }
+
+      key = Tcl_GetByteArrayFromObj(objv[2], &key_len);
+      if( !key || key_len < 1 ){
+        return TCL_ERROR;
+      }
+
+      /*
+       * Improve this command behavior.
+       * If user indicates data is an empty string "", don't return error.
+       */
+      data = Tcl_GetByteArrayFromObj(objv[3], &data_len);
+      if( !data || data_len < 1 ){
+        //return TCL_ERROR;
+        isEmptyData = 1;
+      }
+
+      for(i=4; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      mkey.mv_size = key_len;
+      mkey.mv_data = key;
+
+      /*
+       * Improve this command behavior.
+       * Data is not a empty data, get it.
+       */
+      if(isEmptyData == 0) {
+        mdata.mv_size = data_len;
+        mdata.mv_data = data;
+      }
+
+      /*
+       * Improve this command behavior.
+       * If the database supports sorted duplicates and the data parameter is NULL,
+       * all of the duplicate data items for the key will be deleted.
+       * Otherwise, if the data parameter is non-NULL only the matching data item
+       * will be deleted.
+       */
+      if(isEmptyData == 0) {
+        result = mdb_del (txn, dbi, &mkey, &mdata);
+      } else {
+        result = mdb_del (txn, dbi, &mkey, NULL);
+      }
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case DBI_DROP: {
+      int del_flag;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      int i = 0;
+
+      if( objc < 5  || (objc&1)!=1 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "del_flag -txn txnid");
+        return TCL_ERROR;
+      }
+
+      if(Tcl_GetIntFromObj(interp, objv[2], &del_flag) != TCL_OK) {
+            return TCL_ERROR;
+        }
+
+      for(i=3; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+      result = mdb_drop (txn, dbi, del_flag);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      /*
+       * Improve dbi_handle drop command behavior when del_flag equals 1.
+       * If del_flag equals 1, delete dbi_handle command.
+       *
+       * mdb_drop close the DB handle if del_flag equals 1, I think need do this.
+       */
+      if(del_flag) {
+          Tcl_MutexLock(&myMutex);
+          if( hashEntryPtr )  Tcl_DeleteHashEntry(hashEntryPtr);
+          Tcl_MutexUnlock(&myMutex);
+          Tcl_DeleteCommand(interp, dbiHandle);
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case DBI_CLOSE: {
+      const char *zArg;
+      MDB_env *env;
+      Tcl_HashEntry *envHashEntryPtr;
+      char *envHandle;
+      int i = 0;
+
+      if( objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-env env_handle");
+        return TCL_ERROR;
+      }
+
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-env")==0 ){
+            envHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      envHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, envHandle );
+      if( !envHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", envHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      env = Tcl_GetHashValue( envHashEntryPtr );
+      mdb_dbi_close(env, dbi);
+      Tcl_MutexLock(&myMutex);
+      if( hashEntryPtr )  Tcl_DeleteHashEntry(hashEntryPtr);
+      Tcl_MutexUnlock(&myMutex);
+      Tcl_DeleteCommand(interp, dbiHandle);
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case DBI_STAT: {
+      const char *zArg;
+      MDB_txn *txn;
+      MDB_stat stat;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      int i = 0;
+      Tcl_Obj *pResultStr = NULL;
+
+      if( objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid ");
+        return TCL_ERROR;
+      }
+
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+      result = mdb_stat(txn, dbi, &stat);
+      if(result != 0) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+
+          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      pResultStr = Tcl_NewListObj(6, NULL);
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_psize));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_depth));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_branch_pages));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_leaf_pages));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_overflow_pages));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_entries));
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case DBI_CURSOR: {
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      Tcl_HashEntry *newHashEntryPtr;
+      char handleName[16 + TCL_INTEGER_SPACE];
+      Tcl_Obj *pResultStr = NULL;
+      int newvalue;
+      int i = 0;
+
+      MDB_cursor *cursor;
+
+      if( objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid");
+        return TCL_ERROR;
+      }
+
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+      result = mdb_cursor_open(txn, dbi, &cursor);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_MutexLock(&myMutex);
+      sprintf( handleName, "%s.c%d", dbiHandle, tsdPtr->cur_count++ );
+
+      pResultStr = Tcl_NewStringObj( handleName, -1 );
+
+      newHashEntryPtr = Tcl_CreateHashEntry(tsdPtr->lmdb_hashtblPtr, handleName, &newvalue);
+      Tcl_SetHashValue(newHashEntryPtr, cursor);
+      Tcl_MutexUnlock(&myMutex);
+
+      Tcl_CreateObjCommand(interp, handleName, (Tcl_ObjCmdProc *) LMDB_CUR,
+            (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case DBI_EXPORT: {
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      char *chanName = NULL;
+      Tcl_Channel chan;
+      int mode;
+      int format = LMDB_FORMAT_BINARY;
+      MDB_val mfrom;
+      MDB_val mto;
+      MDB_val *from = NULL;
+      MDB_val *to = NULL;
+      LMDB_Filter filter;
+      Tcl_Size len;
+      Tcl_WideInt count = 0;
+      int i = 0;
+
+      if( objc < 6 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid -channel channelId ?-format binary|tsv|mdbdump? ?-from key? ?-to key? ?-keymatch pattern? ?-keyregexp re? ?-valuematch pattern? ");
+        return TCL_ERROR;
+      }
+
+      /* Nothing is allocated in the filter before the first match. */
+      LMDB_FilterInit(&filter, interp);
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        result = LMDB_FilterOption(&filter, zArg, objv[i+1]);
+        if( result==TCL_ERROR ){
+            return TCL_ERROR;
+        } else if( result==TCL_OK ){
+            continue;
+        }
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-channel")==0 ){
+            chanName = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-format")==0 ){
+            if( Tcl_GetIndexFromObj(interp, objv[i+1], LMDB_Format_strs,
+                                    "format", 0, &format) ){
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-from")==0 ){
+            mfrom.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            mfrom.mv_size = len;
+            from = &mfrom;
+        } else if( strcmp(zArg, "-to")==0 ){
+            mto.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            mto.mv_size = len;
+            to = &mto;
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      if(!chanName) {
+        Tcl_AppendResult(interp, "missing -channel", (char*)0);
+        return TCL_ERROR;
+      }
+
+      chan = Tcl_GetChannel(interp, chanName, &mode);
+      if(!chan) {
+        return TCL_ERROR;
+      }
+      if((mode & TCL_WRITABLE) == 0) {
+        Tcl_AppendResult(interp, "channel \"", chanName,
+                         "\" wasn't opened for writing", (char*)0);
+        return TCL_ERROR;
+      }
+
+      result = LMDB_ExportDbi(txn, dbi, format, 0, NULL, from, to, &filter,
+                              LMDB_ChannelSink, chan, &count);
+      Tcl_DStringFree(&filter.buf);
+      if(result != 0) {
+        LMDB_ExportError(interp, chan, result);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj( count ));
+
+      break;
+    }
+
+    case DBI_IMPORT: {
+      const char *zArg;
+      MDB_env *env;
+      Tcl_HashEntry *envHashEntryPtr;
+      char *envHandle = NULL;
+      char *chanName = NULL;
+      Tcl_Channel chan;
+      int mode;
+      int format = LMDB_FORMAT_BINARY;
+      int batch = 10000;
+      Tcl_WideInt batchBytes = 0;
+      int append = -1;
+      LMDB_Input in;
+      LMDB_Import im;
+      int i = 0;
+
+      if( objc < 6 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-env env_handle -channel channelId ?-format binary|tsv|mdbdump? ?-batch n? ?-batchbytes n? ?-append auto|boolean? ");
+        return TCL_ERROR;
+      }
+
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-env")==0 ){
+            envHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-channel")==0 ){
+            chanName = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-format")==0 ){
+            if( Tcl_GetIndexFromObj(interp, objv[i+1], LMDB_Format_strs,
+                                    "format", 0, &format) ){
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-batch")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &batch) != TCL_OK) {
+              return TCL_ERROR;
+            }
+            if(batch < 1) {
+              Tcl_AppendResult(interp, "-batch must be a positive integer", (char*)0);
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-batchbytes")==0 ){
+            if(Tcl_GetWideIntFromObj(interp, objv[i+1], &batchBytes) != TCL_OK) {
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-append")==0 ){
+            if( strcmp(Tcl_GetString(objv[i+1]), "auto")==0 ){
+              append = -1;
+            } else if( Tcl_GetBooleanFromObj(interp, objv[i+1], &append) ){
+              return TCL_ERROR;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!envHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid env handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      envHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, envHandle );
+      if( !envHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", envHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      env = Tcl_GetHashValue( envHashEntryPtr );
+
+      if(!chanName) {
+        Tcl_AppendResult(interp, "missing -channel", (char*)0);
+        return TCL_ERROR;
+      }
+
+      chan = Tcl_GetChannel(interp, chanName, &mode);
+      if(!chan) {
+        return TCL_ERROR;
+      }
+      if((mode & TCL_READABLE) == 0) {
+        Tcl_AppendResult(interp, "channel \"", chanName,
+                         "\" wasn't opened for reading", (char*)0);
+        return TCL_ERROR;
+      }
+
+      memset(&im, 0, sizeof(im));
+      im.env = env;
+      im.dbi = dbi;
+      im.format = format;
+      im.append = append;
+      im.autoAppend = (append == -1);
+      Tcl_DStringInit(&im.data);
+      Tcl_DStringInit(&im.prevKey);
+      LMDB_InputInit(&in, chan);
+
+      result = TCL_OK;
+      if(format == LMDB_FORMAT_MDBDUMP) {
+        Tcl_Obj *header;
+
+        result = LMDB_ImportHeader(interp, &in, &header, &im.print);
+        if(result == TCL_OK) {
+          if(header) {
+            Tcl_DecrRefCount(header);
+          } else {
+            Tcl_AppendResult(interp, "empty dump", (char*)0);
+            result = TCL_ERROR;
+          }
+        }
+      }
+      if(result == TCL_OK) {
+        result = LMDB_ImportRun(interp, &im, &in, batch, batchBytes);
+      }
+
+      Tcl_DStringFree(&in.buf);
+      Tcl_DStringFree(&im.data);
+      Tcl_DStringFree(&im.prevKey);
+      if(im.recs) {
+        ckfree((char *) im.recs);
+      }
+
+      if(result != TCL_OK) {
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj( im.count ));
+
+      break;
+    }
+
+    case DBI_PARTITIONS: {
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      MDB_val *keys;
+      unsigned int nkeys = 0;
+      int parts = 0;
+      int i = 0;
+      Tcl_Obj *pResultStr = NULL;
+
+      if( objc != 5 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid n ");
+        return TCL_ERROR;
+      }
+
+      for(i=2; i+1<objc-1; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(Tcl_GetIntFromObj(interp, objv[objc-1], &parts) != TCL_OK) {
+        return TCL_ERROR;
+      }
+      if(parts < 1) {
+        Tcl_AppendResult(interp, "n must be a positive integer", (char*)0);
+        return TCL_ERROR;
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      keys = (MDB_val *) ckalloc(parts * sizeof(MDB_val));
+      result = LMDB_Partition(txn, dbi, (unsigned int) parts, keys, &nkeys);
+      if(result != 0) {
+        ckfree((char *) keys);
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+
+          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      pResultStr = Tcl_NewListObj(0, NULL);
+      for(i = 0; i < (int) nkeys; i++) {
+        Tcl_ListObjAppendElement(interp, pResultStr,
+                                 Tcl_NewStringObj(keys[i].mv_data, keys[i].mv_size));
+      }
+      ckfree((char *) keys);
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case DBI_PARALLELSCAN: {
+      const char *zArg;
+      MDB_env *env;
+      MDB_txn *txn = NULL;
+      Tcl_HashEntry *envHashEntryPtr;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *envHandle = NULL;
+      char *txnHandle = NULL;
+      LMDB_Scan scan;
+      int threads = 4;
+      int i = 0;
+
+      if( objc < 4 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-env env_handle|-txn txnid ?-threads n? ?-init script? ?-script script? ?-final script? ");
+        return TCL_ERROR;
+      }
+
+      memset(&scan, 0, sizeof(scan));
+      scan.dbi = dbi;
+
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-env")==0 ){
+            envHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-threads")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &threads) != TCL_OK) {
+              return TCL_ERROR;
+            }
+            if(threads < 1) {
+              Tcl_AppendResult(interp, "-threads must be a positive integer", (char*)0);
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-init")==0 ){
+            scan.init = Tcl_GetString(objv[i+1]);
+        } else if( strcmp(zArg, "-script")==0 ){
+            scan.script = Tcl_GetString(objv[i+1]);
+        } else if( strcmp(zArg, "-final")==0 ){
+            scan.final = Tcl_GetString(objv[i+1]);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(txnHandle) {
+        txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+        if( !txnHashEntryPtr ) {
+          if( interp ) {
+              Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+              Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+          }
+
+          return TCL_ERROR;
+        }
+
+        txn = Tcl_GetHashValue( txnHashEntryPtr );
+        env = mdb_txn_env(txn);
+
+        return LMDB_ParallelScan(interp, env, txn, dbi, &scan, threads);
+      }
+
+      if(!envHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid env handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      envHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, envHandle );
+      if( !envHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", envHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      env = Tcl_GetHashValue( envHashEntryPtr );
+
+      return LMDB_ParallelScan(interp, env, NULL, dbi, &scan, threads);
+    }
+
+    case DBI_AGGREGATE: {
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      LMDB_AggQuery query;
+      LMDB_AggState state;
+      Tcl_DString error;
+      Tcl_Obj **opObjs = NULL;
+      Tcl_Size nops = 0;
+      int ops[5];
+      int threads = 1;
+      Tcl_Size len;
+      int i = 0;
+      Tcl_Obj *pResultStr = NULL;
+
+      if( objc < 4 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid ?-from key? ?-to key? ?-prefix prefix? ?-op ops? ?-valuetype text|int64|double? ?-threads n? ");
+        return TCL_ERROR;
+      }
+
+      memset(&query, 0, sizeof(query));
+      memset(&state, 0, sizeof(state));
+      query.dbi = dbi;
+
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-from")==0 ){
+            query.range.from.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            query.range.from.mv_size = len;
+        } else if( strcmp(zArg, "-to")==0 ){
+            query.range.to.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            query.range.to.mv_size = len;
+        } else if( strcmp(zArg, "-prefix")==0 ){
+            query.range.prefix.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            query.range.prefix.mv_size = len;
+        } else if( strcmp(zArg, "-op")==0 ){
+            if( Tcl_ListObjGetElements(interp, objv[i+1], &nops, &opObjs) ){
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-valuetype")==0 ){
+            if( Tcl_GetIndexFromObj(interp, objv[i+1], LMDB_AggType_strs,
+                                    "valuetype", 0, &query.valuetype) ){
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-threads")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &threads) != TCL_OK) {
+              return TCL_ERROR;
+            }
+            if(threads < 1) {
+              Tcl_AppendResult(interp, "-threads must be a positive integer", (char*)0);
+              return TCL_ERROR;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!opObjs) {
+        nops = 5;
+        for(i = 0; i < 5; i++) {
+          ops[i] = i;
+        }
+      } else {
+        if(nops > 5) {
+          Tcl_AppendResult(interp, "too many ops", (char*)0);
           return TCL_ERROR;
+        }
+        for(i = 0; i < nops; i++) {
+          if( Tcl_GetIndexFromObj(interp, opObjs[i], LMDB_AggOp_strs,
+                                  "op", 0, &ops[i]) ){
+            return TCL_ERROR;
+          }
+        }
+      }
+      for(i = 0; i < nops; i++) {
+        if(ops[i] != LMDB_AGG_COUNT) {
+          query.numeric = 1;
+        }
       }
 
-      if(need_key) {
-         if( objc != 4 && objc != 5){
-           if( interp ) {
-              Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-              Tcl_AppendStringsToObj( resultObj, "Wrong option: need key", (char *)NULL );
-           }
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
 
-           return TCL_ERROR; // This option need a key
-         }
+        return TCL_ERROR;
+      }
 
-         key = Tcl_GetByteArrayFromObj(objv[3], &len);
-         if( !key || len < 1 ){
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      Tcl_DStringInit(&error);
+      if(threads < 2 ||
+         !LMDB_AggParallel(txn, &query, threads, &state, &result, &error)) {
+        MDB_val none;
+
+        none.mv_size = 0;
+        none.mv_data = NULL;
+        memset(&state, 0, sizeof(state));
+        result = LMDB_AggRange(txn, &query, &none, &none, &state, &error);
+      }
+      if(result != 0) {
+        if(result == LMDB_AGG_VALUEERR) {
+          Tcl_DStringResult(interp, &error);
+        } else {
+          Tcl_DStringFree(&error);
+          Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+        }
+        return TCL_ERROR;
+      }
+      Tcl_DStringFree(&error);
+
+      pResultStr = Tcl_NewDictObj();
+      for(i = 0; i < nops; i++) {
+        Tcl_Obj *valueObj;
+
+        if(ops[i] == LMDB_AGG_COUNT) {
+          valueObj = Tcl_NewWideIntObj(state.count);
+        } else if(ops[i] == LMDB_AGG_SUM) {
+          valueObj = state.sum.isDouble ? Tcl_NewDoubleObj(state.sum.d)
+                                        : Tcl_NewWideIntObj(state.sum.i);
+        } else if(state.count == 0) {
+          valueObj = Tcl_NewObj();
+        } else if(ops[i] == LMDB_AGG_AVG) {
+          valueObj = Tcl_NewDoubleObj(LMDB_NumberDouble(&state.sum) / state.count);
+        } else {
+          LMDB_Number *n = (ops[i] == LMDB_AGG_MIN) ? &state.min : &state.max;
+
+          valueObj = n->isDouble ? Tcl_NewDoubleObj(n->d) : Tcl_NewWideIntObj(n->i);
+        }
+        Tcl_DictObjPut(NULL, pResultStr, Tcl_NewStringObj(LMDB_AggOp_strs[ops[i]], -1),
+                       valueObj);
+      }
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case DBI_SCAN: {
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      MDB_cursor *cursor;
+      MDB_val mkey;
+      MDB_val mdata;
+      LMDB_Range range;
+      LMDB_Filter filter;
+      Tcl_DString vbuf;
+      Tcl_WideInt limit = 0;
+      Tcl_WideInt count = 0;
+      int mode = LMDB_DATA_BYTES;
+      int match = 1;
+      Tcl_Size len;
+      int i = 0;
+      Tcl_Obj *pResultStr = NULL;
+
+      if( objc < 4 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid ?-from key? ?-to key? ?-prefix prefix? ?-keymatch pattern? ?-keyregexp re? ?-valuematch pattern? ?-limit n? ?-keysonly boolean? ?-sizes boolean? ");
+        return TCL_ERROR;
+      }
+
+      memset(&range, 0, sizeof(range));
+      /* Nothing is allocated in the filter before the first match. */
+      LMDB_FilterInit(&filter, interp);
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        result = LMDB_FilterOption(&filter, zArg, objv[i+1]);
+        if( result==TCL_ERROR ){
+            return TCL_ERROR;
+        } else if( result==TCL_OK ){
+            continue;
+        }
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-from")==0 ){
+            range.from.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            range.from.mv_size = len;
+        } else if( strcmp(zArg, "-to")==0 ){
+            range.to.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            range.to.mv_size = len;
+        } else if( strcmp(zArg, "-prefix")==0 ){
+            range.prefix.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            range.prefix.mv_size = len;
+        } else if( strcmp(zArg, "-limit")==0 ){
+            if(Tcl_GetWideIntFromObj(interp, objv[i+1], &limit) != TCL_OK) {
+              return TCL_ERROR;
+            }
+            if(limit < 1) {
+              Tcl_AppendResult(interp, "-limit must be a positive integer", (char*)0);
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-keysonly")==0 || strcmp(zArg, "-sizes")==0 ){
+            if( LMDB_DataModeOption(interp, zArg, objv[i+1], &mode) ){
+              return TCL_ERROR;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
            return TCL_ERROR;
-         }
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      result = mdb_cursor_open(txn, dbi, &cursor);
+      if(result != 0) {
+        Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+        return TCL_ERROR;
+      }
+
+      pResultStr = Tcl_NewListObj(0, NULL);
+      Tcl_DStringInit(&vbuf);
+      result = LMDB_RangeFirst(txn, dbi, &range, cursor, &mkey, &mdata);
+      while(result == 0 && !LMDB_RangeDone(txn, dbi, &range, &mkey)) {
+        /* -valuematch needs the value, otherwise only a match reads it. */
+        if(filter.valuematch) {
+          result = LMDB_VlogGet(txn, dbi, &mdata, LMDB_DATA_BYTES, &vbuf);
+          if(result != 0) {
+            break;
+          }
+        }
+        match = LMDB_FilterMatch(&filter, &mkey, &mdata);
+        if(match < 0) {
+          break;
+        }
+        if(match > 0) {
+          if(!filter.valuematch) {
+            result = LMDB_VlogGet(txn, dbi, &mdata, mode, &vbuf);
+            if(result != 0) {
+              break;
+            }
+          }
+          Tcl_ListObjAppendElement(NULL, pResultStr,
+              Tcl_NewStringObj(mkey.mv_data, (Tcl_Size) mkey.mv_size));
+          if(mode != LMDB_DATA_NONE) {
+            Tcl_ListObjAppendElement(NULL, pResultStr,
+                                     LMDB_DataObj(&mdata, mode, 0));
+          }
+          if(++count == limit) {
+            break;
+          }
+        }
+        result = mdb_cursor_get(cursor, &mkey, &mdata, MDB_NEXT);
+      }
+      mdb_cursor_close(cursor);
+      Tcl_DStringFree(&filter.buf);
+      Tcl_DStringFree(&vbuf);
+
+      if(match < 0) {
+        /* A -keyregexp error, the message is in the result. */
+        Tcl_DecrRefCount(pResultStr);
+        return TCL_ERROR;
+      }
+      if(result != 0 && result != MDB_NOTFOUND) {
+        Tcl_DecrRefCount(pResultStr);
+        Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case DBI_DELRANGE:
+    case DBI_DELPREFIX: {
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      LMDB_Range range;
+      Tcl_WideInt count = 0;
+      Tcl_Size len;
+      int nopts = objc;
+      int i = 0;
+
+      if( choice==DBI_DELRANGE && (objc < 4 || (objc&1)!=0) ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid ?-from key? ?-to key? ");
+        return TCL_ERROR;
+      }
+      if( choice==DBI_DELPREFIX && objc != 5 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid prefix ");
+        return TCL_ERROR;
+      }
+
+      memset(&range, 0, sizeof(range));
+      if(choice == DBI_DELPREFIX) {
+        range.prefix.mv_data = Tcl_GetStringFromObj(objv[objc-1], &len);
+        range.prefix.mv_size = len;
+        nopts = objc-1;
+      }
+
+      for(i=2; i+1<nopts; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( choice==DBI_DELRANGE && strcmp(zArg, "-from")==0 ){
+            range.from.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            range.from.mv_size = len;
+        } else if( choice==DBI_DELRANGE && strcmp(zArg, "-to")==0 ){
+            range.to.mv_data = Tcl_GetStringFromObj(objv[i+1], &len);
+            range.to.mv_size = len;
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      result = LMDB_RangeDelete(txn, dbi, &range, &count);
+      if(result != 0) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+
+          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj( count ));
+
+      break;
+    }
+
+    case DBI_INCR:
+    case DBI_APPEND:
+    case DBI_CAS: {
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
+      MDB_cursor *cursor;
+      MDB_val mkey;
+      MDB_val mdata;
+      MDB_val mnew;
+      Tcl_DString buf;
+      Tcl_DString vbuf;
+      Tcl_WideInt delta = 0;
+      Tcl_Size len;
+      int nargs = (choice == DBI_CAS) ? 3 : 2;
+      int found = 0;
+      int i = 0;
+      Tcl_Obj *pResultStr = NULL;
 
-         mkey.mv_size = len;
-         mkey.mv_data = key;
+      if( objc != 4+nargs ){
+        if(choice == DBI_INCR) {
+          Tcl_WrongNumArgs(interp, 2, objv, "key delta -txn txnid ");
+        } else if(choice == DBI_APPEND) {
+          Tcl_WrongNumArgs(interp, 2, objv, "key data -txn txnid ");
+        } else {
+          Tcl_WrongNumArgs(interp, 2, objv, "key expected data -txn txnid ");
+        }
+        return TCL_ERROR;
       }
 
-      if(need_key_data) {
-         if( objc != 5 ){
-           if( interp ) {
-              Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-              Tcl_AppendStringsToObj( resultObj, "Wrong option: need key data", (char *)NULL );
-           }
+      mkey.mv_data = Tcl_GetStringFromObj(objv[2], &len);
+      mkey.mv_size = len;
+      if( len < 1 ){
+        return TCL_ERROR;
+      }
 
-           return TCL_ERROR; // This option need a key and data
-         }
+      if(choice == DBI_INCR &&
+         Tcl_GetWideIntFromObj(interp, objv[3], &delta) != TCL_OK) {
+        return TCL_ERROR;
+      }
 
-         key = Tcl_GetByteArrayFromObj(objv[3], &len);
-         if( !key || len < 1 ){
+      for(i=2+nargs; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
            return TCL_ERROR;
-         }
-
-         mkey.mv_size = len;
-         mkey.mv_data = key;
+        }
+      }
 
-         data = Tcl_GetByteArrayFromObj(objv[4], &len);
-         if( !data || len < 1 ){
-           return TCL_ERROR;
-         }
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
 
-         mdata.mv_size = len;
-         mdata.mv_data = data;
+        return TCL_ERROR;
       }
 
-      result = mdb_cursor_get(cursor, &mkey, &mdata, op);
-      if(result != 0) {
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      pResultStr = Tcl_NewListObj(2, NULL);
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewByteArrayObj(mkey.mv_data, mkey.mv_size));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewByteArrayObj(mdata.mv_data, mdata.mv_size));
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      Tcl_DStringInit(&vbuf);
+      result = LMDB_RmwGet(txn, dbi, &mkey, &cursor, &mdata, &found, &vbuf);
+      if(result != 0) {
+        Tcl_DStringFree(&vbuf);
+        Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+        return TCL_ERROR;
+      }
+
+      /*
+       * The old data is in the map (or vbuf) and the put may move it, so
+       * the new data is built in buf first.
+       */
+      Tcl_DStringInit(&buf);
+      if(choice == DBI_INCR) {
+        Tcl_WideInt value = 0;
+        char number[TCL_INTEGER_SPACE + 2];
+
+        if(found) {
+          char *end;
+
+          Tcl_DStringAppend(&buf, mdata.mv_data, (Tcl_Size) mdata.mv_size);
+          errno = 0;
+          value = strtoll(Tcl_DStringValue(&buf), &end, 10);
+          if(mdata.mv_size == 0 || *end != '\0' || errno == ERANGE ||
+             isspace((unsigned char) *Tcl_DStringValue(&buf))) {
+            mdb_cursor_close(cursor);
+            Tcl_DStringFree(&vbuf);
+            Tcl_AppendResult(interp, "expected integer but got \"",
+                             Tcl_DStringValue(&buf), "\"", (char*)0);
+            Tcl_DStringFree(&buf);
+            return TCL_ERROR;
+          }
+        }
+        if((delta > 0 && value > INT64_MAX - delta) ||
+           (delta < 0 && value < INT64_MIN - delta)) {
+          mdb_cursor_close(cursor);
+          Tcl_DStringFree(&buf);
+          Tcl_DStringFree(&vbuf);
+          Tcl_AppendResult(interp, "integer overflow", (char*)0);
+          return TCL_ERROR;
+        }
+        value += delta;
+        snprintf(number, sizeof(number), "%" TCL_LL_MODIFIER "d", value);
+        Tcl_DStringFree(&buf);
+        Tcl_DStringAppend(&buf, number, -1);
+        pResultStr = Tcl_NewWideIntObj(value);
+      } else if(choice == DBI_APPEND) {
+        const char *data = Tcl_GetStringFromObj(objv[3], &len);
+
+        if(found) {
+          Tcl_DStringAppend(&buf, mdata.mv_data, (Tcl_Size) mdata.mv_size);
+        }
+        Tcl_DStringAppend(&buf, data, len);
+        pResultStr = Tcl_NewWideIntObj(Tcl_DStringLength(&buf));
+      } else {
+        const char *expected = Tcl_GetStringFromObj(objv[3], &len);
+        int match;
+
+        /* An empty expected value stands for a missing key. */
+        if(found) {
+          match = (len > 0 && (size_t) len == mdata.mv_size &&
+                   memcmp(expected, mdata.mv_data, len) == 0);
+        } else {
+          match = (len == 0);
+        }
+        if(!match) {
+          mdb_cursor_close(cursor);
+          Tcl_DStringFree(&vbuf);
+          Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+          break;
+        }
+        expected = Tcl_GetStringFromObj(objv[4], &len);
+        Tcl_DStringAppend(&buf, expected, len);
+        pResultStr = Tcl_NewIntObj(1);
+      }
+
+      Tcl_DStringFree(&vbuf);
+      mnew.mv_data = Tcl_DStringValue(&buf);
+      mnew.mv_size = Tcl_DStringLength(&buf);
+      result = LMDB_RmwPut(cursor, &mkey, &mnew, found);
+      Tcl_DStringFree(&buf);
+      if(result != 0) {
+        Tcl_DecrRefCount(pResultStr);
+        Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+        return TCL_ERROR;
+      }
 
       Tcl_SetObjResult(interp, pResultStr);
 
       break;
     }
 
-    case CUR_PUT: {
-      char *zArg;
+    case DBI_GETRANGE: {
       char *key;
-      char *data;
-      Tcl_Size key_len;
-      Tcl_Size data_len;
+      Tcl_Size len;
       MDB_val mkey;
       MDB_val mdata;
-      int flags = 0;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      char *txnHandle = NULL;
       int i = 0;
 
-      if( objc < 4 || (objc&1)!=0) {
-        Tcl_WrongNumArgs(interp, 2, objv, "key data ?-current boolean? ?-nodupdata boolean? ?-nooverwrite boolean? ?-append boolean? ?-appenddup boolean? ");
+      if( objc != 7 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "key offset length -txn txnid ");
         return TCL_ERROR;
       }
 
-      key = Tcl_GetStringFromObj(objv[2], &key_len);
-      if( !key || key_len < 1 ){
-         return TCL_ERROR;
-      }
-
-      data = Tcl_GetStringFromObj(objv[3], &data_len);
-      if( !data || data_len < 1 ){
-         return TCL_ERROR;
+      key = Tcl_GetStringFromObj(objv[2], &len);
+      if( !key || len < 1 ){
+        return TCL_ERROR;
       }
 
-      for(i=4; i+1<objc; i+=2){
+      for(i=5; i+1<objc; i+=2){
         zArg = Tcl_GetStringFromObj(objv[i], 0);
 
-        if( strcmp(zArg, "-current")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_CURRENT;
-            }else{
-              flags &= ~MDB_CURRENT;
-            }
-        } else if( strcmp(zArg, "-nodupdata")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_NODUPDATA;
-            }else{
-              flags &= ~MDB_NODUPDATA;
-            }
-        } else if( strcmp(zArg, "-nooverwrite")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_NOOVERWRITE;
-            }else{
-              flags &= ~MDB_NOOVERWRITE;
-            }
-        } else if( strcmp(zArg, "-append")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_APPEND;
-            }else{
-              flags &= ~MDB_APPEND;
-            }
-        } else if( strcmp(zArg, "-appenddup")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_APPENDDUP;
-            }else{
-              flags &= ~MDB_APPENDDUP;
-            }
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
         } else{
            Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
            return TCL_ERROR;
         }
       }
 
-      mkey.mv_size = key_len;
-      mkey.mv_data = key;
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
 
-      mdata.mv_size = data_len;
-      mdata.mv_data = data;
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      mkey.mv_size = len;
+      mkey.mv_data = key;
 
-      result = mdb_cursor_put(cursor, &mkey, &mdata, flags);
+      result = mdb_get (txn, dbi, &mkey, &mdata);
       if(result != 0) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
@@ -501,97 +6963,92 @@ static int LMDB_CUR(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
         return TCL_ERROR;
       }
 
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
-
-      break;
+      return LMDB_SliceObj(interp, txn, dbi, &mdata, objv[3], objv[4]);
     }
 
-    /*
-     * Add command to handle byte array.
-     * Use at your own risk.
-     */
-    case CUR_PUT_BINARY: {
-      char *zArg;
-      unsigned char *key;
-      unsigned char *data;
-      Tcl_Size key_len;
-      Tcl_Size data_len;
+    case DBI_OPENBLOB: {
+      char *key;
+      Tcl_Size len;
       MDB_val mkey;
       MDB_val mdata;
-      int flags = 0;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      Tcl_HashEntry *infoEntryPtr = NULL;
+      LMDB_TxnInfo *info;
+      char *txnHandle = NULL;
+      LMDB_Blob *blob;
+      char handleName[16 + TCL_INTEGER_SPACE];
       int i = 0;
 
-      if( objc < 4 || (objc&1)!=0) {
-        Tcl_WrongNumArgs(interp, 2, objv, "key data ?-current boolean? ?-nodupdata boolean? ?-nooverwrite boolean? ?-append boolean? ?-appenddup boolean? ");
+      if( objc != 5 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "key -txn txnid ");
         return TCL_ERROR;
       }
 
-      key = Tcl_GetByteArrayFromObj(objv[2], &key_len);
-      if( !key || key_len < 1 ){
-         return TCL_ERROR;
-      }
-
-      data = Tcl_GetByteArrayFromObj(objv[3], &data_len);
-      if( !data || data_len < 1 ){
-         return TCL_ERROR;
-      }
-
-      for(i=4; i+1<objc; i+=2){
-        zArg = Tcl_GetStringFromObj(objv[i], 0);
-
-        if( strcmp(zArg, "-current")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_CURRENT;
-            }else{
-              flags &= ~MDB_CURRENT;
-            }
-        } else if( strcmp(zArg, "-nodupdata")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_NODUPDATA;
-            }else{
-              flags &= ~MDB_NODUPDATA;
-            }
-        } else if( strcmp(zArg, "-nooverwrite")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_NOOVERWRITE;
-            }else{
-              flags &= ~MDB_NOOVERWRITE;
-            }
-        } else if( strcmp(zArg, "-append")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_APPEND;
-            }else{
-              flags &= ~MDB_APPEND;
-            }
-        } else if( strcmp(zArg, "-appenddup")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_APPENDDUP;
-            }else{
-              flags &= ~MDB_APPENDDUP;
-            }
+      key = Tcl_GetStringFromObj(objv[2], &len);
+      if( !key || len < 1 ){
+        return TCL_ERROR;
+      }
+
+      for(i=3; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
         } else{
            Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
            return TCL_ERROR;
         }
       }
 
-      mkey.mv_size = key_len;
-      mkey.mv_data = key;
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
 
-      mdata.mv_size = data_len;
-      mdata.mv_data = data;
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( !txnHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+
+      /*
+       * A write transaction may change or move the pages of the data
+       * while the channel is open.
+       */
+      if( tsdPtr->txninfo_hashtblPtr ){
+        infoEntryPtr = Tcl_FindHashEntry( tsdPtr->txninfo_hashtblPtr, txnHandle );
+      }
+      if( !infoEntryPtr ){
+        Tcl_AppendResult(interp, "invalid txn handle ", txnHandle, (char*)0);
+        return TCL_ERROR;
+      }
+      info = (LMDB_TxnInfo *) Tcl_GetHashValue( infoEntryPtr );
+      if( !info->readonly ){
+        Tcl_AppendResult(interp, "openBlob needs a read-only transaction", (char*)0);
+        return TCL_ERROR;
+      }
+
+      mkey.mv_size = len;
+      mkey.mv_data = key;
 
-      result = mdb_cursor_put(cursor, &mkey, &mdata, flags);
+      result = mdb_get (txn, dbi, &mkey, &mdata);
+      if(result == 0 &&
+         LMDB_VlogKind(txn, dbi, &mdata) == LMDB_VLOG_POINTER) {
+        /* The channel reads the map, a value in the value log is not. */
+        result = MDB_INCOMPATIBLE;
+      }
       if(result != 0) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
@@ -601,30 +7058,85 @@ static int LMDB_CUR(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
         return TCL_ERROR;
       }
 
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+      blob = (LMDB_Blob *) ckalloc(sizeof(LMDB_Blob));
+      memset(blob, 0, sizeof(LMDB_Blob));
+      LMDB_ChanBaseInit(&blob->base, txnHandle, info);
+      blob->data = mdata;
+
+      Tcl_MutexLock(&myMutex);
+      sprintf( handleName, "%s.blob%d", dbiHandle, tsdPtr->blob_count++ );
+      Tcl_MutexUnlock(&myMutex);
+
+      blob->base.chan = Tcl_CreateChannel(&LMDB_BlobChannelType, handleName,
+                                          blob, TCL_READABLE);
+      Tcl_SetChannelOption(NULL, blob->base.chan, "-translation", "binary");
+      Tcl_RegisterChannel(interp, blob->base.chan);
+
+      Tcl_SetObjResult(interp, Tcl_NewStringObj( handleName, -1 ));
 
       break;
     }
 
-    case CUR_DEL: {
-      char *zArg;
-      int flags = 0;
+    case DBI_BLOBOPEN:
+    case DBI_BLOBGET:
+    case DBI_BLOBDELETE: {
+      static const char *mode_strs[] = { "r", "w", "a", 0 };
+      enum mode_enum { MODE_R, MODE_W, MODE_A };
+      char *key;
+      Tcl_Size len;
+      const char *zArg;
+      MDB_txn *txn;
+      Tcl_HashEntry *txnHashEntryPtr;
+      Tcl_HashEntry *infoEntryPtr = NULL;
+      LMDB_TxnInfo *info;
+      char *txnHandle = NULL;
+      LMDB_Chunked cb;
+      int mode = MODE_R;
+      int chunksize = 0;
+      int threads = 1;
       int i = 0;
 
-      if( objc != 2 && objc != 4){
-        Tcl_WrongNumArgs(interp, 2, objv, "?-nodupdata boolean? ");
+      if( objc < 5 || (objc&1)!=1 ){
+        if(choice == DBI_BLOBOPEN) {
+          Tcl_WrongNumArgs(interp, 2, objv, "key -txn txnid ?-mode r|w|a? ?-chunksize bytes? ");
+        } else if(choice == DBI_BLOBGET) {
+          Tcl_WrongNumArgs(interp, 2, objv, "key -txn txnid ?-threads n? ");
+        } else {
+          Tcl_WrongNumArgs(interp, 2, objv, "key -txn txnid ");
+        }
         return TCL_ERROR;
       }
 
-      for(i=2; i+1<objc; i+=2){
+      key = Tcl_GetStringFromObj(objv[2], &len);
+      if( !key || len < 1 ){
+        return TCL_ERROR;
+      }
+
+      for(i=3; i+1<objc; i+=2){
         zArg = Tcl_GetStringFromObj(objv[i], 0);
-        if( strcmp(zArg, "-nodupdata")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_NODUPDATA;
-            }else{
-              flags &= ~MDB_NODUPDATA;
+
+        if( strcmp(zArg, "-txn")==0 ){
+            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( choice==DBI_BLOBOPEN && strcmp(zArg, "-mode")==0 ){
+            if( Tcl_GetIndexFromObj(interp, objv[i+1], mode_strs,
+                                    "mode", 0, &mode) ){
+              return TCL_ERROR;
+            }
+        } else if( choice==DBI_BLOBOPEN && strcmp(zArg, "-chunksize")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &chunksize) != TCL_OK) {
+              return TCL_ERROR;
+            }
+            if(chunksize < 1) {
+              Tcl_AppendResult(interp, "-chunksize must be a positive integer", (char*)0);
+              return TCL_ERROR;
+            }
+        } else if( choice==DBI_BLOBGET && strcmp(zArg, "-threads")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &threads) != TCL_OK) {
+              return TCL_ERROR;
+            }
+            if(threads < 1) {
+              Tcl_AppendResult(interp, "-threads must be a positive integer", (char*)0);
+              return TCL_ERROR;
             }
         } else{
            Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
@@ -632,31 +7144,255 @@ static int LMDB_CUR(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
         }
       }
 
-      result = mdb_cursor_del(cursor, flags);
-      if(result != 0) {
+      if(!txnHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+      if( tsdPtr->txninfo_hashtblPtr ){
+        infoEntryPtr = Tcl_FindHashEntry( tsdPtr->txninfo_hashtblPtr, txnHandle );
+      }
+      if( !txnHashEntryPtr || !infoEntryPtr ) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+      txn = Tcl_GetHashValue( txnHashEntryPtr );
+      info = (LMDB_TxnInfo *) Tcl_GetHashValue( infoEntryPtr );
+
+      LMDB_ChunkedInit(&cb, txn, dbi, key, (size_t) len);
+      result = LMDB_ChunkManifest(&cb);
+      if(choice == DBI_BLOBOPEN && mode != MODE_R && info->readonly) {
+        LMDB_ChunkedFree(&cb);
+        Tcl_AppendResult(interp, "blobOpen -mode ", mode_strs[mode],
+                         " needs a write transaction", (char*)0);
+        return TCL_ERROR;
+      }
+      if(choice == DBI_BLOBOPEN && mode == MODE_W &&
+         (result == 0 || result == MDB_NOTFOUND || result == MDB_INCOMPATIBLE)) {
+        /* Replace the blob or a plain value. */
+        result = LMDB_ChunkDelete(&cb);
+        cb.size = 0;
+        cb.chunksize = 0;
+      } else if(choice == DBI_BLOBOPEN && result == MDB_NOTFOUND && mode != MODE_R) {
+        /* A new blob. */
+        result = 0;
+      } else if(choice == DBI_BLOBDELETE && result == MDB_NOTFOUND) {
+        LMDB_ChunkedFree(&cb);
+        Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+        break;
+      } else if(choice == DBI_BLOBDELETE && result == 0) {
+        result = LMDB_ChunkDelete(&cb);
+      }
+      if(result != 0) {
+        LMDB_ChunkedFree(&cb);
+        Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+        return TCL_ERROR;
+      }
+
+      if(choice == DBI_BLOBDELETE) {
+        LMDB_ChunkedFree(&cb);
+        Tcl_SetObjResult(interp, Tcl_NewIntObj( 1 ));
+      } else if(choice == DBI_BLOBGET) {
+        Tcl_Obj *pResultStr = Tcl_NewByteArrayObj(NULL, 0);
+        unsigned char *buf;
+
+        buf = Tcl_SetByteArrayLength(pResultStr, (Tcl_Size) cb.size);
+        if(threads < 2 ||
+           !LMDB_ChunkParallel(&cb, buf, threads, &result)) {
+          result = LMDB_ChunkRead(&cb, 0, (char *) buf, (size_t) cb.size);
+        }
+        LMDB_ChunkedFree(&cb);
+        if(result != 0) {
+          Tcl_DecrRefCount(pResultStr);
+          Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+          return TCL_ERROR;
+        }
+        Tcl_SetObjResult(interp, pResultStr);
+      } else {
+        LMDB_ChunkChan *cc;
+        char handleName[16 + TCL_INTEGER_SPACE];
+
+        cc = (LMDB_ChunkChan *) ckalloc(sizeof(LMDB_ChunkChan));
+        memset(cc, 0, sizeof(LMDB_ChunkChan));
+        LMDB_ChanBaseInit(&cc->base, txnHandle, info);
+        cc->cb = cb;
+        if(mode != MODE_R && cc->cb.chunksize == 0) {
+          MDB_stat stat;
+
+          cc->cb.chunksize = (unsigned int) chunksize;
+          if(chunksize == 0) {
+            result = mdb_stat(txn, dbi, &stat);
+            if(result == 0) {
+              cc->cb.chunksize = stat.ms_psize - LMDB_CHUNK_PAGEHDR;
+            }
+          }
+        }
+        if(mode != MODE_R && result == 0) {
+          cc->writing = 1;
+          cc->buf = ckalloc(cc->cb.chunksize);
+          cc->fill = (unsigned int) (cc->cb.size % cc->cb.chunksize);
+          if(cc->fill > 0) {
+            /* Appending to a part filled last chunk. */
+            result = LMDB_ChunkRead(&cc->cb, cc->cb.size - cc->fill,
+                                    cc->buf, cc->fill);
+          }
+        }
+        if(result != 0) {
+          /* Nothing to put, just free it. */
+          if(cc->buf) {
+            ckfree(cc->buf);
+          }
+          cc->writing = 0;
+          LMDB_ChunkChanClose(cc, NULL, 0);
+          Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+          return TCL_ERROR;
+        }
+
+        Tcl_MutexLock(&myMutex);
+        sprintf( handleName, "%s.blob%d", dbiHandle, tsdPtr->blob_count++ );
+        Tcl_MutexUnlock(&myMutex);
+
+        cc->base.chan = Tcl_CreateChannel(&LMDB_ChunkChannelType, handleName,
+                                          cc, mode == MODE_R ? TCL_READABLE
+                                                             : TCL_WRITABLE);
+        Tcl_SetChannelOption(NULL, cc->base.chan, "-translation", "binary");
+        Tcl_RegisterChannel(interp, cc->base.chan);
+        if(cc->writing) {
+          info->writers++;
+        }
+
+        Tcl_SetObjResult(interp, Tcl_NewStringObj( handleName, -1 ));
+      }
 
       break;
     }
 
-    case CUR_COUNT: {
-      size_t count;
-      Tcl_Obj *pResultStr = NULL;
+  }
 
-      if( objc != 2){
+  return TCL_OK;
+}
+
+
+static int LMDB_TXN(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  int choice;
+  int result;
+  MDB_txn *txn;
+  LMDB_TxnInfo *info = NULL;
+  Tcl_HashEntry *hashEntryPtr;
+  char *txnHandle;
+
+  ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+      Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+
+  if (tsdPtr->initialized == 0) {
+    tsdPtr->initialized = 1;
+    tsdPtr->lmdb_hashtblPtr = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+    Tcl_InitHashTable(tsdPtr->lmdb_hashtblPtr, TCL_STRING_KEYS);
+  }
+
+  static const char *DBTXN_strs[] = {
+    "abort",
+    "commit",
+    "reset",
+    "renew",
+    "close",
+    0
+  };
+
+  enum DBTXN_enum {
+    DBTXN_ABORT,
+    DBTXN_COMMIT,
+    DBTXN_RESET,
+    DBTXN_RENEW,
+    DBTXN_CLOSE,
+  };
+
+  if( objc < 2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "SUBCOMMAND ...");
+    return TCL_ERROR;
+  }
+
+  if( Tcl_GetIndexFromObj(interp, objv[1], DBTXN_strs, "option", 0, &choice) ){
+    return TCL_ERROR;
+  }
+
+  /*
+   * Get the MDB_txn * point
+   */
+  txnHandle = Tcl_GetStringFromObj(objv[0], 0);
+  hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
+  if( !hashEntryPtr ) {
+    if( interp ) {
+        Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+        Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+    }
+
+    return TCL_ERROR;
+  }
+
+  txn = Tcl_GetHashValue( hashEntryPtr );
+
+  if( tsdPtr->txninfo_hashtblPtr ){
+    Tcl_HashEntry *infoEntryPtr;
+
+    infoEntryPtr = Tcl_FindHashEntry( tsdPtr->txninfo_hashtblPtr, txnHandle );
+    if( infoEntryPtr ){
+      info = (LMDB_TxnInfo *) Tcl_GetHashValue( infoEntryPtr );
+    }
+  }
+
+  switch( (enum DBTXN_enum)choice ){
+
+    case DBTXN_ABORT: {
+      if( objc != 2 ){
         Tcl_WrongNumArgs(interp, 2, objv, 0);
         return TCL_ERROR;
       }
 
-      result = mdb_cursor_count(cursor, &count);
+      /* The values of a nested transaction are mixed with its parent's. */
+      if( info && !info->readonly && !info->nested ) LMDB_VlogAbort(txn);
+      mdb_txn_abort(txn);
+      if( info ) info->active = 0;
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case DBTXN_COMMIT: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      /*
+       * A blob channel puts its last chunk and the manifest when it is
+       * closed, committing before that would keep chunks of no blob.
+       */
+      if( info && info->writers > 0 ){
+        Tcl_AppendResult(interp, "a blob channel of the transaction is "
+            "open for writing", (char*)0);
+        return TCL_ERROR;
+      }
+
+      /* Only a top-level commit makes the pointer records durable. */
+      result = (info && info->nested) ? 0 : LMDB_VlogCommit(txn);
+      if(result == 0) {
+        result = mdb_txn_commit(txn);
+      } else {
+        LMDB_VlogAbort(txn);
+        mdb_txn_abort(txn);
+      }
+      if( info ) info->active = 0;
       if(result != 0) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
@@ -666,78 +7402,60 @@ static int LMDB_CUR(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
         return TCL_ERROR;
       }
 
-      pResultStr = Tcl_NewIntObj( count );
-      Tcl_SetObjResult(interp, pResultStr);
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
 
       break;
     }
 
-    case CUR_RENEW: {
-      char *zArg;
-      MDB_txn *txn;
-      Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
-
-      if( objc != 4){
-        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid ");
+    case DBTXN_RESET: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
         return TCL_ERROR;
       }
 
-      zArg = Tcl_GetStringFromObj(objv[2], 0);
-      if( strcmp(zArg, "-txn")==0 ){
-         txnHandle = Tcl_GetStringFromObj(objv[3], 0);
-      } else{
-         Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-         return TCL_ERROR;
-      }
-
-      if(!txnHandle) {
-        if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
-        }
-
-        return TCL_ERROR;
-      }
+      mdb_txn_reset(txn);
+      if( info ) info->active = 0;
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
 
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
-        }
+      break;
+    }
 
+    case DBTXN_RENEW: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
         return TCL_ERROR;
       }
 
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
-      result = mdb_cursor_renew(txn, cursor);
+      result = mdb_txn_renew(txn);
       if(result != 0) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+
             Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
+      if( info ) LMDB_TxnInfoStart(interp, info);
+
       Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
 
       break;
     }
 
-    case CUR_CLOSE: {
+    case DBTXN_CLOSE: {
       if( objc != 2 ){
         Tcl_WrongNumArgs(interp, 2, objv, 0);
         return TCL_ERROR;
       }
 
-      mdb_cursor_close (cursor);
+      if( info ) LMDB_TxnInfoFree(info);
 
       Tcl_MutexLock(&myMutex);
       if( hashEntryPtr )  Tcl_DeleteHashEntry(hashEntryPtr);
       Tcl_MutexUnlock(&myMutex);
-      Tcl_DeleteCommand(interp, curHandle);
+      Tcl_DeleteCommand(interp, txnHandle);
 
       Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
 
@@ -750,12 +7468,82 @@ static int LMDB_CUR(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
 }
 
 
-static int LMDB_DBI(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+/*
+ * Clear stale reader slots, then compute how many transactions the
+ * oldest live reader lags behind the last committed transaction.
+ * Pages freed after that snapshot cannot be reused while it is open.
+ */
+static int LMDB_ReaperRun(MDB_env *env, int *dead, Tcl_WideInt *lag)
+{
+  MDB_envinfo info;
+  LMDB_ReaderScan scan;
+  int result;
+
+  result = mdb_reader_check(env, dead);
+  if(result != 0) {
+    return result;
+  }
+
+  result = mdb_env_info(env, &info);
+  if(result != 0) {
+    return result;
+  }
+
+  scan.listPtr = NULL;
+  scan.active = 0;
+  scan.oldest = -1;
+  mdb_reader_list(env, LMDB_ReaderListFunc, &scan);
+
+  if( scan.oldest < 0 || (Tcl_WideInt) info.me_last_txnid < scan.oldest ){
+    *lag = 0;
+  } else {
+    *lag = (Tcl_WideInt) info.me_last_txnid - scan.oldest;
+  }
+
+  return 0;
+}
+
+static void LMDB_ReaperTimer(ClientData clientData)
+{
+  LMDB_Reaper *reaper = (LMDB_Reaper *) clientData;
+  int result;
+
+  reaper->timer = Tcl_CreateTimerHandler(reaper->interval,
+                     LMDB_ReaperTimer, (ClientData) reaper);
+
+  result = LMDB_ReaperRun(reaper->env, &reaper->lastDead, &reaper->lastLag);
+  if( result != 0 || !reaper->script ){
+    return;
+  }
+
+  /*
+   * The callback may close the environment (and free the reaper),
+   * keep what we need on the stack.
+   */
+  {
+    Tcl_Interp *interp = reaper->interp;
+    Tcl_Obj *cmdPtr = Tcl_DuplicateObj(reaper->script);
+
+    Tcl_IncrRefCount(cmdPtr);
+    Tcl_ListObjAppendElement(NULL, cmdPtr, Tcl_NewIntObj(reaper->lastDead));
+    Tcl_ListObjAppendElement(NULL, cmdPtr, Tcl_NewWideIntObj(reaper->lastLag));
+
+    Tcl_Preserve(interp);
+    if( Tcl_EvalObjEx(interp, cmdPtr, TCL_EVAL_GLOBAL) != TCL_OK ){
+      Tcl_BackgroundException(interp, TCL_ERROR);
+    }
+    Tcl_Release(interp);
+    Tcl_DecrRefCount(cmdPtr);
+  }
+}
+
+
+static int LMDB_ENV(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
   int choice;
   int result;
-  MDB_dbi dbi;
+  MDB_env *env;
   Tcl_HashEntry *hashEntryPtr;
-  char *dbiHandle;
+  char *handle;
 
   ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
       Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
@@ -766,31 +7554,47 @@ static int LMDB_DBI(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
     Tcl_InitHashTable(tsdPtr->lmdb_hashtblPtr, TCL_STRING_KEYS);
   }
 
-  static const char *DBI_strs[] = {
-    "put",
-    "putBinary",
-    "get",
-    "getBinary",
-    "del",
-    "delBinary",
-    "drop",
-    "close",
+  static const char *DBENV_strs[] = {
+    "open",
+    "set_mapsize",
+    "set_maxreaders",
+    "set_maxdbs",
+    "sync",
     "stat",
-    "cursor",
+    "copy",
+    "get_path",
+    "get_maxreaders",
+    "get_maxkeysize",
+    "close",
+    "txn",
+    "info",
+    "reader_list",
+    "reader_check",
+    "reaper",
+    "vlog",
+    "vlog_compact",
     0
   };
 
-  enum DBI_enum {
-    DBI_PUT,
-    DBI_PUT_BINARY,
-    DBI_GET,
-    DBI_GET_BINARY,
-    DBI_DEL,
-    DBI_DEL_BINARY,
-    DBI_DROP,
-    DBI_CLOSE,
-    DBI_STAT,
-    DBI_CURSOR,
+  enum DBENV_enum {
+    DBENV_OPEN,
+    DBENV_SET_MAPSIZE,
+    DBENV_SET_MAXREADERS,
+    DBENV_SET_MAXDBS,
+    DBENV_SYNC,
+    DBENV_STAT,
+    DBENV_COPY,
+    DBENV_GET_PATH,
+    DBENV_GET_MAXREADERS,
+    DBENV_GET_MAXKEYSIZE,
+    DBENV_CLOSE,
+    DBENV_TXN,
+    DBENV_INFO,
+    DBENV_READER_LIST,
+    DBENV_READER_CHECK,
+    DBENV_REAPER,
+    DBENV_VLOG,
+    DBENV_VLOG_COMPACT,
   };
 
   if( objc < 2 ){
@@ -798,209 +7602,97 @@ static int LMDB_DBI(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
     return TCL_ERROR;
   }
 
-  if( Tcl_GetIndexFromObj(interp, objv[1], DBI_strs, "option", 0, &choice) ){
+  if( Tcl_GetIndexFromObj(interp, objv[1], DBENV_strs, "option", 0, &choice) ){
     return TCL_ERROR;
   }
 
   /*
-   * Get the MDB_dbi value
+   * Get the MDB_env * point
    */
-  dbiHandle = Tcl_GetStringFromObj(objv[0], 0);
-  hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, dbiHandle );
+  handle = Tcl_GetStringFromObj(objv[0], 0);
+  hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, handle );
   if( !hashEntryPtr ) {
     if( interp ) {
         Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-
-        Tcl_AppendStringsToObj( resultObj, "invalid dbi handle ", dbiHandle, (char *)NULL );
+        Tcl_AppendStringsToObj( resultObj, "invalid env handle ", handle, (char *)NULL );
     }
 
     return TCL_ERROR;
   }
 
-  dbi = (MDB_dbi)(uintptr_t)Tcl_GetHashValue( hashEntryPtr );
-
-  switch( (enum DBI_enum)choice ){
-
-    case DBI_PUT: {
-      char *key;
-      char *data;
-      Tcl_Size key_len;
-      Tcl_Size data_len;
-      MDB_val mkey;
-      MDB_val mdata;
-      const char *zArg;
-      MDB_txn *txn;
-      Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
-      int flags = 0;
-      int i = 0;
-
-      if( objc < 4 || (objc&1)!=0 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "key data -txn txnid ?-nodupdata boolean? ?-nooverwrite boolean? ?-append boolean? ?-appenddup boolean? ");
-        return TCL_ERROR;
-      }
-
-      key = Tcl_GetStringFromObj(objv[2], &key_len);
-      if( !key || key_len < 1 ){
-        return TCL_ERROR;
-      }
-
-      data = Tcl_GetStringFromObj(objv[3], &data_len);
-      if( !data || data_len < 1 ){
-        return TCL_ERROR;
-      }
-
-      for(i=4; i+1<objc; i+=2){
-        zArg = Tcl_GetStringFromObj(objv[i], 0);
-        if( strcmp(zArg, "-txn")==0 ){
-            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else if( strcmp(zArg, "-nodupdata")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_NODUPDATA;
-            }else{
-              flags &= ~MDB_NODUPDATA;
-            }
-        } else if( strcmp(zArg, "-nooverwrite")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_NOOVERWRITE;
-            }else{
-              flags &= ~MDB_NOOVERWRITE;
-            }
-        } else if( strcmp(zArg, "-append")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_APPEND;
-            }else{
-              flags &= ~MDB_APPEND;
-            }
-        } else if( strcmp(zArg, "-appenddup")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_APPENDDUP;
-            }else{
-              flags &= ~MDB_APPENDDUP;
-            }
-        } else{
-           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-           return TCL_ERROR;
-        }
-      }
-
-      if(!txnHandle) {
-        if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
-        }
-
-        return TCL_ERROR;
-      }
-
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
-        }
-
-        return TCL_ERROR;
-      }
-
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
-
-      mkey.mv_size = key_len;
-      mkey.mv_data = key;
-      mdata.mv_size = data_len;
-      mdata.mv_data = data;
-
-      result = mdb_put (txn, dbi, &mkey, &mdata, flags);
-      if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
-
-        return TCL_ERROR;
-      }
-
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+  env = Tcl_GetHashValue( hashEntryPtr );
 
-      break;
-    }
+  switch( (enum DBENV_enum)choice ){
 
-    /*
-     * Add command to handle byte array.
-     * Use at your own risk.
-     */
-    case DBI_PUT_BINARY: {
-      unsigned char *key;
-      unsigned char *data;
-      Tcl_Size key_len;
-      Tcl_Size data_len;
-      MDB_val mkey;
-      MDB_val mdata;
+    case DBENV_OPEN: {
       const char *zArg;
-      MDB_txn *txn;
-      Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
+      char *path = NULL;
+      int mode = 0664;
       int flags = 0;
       int i = 0;
 
-      if( objc < 4 || (objc&1)!=0 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "key data -txn txnid ?-nodupdata boolean? ?-nooverwrite boolean? ?-append boolean? ?-appenddup boolean? ");
-        return TCL_ERROR;
-      }
-
-      key = Tcl_GetByteArrayFromObj(objv[2], &key_len);
-      if( !key || key_len < 1 ){
-        return TCL_ERROR;
-      }
-
-      data = Tcl_GetByteArrayFromObj(objv[3], &data_len);
-      if( !data || data_len < 1 ){
+      if( objc < 4 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 1, objv,
+        "ENV_HANDLE -path path ?-mode mode? ?-fixedmap BOOLEAN? ?-nosubdir BOOLEAN? ?-readonly BOOLEAN? ?-nosync BOOLEAN? ?-nordahead BOOLEAN? "
+        );
+
         return TCL_ERROR;
       }
 
-      for(i=4; i+1<objc; i+=2){
+      for(i=2; i+1<objc; i+=2){
         zArg = Tcl_GetStringFromObj(objv[i], 0);
-        if( strcmp(zArg, "-txn")==0 ){
-            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else if( strcmp(zArg, "-nodupdata")==0 ){
+        if( strcmp(zArg, "-path")==0 ){
+            path = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-mode")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &mode) != TCL_OK) {
+                return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-fixedmap")==0 ){
             int b;
             if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
             if( b ){
-              flags |= MDB_NODUPDATA;
+              flags |= MDB_FIXEDMAP;
             }else{
-              flags &= ~MDB_NODUPDATA;
+              flags &= ~MDB_FIXEDMAP;
             }
-        } else if( strcmp(zArg, "-nooverwrite")==0 ){
+        } else if( strcmp(zArg, "-nosubdir")==0 ){
             int b;
             if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
             if( b ){
-              flags |= MDB_NOOVERWRITE;
+              flags |= MDB_NOSUBDIR;
             }else{
-              flags &= ~MDB_NOOVERWRITE;
+              flags &= ~MDB_NOSUBDIR;
             }
-        } else if( strcmp(zArg, "-append")==0 ){
+        } else if( strcmp(zArg, "-readonly")==0 ){
             int b;
             if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
             if( b ){
-              flags |= MDB_APPEND;
+              flags |= MDB_RDONLY;
             }else{
-              flags &= ~MDB_APPEND;
+              flags &= ~MDB_RDONLY;
             }
-        } else if( strcmp(zArg, "-appenddup")==0 ){
+        } else if( strcmp(zArg, "-nosync")==0 ){
             int b;
             if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
             if( b ){
-              flags |= MDB_APPENDDUP;
+              flags |= MDB_NOSYNC;
             }else{
-              flags &= ~MDB_APPENDDUP;
+              flags &= ~MDB_NOSYNC;
+            }
+        } else if( strcmp(zArg, "-nordahead")==0 ){
+            /*
+             * Turn off readahead. Most operating systems perform readahead on
+             * read requests by default.
+             * Turning it off may help random read performance when the DB is
+             * larger than RAM and system RAM is full.
+             * The option is not implemented on Windows.
+             */
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_NORDAHEAD;
+            }else{
+              flags &= ~MDB_NORDAHEAD;
             }
         } else{
            Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
@@ -1008,33 +7700,57 @@ static int LMDB_DBI(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
         }
       }
 
-      if(!txnHandle) {
+      if(!path) {
         if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "empty path string ", (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
+      result = mdb_env_open(env, path, flags, (mdb_mode_t)mode);
+      if(result == 0) {
+        LMDB_Vlog *vlog;
+
+        /*
+         * An environment with a value log gets it back with threshold
+         * 0, so pointer records are resolved without env_handle vlog.
+         */
+        result = LMDB_VlogOpen(env, 0, &vlog);
+        if(result == 0) {
+          mdb_env_set_userctx(env, vlog);
+        } else if(result == ENOENT) {
+          result = 0;
+        }
+      }
+      if(result != 0) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
 
-      mkey.mv_size = key_len;
-      mkey.mv_data = key;
-      mdata.mv_size = data_len;
-      mdata.mv_data = data;
+      break;
+    }
+
+    case DBENV_SET_MAPSIZE: {
+      Tcl_WideInt wideValue;
+
+      if( objc == 3 ){
+        if(Tcl_GetWideIntFromObj(interp, objv[2], &wideValue) != TCL_OK) {
+            return TCL_ERROR;
+        }
+      }else{
+        Tcl_WrongNumArgs(interp, 2, objv, "size");
+        return TCL_ERROR;
+      }
 
-      result = mdb_put (txn, dbi, &mkey, &mdata, flags);
+      result = mdb_env_set_mapsize(env, (size_t) wideValue);
       if(result != 0) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
@@ -1049,64 +7765,202 @@ static int LMDB_DBI(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
       break;
     }
 
-    case DBI_GET: {
-      char *key;
-      Tcl_Size len;
-      MDB_val mkey;
-      MDB_val mdata;
-      const char *zArg;
-      MDB_txn *txn;
-      Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
-      int i = 0;
-      Tcl_Obj *pResultStr;
+    case DBENV_SET_MAXREADERS: {
+      int value;
 
-      if( objc != 5 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "key -txn txnid ");
+      if( objc == 3 ){
+        if(Tcl_GetIntFromObj(interp, objv[2], &value) != TCL_OK) {
+            return TCL_ERROR;
+        }
+      }else{
+        Tcl_WrongNumArgs(interp, 2, objv, "nReaders ");
         return TCL_ERROR;
       }
 
-      key = Tcl_GetStringFromObj(objv[2], &len);
-      if( !key || len < 1 ){
+      result = mdb_env_set_maxreaders(env, value);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
         return TCL_ERROR;
       }
 
-      for(i=3; i+1<objc; i+=2){
-        zArg = Tcl_GetStringFromObj(objv[i], 0);
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
 
-        if( strcmp(zArg, "-txn")==0 ){
-            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else{
-           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-           return TCL_ERROR;
+      break;
+    }
+
+    case DBENV_SET_MAXDBS: {
+      int value;
+
+      if( objc == 3 ){
+        if(Tcl_GetIntFromObj(interp, objv[2], &value) != TCL_OK) {
+            return TCL_ERROR;
         }
+      }else{
+        Tcl_WrongNumArgs(interp, 2, objv, "nDbs");
+        return TCL_ERROR;
       }
 
-      if(!txnHandle) {
+      result = mdb_env_set_maxdbs(env, value);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case DBENV_SYNC: {
+      int value;
+
+      if( objc == 3 ){
+        if(Tcl_GetIntFromObj(interp, objv[2], &value) != TCL_OK) {
+            return TCL_ERROR;
+        }
+      }else{
+        Tcl_WrongNumArgs(interp, 2, objv, "force");
+        return TCL_ERROR;
+      }
+
+      /*
+       * Data is always written to disk when mdb_txn_commit() is called, but
+       * the operating system may keep it buffered. LMDB always flushes the
+       * OS buffers upon commit as well, unless the environment was opened
+       * with MDB_NOSYNC or in part MDB_NOMETASYNC. This call is not valid
+       * if the environment was opened with MDB_RDONLY.
+       */
+      if(value) {  //If value is non-zero, force a synchronous flush.
+        result = mdb_env_sync(env, value);
+        if(result != 0) {
+          if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+          }
+
+          return TCL_ERROR;
+        }
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+
+      break;
+    }
+
+    case DBENV_STAT: {
+      MDB_stat stat;
+      Tcl_Obj *pResultStr = NULL;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      result = mdb_env_stat(env, &stat);
+      if(result != 0) {
         if( interp ) {
           Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
+        return TCL_ERROR;
+      }
+
+      pResultStr = Tcl_NewListObj(6, NULL);
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_psize));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_depth));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_branch_pages));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_leaf_pages));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_overflow_pages));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_entries));
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case DBENV_COPY: {
+      char *path;
+      char *zArg;
+      Tcl_Size len;
+      #if MDB_VERSION_MAJOR > 0 || \
+        (MDB_VERSION_MAJOR == 0 && (MDB_VERSION_MINOR > 9 || \
+                    (MDB_VERSION_MINOR == 9 && \
+                     MDB_VERSION_PATCH > 13)))
+      int flags = 0;
+      #endif
+
+      if( objc == 3 || objc == 5){
+        path = Tcl_GetStringFromObj(objv[2], &len);
+        if( !path || len < 1 ){
+            return TCL_ERROR;
+        }
+
+      #if MDB_VERSION_MAJOR > 0 || \
+        (MDB_VERSION_MAJOR == 0 && (MDB_VERSION_MINOR > 9 || \
+                    (MDB_VERSION_MINOR == 9 && \
+                     MDB_VERSION_PATCH > 13)))
+        if(objc == 5) {
+          zArg = Tcl_GetStringFromObj(objv[3], 0);
+          if( strcmp(zArg, "-cp_compact")==0 ){
+              int b;
+              if( Tcl_GetBooleanFromObj(interp, objv[4], &b) ) return TCL_ERROR;
+              if( b ){
+                flags |= MDB_CP_COMPACT ;
+              }else{
+                flags &= ~MDB_CP_COMPACT;
+              }
+          } else{
+             Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+             return TCL_ERROR;
+          }
         }
-
+        #endif
+      }else{
+        Tcl_WrongNumArgs(interp, 2, objv, "path ?-cp_compact boolean?");
         return TCL_ERROR;
       }
 
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
+      #if MDB_VERSION_MAJOR > 0 || \
+        (MDB_VERSION_MAJOR == 0 && (MDB_VERSION_MINOR > 9 || \
+                    (MDB_VERSION_MINOR == 9 && \
+                     MDB_VERSION_PATCH > 13)))
+      result = mdb_env_copy2(env, path, flags);
+      #else
+      result = mdb_env_copy(env, path);
+      #endif
+      if(result != 0) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
 
-      mkey.mv_size = len;
-      mkey.mv_data = key;
+      break;
+    }
 
-      result = mdb_get (txn, dbi, &mkey, &mdata);
+    case DBENV_GET_PATH: {
+      const char *path;
+      Tcl_Obj *pResultStr = NULL;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      result = mdb_env_get_path(env, &path);
       if(result != 0) {
         if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
@@ -1116,724 +7970,1435 @@ static int LMDB_DBI(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
         return TCL_ERROR;
       }
 
-      pResultStr = Tcl_NewStringObj( mdata.mv_data, mdata.mv_size );
+      pResultStr = Tcl_NewStringObj( path, -1 );
       Tcl_SetObjResult(interp, pResultStr);
 
       break;
     }
 
-    /*
-     * Add command to handle byte array.
-     * Use at your own risk.
-     */
-    case DBI_GET_BINARY: {
-      unsigned char *key;
-      Tcl_Size len;
-      MDB_val mkey;
-      MDB_val mdata;
-      const char *zArg;
-      MDB_txn *txn;
-      Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
-      int i = 0;
-      Tcl_Obj *pResultStr;
+    case DBENV_GET_MAXREADERS: {
+      unsigned int readers;
+      Tcl_Obj *pResultStr = NULL;
 
-      if( objc != 5 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "key -txn txnid ");
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
         return TCL_ERROR;
       }
 
-      key = Tcl_GetByteArrayFromObj(objv[2], &len);
-      if( !key || len < 1 ){
+      result = mdb_env_get_maxreaders(env, &readers);
+      if(result != 0) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
+
         return TCL_ERROR;
       }
 
-      for(i=3; i+1<objc; i+=2){
-        zArg = Tcl_GetStringFromObj(objv[i], 0);
+      pResultStr = Tcl_NewIntObj( readers );
+      Tcl_SetObjResult(interp, pResultStr);
 
-        if( strcmp(zArg, "-txn")==0 ){
-            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else{
-           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-           return TCL_ERROR;
-        }
-      }
+      break;
+    }
 
-      if(!txnHandle) {
-        if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
-        }
+    case DBENV_GET_MAXKEYSIZE: {
+      unsigned int maxkeysize;
+      Tcl_Obj *pResultStr = NULL;
 
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
         return TCL_ERROR;
       }
 
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
-        }
+      maxkeysize = mdb_env_get_maxkeysize(env);
+
+      pResultStr = Tcl_NewIntObj( maxkeysize );
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
 
+    case DBENV_CLOSE: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
         return TCL_ERROR;
       }
 
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
-
-      mkey.mv_size = len;
-      mkey.mv_data = key;
+      if( tsdPtr->reaper_hashtblPtr ){
+        Tcl_HashEntry *reaperEntryPtr;
 
-      result = mdb_get (txn, dbi, &mkey, &mdata);
-      if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        reaperEntryPtr = Tcl_FindHashEntry( tsdPtr->reaper_hashtblPtr, handle );
+        if( reaperEntryPtr ){
+          LMDB_ReaperFree((LMDB_Reaper *) Tcl_GetHashValue( reaperEntryPtr ));
         }
+      }
 
-        return TCL_ERROR;
+      if( mdb_env_get_userctx(env) ){
+        LMDB_VlogFree((LMDB_Vlog *) mdb_env_get_userctx(env));
+        mdb_env_set_userctx(env, NULL);
       }
 
-      pResultStr = Tcl_NewByteArrayObj( mdata.mv_data, mdata.mv_size );
-      Tcl_SetObjResult(interp, pResultStr);
+      mdb_env_close(env);
+      Tcl_MutexLock(&myMutex);
+      if( hashEntryPtr )  Tcl_DeleteHashEntry(hashEntryPtr);
+      Tcl_MutexUnlock(&myMutex);
+      Tcl_DeleteCommand(interp, handle);
 
       break;
     }
 
-    case DBI_DEL: {
-      char *key;
-      char *data;
-      Tcl_Size key_len;
-      Tcl_Size data_len;
-      MDB_val mkey;
-      MDB_val mdata;
-      int isEmptyData = 0;
-      const char *zArg;
+    case DBENV_TXN: {
+      char *zArg;
+      char *parentTxn = NULL;
+      Tcl_Size len = 0;
+      MDB_txn *parent = NULL;
+      int flags = 0;
       MDB_txn *txn;
+      LMDB_TxnInfo *info;
       Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
+      Tcl_HashEntry *newHashEntryPtr;
+      char handleName[16 + TCL_INTEGER_SPACE];
+      Tcl_Obj *pResultStr = NULL;
+      int newvalue;
       int i = 0;
 
-      if( objc < 6 || (objc&1)!=0 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "key data -txn txnid");
-        return TCL_ERROR;
-      }
-
-      key = Tcl_GetStringFromObj(objv[2], &key_len);
-      if( !key || key_len < 1 ){
+      if( objc < 2 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-parent txnid? ?-readonly boolean? ");
         return TCL_ERROR;
       }
 
-      /*
-       * Improve this command behavior.
-       * If user indicates data is an empty string "", don't return error.
-       */
-      data = Tcl_GetStringFromObj(objv[3], &data_len);
-      if( !data || data_len < 1 ){
-        //return TCL_ERROR;
-        isEmptyData = 1;
-      }
-
-      for(i=4; i+1<objc; i+=2){
+      for(i=2; i+1<objc; i+=2){
         zArg = Tcl_GetStringFromObj(objv[i], 0);
-        if( strcmp(zArg, "-txn")==0 ){
-            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+
+        if( strcmp(zArg, "-parent")==0 ){
+            parentTxn = Tcl_GetStringFromObj(objv[i+1], &len);
+            if( !parentTxn || len < 1 ){
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-readonly")==0 ){
+            int b;
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+            if( b ){
+              flags |= MDB_RDONLY ;
+            }else{
+              flags &= ~MDB_RDONLY;
+            }
         } else{
            Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
            return TCL_ERROR;
         }
       }
 
-      if(!txnHandle) {
-        if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+      if(parentTxn) {
+        txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, parentTxn );
+        if( !txnHashEntryPtr ) {
+          if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", parentTxn, (char *)NULL );
+          }
+
+          return TCL_ERROR;
         }
 
-        return TCL_ERROR;
+        parent = Tcl_GetHashValue( txnHashEntryPtr );
       }
 
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
+      result = mdb_txn_begin(env, parent, flags, &txn);
+      if(result != 0) {
         if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
+      Tcl_MutexLock(&myMutex);
+      sprintf( handleName, "%s.txn%d", handle, tsdPtr->txn_count++ );
 
-      mkey.mv_size = key_len;
-      mkey.mv_data = key;
+      pResultStr = Tcl_NewStringObj( handleName, -1 );
 
-      /*
-       * Improve this command behavior.
-       * Data is not a empty data, get it.
-       */
-      if(isEmptyData == 0) {
-        mdata.mv_size = data_len;
-        mdata.mv_data = data;
+      newHashEntryPtr = Tcl_CreateHashEntry(tsdPtr->lmdb_hashtblPtr, handleName, &newvalue);
+      Tcl_SetHashValue(newHashEntryPtr, txn);
+      Tcl_MutexUnlock(&myMutex);
+
+      if( tsdPtr->txninfo_hashtblPtr == NULL ){
+        tsdPtr->txninfo_hashtblPtr = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+        Tcl_InitHashTable(tsdPtr->txninfo_hashtblPtr, TCL_STRING_KEYS);
       }
 
-      /*
-       * Improve this command behavior.
-       * If the database supports sorted duplicates and the data parameter is NULL,
-       * all of the duplicate data items for the key will be deleted.
-       * Otherwise, if the data parameter is non-NULL only the matching data item
-       * will be deleted.
-       */
-      if(isEmptyData == 0) {
-        result = mdb_del (txn, dbi, &mkey, &mdata);
-      } else {
-        result = mdb_del (txn, dbi, &mkey, NULL);
+      info = (LMDB_TxnInfo *) ckalloc(sizeof(LMDB_TxnInfo));
+      memset(info, 0, sizeof(LMDB_TxnInfo));
+      info->env = env;
+      info->readonly = (flags & MDB_RDONLY) ? 1 : 0;
+      info->nested = parent ? 1 : 0;
+      info->entryPtr = Tcl_CreateHashEntry(tsdPtr->txninfo_hashtblPtr, handleName, &newvalue);
+      Tcl_SetHashValue(info->entryPtr, info);
+      LMDB_TxnInfoStart(interp, info);
+
+      Tcl_CreateObjCommand(interp, handleName, (Tcl_ObjCmdProc *) LMDB_TXN,
+            (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case DBENV_INFO: {
+      MDB_envinfo info;
+      const char *env_path = NULL;
+      Tcl_Obj *pResultStr = NULL;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      if (mdb_env_get_path(env, &env_path) || env_path == NULL)
+      {
+          if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "env was not open", (char *)NULL );
+          }
+          return TCL_ERROR;
       }
+
+      result = mdb_env_info(env, &info);
       if(result != 0) {
         if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+      pResultStr = Tcl_NewListObj(5, NULL);
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj((Tcl_WideInt) info.me_mapsize));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj((Tcl_WideInt) info.me_last_pgno));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj((Tcl_WideInt) info.me_last_txnid));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(info.me_maxreaders));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(info.me_numreaders));
+
+      Tcl_SetObjResult(interp, pResultStr);
 
       break;
     }
 
-    /*
-     * Add command to handle byte array.
-     * Use at your own risk.
-     */
-    case DBI_DEL_BINARY: {
-      unsigned char *key;
-      unsigned char *data;
-      Tcl_Size key_len;
-      Tcl_Size data_len;
-      MDB_val mkey;
-      MDB_val mdata;
-      int isEmptyData = 0;
-      const char *zArg;
-      MDB_txn *txn;
-      Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
-      int i = 0;
+    case DBENV_READER_LIST: {
+      LMDB_ReaderScan scan;
 
-      if( objc < 6 || (objc&1)!=0 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "key data -txn txnid");
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
         return TCL_ERROR;
       }
 
-      key = Tcl_GetByteArrayFromObj(objv[2], &key_len);
-      if( !key || key_len < 1 ){
+      scan.listPtr = Tcl_NewListObj(0, NULL);
+      scan.active = 0;
+      scan.oldest = -1;
+
+      result = mdb_reader_list(env, LMDB_ReaderListFunc, &scan);
+      if(result < 0) {
+        Tcl_DecrRefCount(scan.listPtr);
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "ERROR: reader list failed", (char *)NULL );
+        }
+
         return TCL_ERROR;
       }
 
-      /*
-       * Improve this command behavior.
-       * If user indicates data is an empty string "", don't return error.
-       */
-      data = Tcl_GetByteArrayFromObj(objv[3], &data_len);
-      if( !data || data_len < 1 ){
-        //return TCL_ERROR;
-        isEmptyData = 1;
-      }
+      Tcl_SetObjResult(interp, scan.listPtr);
 
-      for(i=4; i+1<objc; i+=2){
-        zArg = Tcl_GetStringFromObj(objv[i], 0);
-        if( strcmp(zArg, "-txn")==0 ){
-            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else{
-           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-           return TCL_ERROR;
-        }
+      break;
+    }
+
+    case DBENV_READER_CHECK: {
+      int dead = 0;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
       }
 
-      if(!txnHandle) {
+      result = mdb_reader_check(env, &dead);
+      if(result != 0) {
         if( interp ) {
           Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
-        }
+      Tcl_SetObjResult(interp, Tcl_NewIntObj( dead ));
+
+      break;
+    }
+
+    case DBENV_REAPER: {
+      int interval;
+      int newvalue;
+      const char *env_path = NULL;
+      Tcl_HashEntry *reaperEntryPtr = NULL;
+      LMDB_Reaper *reaper = NULL;
+      Tcl_Obj *pResultStr = NULL;
 
+      if( objc > 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?interval? ?script?");
         return TCL_ERROR;
       }
 
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
+      if( tsdPtr->reaper_hashtblPtr == NULL ){
+        tsdPtr->reaper_hashtblPtr = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+        Tcl_InitHashTable(tsdPtr->reaper_hashtblPtr, TCL_STRING_KEYS);
+      }
 
-      mkey.mv_size = key_len;
-      mkey.mv_data = key;
+      reaperEntryPtr = Tcl_FindHashEntry( tsdPtr->reaper_hashtblPtr, handle );
+      if( reaperEntryPtr ){
+        reaper = (LMDB_Reaper *) Tcl_GetHashValue( reaperEntryPtr );
+      }
 
       /*
-       * Improve this command behavior.
-       * Data is not a empty data, get it.
+       * Without arguments report the state of the reaper:
+       * {interval dead lag} of the last run.
        */
-      if(isEmptyData == 0) {
-        mdata.mv_size = data_len;
-        mdata.mv_data = data;
+      if( objc == 2 ){
+        pResultStr = Tcl_NewListObj(3, NULL);
+        Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(reaper ? reaper->interval : 0));
+        Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(reaper ? reaper->lastDead : 0));
+        Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj(reaper ? reaper->lastLag : 0));
+        Tcl_SetObjResult(interp, pResultStr);
+        break;
+      }
+
+      if(Tcl_GetIntFromObj(interp, objv[2], &interval) != TCL_OK) {
+        return TCL_ERROR;
+      }
+
+      if( interval < 0 ){
+        Tcl_AppendResult(interp, "interval must be >= 0", (char*)0);
+        return TCL_ERROR;
       }
 
       /*
-       * Improve this command behavior.
-       * If the database supports sorted duplicates and the data parameter is NULL,
-       * all of the duplicate data items for the key will be deleted.
-       * Otherwise, if the data parameter is non-NULL only the matching data item
-       * will be deleted.
+       * Interval 0 stops the reaper.
        */
-      if(isEmptyData == 0) {
-        result = mdb_del (txn, dbi, &mkey, &mdata);
-      } else {
-        result = mdb_del (txn, dbi, &mkey, NULL);
+      if( interval == 0 ){
+        if( reaper ) LMDB_ReaperFree(reaper);
+        Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+        break;
       }
-      if(result != 0) {
-        if( interp ) {
+
+      if (mdb_env_get_path(env, &env_path) || env_path == NULL)
+      {
+          if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
+            Tcl_AppendStringsToObj( resultObj, "env was not open", (char *)NULL );
+          }
+          return TCL_ERROR;
+      }
 
-        return TCL_ERROR;
+      if( !reaper ){
+        reaper = (LMDB_Reaper *) ckalloc(sizeof(LMDB_Reaper));
+        memset(reaper, 0, sizeof(LMDB_Reaper));
+        reaper->env = env;
+        reaper->entryPtr = Tcl_CreateHashEntry(tsdPtr->reaper_hashtblPtr, handle, &newvalue);
+        Tcl_SetHashValue(reaper->entryPtr, reaper);
+      }
+
+      if( reaper->timer ){
+        Tcl_DeleteTimerHandler(reaper->timer);
       }
+      if( reaper->script ){
+        Tcl_DecrRefCount(reaper->script);
+        reaper->script = NULL;
+      }
+
+      reaper->interp = interp;
+      reaper->interval = interval;
+      if( objc == 4 ){
+        reaper->script = objv[3];
+        Tcl_IncrRefCount(reaper->script);
+      }
+      reaper->timer = Tcl_CreateTimerHandler(interval, LMDB_ReaperTimer,
+                          (ClientData) reaper);
 
       Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
 
       break;
     }
 
-    case DBI_DROP: {
-      int del_flag;
-      const char *zArg;
-      MDB_txn *txn;
-      Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
-      int i = 0;
+    case DBENV_VLOG: {
+      Tcl_WideInt threshold;
+      LMDB_Vlog *vlog = (LMDB_Vlog *) mdb_env_get_userctx(env);
+      Tcl_Obj *pResultStr = NULL;
 
-      if( objc < 5  || (objc&1)!=1 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "del_flag -txn txnid");
+      if( objc > 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?threshold?");
         return TCL_ERROR;
       }
 
-      if(Tcl_GetIntFromObj(interp, objv[2], &del_flag) != TCL_OK) {
-            return TCL_ERROR;
-        }
-
-      for(i=3; i+1<objc; i+=2){
-        zArg = Tcl_GetStringFromObj(objv[i], 0);
-
-        if( strcmp(zArg, "-txn")==0 ){
-            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else{
-           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-           return TCL_ERROR;
-        }
+      /*
+       * Without arguments report {threshold generation size}, size is
+       * the size of the current log file.
+       */
+      if( objc == 2 ){
+        pResultStr = Tcl_NewListObj(3, NULL);
+        Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj(vlog ? vlog->threshold : 0));
+        Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj(vlog ? (Tcl_WideInt) vlog->gen : 0));
+        Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj(vlog ? LMDB_VlogSize(vlog, vlog->gen) : 0));
+        Tcl_SetObjResult(interp, pResultStr);
+        break;
       }
 
-      if(!txnHandle) {
-        if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
-        }
-
+      if(Tcl_GetWideIntFromObj(interp, objv[2], &threshold) != TCL_OK) {
         return TCL_ERROR;
       }
 
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
-        }
-
+      if( threshold < 0 ){
+        Tcl_AppendResult(interp, "threshold must be >= 0", (char*)0);
         return TCL_ERROR;
       }
 
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
-      result = mdb_drop (txn, dbi, del_flag);
-      if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+      if( !vlog ){
+        result = LMDB_VlogOpen(env, 1, &vlog);
+        if(result == EINVAL) {
+          Tcl_AppendResult(interp, "env was not open", (char*)0);
+          return TCL_ERROR;
         }
-
-        return TCL_ERROR;
+        if(result != 0) {
+          Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
+          return TCL_ERROR;
+        }
+        mdb_env_set_userctx(env, vlog);
       }
 
       /*
-       * Improve dbi_handle drop command behavior when del_flag equals 1.
-       * If del_flag equals 1, delete dbi_handle command.
-       *
-       * mdb_drop close the DB handle if del_flag equals 1, I think need do this.
+       * Threshold 0 stops moving new values to the log; pointer
+       * records already stored are still resolved.
        */
-      if(del_flag) {
-          Tcl_MutexLock(&myMutex);
-          if( hashEntryPtr )  Tcl_DeleteHashEntry(hashEntryPtr);
-          Tcl_MutexUnlock(&myMutex);
-          Tcl_DeleteCommand(interp, dbiHandle);
-      }
+      vlog->threshold = threshold;
 
       Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
 
       break;
     }
 
-    case DBI_CLOSE: {
-      const char *zArg;
-      MDB_env *env;
-      Tcl_HashEntry *envHashEntryPtr;
-      char *envHandle;
-      int i = 0;
+    case DBENV_VLOG_COMPACT: {
+      Tcl_WideInt moved;
+      Tcl_WideInt reclaimed;
+      LMDB_Vlog *vlog = (LMDB_Vlog *) mdb_env_get_userctx(env);
+      Tcl_Obj *pResultStr = NULL;
 
-      if( objc != 4 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "-env env_handle");
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
         return TCL_ERROR;
       }
 
-      for(i=2; i+1<objc; i+=2){
-        zArg = Tcl_GetStringFromObj(objv[i], 0);
-
-        if( strcmp(zArg, "-env")==0 ){
-            envHandle = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else{
-           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-           return TCL_ERROR;
-        }
+      if( !vlog ){
+        Tcl_AppendResult(interp, "value log is not enabled", (char*)0);
+        return TCL_ERROR;
       }
 
-      envHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, envHandle );
-      if( !envHashEntryPtr ) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", envHandle, (char *)NULL );
-        }
+      if( LMDB_TxnInfoWriting(tsdPtr, env) ){
+        Tcl_AppendResult(interp, "a write transaction of this thread is "
+            "open on the environment", (char*)0);
+        return TCL_ERROR;
+      }
 
+      result = LMDB_VlogCompact(env, vlog, &moved, &reclaimed);
+      if(result != 0) {
+        Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(result), (char*)0);
         return TCL_ERROR;
       }
 
-      env = Tcl_GetHashValue( envHashEntryPtr );
-      mdb_dbi_close(env, dbi);
-      Tcl_MutexLock(&myMutex);
-      if( hashEntryPtr )  Tcl_DeleteHashEntry(hashEntryPtr);
-      Tcl_MutexUnlock(&myMutex);
-      Tcl_DeleteCommand(interp, dbiHandle);
+      pResultStr = Tcl_NewListObj(2, NULL);
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj(moved));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj(reclaimed));
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+  }
+
+  return TCL_OK;
+}
+
+
+/*
+ * lmdb dump writes several databases in parallel: each worker thread
+ * begins its own read transaction and exports its share of the databases
+ * into in-memory queues, which the calling thread writes to the channel
+ * in database order. The transactions must all see the same snapshot, so
+ * they are begun again until their txnids agree.
+ */
+
+/* A worker stops producing while this much output of one db is queued. */
+#define LMDB_DUMP_QUEUE_MAX (4 * 1024 * 1024)
+
+typedef struct LMDB_DumpChunk {
+  struct LMDB_DumpChunk *next;
+  Tcl_Size len;
+  char data[1];
+} LMDB_DumpChunk;
+
+struct LMDB_Dump;
+
+typedef struct LMDB_DumpDb {
+  struct LMDB_Dump *dump;
+  char *name;                     /* NULL for the main DB */
+  MDB_dbi dbi;
+  LMDB_DumpChunk *head, *tail;
+  Tcl_Size queued;                /* bytes in the queue */
+  int done;
+  int result;                     /* of LMDB_ExportDbi */
+  Tcl_WideInt count;
+} LMDB_DumpDb;
+
+typedef struct LMDB_Dump {
+  MDB_env *env;
+  int print;
+  LMDB_DumpDb *dbs;
+  int ndbs;
+  int nthreads;
+  LMDB_Snapshot snap;
+  Tcl_Mutex mutex;
+  Tcl_Condition cond;
+  int cancel;                     /* the calling thread gave up */
+} LMDB_Dump;
+
+typedef struct LMDB_DumpWorker {
+  LMDB_Dump *dump;
+  int index;
+  Tcl_ThreadId tid;
+} LMDB_DumpWorker;
+
+
+static int LMDB_DumpSink(void *ctx, const char *buf, Tcl_Size len)
+{
+  LMDB_DumpDb *db = (LMDB_DumpDb *) ctx;
+  LMDB_Dump *dump = db->dump;
+  LMDB_DumpChunk *chunk;
+
+  chunk = (LMDB_DumpChunk *) ckalloc(sizeof(LMDB_DumpChunk) + len);
+  chunk->next = NULL;
+  chunk->len = len;
+  memcpy(chunk->data, buf, len);
+
+  Tcl_MutexLock(&dump->mutex);
+  while(db->queued > LMDB_DUMP_QUEUE_MAX && !dump->cancel) {
+    Tcl_ConditionWait(&dump->cond, &dump->mutex, NULL);
+  }
+  if(dump->cancel) {
+    Tcl_MutexUnlock(&dump->mutex);
+    ckfree((char *) chunk);
+    return 1;
+  }
+  if(db->tail) {
+    db->tail->next = chunk;
+  } else {
+    db->head = chunk;
+  }
+  db->tail = chunk;
+  db->queued += len;
+  Tcl_ConditionNotify(&dump->cond);
+  Tcl_MutexUnlock(&dump->mutex);
+
+  return 0;
+}
+
+
+static Tcl_ThreadCreateType LMDB_DumpThread(ClientData clientData)
+{
+  LMDB_DumpWorker *worker = (LMDB_DumpWorker *) clientData;
+  LMDB_Dump *dump = worker->dump;
+  MDB_txn *txn;
+  int result;
+  int i;
+
+  txn = LMDB_SnapshotBegin(&dump->snap, worker->index);
+  if(!txn) {
+    goto done;
+  }
+
+  for(i = worker->index; i < dump->ndbs; i += dump->nthreads) {
+    LMDB_DumpDb *db = &dump->dbs[i];
+    Tcl_WideInt count;
+
+    result = LMDB_ExportDbi(txn, db->dbi, LMDB_FORMAT_MDBDUMP, dump->print,
+                            db->name, NULL, NULL, NULL, LMDB_DumpSink, db,
+                            &count);
+
+    Tcl_MutexLock(&dump->mutex);
+    db->result = result;
+    db->count = count;
+    db->done = 1;
+    Tcl_ConditionNotify(&dump->cond);
+    Tcl_MutexUnlock(&dump->mutex);
+
+    if(result != 0) {
+      break;
+    }
+  }
+
+  mdb_txn_abort(txn);
+
+done:
+  Tcl_FinalizeThread();
+  TCL_THREAD_CREATE_RETURN;
+}
+
 
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+/*
+ * Run the workers and write their output to chan. Returns 0, an LMDB
+ * error code or LMDB_EXPORT_SINKERR; the record count is in *countPtr.
+ */
+static int LMDB_DumpParallel(Tcl_Interp *interp, LMDB_Dump *dump,
+                             Tcl_Channel chan, Tcl_WideInt *countPtr)
+{
+  LMDB_DumpWorker *workers;
+  int started = 0;
+  int result = 0;
+  int i;
+
+  workers = (LMDB_DumpWorker *) ckalloc(dump->nthreads * sizeof(LMDB_DumpWorker));
+  LMDB_SnapshotInit(&dump->snap, dump->env, dump->nthreads);
+  for(i = 0; i < dump->ndbs; i++) {
+    dump->dbs[i].dump = dump;
+  }
 
+  for(i = 0; i < dump->nthreads; i++) {
+    workers[i].dump = dump;
+    workers[i].index = i;
+    if(Tcl_CreateThread(&workers[i].tid, LMDB_DumpThread, &workers[i],
+                        TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
       break;
     }
+    started++;
+  }
+  if(started < dump->nthreads) {
+    /* The databases of the missing workers would never be written. */
+    dump->nthreads = started;
+    result = EAGAIN;
+  }
+  result = LMDB_SnapshotAgree(&dump->snap, started, result);
 
-    case DBI_STAT: {
-      const char *zArg;
-      MDB_txn *txn;
-      MDB_stat stat;
-      Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
-      int i = 0;
-      Tcl_Obj *pResultStr = NULL;
+  /* Write the queues in database order. */
+  for(i = 0; i < dump->ndbs && result == 0; i++) {
+    LMDB_DumpDb *db = &dump->dbs[i];
 
-      if( objc != 4 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid ");
-        return TCL_ERROR;
+    for(;;) {
+      LMDB_DumpChunk *chunk;
+      int done;
+
+      Tcl_MutexLock(&dump->mutex);
+      while(!db->head && !db->done) {
+        Tcl_ConditionWait(&dump->cond, &dump->mutex, NULL);
       }
+      chunk = db->head;
+      db->head = db->tail = NULL;
+      db->queued = 0;
+      done = db->done;
+      Tcl_ConditionNotify(&dump->cond);
+      Tcl_MutexUnlock(&dump->mutex);
 
-      for(i=2; i+1<objc; i+=2){
-        zArg = Tcl_GetStringFromObj(objv[i], 0);
-        if( strcmp(zArg, "-txn")==0 ){
-            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else{
-           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-           return TCL_ERROR;
+      while(chunk) {
+        LMDB_DumpChunk *next = chunk->next;
+
+        if(result == 0 && Tcl_Write(chan, chunk->data, chunk->len) != chunk->len) {
+          result = LMDB_EXPORT_SINKERR;
         }
+        ckfree((char *) chunk);
+        chunk = next;
       }
-
-      if(!txnHandle) {
-        if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
+      if(result != 0) {
+        break;
+      }
+      if(done) {
+        Tcl_MutexLock(&dump->mutex);
+        /* More may have been queued before done was set. */
+        done = (db->head == NULL);
+        Tcl_MutexUnlock(&dump->mutex);
+        if(done) {
+          result = db->result;
+          *countPtr += db->count;
+          break;
         }
-
-        return TCL_ERROR;
       }
+    }
+  }
 
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
-        }
+  Tcl_MutexLock(&dump->mutex);
+  dump->cancel = 1;
+  Tcl_ConditionNotify(&dump->cond);
+  Tcl_MutexUnlock(&dump->mutex);
 
-        return TCL_ERROR;
-      }
+  for(i = 0; i < started; i++) {
+    int state;
+    Tcl_JoinThread(workers[i].tid, &state);
+  }
 
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
-      result = mdb_stat(txn, dbi, &stat);
-      if(result != 0) {
-        if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+  /* Drop what a failed or cancelled dump left queued. */
+  for(i = 0; i < dump->ndbs; i++) {
+    while(dump->dbs[i].head) {
+      LMDB_DumpChunk *next = dump->dbs[i].head->next;
+      ckfree((char *) dump->dbs[i].head);
+      dump->dbs[i].head = next;
+    }
+  }
 
-          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
+  ckfree((char *) workers);
+  LMDB_SnapshotFree(&dump->snap);
+  Tcl_MutexFinalize(&dump->mutex);
+  Tcl_ConditionFinalize(&dump->cond);
+  return result;
+}
 
-        return TCL_ERROR;
-      }
 
-      pResultStr = Tcl_NewListObj(6, NULL);
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_psize));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_depth));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_branch_pages));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_leaf_pages));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_overflow_pages));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_entries));
+/*
+ * Find the databases to dump: the main DB, the named database name, or
+ * with all every named database. The handles are opened in a read-only
+ * transaction that is committed, so they stay open.
+ */
+static int LMDB_DumpDbs(MDB_env *env, const char *name, int all,
+                        LMDB_Dump *dump)
+{
+  MDB_txn *txn;
+  MDB_cursor *cursor = NULL;
+  MDB_val mkey, mdata;
+  MDB_dbi dbi;
+  int maxdbs = 0;
+  int result;
+  int rc;
 
-      Tcl_SetObjResult(interp, pResultStr);
+  result = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+  if(result != 0) {
+    return result;
+  }
 
-      break;
+  if(!all) {
+    result = mdb_dbi_open(txn, name, 0, &dbi);
+    if(result == 0) {
+      dump->dbs = (LMDB_DumpDb *) ckalloc(sizeof(LMDB_DumpDb));
+      memset(dump->dbs, 0, sizeof(LMDB_DumpDb));
+      dump->dbs[0].dbi = dbi;
+      if(name) {
+        dump->dbs[0].name = ckalloc(strlen(name) + 1);
+        strcpy(dump->dbs[0].name, name);
+      }
+      dump->ndbs = 1;
+    }
+  } else {
+    result = mdb_dbi_open(txn, NULL, 0, &dbi);
+    if(result == 0) {
+      result = mdb_cursor_open(txn, dbi, &cursor);
+    }
+    while(result == 0 &&
+          (result = mdb_cursor_get(cursor, &mkey, &mdata, MDB_NEXT_NODUP)) == 0) {
+      char *dbname;
+
+      /* Named databases are keys of the main DB without a NUL byte. */
+      if(memchr(mkey.mv_data, '\0', mkey.mv_size)) {
+        continue;
+      }
+      dbname = ckalloc(mkey.mv_size + 1);
+      memcpy(dbname, mkey.mv_data, mkey.mv_size);
+      dbname[mkey.mv_size] = '\0';
+      rc = mdb_dbi_open(txn, dbname, 0, &dbi);
+      if(rc != 0) {
+        ckfree(dbname);
+        if(rc == MDB_INCOMPATIBLE) {
+          /* A plain key, not a database. */
+          continue;
+        }
+        result = rc;
+        break;
+      }
+      if(dump->ndbs == maxdbs) {
+        maxdbs = maxdbs ? 2 * maxdbs : 8;
+        dump->dbs = (LMDB_DumpDb *) ckrealloc((char *) dump->dbs,
+                                              maxdbs * sizeof(LMDB_DumpDb));
+      }
+      memset(&dump->dbs[dump->ndbs], 0, sizeof(LMDB_DumpDb));
+      dump->dbs[dump->ndbs].dbi = dbi;
+      dump->dbs[dump->ndbs].name = dbname;
+      dump->ndbs++;
+    }
+    if(cursor) {
+      mdb_cursor_close(cursor);
     }
+    if(result == MDB_NOTFOUND) {
+      result = 0;
+    }
+  }
 
-    case DBI_CURSOR: {
-      const char *zArg;
-      MDB_txn *txn;
-      Tcl_HashEntry *txnHashEntryPtr;
-      char *txnHandle = NULL;
-      Tcl_HashEntry *newHashEntryPtr;
-      char handleName[16 + TCL_INTEGER_SPACE];
-      Tcl_Obj *pResultStr = NULL;
-      int newvalue;
-      int i = 0;
+  if(result == 0) {
+    result = mdb_txn_commit(txn);
+  } else {
+    mdb_txn_abort(txn);
+  }
+  return result;
+}
 
-      MDB_cursor *cursor;
 
-      if( objc != 4 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "-txn txnid");
-        return TCL_ERROR;
-      }
+/*
+ * lmdb load: read mdb_dump sections from a channel, create each database
+ * with the flags of its header and import its records.
+ */
+static int LMDB_Load(Tcl_Interp *interp, MDB_env *env, Tcl_Channel chan,
+                     const char *name, int batch, int append,
+                     Tcl_WideInt *countPtr)
+{
+  static const struct {
+    const char *name;
+    unsigned int bit;
+  } dbflags[] = {
+    { "reversekey", MDB_REVERSEKEY },
+    { "duplicates", MDB_DUPSORT },
+    { "integerkey", MDB_INTEGERKEY },
+    { "dupfixed", MDB_DUPFIXED },
+    { "integerdup", MDB_INTEGERDUP },
+    { "reversedup", MDB_REVERSEDUP },
+    { NULL, 0 }
+  };
+  LMDB_Input in;
+  LMDB_Import im;
+  int sections = 0;
+  int result = TCL_OK;
+
+  memset(&im, 0, sizeof(im));
+  im.env = env;
+  im.format = LMDB_FORMAT_MDBDUMP;
+  Tcl_DStringInit(&im.data);
+  Tcl_DStringInit(&im.prevKey);
+  LMDB_InputInit(&in, chan);
+
+  for(;;) {
+    Tcl_Obj *header;
+    Tcl_Obj **elems;
+    Tcl_Size nelems;
+    const char *dbname = name;
+    unsigned int flags = MDB_CREATE;
+    Tcl_WideInt mapsize = 0;
+    MDB_txn *txn;
+    MDB_envinfo info;
+    Tcl_Size i;
+    int rc;
+    int j;
+
+    if(LMDB_ImportHeader(interp, &in, &header, &im.print) != TCL_OK) {
+      result = TCL_ERROR;
+      break;
+    }
+    if(!header) {
+      break;
+    }
+    sections++;
 
-      for(i=2; i+1<objc; i+=2){
-        zArg = Tcl_GetStringFromObj(objv[i], 0);
-        if( strcmp(zArg, "-txn")==0 ){
-            txnHandle = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else{
-           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-           return TCL_ERROR;
+    Tcl_ListObjGetElements(NULL, header, &nelems, &elems);
+    for(i = 0; i + 1 < nelems; i += 2) {
+      const char *key = Tcl_GetString(elems[i]);
+      const char *value = Tcl_GetString(elems[i+1]);
+
+      if(strcmp(key, "database") == 0) {
+        if(!name) dbname = value;
+      } else if(strcmp(key, "mapsize") == 0) {
+        Tcl_GetWideIntFromObj(NULL, elems[i+1], &mapsize);
+      } else {
+        for(j = 0; dbflags[j].name; j++) {
+          if(strcmp(key, dbflags[j].name) == 0 && strcmp(value, "1") == 0) {
+            flags |= dbflags[j].bit;
+          }
         }
       }
+    }
 
-      if(!txnHandle) {
-        if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", (char *)NULL );
-        }
+    /* Grow the map like mdb_load does, a smaller one is left alone. */
+    mdb_env_info(env, &info);
+    if(mapsize > 0 && (size_t) mapsize > info.me_mapsize) {
+      mdb_env_set_mapsize(env, (size_t) mapsize);
+    }
 
-        return TCL_ERROR;
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if(rc == 0) {
+      rc = mdb_dbi_open(txn, dbname, flags, &im.dbi);
+      if(rc == 0) {
+        rc = mdb_txn_commit(txn);
+      } else {
+        mdb_txn_abort(txn);
       }
+    }
+    Tcl_DecrRefCount(header);
+    if(rc != 0) {
+      Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(rc), (char *)NULL);
+      result = TCL_ERROR;
+      break;
+    }
 
-      txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-      if( !txnHashEntryPtr ) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
-        }
+    im.append = append;
+    im.autoAppend = (append == -1);
+    im.havePrev = 0;
+    if(LMDB_ImportRun(interp, &im, &in, batch, 0) != TCL_OK) {
+      result = TCL_ERROR;
+      break;
+    }
+  }
 
-        return TCL_ERROR;
-      }
+  if(result == TCL_OK && sections == 0) {
+    Tcl_AppendResult(interp, "empty dump", (char *)NULL);
+    result = TCL_ERROR;
+  }
 
-      txn = Tcl_GetHashValue( txnHashEntryPtr );
-      result = mdb_cursor_open(txn, dbi, &cursor);
-      if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
+  Tcl_DStringFree(&in.buf);
+  Tcl_DStringFree(&im.data);
+  Tcl_DStringFree(&im.prevKey);
+  if(im.recs) {
+    ckfree((char *) im.recs);
+  }
+  *countPtr = im.count;
+  return result;
+}
 
-        return TCL_ERROR;
-      }
 
-      Tcl_MutexLock(&myMutex);
-      sprintf( handleName, "%s.c%d", dbiHandle, tsdPtr->cur_count++ );
+/*
+ * lmdb bulkload: an external merge sort in front of MDB_APPEND. The
+ * input is read in runs of about runsize bytes, worker threads sort the
+ * runs and spill them to temporary files, and the sorted runs are then
+ * merged and stored in key order, so nearly every put is an append.
+ */
+#define LMDB_BULK_RUNSIZE (64 * 1024 * 1024)
 
-      pResultStr = Tcl_NewStringObj( handleName, -1 );
+#define LMDB_BULK_FILEBUF (256 * 1024)
 
-      newHashEntryPtr = Tcl_CreateHashEntry(tsdPtr->lmdb_hashtblPtr, handleName, &newvalue);
-      Tcl_SetHashValue(newHashEntryPtr, cursor);
-      Tcl_MutexUnlock(&myMutex);
+typedef struct LMDB_Bulk {
+  MDB_txn *txn;                   /* for mdb_cmp and mdb_dcmp only */
+  MDB_dbi dbi;
+  int dupsort;
+} LMDB_Bulk;
+
+typedef struct LMDB_BulkRun {
+  LMDB_Bulk *bulk;
+  int index;                      /* input order, breaks ties */
+  LMDB_Import im;                 /* records while in memory */
+  Tcl_ThreadId tid;
+  int running;                    /* a worker owns the run */
+  FILE *file;                     /* spilled records, or NULL */
+  int error;                      /* errno of the spill, 0 is OK */
+  int pos;                        /* next record of an in-memory run */
+  Tcl_DString cur;                /* current record of a spilled run */
+  MDB_val key, data;              /* current record */
+} LMDB_BulkRun;
+
+static int LMDB_BulkCmp(LMDB_Bulk *bulk, MDB_val *ka, MDB_val *da,
+                        MDB_val *kb, MDB_val *db)
+{
+  int cmp = mdb_cmp(bulk->txn, bulk->dbi, ka, kb);
 
-      Tcl_CreateObjCommand(interp, handleName, (Tcl_ObjCmdProc *) LMDB_CUR,
-            (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+  if(cmp == 0 && bulk->dupsort) {
+    cmp = mdb_dcmp(bulk->txn, bulk->dbi, da, db);
+  }
+  return cmp;
+}
 
-      Tcl_SetObjResult(interp, pResultStr);
+static int LMDB_BulkRecCmp(LMDB_Bulk *bulk, LMDB_Import *im,
+                           LMDB_ImportRec *a, LMDB_ImportRec *b)
+{
+  char *base = Tcl_DStringValue(&im->data);
+  MDB_val ka, da, kb, db;
+
+  ka.mv_size = a->klen;
+  ka.mv_data = base + a->koff;
+  da.mv_size = a->dlen;
+  da.mv_data = base + a->doff;
+  kb.mv_size = b->klen;
+  kb.mv_data = base + b->koff;
+  db.mv_size = b->dlen;
+  db.mv_data = base + b->doff;
+  return LMDB_BulkCmp(bulk, &ka, &da, &kb, &db);
+}
 
-      break;
-    }
+/*
+ * Bottom-up merge sort of the records of a run. It is stable, so of two
+ * equal keys the one read last stays last.
+ */
+static void LMDB_BulkSort(LMDB_Bulk *bulk, LMDB_Import *im)
+{
+  LMDB_ImportRec *src = im->recs;
+  LMDB_ImportRec *dst;
+  LMDB_ImportRec *tmp;
+  int n = im->nrecs;
+  int width;
+
+  if(n < 2) {
+    return;
+  }
+  dst = (LMDB_ImportRec *) ckalloc(n * sizeof(LMDB_ImportRec));
+
+  for(width = 1; width < n; width *= 2) {
+    int lo;
 
+    for(lo = 0; lo < n; lo += 2 * width) {
+      int mid = lo + width < n ? lo + width : n;
+      int hi = lo + 2 * width < n ? lo + 2 * width : n;
+      int i = lo, j = mid, k = lo;
+
+      while(i < mid && j < hi) {
+        if(LMDB_BulkRecCmp(bulk, im, &src[j], &src[i]) < 0) {
+          dst[k++] = src[j++];
+        } else {
+          dst[k++] = src[i++];
+        }
+      }
+      while(i < mid) {
+        dst[k++] = src[i++];
+      }
+      while(j < hi) {
+        dst[k++] = src[j++];
+      }
+    }
+    tmp = src;
+    src = dst;
+    dst = tmp;
   }
 
-  return TCL_OK;
+  /* src holds the sorted records, keep it and free the other array. */
+  ckfree((char *) dst);
+  im->recs = src;
+  im->maxrecs = n;
 }
 
+static void LMDB_BulkPutLength(unsigned char *p, size_t len)
+{
+  p[0] = (unsigned char) (len >> 24);
+  p[1] = (unsigned char) (len >> 16);
+  p[2] = (unsigned char) (len >> 8);
+  p[3] = (unsigned char) len;
+}
 
-static int LMDB_TXN(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
-  int choice;
-  int result;
-  MDB_txn *txn;
-  Tcl_HashEntry *hashEntryPtr;
-  char *txnHandle;
+/*
+ * Write the sorted run to a temporary file in the binary export framing
+ * and drop it from memory. Returns 0 or an errno value.
+ */
+static int LMDB_BulkSpill(LMDB_BulkRun *run)
+{
+  LMDB_Import *im = &run->im;
+  char *base = Tcl_DStringValue(&im->data);
+  unsigned char len[4];
+  int i;
+
+  run->file = tmpfile();
+  if(!run->file) {
+    return errno ? errno : EIO;
+  }
+  setvbuf(run->file, NULL, _IOFBF, LMDB_BULK_FILEBUF);
 
-  ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
-      Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+  for(i = 0; i < im->nrecs; i++) {
+    LMDB_ImportRec *rec = &im->recs[i];
 
-  if (tsdPtr->initialized == 0) {
-    tsdPtr->initialized = 1;
-    tsdPtr->lmdb_hashtblPtr = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
-    Tcl_InitHashTable(tsdPtr->lmdb_hashtblPtr, TCL_STRING_KEYS);
+    LMDB_BulkPutLength(len, rec->klen);
+    if(fwrite(len, 1, 4, run->file) != 4 ||
+       fwrite(base + rec->koff, 1, rec->klen, run->file) != rec->klen) {
+      return errno ? errno : EIO;
+    }
+    LMDB_BulkPutLength(len, rec->dlen);
+    if(fwrite(len, 1, 4, run->file) != 4 ||
+       fwrite(base + rec->doff, 1, rec->dlen, run->file) != rec->dlen) {
+      return errno ? errno : EIO;
+    }
+  }
+  if(fflush(run->file) != 0 || fseek(run->file, 0L, SEEK_SET) != 0) {
+    return errno ? errno : EIO;
   }
 
-  static const char *DBTXN_strs[] = {
-    "abort",
-    "commit",
-    "reset",
-    "renew",
-    "close",
-    0
-  };
+  Tcl_DStringFree(&im->data);
+  ckfree((char *) im->recs);
+  im->recs = NULL;
+  im->nrecs = 0;
+  im->maxrecs = 0;
+  return 0;
+}
 
-  enum DBTXN_enum {
-    DBTXN_ABORT,
-    DBTXN_COMMIT,
-    DBTXN_RESET,
-    DBTXN_RENEW,
-    DBTXN_CLOSE,
-  };
+static Tcl_ThreadCreateType LMDB_BulkThread(ClientData clientData)
+{
+  LMDB_BulkRun *run = (LMDB_BulkRun *) clientData;
 
-  if( objc < 2 ){
-    Tcl_WrongNumArgs(interp, 1, objv, "SUBCOMMAND ...");
-    return TCL_ERROR;
+  LMDB_BulkSort(run->bulk, &run->im);
+  run->error = LMDB_BulkSpill(run);
+
+  Tcl_FinalizeThread();
+  TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ * Move a run to its next record. Returns 1, 0 at the end of the run or
+ * -1 with run->error set.
+ */
+static int LMDB_BulkNext(LMDB_BulkRun *run)
+{
+  unsigned char len[4];
+  size_t klen, dlen;
+  char *p;
+
+  if(!run->file) {
+    LMDB_ImportRec *rec;
+
+    if(run->pos == run->im.nrecs) {
+      return 0;
+    }
+    rec = &run->im.recs[run->pos++];
+    run->key.mv_size = rec->klen;
+    run->key.mv_data = Tcl_DStringValue(&run->im.data) + rec->koff;
+    run->data.mv_size = rec->dlen;
+    run->data.mv_data = Tcl_DStringValue(&run->im.data) + rec->doff;
+    return 1;
   }
 
-  if( Tcl_GetIndexFromObj(interp, objv[1], DBTXN_strs, "option", 0, &choice) ){
-    return TCL_ERROR;
+  if(fread(len, 1, 4, run->file) != 4) {
+    if(feof(run->file)) {
+      return 0;
+    }
+    goto error;
+  }
+  klen = ((size_t)len[0] << 24) | ((size_t)len[1] << 16) | ((size_t)len[2] << 8) | len[3];
+  Tcl_DStringSetLength(&run->cur, (Tcl_Size) klen);
+  if(fread(Tcl_DStringValue(&run->cur), 1, klen, run->file) != klen ||
+     fread(len, 1, 4, run->file) != 4) {
+    goto error;
+  }
+  dlen = ((size_t)len[0] << 24) | ((size_t)len[1] << 16) | ((size_t)len[2] << 8) | len[3];
+  Tcl_DStringSetLength(&run->cur, (Tcl_Size) (klen + dlen));
+  p = Tcl_DStringValue(&run->cur);
+  if(fread(p + klen, 1, dlen, run->file) != dlen) {
+    goto error;
+  }
+  run->key.mv_size = klen;
+  run->key.mv_data = p;
+  run->data.mv_size = dlen;
+  run->data.mv_data = p + klen;
+  return 1;
+
+error:
+  run->error = ferror(run->file) && errno ? errno : EIO;
+  return -1;
+}
+
+static int LMDB_BulkBefore(LMDB_Bulk *bulk, LMDB_BulkRun *a, LMDB_BulkRun *b)
+{
+  int cmp = LMDB_BulkCmp(bulk, &a->key, &a->data, &b->key, &b->data);
+
+  return cmp < 0 || (cmp == 0 && a->index < b->index);
+}
+
+static void LMDB_BulkSiftDown(LMDB_Bulk *bulk, LMDB_BulkRun **heap, int n, int i)
+{
+  for(;;) {
+    int least = i;
+    int child = 2 * i + 1;
+    LMDB_BulkRun *tmp;
+
+    if(child < n && LMDB_BulkBefore(bulk, heap[child], heap[least])) {
+      least = child;
+    }
+    if(child + 1 < n && LMDB_BulkBefore(bulk, heap[child + 1], heap[least])) {
+      least = child + 1;
+    }
+    if(least == i) {
+      return;
+    }
+    tmp = heap[i];
+    heap[i] = heap[least];
+    heap[least] = tmp;
+    i = least;
   }
+}
 
-  /*
-   * Get the MDB_txn * point
-   */
-  txnHandle = Tcl_GetStringFromObj(objv[0], 0);
-  hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, txnHandle );
-  if( !hashEntryPtr ) {
-    if( interp ) {
-        Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-        Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", txnHandle, (char *)NULL );
-    }
+/*
+ * Fold a merged record into the last one of the output batch if it has
+ * the same key: its data replaces the old data (the record read last
+ * wins), and an exact copy of a sorted duplicate is dropped. Returns 1
+ * if the record was folded.
+ */
+static int LMDB_BulkFold(LMDB_Bulk *bulk, LMDB_Import *out,
+                         MDB_val *key, MDB_val *data)
+{
+  LMDB_ImportRec *rec;
+  MDB_val lkey, ldata;
 
-    return TCL_ERROR;
+  if(out->nrecs == 0) {
+    return 0;
   }
+  rec = &out->recs[out->nrecs - 1];
+  lkey.mv_size = rec->klen;
+  lkey.mv_data = Tcl_DStringValue(&out->data) + rec->koff;
+  ldata.mv_size = rec->dlen;
+  ldata.mv_data = Tcl_DStringValue(&out->data) + rec->doff;
+  if(mdb_cmp(bulk->txn, bulk->dbi, key, &lkey) != 0) {
+    return 0;
+  }
+  if(!bulk->dupsort) {
+    rec->doff = Tcl_DStringLength(&out->data);
+    rec->dlen = data->mv_size;
+    Tcl_DStringAppend(&out->data, data->mv_data, (Tcl_Size) data->mv_size);
+    return 1;
+  }
+  return mdb_dcmp(bulk->txn, bulk->dbi, data, &ldata) == 0;
+}
 
-  txn = Tcl_GetHashValue( hashEntryPtr );
-
-  switch( (enum DBTXN_enum)choice ){
+static void LMDB_BulkAdd(LMDB_Import *out, MDB_val *key, MDB_val *data)
+{
+  LMDB_ImportRec *rec;
 
-    case DBTXN_ABORT: {
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
+  if(out->nrecs == out->maxrecs) {
+    out->maxrecs = out->maxrecs ? 2 * out->maxrecs : 1024;
+    out->recs = (LMDB_ImportRec *) ckrealloc((char *) out->recs,
+                                             out->maxrecs * sizeof(LMDB_ImportRec));
+  }
+  rec = &out->recs[out->nrecs++];
+  rec->koff = Tcl_DStringLength(&out->data);
+  rec->klen = key->mv_size;
+  Tcl_DStringAppend(&out->data, key->mv_data, (Tcl_Size) key->mv_size);
+  rec->doff = Tcl_DStringLength(&out->data);
+  rec->dlen = data->mv_size;
+  Tcl_DStringAppend(&out->data, data->mv_data, (Tcl_Size) data->mv_size);
+  rec->flags = 0;
+}
 
-      mdb_txn_abort(txn);
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+static void LMDB_BulkJoin(LMDB_BulkRun *run)
+{
+  int state;
 
-      break;
-    }
+  if(run->running) {
+    Tcl_JoinThread(run->tid, &state);
+    run->running = 0;
+  }
+}
 
-    case DBTXN_COMMIT: {
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
+static void LMDB_BulkFree(LMDB_BulkRun *run)
+{
+  LMDB_BulkJoin(run);
+  if(run->file) {
+    fclose(run->file);
+  }
+  Tcl_DStringFree(&run->im.data);
+  Tcl_DStringFree(&run->im.prevKey);
+  Tcl_DStringFree(&run->cur);
+  if(run->im.recs) {
+    ckfree((char *) run->im.recs);
+  }
+  ckfree((char *) run);
+}
 
-      result = mdb_txn_commit(txn);
-      if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
+/*
+ * Read records from chan in runs, sort and spill them with up to
+ * threads workers, then merge the runs into dbi in batches of batch
+ * records. The last run is sorted in the calling thread and never
+ * spilled, so input that fits in one run does not touch the disk.
+ */
+static int LMDB_BulkLoad(Tcl_Interp *interp, MDB_env *env, MDB_dbi dbi,
+                         Tcl_Channel chan, int format, int runsize,
+                         int threads, int batch, Tcl_WideInt *countPtr)
+{
+  LMDB_Bulk bulk;
+  LMDB_Input in;
+  LMDB_Import out;
+  LMDB_BulkRun **runs = NULL;
+  LMDB_BulkRun **heap = NULL;
+  int nruns = 0;
+  int maxruns = 0;
+  int oldest = 0;                 /* first run that may still be running */
+  int print = 0;
+  unsigned int flags;
+  int result = TCL_OK;
+  int rc;
+  int i, n;
+
+  memset(&bulk, 0, sizeof(bulk));
+  memset(&out, 0, sizeof(out));
+  Tcl_DStringInit(&out.data);
+  Tcl_DStringInit(&out.prevKey);
+  LMDB_InputInit(&in, chan);
+  *countPtr = 0;
+
+  rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &bulk.txn);
+  if(rc == 0) {
+    rc = mdb_dbi_flags(bulk.txn, dbi, &flags);
+  }
+  if(rc != 0) {
+    Tcl_AppendResult(interp, "ERROR: ", mdb_strerror(rc), (char *)NULL);
+    result = TCL_ERROR;
+    goto done;
+  }
+  bulk.dbi = dbi;
+  bulk.dupsort = (flags & MDB_DUPSORT) != 0;
 
-        return TCL_ERROR;
-      }
+  if(format == LMDB_FORMAT_MDBDUMP) {
+    Tcl_Obj *header;
 
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+    if(LMDB_ImportHeader(interp, &in, &header, &print) != TCL_OK) {
+      result = TCL_ERROR;
+      goto done;
+    }
+    if(!header) {
+      goto done;
+    }
+    Tcl_DecrRefCount(header);
+  }
 
+  /* Read the runs, each full one goes to a worker. */
+  for(;;) {
+    LMDB_BulkRun *run;
+    int code;
+
+    run = (LMDB_BulkRun *) ckalloc(sizeof(LMDB_BulkRun));
+    memset(run, 0, sizeof(LMDB_BulkRun));
+    run->bulk = &bulk;
+    run->index = nruns;
+    run->im.env = env;
+    run->im.format = format;
+    run->im.print = print;
+    Tcl_DStringInit(&run->im.data);
+    Tcl_DStringInit(&run->im.prevKey);
+    Tcl_DStringInit(&run->cur);
+    if(nruns == maxruns) {
+      maxruns = maxruns ? 2 * maxruns : 16;
+      runs = (LMDB_BulkRun **) ckrealloc((char *) runs,
+                                         maxruns * sizeof(LMDB_BulkRun *));
+    }
+    runs[nruns++] = run;
+
+    do {
+      code = LMDB_ImportRead(interp, &in, &run->im);
+    } while(code == TCL_OK &&
+            Tcl_DStringLength(&run->im.data) +
+            (size_t) run->im.nrecs * sizeof(LMDB_ImportRec) < (size_t) runsize);
+    if(code == TCL_ERROR) {
+      result = TCL_ERROR;
+      goto done;
+    }
+    if(code == TCL_BREAK) {
+      LMDB_BulkSort(&bulk, &run->im);
       break;
     }
 
-    case DBTXN_RESET: {
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
-
-      mdb_txn_reset(txn);
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+    if(nruns - oldest > threads) {
+      LMDB_BulkJoin(runs[oldest++]);
+    }
+    if(Tcl_CreateThread(&run->tid, LMDB_BulkThread, run,
+                        TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+      /* No thread, do the work here. */
+      LMDB_BulkThread(run);
+    } else {
+      run->running = 1;
+    }
+  }
 
-      break;
+  for(i = 0; i < nruns; i++) {
+    LMDB_BulkJoin(runs[i]);
+    if(runs[i]->error) {
+      Tcl_AppendResult(interp, "error writing temporary file: ",
+                       Tcl_ErrnoMsg(runs[i]->error), (char *)NULL);
+      result = TCL_ERROR;
+      goto done;
     }
+  }
 
-    case DBTXN_RENEW: {
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
+  /*
+   * Merge. The snapshot is not needed any more, a reset transaction
+   * still knows the comparison functions of the database.
+   */
+  mdb_txn_reset(bulk.txn);
+
+  out.env = env;
+  out.dbi = dbi;
+  out.append = 1;
+  out.autoAppend = 1;
+  out.sorted = 1;
+  out.dupsort = bulk.dupsort;
+
+  heap = (LMDB_BulkRun **) ckalloc(nruns * sizeof(LMDB_BulkRun *));
+  n = 0;
+  for(i = 0; i < nruns; i++) {
+    rc = LMDB_BulkNext(runs[i]);
+    if(rc < 0) {
+      goto readerror;
+    }
+    if(rc > 0) {
+      heap[n++] = runs[i];
+    }
+  }
+  for(i = n / 2 - 1; i >= 0; i--) {
+    LMDB_BulkSiftDown(&bulk, heap, n, i);
+  }
 
-      result = mdb_txn_renew(txn);
-      if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+  while(n > 0) {
+    LMDB_BulkRun *run = heap[0];
 
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+    if(!LMDB_BulkFold(&bulk, &out, &run->key, &run->data)) {
+      /* Commit only between keys, so a key is never stored twice. */
+      if(out.nrecs >= batch) {
+        if(LMDB_ImportCommit(interp, &out, 0, out.nrecs) != TCL_OK) {
+          result = TCL_ERROR;
+          goto done;
         }
-
-        return TCL_ERROR;
+        out.nrecs = 0;
+        Tcl_DStringSetLength(&out.data, 0);
       }
-
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
-
-      break;
+      LMDB_BulkAdd(&out, &run->key, &run->data);
     }
 
-    case DBTXN_CLOSE: {
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
-
-      Tcl_MutexLock(&myMutex);
-      if( hashEntryPtr )  Tcl_DeleteHashEntry(hashEntryPtr);
-      Tcl_MutexUnlock(&myMutex);
-      Tcl_DeleteCommand(interp, txnHandle);
-
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+    rc = LMDB_BulkNext(run);
+    if(rc < 0) {
+      goto readerror;
+    }
+    if(rc == 0) {
+      heap[0] = heap[--n];
+    }
+    LMDB_BulkSiftDown(&bulk, heap, n, 0);
+  }
+  if(LMDB_ImportCommit(interp, &out, 0, out.nrecs) != TCL_OK) {
+    result = TCL_ERROR;
+  }
+  goto done;
 
+readerror:
+  for(i = 0; i < nruns; i++) {
+    if(runs[i]->error) {
+      Tcl_AppendResult(interp, "error reading temporary file: ",
+                       Tcl_ErrnoMsg(runs[i]->error), (char *)NULL);
       break;
     }
-
   }
+  result = TCL_ERROR;
 
-  return TCL_OK;
+done:
+  for(i = 0; i < nruns; i++) {
+    LMDB_BulkFree(runs[i]);
+  }
+  if(runs) {
+    ckfree((char *) runs);
+  }
+  if(heap) {
+    ckfree((char *) heap);
+  }
+  if(bulk.txn) {
+    mdb_txn_abort(bulk.txn);
+  }
+  Tcl_DStringFree(&in.buf);
+  Tcl_DStringFree(&out.data);
+  Tcl_DStringFree(&out.prevKey);
+  if(out.recs) {
+    ckfree((char *) out.recs);
+  }
+  *countPtr = out.count;
+  return result;
 }
 
 
-static int LMDB_ENV(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+static int LMDB_MAIN(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
   int choice;
   int result;
-  MDB_env *env;
-  Tcl_HashEntry *hashEntryPtr;
-  char *handle;
 
   ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
       Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
@@ -1844,35 +9409,25 @@ static int LMDB_ENV(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
     Tcl_InitHashTable(tsdPtr->lmdb_hashtblPtr, TCL_STRING_KEYS);
   }
 
-  static const char *DBENV_strs[] = {
+  static const char *DB_strs[] = {
+    "env",
     "open",
-    "set_mapsize",
-    "set_maxreaders",
-    "set_maxdbs",
-    "sync",
-    "stat",
-    "copy",
-    "get_path",
-    "get_maxreaders",
-    "get_maxkeysize",
-    "close",
-    "txn",
+    "version",
+    "readers",
+    "dump",
+    "load",
+    "bulkload",
     0
   };
 
-  enum DBENV_enum {
-    DBENV_OPEN,
-    DBENV_SET_MAPSIZE,
-    DBENV_SET_MAXREADERS,
-    DBENV_SET_MAXDBS,
-    DBENV_SYNC,
-    DBENV_STAT,
-    DBENV_COPY,
-    DBENV_GET_PATH,
-    DBENV_GET_MAXREADERS,
-    DBENV_GET_MAXKEYSIZE,
-    DBENV_CLOSE,
-    DBENV_TXN,
+  enum DB_enum {
+    DB_ENV,
+    DB_OPEN,
+    DB_VERSION,
+    DB_READERS,
+    DB_DUMP,
+    DB_LOAD,
+    DB_BULKLOAD,
   };
 
   if( objc < 2 ){
@@ -1880,795 +9435,710 @@ static int LMDB_ENV(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
     return TCL_ERROR;
   }
 
-  if( Tcl_GetIndexFromObj(interp, objv[1], DBENV_strs, "option", 0, &choice) ){
+  if( Tcl_GetIndexFromObj(interp, objv[1], DB_strs, "option", 0, &choice) ){
     return TCL_ERROR;
   }
 
-  /*
-   * Get the MDB_env * point
-   */
-  handle = Tcl_GetStringFromObj(objv[0], 0);
-  hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, handle );
-  if( !hashEntryPtr ) {
-    if( interp ) {
-        Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-        Tcl_AppendStringsToObj( resultObj, "invalid env handle ", handle, (char *)NULL );
-    }
+  switch( (enum DB_enum)choice ){
 
-    return TCL_ERROR;
-  }
+    case DB_ENV: {
+      MDB_env *env;
+      Tcl_HashEntry *hashEntryPtr;
+      char handleName[16 + TCL_INTEGER_SPACE];
+      Tcl_Obj *pResultStr = NULL;
+      int newvalue;
 
-  env = Tcl_GetHashValue( hashEntryPtr );
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
 
-  switch( (enum DBENV_enum)choice ){
+      result = mdb_env_create (&env);
+      if(result != 0) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+        }
 
-    case DBENV_OPEN: {
-      const char *zArg;
-      char *path = NULL;
-      int mode = 0664;
+        return TCL_ERROR;
+      }
+
+      Tcl_MutexLock(&myMutex);
+      sprintf( handleName, "env%d", tsdPtr->env_count++ );
+
+      pResultStr = Tcl_NewStringObj( handleName, -1 );
+
+      hashEntryPtr = Tcl_CreateHashEntry(tsdPtr->lmdb_hashtblPtr, handleName, &newvalue);
+      Tcl_SetHashValue(hashEntryPtr, env);
+      Tcl_MutexUnlock(&myMutex);
+
+      Tcl_CreateObjCommand(interp, handleName, (Tcl_ObjCmdProc *) LMDB_ENV,
+            (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+      Tcl_SetObjResult(interp, pResultStr);
+
+      break;
+    }
+
+    case DB_OPEN: {
+      char *zArg;
+      MDB_env *env;
+      const char *env_path = NULL;
+      Tcl_HashEntry *hashEntryPtr;
+      char *handle = NULL;
+      MDB_txn *txn;
+      MDB_dbi dbi;
+      const char *database = NULL;
+      Tcl_Size len;
       int flags = 0;
+      Tcl_HashEntry *newHashEntryPtr;
+      char handleName[16 + TCL_INTEGER_SPACE];
+      Tcl_Obj *pResultStr = NULL;
+      int newvalue;
       int i = 0;
 
       if( objc < 4 || (objc&1)!=0 ){
-        Tcl_WrongNumArgs(interp, 1, objv,
-        "ENV_HANDLE -path path ?-mode mode? ?-fixedmap BOOLEAN? ?-nosubdir BOOLEAN? ?-readonly BOOLEAN? ?-nosync BOOLEAN? ?-nordahead BOOLEAN? "
-        );
+          Tcl_WrongNumArgs(interp, 2, objv,
+          "-env env_handle ?-name database? ?-reversekey BOOLEAN? \
+           ?-dupsort BOOLEAN? ?-dupfixed BOOLEAN? ?-reversedup BOOLEAN? \
+           ?-create BOOLEAN? "
+          );
 
         return TCL_ERROR;
       }
 
       for(i=2; i+1<objc; i+=2){
         zArg = Tcl_GetStringFromObj(objv[i], 0);
-        if( strcmp(zArg, "-path")==0 ){
-            path = Tcl_GetStringFromObj(objv[i+1], 0);
-        } else if( strcmp(zArg, "-mode")==0 ){
-            if(Tcl_GetIntFromObj(interp, objv[i+1], &mode) != TCL_OK) {
+
+        if( strcmp(zArg, "-name")==0 ){
+            database = Tcl_GetStringFromObj(objv[i+1], &len);
+            if(!database || len < 0) {
                 return TCL_ERROR;
             }
-        } else if( strcmp(zArg, "-fixedmap")==0 ){
+        } else if( strcmp(zArg, "-env")==0 ){
+            handle = Tcl_GetStringFromObj(objv[i+1], &len);
+            if(!handle || len < 0) {
+                return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-reversekey")==0 ){
             int b;
             if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
             if( b ){
-              flags |= MDB_FIXEDMAP;
+              flags |= MDB_REVERSEKEY;
             }else{
-              flags &= ~MDB_FIXEDMAP;
+              flags &= ~MDB_REVERSEKEY;
             }
-        } else if( strcmp(zArg, "-nosubdir")==0 ){
+        } else if( strcmp(zArg, "-dupsort")==0 ){
             int b;
             if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
             if( b ){
-              flags |= MDB_NOSUBDIR;
+              flags |= MDB_DUPSORT;
             }else{
-              flags &= ~MDB_NOSUBDIR;
+              flags &= ~MDB_DUPSORT;
             }
-        } else if( strcmp(zArg, "-readonly")==0 ){
+        } else if( strcmp(zArg, "-dupfixed")==0 ){
             int b;
             if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
             if( b ){
-              flags |= MDB_RDONLY;
+              flags |= MDB_DUPFIXED;
             }else{
-              flags &= ~MDB_RDONLY;
+              flags &= ~MDB_DUPFIXED;
             }
-        } else if( strcmp(zArg, "-nosync")==0 ){
+        } else if( strcmp(zArg, "-reversedup")==0 ){
             int b;
             if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
             if( b ){
-              flags |= MDB_NOSYNC;
+              flags |= MDB_REVERSEDUP;
             }else{
-              flags &= ~MDB_NOSYNC;
+              flags &= ~MDB_REVERSEDUP;
             }
-        } else if( strcmp(zArg, "-nordahead")==0 ){
-            /*
-             * Turn off readahead. Most operating systems perform readahead on
-             * read requests by default.
-             * Turning it off may help random read performance when the DB is
-             * larger than RAM and system RAM is full.
-             * The option is not implemented on Windows.
-             */
+        } else if( strcmp(zArg, "-create")==0 ){
             int b;
             if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
             if( b ){
-              flags |= MDB_NORDAHEAD;
+              flags |= MDB_CREATE;
             }else{
-              flags &= ~MDB_NORDAHEAD;
+              flags &= ~MDB_CREATE;
             }
-        } else{
+          } else{
            Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
            return TCL_ERROR;
         }
       }
 
-      if(!path) {
-        if( interp ) {
+      if(!handle) {
+          if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "empty path string ", (char *)NULL );
-        }
+            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", (char *)NULL );
+          }
 
-        return TCL_ERROR;
+          return TCL_ERROR;
       }
 
-      result = mdb_env_open(env, path, flags, (mdb_mode_t)mode);
-      if(result != 0) {
-        if( interp ) {
+      hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, handle );
+      if( !hashEntryPtr ) {
+          if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
-
-        return TCL_ERROR;
-      }
-
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
-
-      break;
-    }
-
-    case DBENV_SET_MAPSIZE: {
-      Tcl_WideInt wideValue;
+            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", handle, (char *)NULL );
+          }
 
-      if( objc == 3 ){
-        if(Tcl_GetWideIntFromObj(interp, objv[2], &wideValue) != TCL_OK) {
-            return TCL_ERROR;
-        }
-      }else{
-        Tcl_WrongNumArgs(interp, 2, objv, "size");
-        return TCL_ERROR;
+          return TCL_ERROR;
       }
 
-      result = mdb_env_set_mapsize(env, (size_t) wideValue);
-      if(result != 0) {
-        if( interp ) {
+      env = Tcl_GetHashValue( hashEntryPtr );
+      if (mdb_env_get_path(env, &env_path) || env_path == NULL)
+      {
+          if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
-
-        return TCL_ERROR;
-      }
-
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
-
-      break;
-    }
-
-    case DBENV_SET_MAXREADERS: {
-      int value;
-
-      if( objc == 3 ){
-        if(Tcl_GetIntFromObj(interp, objv[2], &value) != TCL_OK) {
-            return TCL_ERROR;
-        }
-      }else{
-        Tcl_WrongNumArgs(interp, 2, objv, "nReaders ");
-        return TCL_ERROR;
+            Tcl_AppendStringsToObj( resultObj, "env was not open", (char *)NULL );
+          }
+          return TCL_ERROR;
       }
 
-      result = mdb_env_set_maxreaders(env, value);
+      result = mdb_txn_begin(env, NULL, 0, &txn);
       if(result != 0) {
-        if( interp ) {
+          if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
             Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
-
-        return TCL_ERROR;
-      }
-
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
-
-      break;
-    }
-
-    case DBENV_SET_MAXDBS: {
-      int value;
+          }
 
-      if( objc == 3 ){
-        if(Tcl_GetIntFromObj(interp, objv[2], &value) != TCL_OK) {
-            return TCL_ERROR;
-        }
-      }else{
-        Tcl_WrongNumArgs(interp, 2, objv, "nDbs");
-        return TCL_ERROR;
+          return TCL_ERROR;
       }
 
-      result = mdb_env_set_maxdbs(env, value);
+      result = mdb_dbi_open(txn, database, flags, &dbi);
       if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
-
-        return TCL_ERROR;
-      }
-
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
-
-      break;
-    }
-
-    case DBENV_SYNC: {
-      int value;
-
-      if( objc == 3 ){
-        if(Tcl_GetIntFromObj(interp, objv[2], &value) != TCL_OK) {
-            return TCL_ERROR;
-        }
-      }else{
-        Tcl_WrongNumArgs(interp, 2, objv, "force");
-        return TCL_ERROR;
-      }
-
-      /*
-       * Data is always written to disk when mdb_txn_commit() is called, but
-       * the operating system may keep it buffered. LMDB always flushes the
-       * OS buffers upon commit as well, unless the environment was opened
-       * with MDB_NOSYNC or in part MDB_NOMETASYNC. This call is not valid
-       * if the environment was opened with MDB_RDONLY.
-       */
-      if(value) {  //If value is non-zero, force a synchronous flush.
-        result = mdb_env_sync(env, value);
-        if(result != 0) {
           if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
             Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
           }
 
           return TCL_ERROR;
-        }
-      }
-
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
-
-      break;
-    }
-
-    case DBENV_STAT: {
-      MDB_stat stat;
-      Tcl_Obj *pResultStr = NULL;
-
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
-
-      result = mdb_env_stat(env, &stat);
-      if(result != 0) {
-        if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
-
-        return TCL_ERROR;
-      }
-
-      pResultStr = Tcl_NewListObj(6, NULL);
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_psize));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_depth));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_branch_pages));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_leaf_pages));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_overflow_pages));
-      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(stat.ms_entries));
-
-      Tcl_SetObjResult(interp, pResultStr);
-
-      break;
-    }
-
-    case DBENV_COPY: {
-      char *path;
-      char *zArg;
-      Tcl_Size len;
-      #if MDB_VERSION_MAJOR > 0 || \
-        (MDB_VERSION_MAJOR == 0 && (MDB_VERSION_MINOR > 9 || \
-                    (MDB_VERSION_MINOR == 9 && \
-                     MDB_VERSION_PATCH > 13)))
-      int flags = 0;
-      #endif
-
-      if( objc == 3 || objc == 5){
-        path = Tcl_GetStringFromObj(objv[2], &len);
-        if( !path || len < 1 ){
-            return TCL_ERROR;
-        }
-
-      #if MDB_VERSION_MAJOR > 0 || \
-        (MDB_VERSION_MAJOR == 0 && (MDB_VERSION_MINOR > 9 || \
-                    (MDB_VERSION_MINOR == 9 && \
-                     MDB_VERSION_PATCH > 13)))
-        if(objc == 5) {
-          zArg = Tcl_GetStringFromObj(objv[3], 0);
-          if( strcmp(zArg, "-cp_compact")==0 ){
-              int b;
-              if( Tcl_GetBooleanFromObj(interp, objv[4], &b) ) return TCL_ERROR;
-              if( b ){
-                flags |= MDB_CP_COMPACT ;
-              }else{
-                flags &= ~MDB_CP_COMPACT;
-              }
-          } else{
-             Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-             return TCL_ERROR;
-          }
-        }
-        #endif
-      }else{
-        Tcl_WrongNumArgs(interp, 2, objv, "path ?-cp_compact boolean?");
-        return TCL_ERROR;
       }
 
-      #if MDB_VERSION_MAJOR > 0 || \
-        (MDB_VERSION_MAJOR == 0 && (MDB_VERSION_MINOR > 9 || \
-                    (MDB_VERSION_MINOR == 9 && \
-                     MDB_VERSION_PATCH > 13)))
-      result = mdb_env_copy2(env, path, flags);
-      #else
-      result = mdb_env_copy(env, path);
-      #endif
+      /*
+       * The database handle will be private to the current transaction
+       * until the transaction is successfully committed.
+       * After a successful commit the handle will reside in the shared
+       * environment, and may be used by other transactions.
+       * Here I use a transaction and try to commit, users need use
+       * env_handle txn command (at script level) to create a new
+       * transactions.
+       */
+      result = mdb_txn_commit(txn);
       if(result != 0) {
-        if( interp ) {
+          if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
             Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
+          }
 
-        return TCL_ERROR;
+          return TCL_ERROR;
       }
 
-      Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+      Tcl_MutexLock(&myMutex);
+      sprintf( handleName, "dbi%d", tsdPtr->dbi_count++ );
+
+      pResultStr = Tcl_NewStringObj( handleName, -1 );
+
+      newHashEntryPtr = Tcl_CreateHashEntry(tsdPtr->lmdb_hashtblPtr, handleName, &newvalue);
+      Tcl_SetHashValue(newHashEntryPtr, (ClientData)(uintptr_t)dbi);
+      Tcl_MutexUnlock(&myMutex);
+
+      Tcl_CreateObjCommand(interp, handleName, (Tcl_ObjCmdProc *) LMDB_DBI,
+            (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+      Tcl_SetObjResult(interp, pResultStr);
 
       break;
     }
 
-    case DBENV_GET_PATH: {
-      const char *path;
+    case DB_VERSION: {
+      char *zArg;
+      char *verString = NULL;
+      int major = 0, minor = 0, patch = 0;
+      int bReturnString = 0;
       Tcl_Obj *pResultStr = NULL;
 
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
+      if( objc == 2 || objc == 3 ){
+        if (objc == 3) {
+          zArg = Tcl_GetStringFromObj(objv[2], 0);
+          if( strcmp(zArg, "-string")==0 ){
+            bReturnString = 1;
+          } else {
+            Tcl_WrongNumArgs(interp, 2, objv, "?-string?");
+            return TCL_ERROR;
+          }
+        }
+      }else{
+        Tcl_WrongNumArgs(interp, 2, objv, "?-string?");
         return TCL_ERROR;
       }
 
-      result = mdb_env_get_path(env, &path);
-      if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-        }
+      verString = mdb_version(&major, &minor, &patch);
 
-        return TCL_ERROR;
+      if(bReturnString) {
+          pResultStr = Tcl_NewStringObj(verString, -1);
+      } else {
+          pResultStr = Tcl_NewListObj(3, NULL);
+          Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(major));
+          Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(minor));
+          Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(patch));
       }
 
-      pResultStr = Tcl_NewStringObj( path, -1 );
-      Tcl_SetObjResult(interp, pResultStr);
+      Tcl_SetObjResult(interp,  pResultStr);
 
       break;
     }
 
-    case DBENV_GET_MAXREADERS: {
-      unsigned int readers;
-      Tcl_Obj *pResultStr = NULL;
+    case DB_READERS: {
+      char *zArg;
+      Tcl_WideInt olderthan = -1;
+      int threshold = -1;
+      int stacks = -1;
+      Tcl_Obj *script = NULL;
+      int i = 0;
 
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
+      if( (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-olderthan ms? | -threshold ms ?-command script? | -stacks boolean");
         return TCL_ERROR;
       }
 
-      result = mdb_env_get_maxreaders(env, &readers);
-      if(result != 0) {
-        if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-olderthan")==0 ){
+            if(Tcl_GetWideIntFromObj(interp, objv[i+1], &olderthan) != TCL_OK) {
+                return TCL_ERROR;
+            }
+            if( olderthan < 0 ){
+                Tcl_AppendResult(interp, "olderthan must be >= 0", (char*)0);
+                return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-threshold")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &threshold) != TCL_OK) {
+                return TCL_ERROR;
+            }
+            if( threshold < 0 ){
+                Tcl_AppendResult(interp, "threshold must be >= 0", (char*)0);
+                return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-command")==0 ){
+            script = objv[i+1];
+        } else if( strcmp(zArg, "-stacks")==0 ){
+            if(Tcl_GetBooleanFromObj(interp, objv[i+1], &stacks) != TCL_OK) {
+                return TCL_ERROR;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
         }
+      }
 
+      if( (olderthan >= 0) + (threshold >= 0 || script) + (stacks >= 0) > 1 ){
+        Tcl_AppendResult(interp, "-olderthan, -threshold and -stacks "
+                         "cannot be used together", (char*)0);
         return TCL_ERROR;
       }
-
-      pResultStr = Tcl_NewIntObj( readers );
-      Tcl_SetObjResult(interp, pResultStr);
-
-      break;
-    }
-
-    case DBENV_GET_MAXKEYSIZE: {
-      unsigned int maxkeysize;
-      Tcl_Obj *pResultStr = NULL;
-
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
+      if( script && threshold < 0 ){
+        Tcl_AppendResult(interp, "-command needs -threshold", (char*)0);
+        return TCL_ERROR;
+      }
+      if( threshold > 0 && !script ){
+        Tcl_AppendResult(interp, "-threshold needs -command", (char*)0);
         return TCL_ERROR;
       }
 
-      maxkeysize = mdb_env_get_maxkeysize(env);
+      /*
+       * -stacks turns recording of the creating procs on or off for
+       * read transactions started from now on. A -threshold callback
+       * records them too while it is configured.
+       */
+      if( stacks >= 0 ){
+        tsdPtr->watch_stacks = stacks;
+        Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+        break;
+      }
 
-      pResultStr = Tcl_NewIntObj( maxkeysize );
-      Tcl_SetObjResult(interp, pResultStr);
+      /*
+       * -threshold (re)configures the warning callback of this thread,
+       * -threshold 0 turns it off.
+       */
+      if( threshold >= 0 ){
+        if( tsdPtr->watch_timer ){
+          Tcl_DeleteTimerHandler(tsdPtr->watch_timer);
+          tsdPtr->watch_timer = NULL;
+        }
+        if( tsdPtr->watch_script ){
+          Tcl_DecrRefCount(tsdPtr->watch_script);
+          tsdPtr->watch_script = NULL;
+        }
 
-      break;
-    }
+        tsdPtr->watch_threshold = threshold;
+        if( threshold > 0 ){
+          tsdPtr->watch_interp = interp;
+          tsdPtr->watch_script = script;
+          Tcl_IncrRefCount(script);
+          tsdPtr->watch_timer = Tcl_CreateTimerHandler(threshold / 2 + 1,
+                                    LMDB_TxnWatchTimer, NULL);
+        }
 
-    case DBENV_CLOSE: {
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
+        Tcl_SetObjResult(interp, Tcl_NewIntObj( 0 ));
+        break;
       }
 
-      mdb_env_close(env);
-      Tcl_MutexLock(&myMutex);
-      if( hashEntryPtr )  Tcl_DeleteHashEntry(hashEntryPtr);
-      Tcl_MutexUnlock(&myMutex);
-      Tcl_DeleteCommand(interp, handle);
+      Tcl_SetObjResult(interp, LMDB_TxnInfoList(tsdPtr,
+                                   olderthan < 0 ? 0 : olderthan));
 
       break;
     }
 
-    case DBENV_TXN: {
-      char *zArg;
-      char *parentTxn = NULL;
-      Tcl_Size len = 0;
-      MDB_txn *parent = NULL;
-      int flags = 0;
+    case DB_DUMP: {
+      const char *zArg;
+      MDB_env *env;
       MDB_txn *txn;
-      Tcl_HashEntry *txnHashEntryPtr;
-      Tcl_HashEntry *newHashEntryPtr;
-      char handleName[16 + TCL_INTEGER_SPACE];
-      Tcl_Obj *pResultStr = NULL;
-      int newvalue;
+      Tcl_HashEntry *envHashEntryPtr;
+      char *envHandle = NULL;
+      char *chanName = NULL;
+      const char *name = NULL;
+      Tcl_Channel chan;
+      int mode;
+      int all = 0;
+      int threads = 4;
+      LMDB_Dump dump;
+      Tcl_WideInt count = 0;
       int i = 0;
 
-      if( objc < 2 || (objc&1)!=0 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "?-parent txnid? ?-readonly boolean? ");
+      if( objc < 6 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-env env_handle -channel channelId ?-name database? ?-all boolean? ?-print boolean? ?-threads n? ");
         return TCL_ERROR;
       }
 
+      memset(&dump, 0, sizeof(dump));
+
       for(i=2; i+1<objc; i+=2){
         zArg = Tcl_GetStringFromObj(objv[i], 0);
-
-        if( strcmp(zArg, "-parent")==0 ){
-            parentTxn = Tcl_GetStringFromObj(objv[i+1], &len);
-            if( !parentTxn || len < 1 ){
+        if( strcmp(zArg, "-env")==0 ){
+            envHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-channel")==0 ){
+            chanName = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-name")==0 ){
+            name = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-all")==0 ){
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &all) ) return TCL_ERROR;
+        } else if( strcmp(zArg, "-print")==0 ){
+            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &dump.print) ) return TCL_ERROR;
+        } else if( strcmp(zArg, "-threads")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &threads) != TCL_OK) {
               return TCL_ERROR;
             }
-        } else if( strcmp(zArg, "-readonly")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_RDONLY ;
-            }else{
-              flags &= ~MDB_RDONLY;
-            }
         } else{
            Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
            return TCL_ERROR;
         }
       }
 
-      if(parentTxn) {
-        txnHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, parentTxn );
-        if( !txnHashEntryPtr ) {
-          if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid txn handle ", parentTxn, (char *)NULL );
-          }
-
-          return TCL_ERROR;
+      if(!envHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid env handle ", (char *)NULL );
         }
 
-        parent = Tcl_GetHashValue( txnHashEntryPtr );
+        return TCL_ERROR;
       }
 
-      result = mdb_txn_begin(env, parent, flags, &txn);
-      if(result != 0) {
+      envHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, envHandle );
+      if( !envHashEntryPtr ) {
         if( interp ) {
-          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", envHandle, (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      Tcl_MutexLock(&myMutex);
-      sprintf( handleName, "%s.txn%d", handle, tsdPtr->txn_count++ );
-
-      pResultStr = Tcl_NewStringObj( handleName, -1 );
-
-      newHashEntryPtr = Tcl_CreateHashEntry(tsdPtr->lmdb_hashtblPtr, handleName, &newvalue);
-      Tcl_SetHashValue(newHashEntryPtr, txn);
-      Tcl_MutexUnlock(&myMutex);
-
-      Tcl_CreateObjCommand(interp, handleName, (Tcl_ObjCmdProc *) LMDB_TXN,
-            (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
-
-      Tcl_SetObjResult(interp, pResultStr);
-
-      break;
-    }
-
-  }
-
-  return TCL_OK;
-}
-
-
-static int LMDB_MAIN(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
-  int choice;
-  int result;
+      env = Tcl_GetHashValue( envHashEntryPtr );
 
-  ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
-      Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+      if(!chanName) {
+        Tcl_AppendResult(interp, "missing -channel", (char*)0);
+        return TCL_ERROR;
+      }
 
-  if (tsdPtr->initialized == 0) {
-    tsdPtr->initialized = 1;
-    tsdPtr->lmdb_hashtblPtr = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
-    Tcl_InitHashTable(tsdPtr->lmdb_hashtblPtr, TCL_STRING_KEYS);
-  }
+      chan = Tcl_GetChannel(interp, chanName, &mode);
+      if(!chan) {
+        return TCL_ERROR;
+      }
+      if((mode & TCL_WRITABLE) == 0) {
+        Tcl_AppendResult(interp, "channel \"", chanName,
+                         "\" wasn't opened for writing", (char*)0);
+        return TCL_ERROR;
+      }
 
-  static const char *DB_strs[] = {
-    "env",
-    "open",
-    "version",
-    0
-  };
+      result = LMDB_DumpDbs(env, name, all, &dump);
+      if(result == 0) {
+        dump.env = env;
+        dump.nthreads = threads < dump.ndbs ? threads : dump.ndbs;
+        if(dump.nthreads > 1) {
+          result = LMDB_DumpParallel(interp, &dump, chan, &count);
+        } else if(dump.ndbs > 0) {
+          /* One database, or -threads 1: no need for threads. */
+          result = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+          for(i = 0; result == 0 && i < dump.ndbs; i++) {
+            Tcl_WideInt n;
+
+            result = LMDB_ExportDbi(txn, dump.dbs[i].dbi, LMDB_FORMAT_MDBDUMP,
+                                    dump.print, dump.dbs[i].name, NULL, NULL,
+                                    NULL, LMDB_ChannelSink, chan, &n);
+            count += n;
+          }
+          if(i > 0) {
+            mdb_txn_abort(txn);
+          }
+        }
+      }
 
-  enum DB_enum {
-    DB_ENV,
-    DB_OPEN,
-    DB_VERSION,
-  };
+      for(i = 0; i < dump.ndbs; i++) {
+        if(dump.dbs[i].name) {
+          ckfree(dump.dbs[i].name);
+        }
+      }
+      if(dump.dbs) {
+        ckfree((char *) dump.dbs);
+      }
 
-  if( objc < 2 ){
-    Tcl_WrongNumArgs(interp, 1, objv, "SUBCOMMAND ...");
-    return TCL_ERROR;
-  }
+      if(result != 0) {
+        LMDB_ExportError(interp, chan, result);
+        return TCL_ERROR;
+      }
 
-  if( Tcl_GetIndexFromObj(interp, objv[1], DB_strs, "option", 0, &choice) ){
-    return TCL_ERROR;
-  }
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj( count ));
 
-  switch( (enum DB_enum)choice ){
+      break;
+    }
 
-    case DB_ENV: {
+    case DB_LOAD: {
+      const char *zArg;
       MDB_env *env;
-      Tcl_HashEntry *hashEntryPtr;
-      char handleName[16 + TCL_INTEGER_SPACE];
-      Tcl_Obj *pResultStr = NULL;
-      int newvalue;
+      Tcl_HashEntry *envHashEntryPtr;
+      char *envHandle = NULL;
+      char *chanName = NULL;
+      const char *name = NULL;
+      Tcl_Channel chan;
+      int mode;
+      int batch = 10000;
+      int append = -1;
+      Tcl_WideInt count = 0;
+      int i = 0;
 
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
+      if( objc < 6 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-env env_handle -channel channelId ?-name database? ?-batch n? ?-append auto|boolean? ");
         return TCL_ERROR;
       }
 
-      result = mdb_env_create (&env);
-      if(result != 0) {
+      for(i=2; i+1<objc; i+=2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+        if( strcmp(zArg, "-env")==0 ){
+            envHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-channel")==0 ){
+            chanName = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-name")==0 ){
+            name = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-batch")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &batch) != TCL_OK) {
+              return TCL_ERROR;
+            }
+            if(batch < 1) {
+              Tcl_AppendResult(interp, "-batch must be a positive integer", (char*)0);
+              return TCL_ERROR;
+            }
+        } else if( strcmp(zArg, "-append")==0 ){
+            if( strcmp(Tcl_GetString(objv[i+1]), "auto")==0 ){
+              append = -1;
+            } else if( Tcl_GetBooleanFromObj(interp, objv[i+1], &append) ){
+              return TCL_ERROR;
+            }
+        } else{
+           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+           return TCL_ERROR;
+        }
+      }
+
+      if(!envHandle) {
         if( interp ) {
           Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-          Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
+          Tcl_AppendStringsToObj( resultObj, "invalid env handle ", (char *)NULL );
         }
 
         return TCL_ERROR;
       }
 
-      Tcl_MutexLock(&myMutex);
-      sprintf( handleName, "env%d", tsdPtr->env_count++ );
+      envHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, envHandle );
+      if( !envHashEntryPtr ) {
+        if( interp ) {
+            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", envHandle, (char *)NULL );
+        }
 
-      pResultStr = Tcl_NewStringObj( handleName, -1 );
+        return TCL_ERROR;
+      }
 
-      hashEntryPtr = Tcl_CreateHashEntry(tsdPtr->lmdb_hashtblPtr, handleName, &newvalue);
-      Tcl_SetHashValue(hashEntryPtr, env);
-      Tcl_MutexUnlock(&myMutex);
+      env = Tcl_GetHashValue( envHashEntryPtr );
 
-      Tcl_CreateObjCommand(interp, handleName, (Tcl_ObjCmdProc *) LMDB_ENV,
-            (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+      if(!chanName) {
+        Tcl_AppendResult(interp, "missing -channel", (char*)0);
+        return TCL_ERROR;
+      }
 
-      Tcl_SetObjResult(interp, pResultStr);
+      chan = Tcl_GetChannel(interp, chanName, &mode);
+      if(!chan) {
+        return TCL_ERROR;
+      }
+      if((mode & TCL_READABLE) == 0) {
+        Tcl_AppendResult(interp, "channel \"", chanName,
+                         "\" wasn't opened for reading", (char*)0);
+        return TCL_ERROR;
+      }
+
+      if(LMDB_Load(interp, env, chan, name, batch, append, &count) != TCL_OK) {
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj( count ));
 
       break;
     }
 
-    case DB_OPEN: {
-      char *zArg;
+    case DB_BULKLOAD: {
+      const char *zArg;
       MDB_env *env;
-      const char *env_path = NULL;
-      Tcl_HashEntry *hashEntryPtr;
-      char *handle = NULL;
-      MDB_txn *txn;
       MDB_dbi dbi;
-      const char *database = NULL;
-      Tcl_Size len;
-      int flags = 0;
-      Tcl_HashEntry *newHashEntryPtr;
-      char handleName[16 + TCL_INTEGER_SPACE];
-      Tcl_Obj *pResultStr = NULL;
-      int newvalue;
+      Tcl_HashEntry *envHashEntryPtr;
+      Tcl_HashEntry *dbiHashEntryPtr;
+      char *envHandle = NULL;
+      char *dbiHandle = NULL;
+      char *chanName = NULL;
+      Tcl_Channel chan;
+      int mode;
+      int format = LMDB_FORMAT_BINARY;
+      int runsize = LMDB_BULK_RUNSIZE;
+      int threads = 4;
+      int batch = 100000;
+      Tcl_WideInt count = 0;
       int i = 0;
 
-      if( objc < 4 || (objc&1)!=0 ){
-          Tcl_WrongNumArgs(interp, 2, objv,
-          "-env env_handle ?-name database? ?-reversekey BOOLEAN? \
-           ?-dupsort BOOLEAN? ?-dupfixed BOOLEAN? ?-reversedup BOOLEAN? \
-           ?-create BOOLEAN? "
-          );
-
+      if( objc < 8 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "-env env_handle -dbi dbi_handle -channel channelId ?-format binary|tsv|mdbdump? ?-runsize bytes? ?-threads n? ?-batch n? ");
         return TCL_ERROR;
       }
 
       for(i=2; i+1<objc; i+=2){
         zArg = Tcl_GetStringFromObj(objv[i], 0);
-
-        if( strcmp(zArg, "-name")==0 ){
-            database = Tcl_GetStringFromObj(objv[i+1], &len);
-            if(!database || len < 0) {
-                return TCL_ERROR;
+        if( strcmp(zArg, "-env")==0 ){
+            envHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-dbi")==0 ){
+            dbiHandle = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-channel")==0 ){
+            chanName = Tcl_GetStringFromObj(objv[i+1], 0);
+        } else if( strcmp(zArg, "-format")==0 ){
+            if( Tcl_GetIndexFromObj(interp, objv[i+1], LMDB_Format_strs,
+                                    "format", 0, &format) ){
+              return TCL_ERROR;
             }
-        } else if( strcmp(zArg, "-env")==0 ){
-            handle = Tcl_GetStringFromObj(objv[i+1], &len);
-            if(!handle || len < 0) {
-                return TCL_ERROR;
+        } else if( strcmp(zArg, "-runsize")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &runsize) != TCL_OK) {
+              return TCL_ERROR;
             }
-        } else if( strcmp(zArg, "-reversekey")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_REVERSEKEY;
-            }else{
-              flags &= ~MDB_REVERSEKEY;
+            if(runsize < 1) {
+              Tcl_AppendResult(interp, "-runsize must be a positive integer", (char*)0);
+              return TCL_ERROR;
             }
-        } else if( strcmp(zArg, "-dupsort")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_DUPSORT;
-            }else{
-              flags &= ~MDB_DUPSORT;
+        } else if( strcmp(zArg, "-threads")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &threads) != TCL_OK) {
+              return TCL_ERROR;
             }
-        } else if( strcmp(zArg, "-dupfixed")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_DUPFIXED;
-            }else{
-              flags &= ~MDB_DUPFIXED;
+            if(threads < 1) {
+              Tcl_AppendResult(interp, "-threads must be a positive integer", (char*)0);
+              return TCL_ERROR;
             }
-        } else if( strcmp(zArg, "-reversedup")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_REVERSEDUP;
-            }else{
-              flags &= ~MDB_REVERSEDUP;
+        } else if( strcmp(zArg, "-batch")==0 ){
+            if(Tcl_GetIntFromObj(interp, objv[i+1], &batch) != TCL_OK) {
+              return TCL_ERROR;
             }
-        } else if( strcmp(zArg, "-create")==0 ){
-            int b;
-            if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-            if( b ){
-              flags |= MDB_CREATE;
-            }else{
-              flags &= ~MDB_CREATE;
+            if(batch < 1) {
+              Tcl_AppendResult(interp, "-batch must be a positive integer", (char*)0);
+              return TCL_ERROR;
             }
-          } else{
+        } else{
            Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
            return TCL_ERROR;
         }
       }
 
-      if(!handle) {
-          if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", (char *)NULL );
-          }
+      if(!envHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid env handle ", (char *)NULL );
+        }
 
-          return TCL_ERROR;
+        return TCL_ERROR;
       }
 
-      hashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, handle );
-      if( !hashEntryPtr ) {
-          if( interp ) {
+      envHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, envHandle );
+      if( !envHashEntryPtr ) {
+        if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", handle, (char *)NULL );
-          }
+            Tcl_AppendStringsToObj( resultObj, "invalid env handle ", envHandle, (char *)NULL );
+        }
 
-          return TCL_ERROR;
+        return TCL_ERROR;
       }
 
-      env = Tcl_GetHashValue( hashEntryPtr );
-      if (mdb_env_get_path(env, &env_path) || env_path == NULL)
-      {
-          if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "env was not open", (char *)NULL );
-          }
-          return TCL_ERROR;
-      }
+      env = Tcl_GetHashValue( envHashEntryPtr );
 
-      result = mdb_txn_begin(env, NULL, 0, &txn);
-      if(result != 0) {
-          if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-          }
+      if(!dbiHandle) {
+        if( interp ) {
+          Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
+          Tcl_AppendStringsToObj( resultObj, "invalid dbi handle ", (char *)NULL );
+        }
 
-          return TCL_ERROR;
+        return TCL_ERROR;
       }
 
-      result = mdb_dbi_open(txn, database, flags, &dbi);
-      if(result != 0) {
-          if( interp ) {
+      dbiHashEntryPtr = Tcl_FindHashEntry( tsdPtr->lmdb_hashtblPtr, dbiHandle );
+      if( !dbiHashEntryPtr ) {
+        if( interp ) {
             Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-          }
+            Tcl_AppendStringsToObj( resultObj, "invalid dbi handle ", dbiHandle, (char *)NULL );
+        }
 
-          return TCL_ERROR;
+        return TCL_ERROR;
       }
 
-      /*
-       * The database handle will be private to the current transaction
-       * until the transaction is successfully committed.
-       * After a successful commit the handle will reside in the shared
-       * environment, and may be used by other transactions.
-       * Here I use a transaction and try to commit, users need use
-       * env_handle txn command (at script level) to create a new
-       * transactions.
-       */
-      result = mdb_txn_commit(txn);
-      if(result != 0) {
-          if( interp ) {
-            Tcl_Obj *resultObj = Tcl_GetObjResult( interp );
-            Tcl_AppendStringsToObj( resultObj, "ERROR: ", mdb_strerror(result), (char *)NULL );
-          }
+      dbi = (MDB_dbi)(uintptr_t)Tcl_GetHashValue( dbiHashEntryPtr );
 
-          return TCL_ERROR;
+      if(!chanName) {
+        Tcl_AppendResult(interp, "missing -channel", (char*)0);
+        return TCL_ERROR;
       }
 
-      Tcl_MutexLock(&myMutex);
-      sprintf( handleName, "dbi%d", tsdPtr->dbi_count++ );
-
-      pResultStr = Tcl_NewStringObj( handleName, -1 );
-
-      newHashEntryPtr = Tcl_CreateHashEntry(tsdPtr->lmdb_hashtblPtr, handleName, &newvalue);
-      Tcl_SetHashValue(newHashEntryPtr, (ClientData)(uintptr_t)dbi);
-      Tcl_MutexUnlock(&myMutex);
-
-      Tcl_CreateObjCommand(interp, handleName, (Tcl_ObjCmdProc *) LMDB_DBI,
-            (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
-
-      Tcl_SetObjResult(interp, pResultStr);
-
-      break;
-    }
-
-    case DB_VERSION: {
-      char *zArg;
-      char *verString = NULL;
-      int major = 0, minor = 0, patch = 0;
-      int bReturnString = 0;
-      Tcl_Obj *pResultStr = NULL;
-
-      if( objc == 2 || objc == 3 ){
-        if (objc == 3) {
-          zArg = Tcl_GetStringFromObj(objv[2], 0);
-          if( strcmp(zArg, "-string")==0 ){
-            bReturnString = 1;
-          } else {
-            Tcl_WrongNumArgs(interp, 2, objv, "?-string?");
-            return TCL_ERROR;
-          }
-        }
-      }else{
-        Tcl_WrongNumArgs(interp, 2, objv, "?-string?");
+      chan = Tcl_GetChannel(interp, chanName, &mode);
+      if(!chan) {
+        return TCL_ERROR;
+      }
+      if((mode & TCL_READABLE) == 0) {
+        Tcl_AppendResult(interp, "channel \"", chanName,
+                         "\" wasn't opened for reading", (char*)0);
         return TCL_ERROR;
       }
 
-      verString = mdb_version(&major, &minor, &patch);
-
-      if(bReturnString) {
-          pResultStr = Tcl_NewStringObj(verString, -1);
-      } else {
-          pResultStr = Tcl_NewListObj(3, NULL);
-          Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(major));
-          Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(minor));
-          Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(patch));
+      if(LMDB_BulkLoad(interp, env, dbi, chan, format, runsize, threads,
+                       batch, &count) != TCL_OK) {
+        return TCL_ERROR;
       }
 
-      Tcl_SetObjResult(interp,  pResultStr);
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj( count ));
 
       break;
     }
+
   }
 
   return TCL_OK;
@@ -2719,6 +10189,7 @@ EXTERN int Lmdb_Init(Tcl_Interp *interp)
         tsdPtr->txn_count = 0;
         tsdPtr->dbi_count = 0;
         tsdPtr->cur_count = 0;
+        tsdPtr->blob_count = 0;
     }
     Tcl_MutexUnlock(&myMutex);
 
@@ -0,0 +1,460 @@
+# bench.tcl --
+#
+#	Benchmark suite for tcl-lmdb.
+#
+#	Usage: tclsh bench.tcl ?-option value ...?
+#
+#	-load script        script to load the package (used by "make bench")
+#	-flags list         more options as one list (BENCHFLAGS of "make bench")
+#	-output file        write the JSON report to file (default stdout)
+#	-directory dir      scratch directory for the environments
+#	-workloads list     workloads to run (default all, see below)
+#	-sizes list         value sizes in bytes (default 8 .. 1MB)
+#	-syncmodes list     sync nosync (default both)
+#	-count n            operations per workload (default 20000)
+#	-maxbytes n         cap of count * size per workload (default 64MB)
+#	-batch n            operations per write transaction (default 1000)
+#	-seed n             random seed (default 1)
+#
+#	Every workload runs for every value size under every sync mode in a
+#	fresh environment. The report is a JSON object with one result per
+#	run: ops/s and latency percentiles in microseconds.
+#------------------------------------------------------------------------------
+
+namespace eval bench {
+    variable options
+    array set options {
+        -load      {}
+        -flags     {}
+        -output    {}
+        -directory {}
+        -workloads {seqput randput seqget randget scan dupsort dupfixed}
+        -sizes     {8 64 512 4096 65536 1048576}
+        -syncmodes {sync nosync}
+        -count     20000
+        -maxbytes  67108864
+        -batch     1000
+        -seed      1
+    }
+    variable results {}
+}
+
+proc bench::usage {} {
+    variable options
+    puts stderr "usage: [file tail [info script]] ?-option value ...?"
+    puts stderr "options: [lsort [array names options]]"
+    exit 1
+}
+
+proc bench::parseArgs {argv} {
+    variable options
+    if {[llength $argv] % 2} {
+        usage
+    }
+    foreach {opt value} $argv {
+        if {![info exists options($opt)]} {
+            usage
+        }
+        if {$opt eq "-flags"} {
+            parseArgs $value
+            continue
+        }
+        set options($opt) $value
+    }
+}
+
+#------------------------------------------------------------------------------
+# Helpers
+
+proc bench::key {i} {
+    return [format %016d $i]
+}
+
+# A deterministic permutation of 0 .. n-1 (Fisher-Yates).
+proc bench::permutation {n} {
+    set l {}
+    for {set i 0} {$i < $n} {incr i} {
+        lappend l $i
+    }
+    for {set i [expr {$n - 1}]} {$i > 0} {incr i -1} {
+        set j [expr {int(rand() * ($i + 1))}]
+        set t [lindex $l $i]
+        lset l $i [lindex $l $j]
+        lset l $j $t
+    }
+    return $l
+}
+
+proc bench::openEnv {sync} {
+    variable options
+    variable envdir
+
+    set envdir [file join $options(-directory) \
+        bench-[pid]-[clock microseconds]]
+    file mkdir $envdir
+
+    set env [lmdb env]
+    $env set_mapsize [expr {wide(4) * 1024 * 1024 * 1024}]
+    $env set_maxdbs 4
+    $env open -path $envdir -nosync [expr {$sync eq "nosync"}]
+    return $env
+}
+
+proc bench::closeEnv {env} {
+    variable envdir
+    $env close
+    file delete -force $envdir
+}
+
+proc bench::percentile {sorted p} {
+    set n [llength $sorted]
+    if {$n == 0} {
+        return 0
+    }
+    set i [expr {int(ceil($p / 100.0 * $n)) - 1}]
+    if {$i < 0} {
+        set i 0
+    }
+    return [lindex $sorted $i]
+}
+
+# Record one run. samples are per-operation latencies in microseconds.
+proc bench::report {workload size sync ops elapsed samples {extra {}}} {
+    variable results
+
+    set sorted [lsort -integer $samples]
+    set seconds [expr {$elapsed / 1e6}]
+    if {$seconds <= 0} {
+        set seconds 1e-6
+    }
+
+    set r [dict create \
+        workload $workload value_size $size sync $sync ops $ops \
+        seconds [format %.6f $seconds] \
+        ops_per_sec [format %.1f [expr {$ops / $seconds}]] \
+        latency_us [dict create \
+            p50  [percentile $sorted 50] \
+            p90  [percentile $sorted 90] \
+            p99  [percentile $sorted 99] \
+            p999 [percentile $sorted 99.9] \
+            max  [percentile $sorted 100]]]
+    foreach {k v} $extra {
+        dict set r $k $v
+    }
+    lappend results $r
+
+    puts stderr [format "%-10s %8d %-7s %10s ops/s  p50 %6s us  p99 %6s us" \
+        $workload $size $sync [dict get $r ops_per_sec] \
+        [dict get $r latency_us p50] [dict get $r latency_us p99]]
+}
+
+# Insert keys in the given order, committing every -batch operations.
+# Returns {elapsed samples commitSamples}.
+proc bench::load {env dbi order value} {
+    variable options
+
+    set samples {}
+    set commits {}
+    set n 0
+    set start [clock microseconds]
+    set txn [$env txn]
+    foreach i $order {
+        set t0 [clock microseconds]
+        $dbi put [key $i] $value -txn $txn
+        lappend samples [expr {[clock microseconds] - $t0}]
+        if {[incr n] % $options(-batch) == 0} {
+            set t0 [clock microseconds]
+            $txn commit
+            $txn close
+            lappend commits [expr {[clock microseconds] - $t0}]
+            set txn [$env txn]
+        }
+    }
+    set t0 [clock microseconds]
+    $txn commit
+    $txn close
+    lappend commits [expr {[clock microseconds] - $t0}]
+    return [list [expr {[clock microseconds] - $start}] $samples $commits]
+}
+
+proc bench::commitExtra {commits} {
+    set sorted [lsort -integer $commits]
+    return [list commit_latency_us [dict create \
+        count [llength $sorted] \
+        p50 [percentile $sorted 50] \
+        p99 [percentile $sorted 99] \
+        max [percentile $sorted 100]]]
+}
+
+#------------------------------------------------------------------------------
+# Workloads. Each one gets the number of operations, value size and
+# sync mode, and records its results with bench::report.
+
+proc bench::run_seqput {count size sync} {
+    set env [openEnv $sync]
+    set dbi [lmdb open -env $env]
+    set order {}
+    for {set i 0} {$i < $count} {incr i} {
+        lappend order $i
+    }
+    lassign [load $env $dbi $order [string repeat x $size]] elapsed samples commits
+    report seqput $size $sync $count $elapsed $samples [commitExtra $commits]
+    $dbi close -env $env
+    closeEnv $env
+}
+
+proc bench::run_randput {count size sync} {
+    set env [openEnv $sync]
+    set dbi [lmdb open -env $env]
+    set order [permutation $count]
+    lassign [load $env $dbi $order [string repeat x $size]] elapsed samples commits
+    report randput $size $sync $count $elapsed $samples [commitExtra $commits]
+    $dbi close -env $env
+    closeEnv $env
+}
+
+proc bench::getWorkload {name count size sync order} {
+    set env [openEnv $sync]
+    set dbi [lmdb open -env $env]
+    set seq {}
+    for {set i 0} {$i < $count} {incr i} {
+        lappend seq $i
+    }
+    load $env $dbi $seq [string repeat x $size]
+
+    set samples {}
+    set txn [$env txn -readonly 1]
+    set start [clock microseconds]
+    foreach i $order {
+        set t0 [clock microseconds]
+        $dbi get [key $i] -txn $txn
+        lappend samples [expr {[clock microseconds] - $t0}]
+    }
+    set elapsed [expr {[clock microseconds] - $start}]
+    $txn abort
+    $txn close
+    report $name $size $sync $count $elapsed $samples
+    $dbi close -env $env
+    closeEnv $env
+}
+
+proc bench::run_seqget {count size sync} {
+    set order {}
+    for {set i 0} {$i < $count} {incr i} {
+        lappend order $i
+    }
+    getWorkload seqget $count $size $sync $order
+}
+
+proc bench::run_randget {count size sync} {
+    getWorkload randget $count $size $sync [permutation $count]
+}
+
+proc bench::cursorScan {dbi txn op} {
+    set samples {}
+    set n 0
+    set cursor [$dbi cursor -txn $txn]
+    set start [clock microseconds]
+    while 1 {
+        set t0 [clock microseconds]
+        if {[catch {$cursor get $op}]} {
+            break
+        }
+        lappend samples [expr {[clock microseconds] - $t0}]
+        incr n
+    }
+    set elapsed [expr {[clock microseconds] - $start}]
+    $cursor close
+    return [list $n $elapsed $samples]
+}
+
+proc bench::run_scan {count size sync} {
+    set env [openEnv $sync]
+    set dbi [lmdb open -env $env]
+    set order {}
+    for {set i 0} {$i < $count} {incr i} {
+        lappend order $i
+    }
+    load $env $dbi $order [string repeat x $size]
+
+    set txn [$env txn -readonly 1]
+    lassign [cursorScan $dbi $txn -next] n elapsed samples
+    $txn abort
+    $txn close
+    report scan $size $sync $n $elapsed $samples
+    $dbi close -env $env
+    closeEnv $env
+}
+
+# Keys with 10 sorted duplicates each. Values of a -dupsort database
+# must fit in a key, so the size is capped by get_maxkeysize.
+proc bench::dupWorkload {name count size sync flags} {
+    variable options
+
+    set env [openEnv $sync]
+    set maxsize [$env get_maxkeysize]
+    if {$size > $maxsize} {
+        puts stderr [format "%-10s %8d %-7s skipped, values over maxkeysize %d" \
+            $name $size $sync $maxsize]
+        closeEnv $env
+        return
+    }
+    set dbi [lmdb open -env $env -name $name -create 1 {*}$flags]
+
+    set samples {}
+    set commits {}
+    set n 0
+    set start [clock microseconds]
+    set txn [$env txn]
+    for {set i 0} {$n < $count} {incr i} {
+        for {set j 0} {$j < 10 && $n < $count} {incr j} {
+            set value [format %0${size}d $j]
+            set t0 [clock microseconds]
+            $dbi put [key $i] $value -txn $txn
+            lappend samples [expr {[clock microseconds] - $t0}]
+            if {[incr n] % $options(-batch) == 0} {
+                set t0 [clock microseconds]
+                $txn commit
+                $txn close
+                lappend commits [expr {[clock microseconds] - $t0}]
+                set txn [$env txn]
+            }
+        }
+    }
+    $txn commit
+    $txn close
+    set elapsed [expr {[clock microseconds] - $start}]
+    report ${name}-put $size $sync $count $elapsed $samples [commitExtra $commits]
+
+    set txn [$env txn -readonly 1]
+    if {$name eq "dupfixed"} {
+        # One call returns up to a page of duplicates.
+        set samples {}
+        set n 0
+        set cursor [$dbi cursor -txn $txn]
+        set start [clock microseconds]
+        while {![catch {$cursor get -nextnodup} data]} {
+            set t0 [clock microseconds]
+            set data [$cursor get -get_multiple {*}$data]
+            lappend samples [expr {[clock microseconds] - $t0}]
+            incr n [expr {[string length [lindex $data 1]] / $size}]
+            while {![catch {$cursor get -next_multiple {*}$data} data]} {
+                incr n [expr {[string length [lindex $data 1]] / $size}]
+            }
+        }
+        set elapsed [expr {[clock microseconds] - $start}]
+        $cursor close
+    } else {
+        lassign [cursorScan $dbi $txn -next] n elapsed samples
+    }
+    $txn abort
+    $txn close
+    report ${name}-scan $size $sync $n $elapsed $samples
+
+    $dbi close -env $env
+    closeEnv $env
+}
+
+proc bench::run_dupsort {count size sync} {
+    dupWorkload dupsort $count $size $sync {-dupsort 1}
+}
+
+proc bench::run_dupfixed {count size sync} {
+    dupWorkload dupfixed $count $size $sync {-dupsort 1 -dupfixed 1}
+}
+
+#------------------------------------------------------------------------------
+# JSON output
+
+# Keys whose values are nested objects.
+set bench::jsonObjects {latency_us commit_latency_us}
+
+proc bench::jsonValue {v} {
+    if {[string is double -strict $v]} {
+        return $v
+    }
+    return "\"[string map {\\ \\\\ \" \\\" \n \\n \t \\t} $v]\""
+}
+
+proc bench::jsonObject {d} {
+    variable jsonObjects
+    set parts {}
+    dict for {k v} $d {
+        if {$k in $jsonObjects} {
+            lappend parts "\"$k\": [jsonObject $v]"
+        } else {
+            lappend parts "\"$k\": [jsonValue $v]"
+        }
+    }
+    return "{[join $parts {, }]}"
+}
+
+proc bench::json {} {
+    variable results
+    variable options
+
+    set head [dict create \
+        suite tcl-lmdb \
+        lmdb_version [lmdb version -string] \
+        tcl_version [info patchlevel] \
+        platform "$::tcl_platform(os) $::tcl_platform(machine)" \
+        timestamp [clock format [clock seconds] -gmt 1 \
+            -format %Y-%m-%dT%H:%M:%SZ] \
+        seed $options(-seed) \
+        batch $options(-batch)]
+    set runs {}
+    foreach r $results {
+        lappend runs "    [jsonObject $r]"
+    }
+    set out "{\n"
+    dict for {k v} $head {
+        append out "  \"$k\": [jsonValue $v],\n"
+    }
+    append out "  \"results\": \[\n[join $runs ,\n]\n  \]\n}"
+    return $out
+}
+
+#------------------------------------------------------------------------------
+
+proc bench::main {argv} {
+    variable options
+
+    parseArgs $argv
+    if {$options(-load) ne ""} {
+        uplevel #0 $options(-load)
+    }
+    package require lmdb
+
+    if {$options(-directory) eq ""} {
+        set options(-directory) [pwd]
+    }
+    expr {srand($options(-seed))}
+
+    foreach sync $options(-syncmodes) {
+        if {$sync ni {sync nosync}} {
+            error "unknown sync mode \"$sync\": must be sync or nosync"
+        }
+        foreach workload $options(-workloads) {
+            if {[info commands run_$workload] eq ""} {
+                error "unknown workload \"$workload\""
+            }
+            foreach size $options(-sizes) {
+                set count $options(-count)
+                if {$count * $size > $options(-maxbytes)} {
+                    set count [expr {max(1, $options(-maxbytes) / $size)}]
+                }
+                run_$workload $count $size $sync
+            }
+        }
+    }
+
+    if {$options(-output) eq ""} {
+        puts [json]
+    } else {
+        set f [open $options(-output) w]
+        puts $f [json]
+        close $f
+    }
+}
+
+bench::main $argv
@@ -0,0 +1,459 @@
+# concurrency.tcl --
+#
+#	Concurrency benchmark for tcl-lmdb: reader threads and reader
+#	processes against one environment while writers commit.
+#
+#	Usage: tclsh concurrency.tcl ?-option value ...?
+#
+#	-load script        script to load the package (used by "make bench")
+#	-flags list         more options as one list (BENCHFLAGS of "make bench")
+#	-output file        write the JSON report to file (default stdout)
+#	-directory dir      scratch directory for the environment
+#	-threads list       reader thread counts to run (default 1 2 4 8)
+#	-processes list     reader process counts to run (default 0 2)
+#	-writers n          writer threads (default 1)
+#	-keys n             keys loaded before the runs (default 100000)
+#	-valuesize n        value size in bytes (default 100)
+#	-duration ms        length of each run (default 3000)
+#	-readbatch n        gets per read transaction (default 100)
+#	-batch n            puts per write transaction (default 100)
+#	-maxreaders n       size of the reader table (default 126)
+#	-nosync bool        open the environment with -nosync (default 1)
+#	-seed n             random seed (default 1)
+#
+#	Every combination of -threads and -processes is one run. Reader
+#	threads use the Thread package, reader processes are child tclsh
+#	processes running this script with -child. As the Tcl binding keeps
+#	handles per thread, each reader thread opens the environment itself,
+#	like the Thread example in README.md.
+#
+#	Each run reports reader throughput (total, per reader and relative to
+#	the single reader rate of the first run), the time writers wait in
+#	"$env txn" for the writer mutex, commit latency, and the reader table
+#	usage sampled every 50 ms from "$env info" and "$env reader_list".
+#------------------------------------------------------------------------------
+
+namespace eval bench {
+    variable options
+    array set options {
+        -load       {}
+        -flags      {}
+        -output     {}
+        -directory  {}
+        -threads    {1 2 4 8}
+        -processes  {0 2}
+        -writers    1
+        -keys       100000
+        -valuesize  100
+        -duration   3000
+        -readbatch  100
+        -batch      100
+        -maxreaders 126
+        -nosync     1
+        -seed       1
+        -child      0
+        -path       {}
+        -start      0
+    }
+    variable results {}
+}
+
+proc bench::usage {} {
+    variable options
+    puts stderr "usage: [file tail [info script]] ?-option value ...?"
+    puts stderr "options: [lsort [array names options]]"
+    exit 1
+}
+
+proc bench::parseArgs {argv} {
+    variable options
+    if {[llength $argv] % 2} {
+        usage
+    }
+    foreach {opt value} $argv {
+        if {![info exists options($opt)]} {
+            usage
+        }
+        if {$opt eq "-flags"} {
+            parseArgs $value
+            continue
+        }
+        set options($opt) $value
+    }
+}
+
+proc bench::percentile {sorted p} {
+    set n [llength $sorted]
+    if {$n == 0} {
+        return 0
+    }
+    set i [expr {int(ceil($p / 100.0 * $n)) - 1}]
+    if {$i < 0} {
+        set i 0
+    }
+    return [lindex $sorted $i]
+}
+
+proc bench::summary {samples} {
+    set sorted [lsort -integer $samples]
+    return [dict create \
+        count [llength $sorted] \
+        p50 [percentile $sorted 50] \
+        p99 [percentile $sorted 99] \
+        max [percentile $sorted 100]]
+}
+
+#------------------------------------------------------------------------------
+# Worker scripts. They run in reader threads, writer threads and child
+# processes alike, so they only use their arguments and the lmdb package.
+
+set bench::openScript {
+    proc openEnv {path maxreaders nosync} {
+        set env [lmdb env]
+        $env set_mapsize [expr {wide(4) * 1024 * 1024 * 1024}]
+        $env set_maxreaders $maxreaders
+        $env open -path $path -nosync $nosync
+        return $env
+    }
+
+    proc setup {path maxreaders nosync} {
+        set ::myenv [openEnv $path $maxreaders $nosync]
+        set ::mydbi [lmdb open -env $::myenv]
+    }
+
+    proc teardown {} {
+        $::mydbi close -env $::myenv
+        $::myenv close
+    }
+
+    proc waitUntil {ms} {
+        set delay [expr {$ms - [clock milliseconds]}]
+        if {$delay > 0} {
+            after $delay
+        }
+    }
+}
+
+# Returns the number of gets done between start and end.
+set bench::readerScript {
+    proc reader {keys readbatch seed start end} {
+        global myenv mydbi
+        expr {srand($seed)}
+        set n 0
+        waitUntil $start
+        while {[clock milliseconds] < $end} {
+            set txn [$myenv txn -readonly 1]
+            for {set i 0} {$i < $readbatch} {incr i} {
+                $mydbi get [format %016d [expr {int(rand() * $keys)}]] -txn $txn
+            }
+            $txn abort
+            $txn close
+            incr n $readbatch
+        }
+        teardown
+        return $n
+    }
+}
+
+# Returns {commits waitSamples commitSamples}, in microseconds.
+set bench::writerScript {
+    proc writer {keys batch value seed start end} {
+        global myenv mydbi
+        expr {srand($seed)}
+        set waits {}
+        set commits {}
+        waitUntil $start
+        while {[clock milliseconds] < $end} {
+            set t0 [clock microseconds]
+            set txn [$myenv txn]
+            lappend waits [expr {[clock microseconds] - $t0}]
+            for {set i 0} {$i < $batch} {incr i} {
+                $mydbi put [format %016d [expr {int(rand() * $keys)}]] $value \
+                    -txn $txn
+            }
+            set t0 [clock microseconds]
+            $txn commit
+            $txn close
+            lappend commits [expr {[clock microseconds] - $t0}]
+        }
+        teardown
+        return [list [llength $commits] $waits $commits]
+    }
+}
+
+#------------------------------------------------------------------------------
+
+proc bench::load {env} {
+    variable options
+
+    set dbi [lmdb open -env $env]
+    set value [string repeat x $options(-valuesize)]
+    set txn [$env txn]
+    for {set i 0} {$i < $options(-keys)} {incr i} {
+        $dbi put [format %016d $i] $value -txn $txn
+        if {($i + 1) % 10000 == 0} {
+            $txn commit
+            $txn close
+            set txn [$env txn]
+        }
+    }
+    $txn commit
+    $txn close
+    $dbi close -env $env
+}
+
+proc bench::newThread {path} {
+    variable options
+    variable openScript
+
+    set tid [thread::create]
+    thread::send $tid [list uplevel #0 $options(-load)]
+    thread::send $tid {package require lmdb}
+    thread::send $tid $openScript
+    thread::send $tid [list setup $path $options(-maxreaders) $options(-nosync)]
+    return $tid
+}
+
+proc bench::run {env path nthreads nprocs} {
+    variable options
+    variable readerScript
+    variable writerScript
+    variable done
+
+    # Open the environment in every worker before the start time and let
+    # them begin together, so thread creation, process startup and
+    # mdb_env_open are not part of the measurement. Opening the same
+    # environment more than once in a process may reset the lock table,
+    # which is harmless only while none of them has a transaction.
+    set tids {}
+    for {set i 0} {$i < $options(-writers) + $nthreads} {incr i} {
+        lappend tids [newThread $path]
+    }
+    set start [expr {[clock milliseconds] + 1000 + 100 * $nprocs}]
+    set end [expr {$start + $options(-duration)}]
+
+    array unset done
+    set i 0
+    foreach tid $tids {
+        set seed [expr {$options(-seed) * 1000 + $i}]
+        if {$i < $options(-writers)} {
+            thread::send $tid $writerScript
+            set cmd [list writer $options(-keys) $options(-batch) \
+                [string repeat y $options(-valuesize)] $seed $start $end]
+        } else {
+            thread::send $tid $readerScript
+            set cmd [list reader $options(-keys) \
+                $options(-readbatch) $seed $start $end]
+        }
+        thread::send -async $tid $cmd [namespace current]::done($i)
+        incr i
+    }
+
+    set chans {}
+    for {set p 0} {$p < $nprocs} {incr p} {
+        set seed [expr {$options(-seed) * 1000 + 500 + $p}]
+        lappend chans [open |[list [info nameofexecutable] [info script] \
+            -child 1 -load $options(-load) -path $path \
+            -maxreaders $options(-maxreaders) -nosync $options(-nosync) \
+            -keys $options(-keys) -readbatch $options(-readbatch) \
+            -seed $seed -start $start -duration $options(-duration) \
+            2>@stderr] r]
+    }
+
+    # Sample the reader table while the run is going on.
+    set maxSlots 0
+    set maxActive 0
+    while {[clock milliseconds] < $end} {
+        if {[clock milliseconds] >= $start} {
+            set maxSlots [expr {max($maxSlots, [lindex [$env info] 4])}]
+            set active 0
+            foreach r [$env reader_list] {
+                if {[lindex $r 2] ne "-"} {
+                    incr active
+                }
+            }
+            set maxActive [expr {max($maxActive, $active)}]
+        }
+        after 50
+    }
+
+    set readerOps 0
+    set commits 0
+    set waits {}
+    set commitSamples {}
+    for {set i 0} {$i < [llength $tids]} {incr i} {
+        if {![info exists done($i)]} {
+            vwait [namespace current]::done($i)
+        }
+        if {$i < $options(-writers)} {
+            lassign $done($i) n w c
+            incr commits $n
+            lappend waits {*}$w
+            lappend commitSamples {*}$c
+        } else {
+            incr readerOps $done($i)
+        }
+    }
+    foreach tid $tids {
+        thread::release $tid
+    }
+    foreach chan $chans {
+        incr readerOps [string trim [read $chan]]
+        close $chan
+    }
+
+    set readers [expr {$nthreads + $nprocs}]
+    set seconds [expr {$options(-duration) / 1000.0}]
+    set rate [expr {$readerOps / $seconds}]
+    return [dict create \
+        reader_threads $nthreads \
+        reader_processes $nprocs \
+        writers $options(-writers) \
+        seconds [format %.3f $seconds] \
+        reader_ops $readerOps \
+        reader_ops_per_sec [format %.1f $rate] \
+        per_reader_ops_per_sec [format %.1f \
+            [expr {$readers ? $rate / $readers : 0}]] \
+        writer_commits $commits \
+        writer_commits_per_sec [format %.1f [expr {$commits / $seconds}]] \
+        writer_wait_us [summary $waits] \
+        commit_latency_us [summary $commitSamples] \
+        reader_slots [dict create \
+            maxreaders [lindex [$env info] 3] \
+            max_used $maxSlots \
+            max_active $maxActive]]
+}
+
+#------------------------------------------------------------------------------
+# JSON output
+
+# Keys whose values are nested objects.
+set bench::jsonObjects {writer_wait_us commit_latency_us reader_slots}
+
+proc bench::jsonValue {v} {
+    if {[string is double -strict $v]} {
+        return $v
+    }
+    return "\"[string map {\\ \\\\ \" \\\" \n \\n \t \\t} $v]\""
+}
+
+proc bench::jsonObject {d} {
+    variable jsonObjects
+    set parts {}
+    dict for {k v} $d {
+        if {$k in $jsonObjects} {
+            lappend parts "\"$k\": [jsonObject $v]"
+        } else {
+            lappend parts "\"$k\": [jsonValue $v]"
+        }
+    }
+    return "{[join $parts {, }]}"
+}
+
+proc bench::json {} {
+    variable results
+    variable options
+
+    set head [dict create \
+        suite tcl-lmdb-concurrency \
+        lmdb_version [lmdb version -string] \
+        tcl_version [info patchlevel] \
+        platform "$::tcl_platform(os) $::tcl_platform(machine)" \
+        timestamp [clock format [clock seconds] -gmt 1 \
+            -format %Y-%m-%dT%H:%M:%SZ] \
+        seed $options(-seed) \
+        keys $options(-keys) \
+        value_size $options(-valuesize) \
+        readbatch $options(-readbatch) \
+        batch $options(-batch) \
+        nosync $options(-nosync)]
+    set runs {}
+    foreach r $results {
+        lappend runs "    [jsonObject $r]"
+    }
+    set out "{\n"
+    dict for {k v} $head {
+        append out "  \"$k\": [jsonValue $v],\n"
+    }
+    append out "  \"results\": \[\n[join $runs ,\n]\n  \]\n}"
+    return $out
+}
+
+#------------------------------------------------------------------------------
+
+# A reader process: run one reader and print the number of gets.
+proc bench::child {} {
+    variable options
+    variable openScript
+    variable readerScript
+
+    uplevel #0 $openScript
+    uplevel #0 $readerScript
+    setup $options(-path) $options(-maxreaders) $options(-nosync)
+    puts [reader $options(-keys) $options(-readbatch) $options(-seed) \
+        $options(-start) [expr {$options(-start) + $options(-duration)}]]
+}
+
+proc bench::main {argv} {
+    variable options
+    variable results
+
+    parseArgs $argv
+    if {$options(-load) ne ""} {
+        uplevel #0 $options(-load)
+    }
+    package require lmdb
+
+    if {$options(-child)} {
+        child
+        return
+    }
+    package require Thread
+
+    if {$options(-directory) eq ""} {
+        set options(-directory) [pwd]
+    }
+    set path [file join $options(-directory) \
+        concurrency-[pid]-[clock microseconds]]
+    file mkdir $path
+
+    uplevel #0 $bench::openScript
+    set env [openEnv $path $options(-maxreaders) $options(-nosync)]
+    load $env
+
+    set base {}
+    foreach nprocs $options(-processes) {
+        foreach nthreads $options(-threads) {
+            if {$nthreads + $nprocs == 0} {
+                continue
+            }
+            set r [run $env $path $nthreads $nprocs]
+            set rate [dict get $r per_reader_ops_per_sec]
+            if {$base eq ""} {
+                set base $rate
+            }
+            dict set r scaling [format %.3f [expr {
+                $base > 0 ? [dict get $r reader_ops_per_sec] / $base : 0}]]
+            lappend results $r
+
+            puts stderr [format \
+                "threads %3d procs %3d  %12s gets/s  wait p99 %6s us  slots %d" \
+                $nthreads $nprocs [dict get $r reader_ops_per_sec] \
+                [dict get $r writer_wait_us p99] \
+                [dict get $r reader_slots max_used]]
+        }
+    }
+
+    $env close
+    file delete -force $path
+
+    if {$options(-output) eq ""} {
+        puts [json]
+    } else {
+        set f [open $options(-output) w]
+        puts $f [json]
+        close $f
+    }
+}
+
+bench::main $argv
@@ -0,0 +1,605 @@
+/*
+ * mdb_bench.c --
+ *
+ *	Microbenchmark for the bundled LMDB engine (generic/mdb.c), without
+ *	the Tcl binding. Drives mdb_put/mdb_get/cursor walks/commits directly.
+ *
+ *	Usage: mdb_bench ?options?
+ *
+ *	-p path       database directory (default ./mdb_bench.db, created)
+ *	-n count      number of keys in the key space (default 1000000)
+ *	-o ops        operations per phase (default count)
+ *	-v size       value size in bytes (default 100)
+ *	-V max        random value sizes from -v size up to max bytes
+ *	-d dist       key distribution: seq, uniform or zipf (default seq)
+ *	-z theta      zipf skew, 0 < theta < 1 (default 0.99)
+ *	-b batch      puts per write transaction (default 1000)
+ *	-t threads    reader threads for the get phase (default 1)
+ *	-m mapsize    map size in MB (default 4096)
+ *	-w phases     comma separated phases: put,get,scan,del (default put,get,scan)
+ *	-s seed       random seed (default 1)
+ *	-N            open the environment with MDB_NOSYNC
+ *	-W            open the environment with MDB_WRITEMAP
+ *	-P            collect hardware counters with perf_event_open (Linux)
+ *
+ *	Each phase prints one JSON object per line with ops/s and latency
+ *	percentiles in nanoseconds, in the same shape as tests/bench/bench.tcl,
+ *	and the last page number of the file afterwards.
+ *
+ *	With -V the put phase writes overflow values of mixed sizes, which
+ *	exercises the search for runs of free pages in mdb_page_alloc:
+ *	./mdb_bench -n 2000 -o 20000 -v 65536 -V 4194304 -d uniform -b 10 -w put
+ */
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "lmdb.h"
+
+#define KEYSIZE 16
+
+enum { DIST_SEQ, DIST_UNIFORM, DIST_ZIPF };
+
+static const char *distNames[] = { "seq", "uniform", "zipf" };
+
+typedef struct Options {
+  const char *path;
+  uint64_t count;
+  uint64_t ops;
+  size_t valsize;
+  size_t valmax;
+  int dist;
+  double theta;
+  int batch;
+  int threads;
+  size_t mapsize;
+  const char *phases;
+  uint64_t seed;
+  unsigned int envflags;
+  int perf;
+} Options;
+
+static Options opt;
+static MDB_env *env;
+static MDB_dbi dbi;
+
+#define CHECK(expr) do { int rc_ = (expr); if (rc_) { \
+    fprintf(stderr, "%s:%d: %s: %s\n", __FILE__, __LINE__, #expr, \
+            mdb_strerror(rc_)); exit(1); } } while (0)
+
+/*
+ * Random numbers: xorshift64*, one state per thread.
+ */
+static uint64_t rng_next(uint64_t *s)
+{
+  uint64_t x = *s;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *s = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_double(uint64_t *s)
+{
+  return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Zipfian generator (Gray et al., "Quickly generating billion-record
+ * synthetic databases"), as used by YCSB. Item 0 is the hottest.
+ */
+typedef struct Zipf {
+  uint64_t n;
+  double theta, alpha, zetan, eta, half;
+} Zipf;
+
+static Zipf zipf;
+
+static void zipf_init(Zipf *z, uint64_t n, double theta)
+{
+  double zeta2 = 0;
+  uint64_t i;
+
+  z->n = n;
+  z->theta = theta;
+  z->zetan = 0;
+  for (i = 1; i <= n; i++)
+    z->zetan += 1.0 / pow((double)i, theta);
+  for (i = 1; i <= 2; i++)
+    zeta2 += 1.0 / pow((double)i, theta);
+  z->alpha = 1.0 / (1.0 - theta);
+  z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+  z->half = pow(0.5, theta);
+}
+
+static uint64_t zipf_next(Zipf *z, uint64_t *s)
+{
+  double u = rng_double(s);
+  double uz = u * z->zetan;
+
+  if (uz < 1.0)
+    return 0;
+  if (uz < 1.0 + z->half)
+    return 1;
+  return (uint64_t)(z->n * pow(z->eta * u - z->eta + 1, z->alpha)) % z->n;
+}
+
+static uint64_t next_key(uint64_t i, uint64_t *s)
+{
+  switch (opt.dist) {
+  case DIST_UNIFORM:
+    return rng_next(s) % opt.count;
+  case DIST_ZIPF:
+    return zipf_next(&zipf, s);
+  default:
+    return i % opt.count;
+  }
+}
+
+static void format_key(char *buf, uint64_t k)
+{
+  char tmp[KEYSIZE + 1];
+
+  snprintf(tmp, sizeof(tmp), "%016llu", (unsigned long long)k);
+  memcpy(buf, tmp, KEYSIZE);
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Latency samples, one array per thread, merged for the report.
+ */
+typedef struct Samples {
+  uint64_t *v;
+  uint64_t n;
+} Samples;
+
+static void samples_init(Samples *sm, uint64_t cap)
+{
+  sm->v = malloc((cap ? cap : 1) * sizeof(uint64_t));
+  sm->n = 0;
+  if (!sm->v) {
+    perror("malloc");
+    exit(1);
+  }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(Samples *sm, double p)
+{
+  uint64_t i;
+
+  if (!sm->n)
+    return 0;
+  i = (uint64_t)ceil(p / 100.0 * sm->n);
+  return sm->v[i ? i - 1 : 0];
+}
+
+/*
+ * Hardware counters. The group is opened with inherit set, so counts of
+ * reader threads created during the phase are included.
+ */
+#define NCOUNTERS 4
+
+typedef struct Perf {
+  int fd[NCOUNTERS];
+  int ok[NCOUNTERS];
+  uint64_t value[NCOUNTERS];
+} Perf;
+
+static const char *perfNames[NCOUNTERS] = {
+  "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+static void perf_start(Perf *p)
+{
+  int i;
+
+  for (i = 0; i < NCOUNTERS; i++) {
+    p->fd[i] = -1;
+    p->ok[i] = 0;
+    p->value[i] = 0;
+  }
+#ifdef __linux__
+  if (opt.perf) {
+    static const uint64_t config[NCOUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for (i = 0; i < NCOUNTERS; i++) {
+      struct perf_event_attr attr;
+
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = config[i];
+      attr.disabled = 1;
+      attr.inherit = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      p->fd[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      if (p->fd[i] < 0) {
+        fprintf(stderr, "perf_event_open %s: %s\n", perfNames[i],
+                strerror(errno));
+        continue;
+      }
+      ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+}
+
+static void perf_stop(Perf *p)
+{
+  int i;
+
+  for (i = 0; i < NCOUNTERS; i++) {
+    if (p->fd[i] < 0)
+      continue;
+#ifdef __linux__
+    ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    p->ok[i] = read(p->fd[i], &p->value[i], sizeof(uint64_t)) ==
+               sizeof(uint64_t);
+#endif
+    close(p->fd[i]);
+  }
+}
+
+static void report(const char *phase, uint64_t ops, uint64_t elapsed,
+                   Samples *sm, Samples *commits, Perf *p)
+{
+  double seconds = elapsed / 1e9;
+  MDB_envinfo info;
+  int i;
+
+  qsort(sm->v, sm->n, sizeof(uint64_t), cmp_u64);
+  printf("{\"workload\": \"%s\", \"dist\": \"%s\", \"value_size\": %zu, "
+         "\"threads\": %d, \"sync\": \"%s\", \"ops\": %llu, "
+         "\"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+         "\"latency_ns\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+         "\"p999\": %llu, \"max\": %llu}",
+         phase, distNames[opt.dist], opt.valsize,
+         strcmp(phase, "get") ? 1 : opt.threads,
+         (opt.envflags & MDB_NOSYNC) ? "nosync" : "sync",
+         (unsigned long long)ops, seconds, seconds > 0 ? ops / seconds : 0.0,
+         (unsigned long long)percentile(sm, 50),
+         (unsigned long long)percentile(sm, 90),
+         (unsigned long long)percentile(sm, 99),
+         (unsigned long long)percentile(sm, 99.9),
+         (unsigned long long)percentile(sm, 100));
+  if (commits && commits->n) {
+    qsort(commits->v, commits->n, sizeof(uint64_t), cmp_u64);
+    printf(", \"commit_latency_ns\": {\"count\": %llu, \"p50\": %llu, "
+           "\"p99\": %llu, \"max\": %llu}",
+           (unsigned long long)commits->n,
+           (unsigned long long)percentile(commits, 50),
+           (unsigned long long)percentile(commits, 99),
+           (unsigned long long)percentile(commits, 100));
+  }
+  if (opt.perf) {
+    printf(", \"perf\": {");
+    for (i = 0; i < NCOUNTERS; i++) {
+      if (p->ok[i])
+        printf("%s\"%s\": %llu", i ? ", " : "", perfNames[i],
+               (unsigned long long)p->value[i]);
+      else
+        printf("%s\"%s\": null", i ? ", " : "", perfNames[i]);
+    }
+    printf("}");
+  }
+  CHECK(mdb_env_info(env, &info));
+  printf(", \"last_pgno\": %llu}\n", (unsigned long long)info.me_last_pgno);
+  fflush(stdout);
+}
+
+/*
+ * Phases
+ */
+static void phase_put(void)
+{
+  MDB_txn *txn;
+  MDB_val key, data;
+  char kbuf[KEYSIZE];
+  char *vbuf;
+  Samples sm, commits;
+  Perf perf;
+  uint64_t seed = opt.seed, sizeseed = opt.seed ^ 0x5DEECE66DULL;
+  uint64_t i, t0, start;
+  size_t vmax = opt.valmax > opt.valsize ? opt.valmax : opt.valsize;
+
+  vbuf = malloc(vmax ? vmax : 1);
+  memset(vbuf, 'x', vmax);
+  samples_init(&sm, opt.ops);
+  samples_init(&commits, opt.ops / opt.batch + 1);
+
+  perf_start(&perf);
+  start = now_ns();
+  CHECK(mdb_txn_begin(env, NULL, 0, &txn));
+  for (i = 0; i < opt.ops; i++) {
+    format_key(kbuf, next_key(i, &seed));
+    key.mv_size = KEYSIZE;
+    key.mv_data = kbuf;
+    data.mv_size = opt.valsize;
+    if (vmax > opt.valsize)
+      data.mv_size += rng_next(&sizeseed) % (vmax - opt.valsize + 1);
+    data.mv_data = vbuf;
+    t0 = now_ns();
+    CHECK(mdb_put(txn, dbi, &key, &data, 0));
+    sm.v[sm.n++] = now_ns() - t0;
+    if ((i + 1) % opt.batch == 0) {
+      t0 = now_ns();
+      CHECK(mdb_txn_commit(txn));
+      commits.v[commits.n++] = now_ns() - t0;
+      CHECK(mdb_txn_begin(env, NULL, 0, &txn));
+    }
+  }
+  t0 = now_ns();
+  CHECK(mdb_txn_commit(txn));
+  commits.v[commits.n++] = now_ns() - t0;
+  perf_stop(&perf);
+
+  report("put", opt.ops, now_ns() - start, &sm, &commits, &perf);
+  free(sm.v);
+  free(commits.v);
+  free(vbuf);
+}
+
+typedef struct Reader {
+  pthread_t tid;
+  uint64_t seed;
+  uint64_t ops;
+  uint64_t found;
+  Samples sm;
+} Reader;
+
+static void *reader_main(void *arg)
+{
+  Reader *r = (Reader *)arg;
+  MDB_txn *txn;
+  MDB_val key, data;
+  char kbuf[KEYSIZE];
+  uint64_t i, t0;
+
+  CHECK(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+  for (i = 0; i < r->ops; i++) {
+    format_key(kbuf, next_key(i, &r->seed));
+    key.mv_size = KEYSIZE;
+    key.mv_data = kbuf;
+    t0 = now_ns();
+    if (mdb_get(txn, dbi, &key, &data) == 0)
+      r->found++;
+    r->sm.v[r->sm.n++] = now_ns() - t0;
+  }
+  mdb_txn_abort(txn);
+  return NULL;
+}
+
+static void phase_get(void)
+{
+  Reader *readers;
+  Samples all;
+  Perf perf;
+  uint64_t start, elapsed, total = 0;
+  int i;
+
+  readers = calloc(opt.threads, sizeof(Reader));
+  for (i = 0; i < opt.threads; i++) {
+    readers[i].seed = opt.seed + 0x9E3779B97F4A7C15ULL * (i + 1);
+    readers[i].ops = opt.ops;
+    samples_init(&readers[i].sm, opt.ops);
+  }
+
+  perf_start(&perf);
+  start = now_ns();
+  for (i = 0; i < opt.threads; i++)
+    pthread_create(&readers[i].tid, NULL, reader_main, &readers[i]);
+  for (i = 0; i < opt.threads; i++)
+    pthread_join(readers[i].tid, NULL);
+  elapsed = now_ns() - start;
+  perf_stop(&perf);
+
+  samples_init(&all, opt.ops * opt.threads);
+  for (i = 0; i < opt.threads; i++) {
+    memcpy(all.v + all.n, readers[i].sm.v, readers[i].sm.n * sizeof(uint64_t));
+    all.n += readers[i].sm.n;
+    total += readers[i].ops;
+    free(readers[i].sm.v);
+  }
+
+  report("get", total, elapsed, &all, NULL, &perf);
+  free(all.v);
+  free(readers);
+}
+
+static void phase_scan(void)
+{
+  MDB_txn *txn;
+  MDB_cursor *cursor;
+  MDB_val key, data;
+  Samples sm;
+  Perf perf;
+  uint64_t n = 0, t0, start;
+  MDB_stat st;
+
+  CHECK(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+  CHECK(mdb_stat(txn, dbi, &st));
+  samples_init(&sm, st.ms_entries + 1);
+  CHECK(mdb_cursor_open(txn, dbi, &cursor));
+
+  perf_start(&perf);
+  start = now_ns();
+  for (;;) {
+    t0 = now_ns();
+    if (mdb_cursor_get(cursor, &key, &data, MDB_NEXT))
+      break;
+    sm.v[sm.n++] = now_ns() - t0;
+    n++;
+  }
+  perf_stop(&perf);
+
+  report("scan", n, now_ns() - start, &sm, NULL, &perf);
+  mdb_cursor_close(cursor);
+  mdb_txn_abort(txn);
+  free(sm.v);
+}
+
+static void phase_del(void)
+{
+  MDB_txn *txn;
+  MDB_val key;
+  char kbuf[KEYSIZE];
+  Samples sm, commits;
+  Perf perf;
+  uint64_t seed = opt.seed, i, t0, start, n = 0;
+  int rc;
+
+  samples_init(&sm, opt.ops);
+  samples_init(&commits, opt.ops / opt.batch + 1);
+
+  perf_start(&perf);
+  start = now_ns();
+  CHECK(mdb_txn_begin(env, NULL, 0, &txn));
+  for (i = 0; i < opt.ops; i++) {
+    format_key(kbuf, next_key(i, &seed));
+    key.mv_size = KEYSIZE;
+    key.mv_data = kbuf;
+    t0 = now_ns();
+    rc = mdb_del(txn, dbi, &key, NULL);
+    if (rc && rc != MDB_NOTFOUND)
+      CHECK(rc);
+    sm.v[sm.n++] = now_ns() - t0;
+    n++;
+    if ((i + 1) % opt.batch == 0) {
+      t0 = now_ns();
+      CHECK(mdb_txn_commit(txn));
+      commits.v[commits.n++] = now_ns() - t0;
+      CHECK(mdb_txn_begin(env, NULL, 0, &txn));
+    }
+  }
+  t0 = now_ns();
+  CHECK(mdb_txn_commit(txn));
+  commits.v[commits.n++] = now_ns() - t0;
+  perf_stop(&perf);
+
+  report("del", n, now_ns() - start, &sm, &commits, &perf);
+  free(sm.v);
+  free(commits.v);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+    "usage: %s [-p path] [-n count] [-o ops] [-v size] [-V max]\n"
+    "       [-d seq|uniform|zipf]\n"
+    "       [-z theta] [-b batch] [-t threads] [-m mapsizeMB]\n"
+    "       [-w put,get,scan,del] [-s seed] [-N] [-W] [-P]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  MDB_txn *txn;
+  char *phases, *phase, *save = NULL;
+  int c;
+
+  opt.path = "mdb_bench.db";
+  opt.count = 1000000;
+  opt.valsize = 100;
+  opt.dist = DIST_SEQ;
+  opt.theta = 0.99;
+  opt.batch = 1000;
+  opt.threads = 1;
+  opt.mapsize = 4096;
+  opt.phases = "put,get,scan";
+  opt.seed = 1;
+
+  while ((c = getopt(argc, argv, "p:n:o:v:V:d:z:b:t:m:w:s:NWP")) != -1) {
+    switch (c) {
+    case 'p': opt.path = optarg; break;
+    case 'n': opt.count = strtoull(optarg, NULL, 10); break;
+    case 'o': opt.ops = strtoull(optarg, NULL, 10); break;
+    case 'v': opt.valsize = strtoul(optarg, NULL, 10); break;
+    case 'V': opt.valmax = strtoul(optarg, NULL, 10); break;
+    case 'd':
+      for (opt.dist = 0; opt.dist < 3; opt.dist++)
+        if (!strcmp(optarg, distNames[opt.dist]))
+          break;
+      if (opt.dist == 3)
+        usage(argv[0]);
+      break;
+    case 'z': opt.theta = atof(optarg); break;
+    case 'b': opt.batch = atoi(optarg); break;
+    case 't': opt.threads = atoi(optarg); break;
+    case 'm': opt.mapsize = strtoul(optarg, NULL, 10); break;
+    case 'w': opt.phases = optarg; break;
+    case 's': opt.seed = strtoull(optarg, NULL, 10); break;
+    case 'N': opt.envflags |= MDB_NOSYNC; break;
+    case 'W': opt.envflags |= MDB_WRITEMAP; break;
+    case 'P': opt.perf = 1; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (!opt.count || opt.batch < 1 || opt.threads < 1 ||
+      (opt.dist == DIST_ZIPF && (opt.theta <= 0 || opt.theta >= 1)))
+    usage(argv[0]);
+  if (!opt.ops)
+    opt.ops = opt.count;
+  if (!opt.seed)
+    opt.seed = 1;
+  if (opt.dist == DIST_ZIPF)
+    zipf_init(&zipf, opt.count, opt.theta);
+
+  mkdir(opt.path, 0775);
+  CHECK(mdb_env_create(&env));
+  CHECK(mdb_env_set_mapsize(env, opt.mapsize * 1024 * 1024));
+  CHECK(mdb_env_set_maxreaders(env, opt.threads + 8));
+  CHECK(mdb_env_open(env, opt.path, opt.envflags, 0664));
+  CHECK(mdb_txn_begin(env, NULL, 0, &txn));
+  CHECK(mdb_dbi_open(txn, NULL, 0, &dbi));
+  CHECK(mdb_txn_commit(txn));
+
+  phases = strdup(opt.phases);
+  for (phase = strtok_r(phases, ",", &save); phase;
+       phase = strtok_r(NULL, ",", &save)) {
+    if (!strcmp(phase, "put"))
+      phase_put();
+    else if (!strcmp(phase, "get"))
+      phase_get();
+    else if (!strcmp(phase, "scan"))
+      phase_scan();
+    else if (!strcmp(phase, "del"))
+      phase_del();
+    else {
+      fprintf(stderr, "unknown phase \"%s\"\n", phase);
+      return 1;
+    }
+  }
+  free(phases);
+
+  mdb_env_close(env);
+  return 0;
+}
@@ -0,0 +1,439 @@
+/*
+ * midl_bench.c --
+ *
+ *	Microbenchmark for the ID list functions in generic/midl.c. It
+ *	includes midl.c directly, so the quicksort and the radix sort behind
+ *	mdb_midl_sort() can be timed separately. Searches and merges are
+ *	timed against the plain binary search and merge loop that midl.c
+ *	used before, which are kept here for reference.
+ *
+ *	Usage: midl_bench ?options?
+ *
+ *	-n sizes      comma separated list sizes (default 16,64,256,1024,4096,
+ *	              16384,65536,262144,1048576,4194304)
+ *	-t total      IDs sorted, searched or merged per size and case, the
+ *	              work is repeated until this many were done
+ *	              (default 4194304)
+ *	-w ops        comma separated: sort,search,merge (default all)
+ *	-s seed       random seed (default 1)
+ *
+ *	sort: each size is sorted with three input patterns: random page
+ *	numbers up to 4 times the list size, a descending list with 1% of
+ *	the IDs swapped, and a list that is already sorted. Prints the
+ *	nanoseconds per ID of qsort (the quicksort), radix (the radix sort)
+ *	and sort (mdb_midl_sort, which picks one).
+ *
+ *	search: random lookups in an IDL (like me_pghead), an ID2L (like the
+ *	dirty list) and an ID3L of each size, half of them hits. Prints the
+ *	nanoseconds per lookup of ref (the old search) and new.
+ *
+ *	merge: mdb_midl_xmerge() of a random list of 1/16 of the size into
+ *	a list of each size, as when a freeDB record is merged into
+ *	me_pghead, and of two lists of the same size. Prints the nanoseconds
+ *	per merged ID of ref (the old merge) and new.
+ *
+ *	One JSON object per line is printed.
+ *
+ *	Build with "make midl_bench".
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+/* midl.c only has the ID3L functions with MDB_VL32, which makes MDB_ID
+ * 64 bits wide everywhere.
+ */
+#define MDB_VL32
+#include "midl.c"
+
+/*
+ * The search and merge of midl.c before they were made branchless
+ */
+#define CMP(x,y)	 ( (x) < (y) ? -1 : (x) > (y) )
+
+static unsigned ref_midl_search(MDB_IDL ids, MDB_ID id)
+{
+  unsigned base = 0, cursor = 1, n = ids[0];
+  int val = 0;
+
+  while (0 < n) {
+    unsigned pivot = n >> 1;
+    cursor = base + pivot + 1;
+    val = CMP(ids[cursor], id);
+    if (val < 0) {
+      n = pivot;
+    } else if (val > 0) {
+      base = cursor;
+      n -= pivot + 1;
+    } else {
+      return cursor;
+    }
+  }
+  if (val > 0)
+    ++cursor;
+  return cursor;
+}
+
+static unsigned ref_mid2l_search(MDB_ID2L ids, MDB_ID id)
+{
+  unsigned base = 0, cursor = 1, n = (unsigned)ids[0].mid;
+  int val = 0;
+
+  while (0 < n) {
+    unsigned pivot = n >> 1;
+    cursor = base + pivot + 1;
+    val = CMP(id, ids[cursor].mid);
+    if (val < 0) {
+      n = pivot;
+    } else if (val > 0) {
+      base = cursor;
+      n -= pivot + 1;
+    } else {
+      return cursor;
+    }
+  }
+  if (val > 0)
+    ++cursor;
+  return cursor;
+}
+
+static void ref_midl_xmerge(MDB_IDL idl, MDB_IDL merge)
+{
+  MDB_ID old_id, merge_id, i = merge[0], j = idl[0], k = i+j, total = k;
+  idl[0] = (MDB_ID)-1;
+  old_id = idl[j];
+  while (i) {
+    merge_id = merge[i--];
+    for (; old_id < merge_id; old_id = idl[--j])
+      idl[k--] = old_id;
+    idl[k--] = merge_id;
+  }
+  idl[0] = total;
+}
+
+static unsigned ref_mid3l_search(MDB_ID3L ids, MDB_ID id)
+{
+  unsigned base = 0, cursor = 1, n = (unsigned)ids[0].mid;
+  int val = 0;
+
+  while (0 < n) {
+    unsigned pivot = n >> 1;
+    cursor = base + pivot + 1;
+    val = CMP(id, ids[cursor].mid);
+    if (val < 0) {
+      n = pivot;
+    } else if (val > 0) {
+      base = cursor;
+      n -= pivot + 1;
+    } else {
+      return cursor;
+    }
+  }
+  if (val > 0)
+    ++cursor;
+  return cursor;
+}
+
+static uint64_t rng_next(uint64_t *s)
+{
+  /* xorshift64* */
+  uint64_t x = *s;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *s = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char *patterns[] = { "random", "nearly", "sorted" };
+
+static void fill(MDB_IDL ids, MDB_ID n, int pattern, uint64_t *seed)
+{
+  MDB_ID i, a, b, tmp;
+
+  ids[0] = n;
+  if (pattern == 0) {
+    for (i = 1; i <= n; i++)
+      ids[i] = 2 + rng_next(seed) % (4 * n);
+    return;
+  }
+  for (i = 1; i <= n; i++)
+    ids[i] = 2 + 4 * (n - i);
+  if (pattern == 1) {
+    for (i = 0; i < n / 100; i++) {
+      a = 1 + rng_next(seed) % n;
+      b = 1 + rng_next(seed) % n;
+      tmp = ids[a];
+      ids[a] = ids[b];
+      ids[b] = tmp;
+    }
+  }
+}
+
+static int check(MDB_IDL ids)
+{
+  MDB_ID i;
+
+  for (i = 2; i <= ids[0]; i++)
+    if (ids[i-1] < ids[i])
+      return 0;
+  return 1;
+}
+
+static void radix(MDB_IDL ids)
+{
+  if (mdb_midl_radixsort(ids) != 0) {
+    fprintf(stderr, "radix sort: out of memory\n");
+    exit(1);
+  }
+}
+
+/* Nanoseconds per ID, not counting the refill of the list */
+static double run(void (*sort)(MDB_IDL), MDB_IDL ids, MDB_IDL orig,
+                  MDB_ID n, uint64_t total)
+{
+  uint64_t rounds = total / n ? total / n : 1, r, t0, sorting = 0;
+
+  for (r = 0; r < rounds; r++) {
+    memcpy(ids, orig, (n + 1) * sizeof(MDB_ID));
+    t0 = now_ns();
+    sort(ids);
+    sorting += now_ns() - t0;
+  }
+  if (!check(ids)) {
+    fprintf(stderr, "list of %llu IDs is not sorted\n", (unsigned long long)n);
+    exit(1);
+  }
+  return (double)sorting / (rounds * n);
+}
+
+static void *xmalloc(size_t size)
+{
+  void *p = malloc(size);
+  if (!p) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+static void bench_sort(MDB_ID n, uint64_t total, uint64_t *seed)
+{
+  MDB_IDL orig = xmalloc((n + 1) * sizeof(MDB_ID));
+  MDB_IDL ids = xmalloc((n + 1) * sizeof(MDB_ID));
+  int pattern;
+
+  for (pattern = 0; pattern < 3; pattern++) {
+    double q, r, s;
+    fill(orig, n, pattern, seed);
+    q = run(mdb_midl_qsort, ids, orig, n, total);
+    r = run(radix, ids, orig, n, total);
+    s = run(mdb_midl_sort, ids, orig, n, total);
+    printf("{\"op\": \"sort\", \"n\": %llu, \"pattern\": \"%s\", "
+           "\"ns_per_id\": {\"qsort\": %.2f, \"radix\": %.2f, "
+           "\"sort\": %.2f}}\n",
+           (unsigned long long)n, patterns[pattern], q, r, s);
+    fflush(stdout);
+  }
+  free(orig);
+  free(ids);
+}
+
+#define NKEYS 65536
+
+static void report_search(const char *list, MDB_ID n, uint64_t lookups,
+                          uint64_t ref, uint64_t new)
+{
+  printf("{\"op\": \"search\", \"n\": %llu, \"list\": \"%s\", "
+         "\"ns_per_lookup\": {\"ref\": %.2f, \"new\": %.2f}}\n",
+         (unsigned long long)n, list, (double)ref / lookups,
+         (double)new / lookups);
+  fflush(stdout);
+}
+
+/* The lists hold the even numbers 2..2n, half of the keys are odd */
+static void bench_search(MDB_ID n, uint64_t total, uint64_t *seed)
+{
+  MDB_IDL idl = xmalloc((n + 1) * sizeof(MDB_ID));
+  MDB_ID2L id2l = xmalloc((n + 1) * sizeof(MDB_ID2));
+  MDB_ID3L id3l = xmalloc((n + 1) * sizeof(MDB_ID3));
+  MDB_ID *keys = xmalloc(NKEYS * sizeof(MDB_ID)), i;
+  uint64_t rounds = total / NKEYS ? total / NKEYS : 1, r, t0, ref, new;
+  unsigned sum = 0, k;
+
+  idl[0] = n;
+  id2l[0].mid = n;
+  id3l[0].mid = n;
+  for (i = 1; i <= n; i++) {
+    idl[i] = 2 * (n + 1 - i);
+    id2l[i].mid = id3l[i].mid = 2 * i;
+    id2l[i].mptr = id3l[i].mptr = NULL;
+  }
+  for (k = 0; k < NKEYS; k++) {
+    keys[k] = 1 + rng_next(seed) % (2 * n + 1);
+    if (ref_midl_search(idl, keys[k]) != mdb_midl_search(idl, keys[k]) ||
+        ref_mid2l_search(id2l, keys[k]) != mdb_mid2l_search(id2l, keys[k]) ||
+        ref_mid3l_search(id3l, keys[k]) != mdb_mid3l_search(id3l, keys[k])) {
+      fprintf(stderr, "search of %llu in %llu IDs differs\n",
+              (unsigned long long)keys[k], (unsigned long long)n);
+      exit(1);
+    }
+  }
+
+#define TIME_SEARCH(fn, list, out) do { \
+    t0 = now_ns(); \
+    for (r = 0; r < rounds; r++) \
+      for (k = 0; k < NKEYS; k++) \
+        sum += fn(list, keys[k]); \
+    out = now_ns() - t0; \
+  } while (0)
+
+  TIME_SEARCH(ref_midl_search, idl, ref);
+  TIME_SEARCH(mdb_midl_search, idl, new);
+  report_search("idl", n, rounds * NKEYS, ref, new);
+  TIME_SEARCH(ref_mid2l_search, id2l, ref);
+  TIME_SEARCH(mdb_mid2l_search, id2l, new);
+  report_search("id2l", n, rounds * NKEYS, ref, new);
+  TIME_SEARCH(ref_mid3l_search, id3l, ref);
+  TIME_SEARCH(mdb_mid3l_search, id3l, new);
+  report_search("id3l", n, rounds * NKEYS, ref, new);
+#undef TIME_SEARCH
+
+  if (sum == 1)   /* keep the searches */
+    printf("\n");
+  free(idl);
+  free(id2l);
+  free(id3l);
+  free(keys);
+}
+
+/* Random descending list of n distinct IDs with the given low bit */
+static void fill_merge(MDB_IDL ids, MDB_ID n, MDB_ID range, int odd,
+                       uint64_t *seed)
+{
+  MDB_ID i, id = 2 * range + odd;
+
+  ids[0] = n;
+  for (i = 1; i <= n; i++) {
+    /* spread the rest of the range over the rest of the IDs */
+    MDB_ID gap = (id - odd) / 2 / (n - i + 1);
+    id -= 2 * (1 + rng_next(seed) % (gap ? gap : 1));
+    ids[i] = id;
+  }
+}
+
+static void bench_merge(MDB_ID n, uint64_t total, uint64_t *seed)
+{
+  static const char *cases[] = { "small", "equal" };
+  MDB_IDL big = xmalloc((n + 1) * sizeof(MDB_ID));
+  MDB_IDL merge = xmalloc((n + 1) * sizeof(MDB_ID));
+  MDB_IDL out = xmalloc((2 * n + 2) * sizeof(MDB_ID));
+  MDB_IDL check_out = xmalloc((2 * n + 2) * sizeof(MDB_ID));
+  uint64_t rounds, r, t0, ref, new;
+  MDB_ID m;
+  int c;
+
+  for (c = 0; c < 2; c++) {
+    m = c ? n : (n / 16 ? n / 16 : 1);
+    fill_merge(big, n, 2 * n, 0, seed);
+    fill_merge(merge, m, 2 * n, 1, seed);
+    rounds = total / (n + m) ? total / (n + m) : 1;
+
+    memcpy(check_out, big, (n + 1) * sizeof(MDB_ID));
+    ref_midl_xmerge(check_out, merge);
+    memcpy(out, big, (n + 1) * sizeof(MDB_ID));
+    mdb_midl_xmerge(out, merge);
+    if (memcmp(out, check_out, (n + m + 1) * sizeof(MDB_ID)) || !check(out)) {
+      fprintf(stderr, "merge of %llu into %llu IDs differs\n",
+              (unsigned long long)m, (unsigned long long)n);
+      exit(1);
+    }
+
+#define TIME_MERGE(fn, outv) do { \
+    outv = 0; \
+    for (r = 0; r < rounds; r++) { \
+      memcpy(out, big, (n + 1) * sizeof(MDB_ID)); \
+      t0 = now_ns(); \
+      fn(out, merge); \
+      outv += now_ns() - t0; \
+    } \
+  } while (0)
+
+    TIME_MERGE(ref_midl_xmerge, ref);
+    TIME_MERGE(mdb_midl_xmerge, new);
+#undef TIME_MERGE
+
+    printf("{\"op\": \"merge\", \"n\": %llu, \"merged\": %llu, "
+           "\"case\": \"%s\", \"ns_per_id\": {\"ref\": %.2f, \"new\": %.2f}}\n",
+           (unsigned long long)n, (unsigned long long)m, cases[c],
+           (double)ref / (rounds * (n + m)), (double)new / (rounds * (n + m)));
+    fflush(stdout);
+  }
+  free(big);
+  free(merge);
+  free(out);
+  free(check_out);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-n size,...] [-t total] [-w sort,search,merge] "
+          "[-s seed]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  const char *sizes = "16,64,256,1024,4096,16384,65536,262144,1048576,4194304";
+  const char *ops = "sort,search,merge";
+  uint64_t total = 4194304, seed = 1;
+  char *list, *tok, *oplist, *op, *save;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (i + 1 >= argc)
+      usage(argv[0]);
+    if (!strcmp(argv[i], "-n"))
+      sizes = argv[++i];
+    else if (!strcmp(argv[i], "-t"))
+      total = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "-w"))
+      ops = argv[++i];
+    else if (!strcmp(argv[i], "-s"))
+      seed = strtoull(argv[++i], NULL, 10);
+    else
+      usage(argv[0]);
+  }
+  if (!seed)
+    seed = 1;
+
+  oplist = strdup(ops);
+  for (op = strtok_r(oplist, ",", &save); op; op = strtok_r(NULL, ",", &save)) {
+    if (strcmp(op, "sort") && strcmp(op, "search") && strcmp(op, "merge"))
+      usage(argv[0]);
+    list = strdup(sizes);
+    for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      MDB_ID n = strtoull(tok, NULL, 10);
+
+      if (!n)
+        usage(argv[0]);
+      if (!strcmp(op, "sort"))
+        bench_sort(n, total, &seed);
+      else if (!strcmp(op, "search"))
+        bench_search(n, total, &seed);
+      else
+        bench_merge(n, total, &seed);
+    }
+    free(list);
+  }
+  free(oplist);
+  return 0;
+}